@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "kappok.h"
+
+// 行列の積のベンチマーク
+// 素朴な三重ループと matrix_multiply_kernel (ブロック分割 + SIMD マイクロカーネル) の
+// 速度を比べ、両者の結果がビット単位で一致することを確かめる。
+//
+//     make bench                   # CPU が対応する最も広い命令セット
+//     ./bench/matmul scalar 1024   # 命令セットの上限と最大の大きさを指定する
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static double *random_matrix(size_t n, unsigned long *seed) {
+    double *m = malloc(n * n * sizeof(double));
+    if (m == NULL) {
+        perror("Failed to allocate matrix");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n * n; i++) {
+        *seed = *seed * 6364136223846793005UL + 1442695040888963407UL;
+        m[i] = (double)(*seed >> 11) / (double)(1UL << 53) - 0.5;
+    }
+    return m;
+}
+
+static void naive_multiply(const double *a, const double *b, double *c, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < n; j++) {
+            double sum = 0.0;
+            for (size_t p = 0; p < n; p++) {
+                sum += a[i * n + p] * b[p * n + j];
+            }
+            c[i * n + j] = sum;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *level_names[] = { "scalar", "sse2", "avx2" };
+    if (argc > 1) {
+        if (strcmp(argv[1], "scalar") == 0) {
+            set_simd_level(SIMD_SCALAR);
+        } else if (strcmp(argv[1], "sse2") == 0) {
+            set_simd_level(SIMD_SSE2);
+        } else if (strcmp(argv[1], "avx2") != 0) {
+            printf("使用方法: %s [avx2|sse2|scalar] [最大の大きさ]\n", argv[0]);
+            return 1;
+        }
+    }
+    size_t max_size = (argc > 2) ? (size_t)strtoul(argv[2], NULL, 10) : 512;
+    printf("SIMD: %s\n", level_names[simd_level()]);
+    printf("%6s %12s %12s %10s %s\n", "n", "naive GF/s", "kernel GF/s", "speedup", "result");
+
+    unsigned long seed = 42;
+    int status = 0;
+    for (size_t n = 64; n <= max_size; n *= 2) {
+        double *a = random_matrix(n, &seed);
+        double *b = random_matrix(n, &seed);
+        double *expected = malloc(n * n * sizeof(double));
+        double *actual = malloc(n * n * sizeof(double));
+        if (expected == NULL || actual == NULL) {
+            perror("Failed to allocate result");
+            exit(EXIT_FAILURE);
+        }
+        double flops = 2.0 * (double)n * (double)n * (double)n;
+
+        double start = now_seconds();
+        naive_multiply(a, b, expected, n);
+        double naive_time = now_seconds() - start;
+
+        // 小さい行列は何度か繰り返して計る
+        int repeats = (n <= 128) ? 20 : (n <= 256 ? 5 : 1);
+        start = now_seconds();
+        for (int r = 0; r < repeats; r++) {
+            matrix_multiply_kernel(a, b, actual, n, n, n);
+        }
+        double kernel_time = (now_seconds() - start) / repeats;
+
+        bool identical = memcmp(expected, actual, n * n * sizeof(double)) == 0;
+        status |= identical ? 0 : 1;
+        printf("%6zu %12.2f %12.2f %9.1fx %s\n", n, flops / naive_time * 1e-9, flops / kernel_time * 1e-9,
+               naive_time / kernel_time, identical ? "一致" : "不一致");
+        free(a);
+        free(b);
+        free(expected);
+        free(actual);
+    }
+    return status;
+}
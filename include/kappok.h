@@ -6,7 +6,11 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h> // bool型のために追加
+#include <stdint.h>  // NaN-boxing の uint64_t のために追加
 #include <math.h>    // round, roundf のために追加
+#include <limits.h>  // LONG_MAX, LONG_MIN のために追加
+#include <pthread.h> // 出力のロックとタスクのために追加
+#include "kappok_api.h" // Value の表現とネイティブ関数の型 (ホストプログラムと共有する)
 
 // --- トークンタイプ ---
 typedef enum {
@@ -19,6 +23,8 @@ typedef enum {
     TOKEN_LBRACE,          // {
     TOKEN_RBRACE,          // }
     TOKEN_COMMA,           // ,
+    TOKEN_LBRACKET,        // [
+    TOKEN_RBRACKET,        // ]
     TOKEN_ASSIGN,          // =
     
     // キーワード
@@ -28,8 +34,16 @@ typedef enum {
     TOKEN_STR,             // str
     TOKEN_DOUBLE,          // double
     TOKEN_BOOL,            // bool
+    TOKEN_MAT,             // mat
     TOKEN_TRUE,            // True
     TOKEN_FALSE,           // False
+    TOKEN_CONST,           // const
+    TOKEN_FOR,             // for
+    TOKEN_IN,              // in
+    TOKEN_FUTURE,          // future
+    TOKEN_SPAWN,           // spawn
+    TOKEN_GENERATOR,       // generator
+    TOKEN_YIELD,           // yield
 
     // 浮動小数点数リテラル
     TOKEN_FLOAT_LITERAL,   // 3.14など
@@ -39,6 +53,7 @@ typedef enum {
     TOKEN_MINUS,           // -
     TOKEN_ASTERISK,        // *
     TOKEN_SLASH,           // /
+    TOKEN_AT,              // @ (関数の注釈)
 
     TOKEN_UNKNOWN          // 不明なトークン
 } TokenType;
@@ -57,6 +72,7 @@ typedef struct Lexer {
     int line;
 } Lexer;
 
+
 // --- ASTノードタイプ ---
 typedef enum {
     NODE_PROGRAM,
@@ -75,7 +91,27 @@ typedef enum {
     NODE_ADD,
     NODE_SUBTRACT,
     NODE_MULTIPLY,
-    NODE_DIVIDE
+    NODE_DIVIDE,
+    // 型検査後の特殊化されたノード (オペランドの型が静的に確定している)
+    NODE_ADD_INT,
+    NODE_SUBTRACT_INT,
+    NODE_MULTIPLY_INT,
+    NODE_DIVIDE_INT,
+    NODE_ADD_DOUBLE,
+    NODE_SUBTRACT_DOUBLE,
+    NODE_MULTIPLY_DOUBLE,
+    NODE_DIVIDE_DOUBLE,
+    NODE_CONCAT,              // str + str
+    NODE_CONVERT,             // 宣言型への暗黙の変換 (int→double など)
+    // 配列
+    NODE_ARRAY_LITERAL,       // [式, 式, ...]
+    NODE_INDEX,               // 式[添字]
+    NODE_INDEX_ASSIGNMENT,    // 変数[添字] = 式
+    // 繰り返し
+    NODE_FOR,                 // for 変数 in range(始め, 終わり) { 文... } / for 変数 in ジェネレータ { 文... }
+    NODE_YIELD,               // yield 式 (ジェネレータ関数の本体)
+    // 自動並列化
+    NODE_FORK                 // 中のタスクにする呼び出しを先に始めてから評価する式・文 (autopar.c が挿入)
 } ASTNodeType;
 
 // --- ASTノード構造体 ---
@@ -92,10 +128,29 @@ typedef struct ASTNode {
         } program;
         struct {
             char *name;
-            struct ASTNode **parameters; // 引数パース未実装
+            unsigned int name_hash; // 登録時に再計算しないよう事前計算したハッシュ
+            struct ASTNode **parameters; // 初期化式なしの NODE_VAR_DECLARATION
             int num_parameters;
             int capacity_parameters;
             struct ASTNode *body;
+            int frame_size; // 引数とローカル変数のスロット数 (リゾルバが設定)
+            // 段階的実行 (tier.c)
+            unsigned int call_count;       // 呼び出し回数 (未最適化の間だけ数える)
+            int tier_state;                // TierState
+            struct ASTNode *optimized_body; // 最適化済みの本体 (公開されるまでは NULL)
+            int optimized_frame_size;      // 最適化済みの本体のスロット数 (インライン展開で増える)
+            // 型検査 (typecheck.c)
+            ValueType result_type;         // 呼び出しの結果の型 (VALUE_TYPE_UNKNOWN は静的に不明)
+            int check_state;               // 0: 未検査, 1: 検査中, 2: 検査済み
+            int purity;                    // Purity (consteval.c が解析する)
+            // メモ化 (memo.c)
+            bool memoize_annotated;        // @memoize 注釈が付いている
+            bool memoized;                 // 呼び出し結果をメモ化表に記録する
+            // ジェネレータ (generator.c)
+            bool generator;                // 本体に yield がある (呼び出すとジェネレータを返す。パーサーが設定)
+            ValueType yield_type;          // yield する値の型 (型検査が設定。VALUE_TYPE_UNKNOWN は静的に不明)
+            // 自動並列化 (autopar.c)
+            long cost_estimate;            // 本体の評価の見積もりコスト (-1 は未見積もり、-2 は見積もり中)
         } func_def;
         struct {
             struct ASTNode **statements;
@@ -105,6 +160,9 @@ typedef struct ASTNode {
         struct {
             struct ASTNode *value;
         } return_stmt;
+        struct {
+            struct ASTNode *value;
+        } yield_stmt;
         struct {
             struct ASTNode **arguments;
             int num_arguments;
@@ -112,6 +170,7 @@ typedef struct ASTNode {
         } print_stmt;
         struct {
             char *value;
+            Value cached; // 評価のたびに複製しないよう事前に作った文字列値 (ASTが参照を1つ所有)
         } string_literal;
         struct {
             long value; // 整数リテラル
@@ -121,72 +180,224 @@ typedef struct ASTNode {
         } float_literal;
         struct {
             char *function_name;
+            unsigned int name_hash;
             struct ASTNode **arguments;
             int num_arguments;
             int capacity_arguments;
+            const struct NativeFunctionEntry *native; // 組み込み/ホスト関数 (リゾルバが設定、NULL ならユーザー定義関数)
+            struct ASTNode *cached_target; // 前回解決したユーザー定義関数
+            unsigned int cached_epoch;     // cached_target を解決したときの関数の世代 (0 は未解決)
+            struct ASTNode *callee;        // 型検査が解決した呼び出し先 (main の実行前に確定する)
+            bool checked;                  // 引数の個数と型を型検査で確認済み (実行時の検査を省く)
+            bool spawned;                  // spawn f(...): 呼び出しをタスクとして実行し future を返す
+            int fork_slot;                 // 自動並列化でタスクにする呼び出しの future を置く隠れたスロット (-1 はしない)
         } func_call;
         struct {
             char *type_name; // "int", "str", "double", "bool"
+            ValueType decl_type; // type_name に対応する型 (パーサーが設定)
             char *name;
+            unsigned int name_hash;
             struct ASTNode *initializer;
+            int slot; // フレーム内のスロット番号 (-1 は名前で探索)
+            bool checked; // 初期化式が宣言型の値を返すことを型検査で確認済み
+            bool is_const; // const 宣言 (初期化式はロード時に評価する)
         } var_decl;
         struct {
             char *name;
+            unsigned int name_hash;
             struct ASTNode *value;
+            int slot;
+            bool checked; // 代入先が宣言済みで、右辺が同じ型の値を返すことを確認済み
         } assignment;
         struct {
             char *name;
+            unsigned int name_hash;
+            int slot;
         } identifier_expr;
         // 算術演算子ノード
         struct {
             struct ASTNode *left;
             struct ASTNode *right;
         } binary_expr;
+        struct {
+            struct ASTNode *operand;
+            ValueType from;
+            ValueType to;
+        } convert;
+        struct {
+            struct ASTNode **elements;
+            int num_elements;
+            int capacity_elements;
+            ValueType element_type; // 型検査で確定した要素の型 (VALUE_TYPE_UNKNOWN なら要素の値で決める)
+        } array_literal;
+        struct {
+            struct ASTNode *target;
+            struct ASTNode *index;
+            struct ASTNode *column; // 行列の m[行, 列] の列 (配列の添字では NULL)
+        } index_expr;
+        struct {
+            char *name;
+            unsigned int name_hash;
+            struct ASTNode *index;
+            struct ASTNode *column; // 行列の要素への代入 m[行, 列] = 値 の列 (配列では NULL)
+            struct ASTNode *value;
+            int slot;
+            bool checked; // 代入先が配列で、右辺が要素の型の値を返すことを確認済み
+        } index_assignment;
+        struct {
+            char *name; // ループ変数
+            unsigned int name_hash;
+            struct ASTNode *start; // 範囲の始め (含む、ループの前に一度だけ評価する)
+            struct ASTNode *end;   // 範囲の終わり (含まない、ループの前に一度だけ評価する)
+            struct ASTNode *iterable; // ジェネレータを回す for の式 (range の for では NULL で、start と end が NULL)
+            struct ASTNode *body;  // NODE_BLOCK
+            int slot;              // ループ変数のスロット番号
+            int iterator_slot;     // ジェネレータを回す for で、回しているジェネレータを置く隠れたスロット
+            bool checked;          // 範囲が整数であることを型検査で確認済み
+            struct ASTNode *function; // ループを含む関数 (段階的実行で周回を数える。リゾルバが設定)
+        } for_stmt;
+        struct {
+            struct ASTNode *body;  // 包んだ式か文 (print 文など)
+        } fork_expr;
     } data;
 } ASTNode;
 
-// --- 値の型 ---
+// --- 段階的実行 ---
+// 関数は最初は元のASTのまま実行し、呼び出し回数が閾値に達したら最適化した複製に切り替える。
 typedef enum {
-    VALUE_TYPE_INT,
-    VALUE_TYPE_STR,
-    VALUE_TYPE_DOUBLE,
-    VALUE_TYPE_BOOL,
-    VALUE_TYPE_VOID,
-    VALUE_TYPE_FUNCTION,
-    VALUE_TYPE_UNKNOWN
-} ValueType;
-
-// --- 値構造体 ---
-typedef struct Value {
-    ValueType type;
-    union {
-        long int_value;
-        char *str_value;
-        double double_value;
-        bool bool_value;
-        struct {
-            char *name;
-            struct ASTNode *body;
-            // TODO: parameters もここに追加する
-        } func_ptr;
-    } data;
-} Value;
+    TIER_COLD,      // 元のASTを実行中
+    TIER_COMPILING, // 最適化中 (バックグラウンドスレッド)
+    TIER_OPTIMIZED  // optimized_body を公開済み
+} TierState;
+
+#define TIER_DEFAULT_THRESHOLD 1000
+#define TIER_LOOP_BATCH 64 // for ループの周回はこの回数ごとにまとめて数える (周回ごとのアトミック操作を避ける)
+
+// --- 関数の純粋性 ---
+typedef enum {
+    PURITY_UNKNOWN,   // 未解析
+    PURITY_ANALYZING, // 解析中 (ここに戻ってきたら再帰呼び出し)
+    PURITY_IMPURE,    // print や副作用のあるホスト関数を呼ぶ、または再帰する
+    PURITY_PURE,      // 引数だけで結果が決まる (実行時エラーにはなり得る)
+    PURITY_TOTAL      // 純粋で、型検査済みの引数に対して失敗しない
+} Purity;
 
 // --- シンボルテーブルのエントリ ---
 typedef struct SymbolEntry {
     char *name;
-    Value value;
-    ValueType type; // シンボルの型を保存
+    unsigned int hash; // 名前のハッシュ (比較前の絞り込みに使う)
+    Value value;       // 型は VAL_TYPE(value) で得る
 } SymbolEntry;
 
+// --- ハッシュ索引のスロット ---
+// オープンアドレス法の索引。ハッシュとシンボル配列の添字だけを持つ小さな構造体にして、
+// プローブ中は名前の文字列に触れずに済むようにする。
+typedef struct SymbolSlot {
+    unsigned int hash;
+    int index; // symbols 配列の添字 (-1 は空きスロット)
+} SymbolSlot;
+
+// シンボル数がこれを超えた環境だけハッシュ索引を持つ (小さな関数スコープは線形探索の方が速い)
+#define SYMBOL_INDEX_THRESHOLD 8
+
+// --- ネイティブ関数 ---
+// 組み込み関数とホストプログラムが C で実装する関数 (NativeFunction と NativeParam は kappok_api.h)。
+#define NATIVE_MAX_PARAMS 16
+
+typedef struct NativeFunctionEntry {
+    char *name;
+    unsigned int hash;
+    NativeFunction function;
+    ValueType return_type; // 型検査に使う戻り値の型 (VALUE_TYPE_UNKNOWN は不明)
+    bool element_result;   // 結果は配列の引数の要素の型 (どれかが double[] なら double)
+    bool maps_function;    // 第1引数の関数を第2引数の配列の各要素に適用する (parallel_map)
+    Purity purity;         // PURITY_TOTAL ならロード時に評価してよい
+    int num_params;
+    NativeParam params[NATIVE_MAX_PARAMS];
+} NativeFunctionEntry;
+
+// --- 出力 ---
+// print の出力はユーザー空間の大きなバッファに溜めて write/writev でまとめて書き出す。
+typedef enum {
+    OUTPUT_BUFFER_AUTO, // 端末なら LINE、それ以外は FULL
+    OUTPUT_BUFFER_LINE, // 改行ごとにフラッシュ
+    OUTPUT_BUFFER_FULL, // バッファが埋まったとき (と終了時) だけフラッシュ
+    OUTPUT_BUFFER_NONE, // 書くたびにフラッシュ
+    OUTPUT_BUFFER_MEMORY // 書き出さずに溜める (print の1行を組み立てるバッファ)
+} OutputBufferMode;
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+typedef struct OutputWriter {
+    int fd;
+    OutputBufferMode mode; // AUTO は output_open で LINE か FULL に決まる
+    char *buffer;
+    size_t length;
+    size_t capacity;
+    bool failed;           // 書き込みに失敗したら以降の出力は捨てる
+    pthread_mutex_t lock;  // 組み立てた1行を書く間持つ (スレッドごとの行が途中で混ざらない)
+    struct OutputWriter *next; // 終了時にフラッシュする一覧
+} OutputWriter;
+
+// --- タスクの組 ---
+// main の1回の実行が作ったタスクを数える (main の後に待つのも、失敗を報告するのも組の中だけ)。
+// 同じプログラムを複数のスレッドで同時に実行しても、互いのタスクを待ったり報告したりしない。
+typedef struct TaskGroup {
+    long pending;              // まだ終わっていないタスク (原子的に読み書きする)
+    pthread_mutex_t lock;      // 失敗したタスクと後回しのタスクの一覧を守る
+    struct KTask *failed_head; // join されないまま終わり得る、失敗した spawn のタスク
+    struct KTask *failed_tail;
+    struct KTask *deferred;    // 作業スレッドがないので join か main の終わりまで後回しにしたタスク
+} TaskGroup;
+
+// --- 実行状態 ---
+// 全ての呼び出しフレームは一本の連続した値スタックから切り出す。
+// 関数呼び出しは stack_top を進めるだけで、ヒープ確保は容量不足時の realloc のみ。
+// 式の評価の途中の値 (二項演算の左辺、添字、組み込み関数の引数など) もフレームの上に積むので、
+// 実行時エラーで打ち切られた実行は [0, stack_top) を解放するだけで片付く。
+typedef struct ExecState {
+    Value *stack;
+    int stack_top;
+    int stack_capacity;
+    struct Environment *globals; // 関数が定義されているグローバルスコープ
+    OutputWriter *out;           // print の出力先
+    long *load_budget;           // ロード時の評価の残りのステップ数 (実行時は NULL。段階的実行の回数を数えない)
+    struct KGenerator *generator; // この値スタックで本体を実行しているジェネレータ (yield の戻り先)
+    TaskGroup *tasks;            // 作ったタスクを数える組
+} ExecState;
+
 // --- 環境 (シンボルテーブル) ---
+// グローバルスコープは名前付きシンボルを持ち、関数フレームは値スタック上の
+// [frame_base, frame_base + frame_size) をスロットとして使う。
 typedef struct Environment {
     SymbolEntry *symbols;
     int num_symbols;
     int capacity_symbols;
+    SymbolSlot *slots;  // ハッシュ索引 (NULL なら線形探索)
+    int capacity_slots; // 常に2の冪
     struct Environment *parent; // 親スコープ
+    ExecState *state;   // 関数フレームのみ (グローバルスコープでは NULL)
+    int frame_base;     // state->stack 上のこのフレームの先頭
+    unsigned int function_epoch; // 関数が定義されるたびに増える世代番号 (グローバルスコープのみ使う)
 } Environment;
 
+// --- 読み込み ---
+// 読み込み時の最適化の設定 (コマンドラインの指定か、埋め込み API の実行時オブジェクトの設定)
+typedef struct LoadOptions {
+    bool memoize_all;   // 純粋な関数の呼び出し結果を全てメモ化する (--memoize)
+    bool auto_parallel; // 互いに独立な重い純粋な呼び出しを並行に評価する (--auto-parallel)
+} LoadOptions;
+
+// 読み込んだプログラム
+// 読み込んだ後は変更しない (実行中に書き換えるのはアトミックなキャッシュだけ) ので、
+// main を何度でも、複数のスレッドから同時に実行できる。
+typedef struct LoadedProgram {
+    ASTNode *ast;
+    Environment *globals; // 関数を登録したグローバルスコープ
+    ASTNode *main_call;   // main を呼び出す仮想的なノード (main がなければ NULL)
+    bool memoized;        // メモ化する関数がある (解放するときにメモを捨てる)
+} LoadedProgram;
+
 
 // --- レクサー関数プロトタイプ ---
 Lexer *lexer_create(char *source);
@@ -206,28 +417,240 @@ void add_statement_to_program(ASTNode *program, ASTNode *statement);
 void add_statement_to_block(ASTNode *block_node, ASTNode *statement);
 void add_argument_to_print(ASTNode *print_node, ASTNode *argument);
 void add_argument_to_function_call(ASTNode *func_call_node, ASTNode *argument);
+void add_parameter_to_function_definition(ASTNode *func_def_node, ASTNode *parameter);
+void add_element_to_array_literal(ASTNode *array_node, ASTNode *element);
 ASTNode *parse_expression(Lexer *lexer);
 ASTNode *parse_print_statement(Lexer *lexer);
 ASTNode *parse_return_statement(Lexer *lexer);
+ASTNode *parse_yield_statement(Lexer *lexer);
 ASTNode *parse_function_call(Lexer *lexer, char *function_name); // func_call.arguments が使えるように
 ASTNode *parse_var_declaration(Lexer *lexer, char *type_name);
 ASTNode *parse_assignment_or_call(Lexer *lexer, char *identifier_name);
+ASTNode *parse_for_statement(Lexer *lexer);
+ASTNode *parse_block(Lexer *lexer);
 ASTNode *parse_term(Lexer *lexer);
 ASTNode *parse_factor(Lexer *lexer);
 
 
-// --- AST解放関数プロトタイプ ---
+// --- 文字列関数プロトタイプ ---
+KString *kstring_new(const char *data, size_t length);
+void kstring_retain(KString *str);
+void kstring_release(KString *str);
+Value make_string_value(const char *data, size_t length);
+Value concat_string_values(Value left, Value right);
+void string_view(Value value, StrView *view);
+
+
+// --- int の演算 ---
+// int は64ビットの2の補数で折り返す。符号付きのオーバーフローは C では未定義動作なので符号なしで計算する
+// (インタプリタ、定数の畳み込みとコンパイル時評価、int[] の要素ごとの演算で共有する)。
+static inline long add_ints(long x, long y) {
+    return (long)((unsigned long)x + (unsigned long)y);
+}
+
+static inline long subtract_ints(long x, long y) {
+    return (long)((unsigned long)x - (unsigned long)y);
+}
+
+static inline long multiply_ints(long x, long y) {
+    return (long)((unsigned long)x * (unsigned long)y);
+}
+
+// 0 への切り捨て。y は 0 でないこと (呼び出し側で検査する)
+// LONG_MIN / -1 は割り算の命令ではトラップするので、符号の反転として折り返す (結果は LONG_MIN)。
+static inline long divide_ints(long x, long y) {
+    return (y == -1) ? subtract_ints(0, x) : x / y;
+}
+
+
+// --- 配列関数プロトタイプ ---
+typedef enum {
+    ARRAY_OP_ADD,
+    ARRAY_OP_SUBTRACT,
+    ARRAY_OP_MULTIPLY,
+    ARRAY_OP_DIVIDE
+} ArrayOp;
+
+KArray *karray_new(ValueType element_type, size_t length, int line);
+void karray_retain(KArray *array);
+void karray_release(KArray *array);
+Value array_arithmetic(ArrayOp op, Value left, Value right, int line);
+Value array_to_double(Value value);
+Value array_element(Value array, Value index, int line);
+void array_store_element(Value *target, Value index, Value value, const char *name, int line);
+KArray *karray_unshare(KArray *array, int line);
+
+
+// --- 行列関数プロトタイプ ---
+KArray *matrix_new(long rows, long columns, int line);
+Value matrix_element(Value matrix, Value row, Value column, int line);
+void matrix_store_element(Value *target, Value row, Value column, Value value, const char *name, int line);
+KArray *matrix_transpose(const KArray *matrix, int line);
+KArray *matrix_multiply(const KArray *left, const KArray *right, int line);
+void matrix_multiply_kernel(const double *a, const double *b, double *c, size_t m, size_t k, size_t n);
+
+
+// --- SIMD カーネル関数プロトタイプ ---
+typedef enum {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2
+} SimdLevel;
+
+void set_simd_level(SimdLevel level);
+SimdLevel simd_level(void);
+void simd_double_op(ArrayOp op, const double *a, const double *b, double *out, size_t n);
+void simd_double_op_scalar(ArrayOp op, const double *a, double scalar, double *out, size_t n, bool scalar_left);
+void simd_int_op(ArrayOp op, const long *a, const long *b, long *out, size_t n);
+void simd_int_op_scalar(ArrayOp op, const long *a, long scalar, long *out, size_t n, bool scalar_left);
+bool simd_double_has_zero(const double *a, size_t n);
+double simd_double_sum(const double *a, size_t n);
+double simd_double_dot(const double *a, const double *b, size_t n);
+double simd_double_extreme(const double *a, size_t n, bool maximum);
+long simd_int_sum(const long *a, size_t n);
+long simd_int_dot(const long *a, const long *b, size_t n);
+long simd_int_extreme(const long *a, size_t n, bool maximum);
+
+
+// --- 出力関数プロトタイプ ---
+void output_open(OutputWriter *out, int fd, OutputBufferMode mode);
+void output_close(OutputWriter *out);
+void output_flush(OutputWriter *out);
+void output_write(OutputWriter *out, const char *data, size_t length);
+void output_char(OutputWriter *out, char c);
+void output_string(OutputWriter *out, const char *str);
+void output_newline(OutputWriter *out);
+OutputWriter *output_begin_line(OutputWriter *out);
+void output_end_line(OutputWriter *out);
+size_t output_set_aside_line(void);
+void output_resume_line(size_t saved);
+void output_write_partial_line(void);
+void output_release_line_buffer(void);
+
+
+// --- 数値フォーマット関数プロトタイプ ---
+#define FORMAT_INT_MAX_LENGTH 24
+#define FORMAT_DOUBLE_MAX_LENGTH 32
+#define FORMAT_FIXED_MAX_LENGTH(precision) ((size_t)(precision) + 330) // 符号 + 整数部309桁 + 小数点 + 終端
+int format_int(long value, char *buffer);
+int format_double_general(double value, char *buffer);
+int format_double_fixed(double value, int precision, char *buffer);
+double exact_pow10(int exponent);
+
+
+// --- ネイティブ関数プロトタイプ ---
+const NativeFunctionEntry *find_native_function(const char *name, unsigned int hash);
+Value call_native_function(const NativeFunctionEntry *native, ASTNode *node, Environment *env);
+void check_native_call(const NativeFunctionEntry *native, int line, int num_args, const ValueType *arg_types);
+
+
+// --- リゾルバ関数プロトタイプ ---
+void resolve_program(ASTNode *program_node);
+
+
+// --- 型検査関数プロトタイプ ---
+void typecheck_program(ASTNode *program_node, Environment *globals);
+bool is_assignable_type(ValueType declared, ValueType type);
+const char *value_type_name(ValueType type);
+
+
+// --- 不要コード除去関数プロトタイプ ---
+void eliminate_unreachable_code(ASTNode *program_node);
+void eliminate_dead_stores(ASTNode *program_node);
+bool is_pure_expression(const ASTNode *node);
+
+
+// --- コンパイル時評価関数プロトタイプ ---
+void evaluate_constants(ASTNode *program_node, Environment *globals);
+Purity analyze_purity(ASTNode *func_def);
+Purity expression_purity(const ASTNode *node);
+
+
+// --- メモ化関数プロトタイプ ---
+#define MEMO_MAX_ARGS 8 // メモ化できる関数の引数の最大数 (キーは固定長の配列に持つ)
+bool configure_memoization(ASTNode *program_node, bool memoize_all);
+bool memo_lookup(ASTNode *func_def, const Value *args, int num_args, Value *result);
+void memo_store(ASTNode *func_def, Value *args, int num_args, Value result);
+void memo_forget_program(ASTNode *program_node);
+
+
+// --- 自動並列化関数プロトタイプ ---
+void configure_auto_parallel(ASTNode *program_node, bool enabled);
+
+
+// --- AST解放・複製関数プロトタイプ ---
 void destroy_ast(ASTNode *node);
+ASTNode *clone_ast(const ASTNode *node);
+ASTNode *make_literal_node(Value value, int line);
+bool is_literal_node(const ASTNode *node);
+
+
+// --- 最適化・段階的実行関数プロトタイプ ---
+ASTNode *optimize_function_body(ASTNode *func_def, int *frame_size);
+void set_tier_threshold(int threshold);
+void tier_count_call(ASTNode *func_def);
+void tier_count_iterations(ASTNode *func_def, unsigned int iterations);
+void tier_wait_for_compiles(const ASTNode *program_node);
+
+// --- 並列実行関数プロトタイプ ---
+void set_parallel_threads(int threads);
+Value parallel_map(Value function, Value array, ExecState *state, int line);
+Value spawn_task(ASTNode *func_def, Value *args, int num_args, ExecState *state, int line);
+Value fork_task(ASTNode *func_def, Value *args, int num_args, ExecState *state, int line);
+int parallel_pool_size(void);
+Value join_task(KTask *task);
+void ktask_retain(KTask *task);
+void ktask_release(KTask *task);
+void task_group_init(TaskGroup *group);
+void task_group_destroy(TaskGroup *group);
+void wait_for_tasks(TaskGroup *group);
+void discard_tasks(TaskGroup *group);
+void runtime_error(int line, const char *format, ...) __attribute__((noreturn, format(printf, 2, 3)));
+void compile_error(int line, const char *format, ...) __attribute__((noreturn, format(printf, 2, 3)));
+void syntax_error(int line, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void begin_syntax_error_capture(void);
+char *end_syntax_error_capture(void);
+void raise_error_message(char *message) __attribute__((noreturn));
+typedef struct TaskFailure TaskFailure;
+char *run_trapping_errors(void (*body)(void *), void *arg);
+TaskFailure *exchange_error_trap(TaskFailure *trap);
+void check_call_depth(int line);
+char *exchange_stack_floor(char *floor);
+
+// --- ジェネレータ関数プロトタイプ ---
+Value generator_new(ASTNode *func_def, Value *args, int num_args, int line);
+bool generator_next(KGenerator *generator, ExecState *state, Value *value, int line);
+void generator_yield(ExecState *state, Value value);
+void kgenerator_retain(KGenerator *generator);
+void kgenerator_release(KGenerator *generator);
 
 // --- インタプリタ関数プロトタイプ ---
-void interpret_ast(ASTNode *program_node);
+void load_program(LoadedProgram *program, ASTNode *program_node, const LoadOptions *options);
+void unload_program(LoadedProgram *program);
+void init_exec_state(ExecState *state, Environment *globals, OutputWriter *out, TaskGroup *tasks);
+void run_main(const LoadedProgram *program, ExecState *state);
+void interpret_ast(ASTNode *program_node, OutputWriter *out, const LoadOptions *options);
 Value interpret_node(ASTNode *node, Environment *env);
+bool evaluate_at_load(ASTNode *node, Environment *globals, Value *value);
+Value call_function(ASTNode *func_def, Value *args, int num_args, ExecState *state, int line);
+Value enter_function(ASTNode *func_def, Value *args, int num_args, ExecState *state, int line);
+void push_temporary(ExecState *state, Value value);
+Value pop_temporary(ExecState *state);
 Environment *create_environment(Environment *parent);
 void destroy_environment(Environment *env);
+unsigned int hash_symbol_name(const char *name);
 void define_symbol(Environment *env, const char *name, Value value);
+void define_symbol_hashed(Environment *env, const char *name, unsigned int hash, Value value);
 SymbolEntry *get_symbol(Environment *env, const char *name);
+SymbolEntry *get_symbol_hashed(Environment *env, const char *name, unsigned int hash);
+SymbolEntry *get_local_symbol_hashed(Environment *env, const char *name, unsigned int hash);
 void free_value_data(Value value);
-void print_value(Value val, int precision); // precision引数を追加
-Value convert_value_to_double(Value val);
+Value copy_value(Value value);
+void print_value(OutputWriter *out, Value val, int precision); // precision引数を追加
+Value convert_value_to_double(Value val, int line);
+
+// --- 常駐サーバ関数プロトタイプ ---
+int run_server(const char *socket_path, int workers, const struct KappokOptions *options);
+int run_client(const char *socket_path, const char *filename);
 
 #endif // KAPPOK_H
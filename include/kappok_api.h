@@ -0,0 +1,96 @@
+#ifndef KAPPOK_API_H
+#define KAPPOK_API_H
+
+// kappok 埋め込み API (libkappok.a)
+// ホストプログラムは実行時オブジェクトを作り、ソースを一度コンパイルしたプログラムを何度でも実行する。
+// 複数のスレッドから同時に、同じプログラムを kappok_run したり、別々のプログラムをコンパイル・解放したりしてよい。
+// 実行ごとの状態 (値スタック・出力先・spawn したタスク) は呼び出しごとに用意する。
+// 実行中にプログラムへ書き込むのは、呼び出し先のキャッシュと段階的実行の最適化済みの本体 (どちらもアトミックに
+// 公開する) だけ。プロセス全体で共有するメモ化の表はロックを取って引き、同じ実行のタスクは出力先のロックを取って書く。
+//
+// エラーはプロセスを終了せず、状態コードとメッセージ (コマンドラインが標準エラーに書くものと同じ) で返す。
+// メッセージと取り込んだ出力は呼び出し側が free() で解放する。
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "kappok_value.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct KappokRuntime KappokRuntime;
+typedef struct KappokProgram KappokProgram;
+
+typedef enum KappokStatus {
+    KAPPOK_OK = 0,
+    KAPPOK_ERROR_SYNTAX,   // 字句・構文のエラー
+    KAPPOK_ERROR_COMPILE,  // 名前解決・型検査・コンパイル時評価のエラー
+    KAPPOK_ERROR_RUNTIME,  // 実行時エラー (join されなかった spawn したタスクの失敗を含む)
+    KAPPOK_ERROR_IO,       // ソースファイルを読めない
+    KAPPOK_ERROR_ARGUMENT  // 引数が不正
+} KappokStatus;
+
+// 実行時オブジェクトの設定
+// threads と tier_threshold はプロセス全体で共有するスレッドプールと段階的実行の設定。
+// threads は最初に作った実行時オブジェクトのものに固定され、tier_threshold は生きている実行時オブジェクトの
+// 間で揃える。食い違う設定の実行時オブジェクトは作れない (kappok_runtime_new が NULL を返す)。
+typedef struct KappokOptions {
+    int threads;        // 並列に動かすスレッドの数 (0 なら CPU のコア数。--threads)
+    int tier_threshold; // 関数を最適化するまでの呼び出し回数 (0 で無効、負なら既定値。--tier-threshold)
+    bool memoize;       // 純粋な関数の呼び出し結果を全てメモ化する (--memoize)
+    bool auto_parallel; // 互いに独立な重い純粋な呼び出しを並行に評価する (--auto-parallel)
+} KappokOptions;
+
+// 既定の設定 (コマンドラインで何も指定しないときと同じ)
+void kappok_options_init(KappokOptions *options);
+
+// 実行時オブジェクトを作る (options が NULL なら既定の設定。作れないか、設定が他と食い違えば NULL)
+KappokRuntime *kappok_runtime_new(const KappokOptions *options);
+// 実行時オブジェクトを解放する (それで作ったプログラムを全て解放してから呼ぶ)
+void kappok_runtime_free(KappokRuntime *runtime);
+
+// ソースをコンパイルする
+// 成功すると *program にプログラムを入れて KAPPOK_OK を返す。失敗すると *program は NULL で、
+// error が NULL でなければ *error にメッセージを入れる。
+KappokStatus kappok_compile(KappokRuntime *runtime, const char *source, KappokProgram **program, char **error);
+// ファイルを読んでコンパイルする
+KappokStatus kappok_compile_file(KappokRuntime *runtime, const char *path, KappokProgram **program, char **error);
+// プログラムを解放する (このプログラムを実行中のものがあってはならない。他のプログラムは実行中でもよい)
+void kappok_program_free(KappokProgram *program);
+
+// main を実行し、print の出力と main の戻り値を output_fd に書く
+// 出力はコマンドラインの標準出力と同じ (最後に改行が付く)。実行時エラーで打ち切られたときは
+// それまでの出力を書いて KAPPOK_ERROR_RUNTIME を返す。
+KappokStatus kappok_run(const KappokProgram *program, int output_fd, char **error);
+// main を実行し、出力を書き出さずに取り込む
+// *output に NUL で終わる出力 (呼び出し側が free() する) を、length が NULL でなければその長さを入れる。
+// 実行時エラーのときも、それまでの出力を返す。
+KappokStatus kappok_run_capture(const KappokProgram *program, char **output, size_t *length, char **error);
+
+// --- ネイティブ関数 ---
+// ホストプログラムが C で実装し、スクリプトから組み込み関数と同じように呼べる関数。
+// 引数は呼び出し側が所有し、戻り値は新しい参照として返す。line はエラー報告用の呼び出し行。
+// 値は kappok_value.h のアクセサマクロ (AS_INT, INT_VAL など) で読み書きする。
+typedef Value (*NativeFunction)(Value *args, int num_args, int line);
+
+#define VALUE_TYPE_MASK(type) (1u << (type))
+#define NATIVE_ANY_TYPE 0xFFFFFFFFu
+
+typedef struct NativeParam {
+    const char *name;   // エラーメッセージに使う引数名
+    unsigned int types; // 受け付ける型の VALUE_TYPE_MASK の和
+} NativeParam;
+
+// ネイティブ関数を登録する (プロセス全体で共有し、登録した後にコンパイルするプログラムから呼べる)
+// 同名の関数が既にある場合 (組み込み関数を含む) や引数が16個を超える場合は登録せずに false を返す。
+bool kappok_register_native(const char *name, NativeFunction function, const NativeParam *params, int num_params);
+
+// 状態コードの説明
+const char *kappok_status_name(KappokStatus status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KAPPOK_API_H
@@ -0,0 +1,319 @@
+#ifndef KAPPOK_VALUE_H
+#define KAPPOK_VALUE_H
+
+// kappok の値 (Value) の表現とアクセサマクロ
+// インタプリタ (kappok.h) と、ネイティブ関数を書くホストプログラム (kappok_api.h) の両方が使う。
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// --- 値の型 ---
+typedef enum {
+    VALUE_TYPE_INT,
+    VALUE_TYPE_STR,
+    VALUE_TYPE_DOUBLE,
+    VALUE_TYPE_BOOL,
+    VALUE_TYPE_VOID,
+    VALUE_TYPE_FUNCTION,
+    VALUE_TYPE_INT_ARRAY,    // int[]
+    VALUE_TYPE_DOUBLE_ARRAY, // double[]
+    VALUE_TYPE_MAT,          // 行列 (行優先の double)
+    VALUE_TYPE_FUTURE,       // spawn したタスクの結果 (join で受け取る)
+    VALUE_TYPE_GENERATOR,    // yield を含む関数の呼び出し (for で値を1つずつ取り出す)
+    VALUE_TYPE_UNKNOWN
+} ValueType;
+
+// --- 文字列 ---
+// 不変の参照カウント付き文字列。参照カウントは原子的に増減するので、
+// 値をスレッド間で共有しても複製は不要。短い文字列は KString を作らず Value にインラインで持つ。
+// 連結 (str + str) の結果はロープ節になり、表示や組み込み関数に渡すときに初めて平坦化する。
+typedef struct KString {
+    unsigned int refcount;
+    bool is_rope;
+    size_t length;
+    const char *chars;      // 平坦な文字列は data を指す。ロープは平坦化するまで NULL
+    struct KString *left;   // ロープ節の左右 (平坦な文字列では NULL)
+    struct KString *right;
+    char data[];            // 平坦な文字列の中身 (NUL終端)
+} KString;
+
+// これより短い連結結果はロープを作らずその場でコピーする
+#define ROPE_MIN_LENGTH 64
+
+// --- 配列 ---
+// int[] と double[] の値。要素は64バイト境界に揃えた連続領域に置き、SIMD のカーネルでまとめて演算する。
+// 文字列と同じく参照カウント (原子的に増減) で共有する。要素への代入は、配列が共有されていれば
+// 複製してから行うので、配列は int や double と同じく値として振る舞う。
+// 行列 (mat) も同じ構造で、columns 列ずつ行優先に並べた length 個の double を持つ。
+typedef struct KArray {
+    unsigned int refcount;
+    ValueType element_type; // VALUE_TYPE_INT または VALUE_TYPE_DOUBLE
+    size_t length;
+    size_t columns;         // 行列の列数 (int[] と double[] では 0)
+    union {
+        long *ints;
+        double *doubles;
+    } data;                 // 同じ確保の中の、ヘッダの後ろの要素領域を指す
+} KArray;
+
+#define KARRAY_ALIGNMENT 64
+// 行列の行数
+#define MAT_ROWS(m) ((m)->length / (m)->columns)
+// ロード時に評価した配列をリテラルに戻すときの要素数の上限 (これより長い配列は実行時に作る)
+#define ARRAY_LITERAL_MAX_ELEMENTS 256
+
+// --- タスク ---
+// spawn したタスク。中身は parallel.c だけが扱い、future の値は参照カウント (原子的に増減) で共有する。
+typedef struct KTask KTask;
+
+// --- ジェネレータ ---
+// yield を含む関数を呼び出した結果。中身は generator.c だけが扱い、値は参照カウント (原子的に増減) で共有する。
+typedef struct KGenerator KGenerator;
+
+// 文字列値の中身を読むためのビュー (インライン文字列は inline_buf に取り出す)
+// data が inline_buf を指すことがあるので、ビュー自体をコピーしてはいけない
+typedef struct StrView {
+    const char *data;
+    size_t length;
+    char inline_buf[8];
+} StrView;
+
+// --- 値構造体 ---
+// Value の表現はアクセサマクロの裏に隠し、インタプリタは中身に直接触らない。
+// 表現の切り替えはここだけで行う。
+//   VAL_TYPE(v)                                         値の型 (ValueType)
+//   AS_INT / AS_DOUBLE / AS_BOOL / AS_FUNC              中身の取り出し
+//   INT_VAL / DOUBLE_VAL / BOOL_VAL / FUNC_VAL / VOID_VAL / UNKNOWN_VAL  値の生成
+//   VAL_IS_BIGINT / AS_BIGINT_PTR                       ヒープに逃がした int (NaN-boxing のみ)
+//   STR_VAL / VAL_IS_HEAP_STR / AS_KSTRING              ヒープ上の文字列 (参照を1つ所有する)
+//   SMALL_STR_MAX / small_str_value / small_str_length / small_str_copy  インライン文字列
+//   ARRAY_VAL / VAL_IS_ARRAY / AS_ARRAY                 配列 (参照を1つ所有する)
+//   FUTURE_VAL / VAL_IS_FUTURE / AS_TASK                spawn したタスク (参照を1つ所有する)
+//   GENERATOR_VAL / VAL_IS_GENERATOR / AS_GENERATOR     ジェネレータ (参照を1つ所有する)
+// 64ビットのポインタが48ビットに収まる環境では NaN-boxing を使う。
+// 16バイトのタグ付き共用体に戻すには -DKAPPOK_NO_NAN_BOXING (make NAN_BOXING=0) を指定する。
+#if !defined(KAPPOK_NO_NAN_BOXING) && (defined(__x86_64__) || defined(__aarch64__))
+#define KAPPOK_NAN_BOXING 1
+#endif
+
+#ifdef KAPPOK_NAN_BOXING
+
+// NaN-boxing: 8バイトの Value
+// double はそのまま格納し、それ以外は quiet NaN のペイロードに入れる。
+// 符号ビットとビット48-50の4ビットがタグ、下位48ビットがペイロード。
+// タグ0 (符号0/1) は本物の NaN 用に予約し、DOUBLE_VAL で正規化する。
+typedef uint64_t Value;
+
+#define NANBOX_QNAN         ((uint64_t)0x7FF8000000000000ULL)
+#define NANBOX_SIGN         ((uint64_t)0x8000000000000000ULL)
+#define NANBOX_TAG_MASK     ((uint64_t)0xFFFF000000000000ULL)
+#define NANBOX_PAYLOAD_MASK ((uint64_t)0x0000FFFFFFFFFFFFULL)
+#define NANBOX_TAG(sign, tag) (((sign) ? NANBOX_SIGN : 0) | NANBOX_QNAN | ((uint64_t)(tag) << 48))
+
+#define NANBOX_TAG_INT      NANBOX_TAG(0, 1) // 48ビット符号付き整数
+#define NANBOX_TAG_BOOL     NANBOX_TAG(0, 2)
+#define NANBOX_TAG_VOID     NANBOX_TAG(0, 3)
+#define NANBOX_TAG_UNKNOWN  NANBOX_TAG(0, 4)
+#define NANBOX_TAG_FUNC     NANBOX_TAG(0, 5) // ASTNode * (関数定義)
+#define NANBOX_TAG_SMALL_STR NANBOX_TAG(0, 6) // 5バイト以下の文字列 (ビット40-47が長さ)
+#define NANBOX_TAG_BIGINT   NANBOX_TAG(1, 1) // 48ビットに収まらない int (ヒープ上の long)
+#define NANBOX_TAG_STR      NANBOX_TAG(1, 2) // KString *
+#define NANBOX_TAG_INT_ARRAY    NANBOX_TAG(1, 3) // KArray * (int[])
+#define NANBOX_TAG_DOUBLE_ARRAY NANBOX_TAG(1, 4) // KArray * (double[])
+#define NANBOX_TAG_MAT      NANBOX_TAG(1, 5) // KArray * (mat)
+#define NANBOX_TAG_FUTURE   NANBOX_TAG(1, 6) // KTask *
+#define NANBOX_TAG_GENERATOR NANBOX_TAG(1, 7) // KGenerator *
+
+#define NANBOX_INT_MIN (-((long)1 << 47))
+#define NANBOX_INT_MAX (((long)1 << 47) - 1)
+
+// タグ (符号ビット + ビット48-50) から ValueType を引く表 (interpreter.c で定義)
+extern const ValueType nanbox_type_table[16];
+
+static inline ValueType nanbox_type(Value v) {
+    if ((v & NANBOX_QNAN) != NANBOX_QNAN) {
+        return VALUE_TYPE_DOUBLE;
+    }
+    return nanbox_type_table[((v >> 60) & 8) | ((v >> 48) & 7)];
+}
+
+static inline void *nanbox_ptr(Value v) {
+    return (void *)(uintptr_t)(v & NANBOX_PAYLOAD_MASK);
+}
+
+static inline Value nanbox_from_ptr(uint64_t tag, const void *ptr) {
+    return tag | ((uint64_t)(uintptr_t)ptr & NANBOX_PAYLOAD_MASK);
+}
+
+static inline Value nanbox_from_double(double d) {
+    Value v;
+    if (d != d) {
+        return NANBOX_QNAN; // NaN はペイロードを持たない形に正規化する
+    }
+    memcpy(&v, &d, sizeof(v));
+    return v;
+}
+
+static inline double nanbox_to_double(Value v) {
+    double d;
+    memcpy(&d, &v, sizeof(d));
+    return d;
+}
+
+static inline Value nanbox_from_int(long x) {
+    if (x >= NANBOX_INT_MIN && x <= NANBOX_INT_MAX) {
+        return NANBOX_TAG_INT | ((uint64_t)x & NANBOX_PAYLOAD_MASK);
+    }
+    // ペイロードに収まらない値はヒープに置く
+    long *box = (long *)malloc(sizeof(long));
+    if (box == NULL) {
+        perror("Failed to allocate boxed integer");
+        exit(EXIT_FAILURE);
+    }
+    *box = x;
+    return nanbox_from_ptr(NANBOX_TAG_BIGINT, box);
+}
+
+static inline long nanbox_to_int(Value v) {
+    if ((v & NANBOX_TAG_MASK) == NANBOX_TAG_INT) {
+        return (long)((int64_t)(v << 16) >> 16); // 48ビットを符号拡張
+    }
+    return *(long *)nanbox_ptr(v);
+}
+
+#define SMALL_STR_MAX 5
+
+static inline Value small_str_value(const char *data, size_t length) {
+    Value v = NANBOX_TAG_SMALL_STR | ((uint64_t)length << 40);
+    for (size_t i = 0; i < length; i++) {
+        v |= (uint64_t)(unsigned char)data[i] << (8 * i);
+    }
+    return v;
+}
+
+static inline size_t small_str_length(Value v) {
+    return (size_t)((v >> 40) & 0xFF);
+}
+
+// インライン文字列を buf に取り出し (NUL終端)、長さを返す
+static inline size_t small_str_copy(Value v, char *buf) {
+    size_t length = small_str_length(v);
+    for (size_t i = 0; i < length; i++) {
+        buf[i] = (char)((v >> (8 * i)) & 0xFF);
+    }
+    buf[length] = '\0';
+    return length;
+}
+
+#define VAL_TYPE(v)       nanbox_type(v)
+#define AS_INT(v)         nanbox_to_int(v)
+#define AS_DOUBLE(v)      nanbox_to_double(v)
+#define AS_BOOL(v)        ((bool)((v) & 1))
+#define AS_FUNC(v)        ((struct ASTNode *)nanbox_ptr(v))
+#define AS_KSTRING(v)     ((KString *)nanbox_ptr(v))
+#define VAL_IS_BIGINT(v)  (((v) & NANBOX_TAG_MASK) == NANBOX_TAG_BIGINT)
+#define VAL_IS_HEAP_STR(v) (((v) & NANBOX_TAG_MASK) == NANBOX_TAG_STR)
+#define AS_BIGINT_PTR(v)  ((long *)nanbox_ptr(v))
+#define AS_ARRAY(v)       ((KArray *)nanbox_ptr(v))
+#define VAL_IS_ARRAY(v)   (((v) & NANBOX_TAG_MASK) == NANBOX_TAG_INT_ARRAY || ((v) & NANBOX_TAG_MASK) == NANBOX_TAG_DOUBLE_ARRAY)
+#define VAL_IS_MAT(v)     (((v) & NANBOX_TAG_MASK) == NANBOX_TAG_MAT)
+#define AS_TASK(v)        ((struct KTask *)nanbox_ptr(v))
+#define VAL_IS_FUTURE(v)  (((v) & NANBOX_TAG_MASK) == NANBOX_TAG_FUTURE)
+#define AS_GENERATOR(v)   ((struct KGenerator *)nanbox_ptr(v))
+#define VAL_IS_GENERATOR(v) (((v) & NANBOX_TAG_MASK) == NANBOX_TAG_GENERATOR)
+
+#define INT_VAL(x)        nanbox_from_int(x)
+#define DOUBLE_VAL(x)     nanbox_from_double(x)
+#define BOOL_VAL(b)       (NANBOX_TAG_BOOL | ((b) ? 1 : 0))
+#define STR_VAL(ks)       nanbox_from_ptr(NANBOX_TAG_STR, (ks))
+#define FUNC_VAL(n)       nanbox_from_ptr(NANBOX_TAG_FUNC, (n))
+#define ARRAY_VAL(a)      nanbox_from_ptr((a)->element_type == VALUE_TYPE_INT ? NANBOX_TAG_INT_ARRAY : NANBOX_TAG_DOUBLE_ARRAY, (a))
+#define MAT_VAL(a)        nanbox_from_ptr(NANBOX_TAG_MAT, (a))
+#define FUTURE_VAL(t)     nanbox_from_ptr(NANBOX_TAG_FUTURE, (t))
+#define GENERATOR_VAL(g)  nanbox_from_ptr(NANBOX_TAG_GENERATOR, (g))
+#define VOID_VAL          ((Value)NANBOX_TAG_VOID)
+#define UNKNOWN_VAL       ((Value)NANBOX_TAG_UNKNOWN)
+
+#else
+
+// 16バイトのタグ付き共用体
+typedef struct Value {
+    ValueType type;
+    int small_len; // VALUE_TYPE_STR のみ: インライン文字列の長さ (-1 ならヒープ上の KString)
+    union {
+        long int_value;
+        struct KString *str;
+        char small_str[8];
+        double double_value;
+        bool bool_value;
+        struct ASTNode *func_def; // NODE_FUNCTION_DEFINITION (名前・引数・本体・フレームサイズ)
+        struct KArray *array;
+        struct KTask *task;
+        struct KGenerator *generator;
+    } data;
+} Value;
+
+#define SMALL_STR_MAX 7
+
+static inline Value small_str_value(const char *data, size_t length) {
+    Value v;
+    v.type = VALUE_TYPE_STR;
+    v.small_len = (int)length;
+    memset(v.data.small_str, 0, sizeof(v.data.small_str));
+    memcpy(v.data.small_str, data, length);
+    return v;
+}
+
+static inline size_t small_str_length(Value v) {
+    return (size_t)v.small_len;
+}
+
+static inline size_t small_str_copy(Value v, char *buf) {
+    memcpy(buf, v.data.small_str, (size_t)v.small_len + 1);
+    return (size_t)v.small_len;
+}
+
+#define VAL_TYPE(v)       ((v).type)
+#define AS_INT(v)         ((v).data.int_value)
+#define AS_DOUBLE(v)      ((v).data.double_value)
+#define AS_BOOL(v)        ((v).data.bool_value)
+#define AS_FUNC(v)        ((v).data.func_def)
+#define AS_KSTRING(v)     ((v).data.str)
+#define VAL_IS_BIGINT(v)  ((void)(v), false)
+#define VAL_IS_HEAP_STR(v) ((v).type == VALUE_TYPE_STR && (v).small_len < 0)
+#define AS_BIGINT_PTR(v)  ((long *)NULL)
+#define AS_ARRAY(v)       ((v).data.array)
+#define VAL_IS_ARRAY(v)   ((v).type == VALUE_TYPE_INT_ARRAY || (v).type == VALUE_TYPE_DOUBLE_ARRAY)
+#define VAL_IS_MAT(v)     ((v).type == VALUE_TYPE_MAT)
+#define AS_TASK(v)        ((v).data.task)
+#define VAL_IS_FUTURE(v)  ((v).type == VALUE_TYPE_FUTURE)
+#define AS_GENERATOR(v)   ((v).data.generator)
+#define VAL_IS_GENERATOR(v) ((v).type == VALUE_TYPE_GENERATOR)
+
+#define INT_VAL(x)        ((Value){ VALUE_TYPE_INT, 0, { .int_value = (x) } })
+#define DOUBLE_VAL(x)     ((Value){ VALUE_TYPE_DOUBLE, 0, { .double_value = (x) } })
+#define BOOL_VAL(b)       ((Value){ VALUE_TYPE_BOOL, 0, { .bool_value = (b) } })
+#define STR_VAL(ks)       ((Value){ VALUE_TYPE_STR, -1, { .str = (ks) } })
+#define FUNC_VAL(n)       ((Value){ VALUE_TYPE_FUNCTION, 0, { .func_def = (n) } })
+#define ARRAY_VAL(a)      ((Value){ (a)->element_type == VALUE_TYPE_INT ? VALUE_TYPE_INT_ARRAY : VALUE_TYPE_DOUBLE_ARRAY, 0, { .array = (a) } })
+#define MAT_VAL(a)        ((Value){ VALUE_TYPE_MAT, 0, { .array = (a) } })
+#define FUTURE_VAL(t)     ((Value){ VALUE_TYPE_FUTURE, 0, { .task = (t) } })
+#define GENERATOR_VAL(g)  ((Value){ VALUE_TYPE_GENERATOR, 0, { .generator = (g) } })
+#define VOID_VAL          ((Value){ VALUE_TYPE_VOID, 0, { .int_value = 0 } })
+#define UNKNOWN_VAL       ((Value){ VALUE_TYPE_UNKNOWN, 0, { .int_value = 0 } })
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KAPPOK_VALUE_H
@@ -0,0 +1,292 @@
+#include "kappok.h"
+#include "kappok_api.h"
+
+// 埋め込み API (include/kappok_api.h)
+// コンパイルは名前解決から自動並列化までの読み込みをまとめて行い、読み込んだプログラムを返す。
+// 読み込み時のエラーは compile_error が実行時エラーと同じ戻り先へ戻すので、run_trapping_errors で
+// 捕まえてメッセージを返す (字句・構文のエラーはスレッドごとに溜めたものを返す)。
+//
+// 実行は呼び出しごとに値スタック・出力先・タスクの組を用意して main を実行する。
+// 実行中にプログラムへ書き込むのはアトミックに公開するキャッシュ (呼び出し先と最適化済みの本体) だけなので、
+// 同じプログラムを複数のスレッドで同時に実行できる。
+// 実行時エラーで打ち切られたら、まだ動いているこの実行のタスクを終わらせてから状態を片付ける。
+//
+// スレッドプールと段階的実行の閾値はプロセスに1つしかないので、設定の食い違う実行時オブジェクトは作らない。
+// スレッドプールは一度起動すると大きさを変えられないので、threads は最初の実行時オブジェクトのものに固定する。
+
+struct KappokRuntime {
+    LoadOptions load_options;
+};
+
+struct KappokProgram {
+    LoadedProgram loaded; // loaded.ast はこのプログラムが所有する
+};
+
+static pthread_mutex_t runtimes_lock = PTHREAD_MUTEX_INITIALIZER;
+static int live_runtimes = 0;        // 解放されていない実行時オブジェクトの数
+static int process_threads = -1;     // 最初の実行時オブジェクトの threads (-1 はまだない)
+static int process_tier_threshold;   // 生きている実行時オブジェクトの段階的実行の閾値
+
+typedef struct {
+    LoadedProgram *program;
+    ASTNode *program_node;
+    const LoadOptions *options;
+} CompileJob;
+
+typedef struct {
+    const LoadedProgram *program;
+    ExecState state;
+} RunJob;
+
+// メッセージ (所有権を受け取る) を呼び出し側に渡すか捨てて、status を返す
+static KappokStatus report(KappokStatus status, char *message, char **error) {
+    if (error != NULL) {
+        *error = message;
+    } else {
+        free(message);
+    }
+    return status;
+}
+
+static char *copy_message(const char *message) {
+    char *copy = strdup(message);
+    if (copy == NULL) {
+        perror("Failed to duplicate error message");
+        exit(EXIT_FAILURE);
+    }
+    return copy;
+}
+
+void kappok_options_init(KappokOptions *options) {
+    options->threads = 0;
+    options->tier_threshold = -1;
+    options->memoize = false;
+    options->auto_parallel = false;
+}
+
+KappokRuntime *kappok_runtime_new(const KappokOptions *options) {
+    KappokOptions defaults;
+    if (options == NULL) {
+        kappok_options_init(&defaults);
+        options = &defaults;
+    }
+    if (options->threads < 0 || options->threads > 1024) {
+        return NULL;
+    }
+    int tier_threshold = (options->tier_threshold >= 0) ? options->tier_threshold : TIER_DEFAULT_THRESHOLD;
+
+    pthread_mutex_lock(&runtimes_lock);
+    if ((process_threads >= 0 && options->threads != process_threads) ||
+        (live_runtimes > 0 && tier_threshold != process_tier_threshold)) {
+        pthread_mutex_unlock(&runtimes_lock);
+        return NULL; // 他の実行時オブジェクトの設定を変えてしまう
+    }
+    KappokRuntime *runtime = malloc(sizeof(KappokRuntime));
+    if (runtime == NULL) {
+        pthread_mutex_unlock(&runtimes_lock);
+        return NULL;
+    }
+    runtime->load_options.memoize_all = options->memoize;
+    runtime->load_options.auto_parallel = options->auto_parallel;
+    if (process_threads < 0) {
+        process_threads = options->threads;
+        set_parallel_threads(options->threads);
+    }
+    if (live_runtimes == 0) {
+        process_tier_threshold = tier_threshold;
+        set_tier_threshold(tier_threshold);
+    }
+    live_runtimes++;
+    pthread_mutex_unlock(&runtimes_lock);
+    return runtime;
+}
+
+void kappok_runtime_free(KappokRuntime *runtime) {
+    if (runtime == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&runtimes_lock);
+    live_runtimes--;
+    pthread_mutex_unlock(&runtimes_lock);
+    free(runtime);
+}
+
+static void compile_body(void *arg) {
+    CompileJob *job = arg;
+    load_program(job->program, job->program_node, job->options);
+}
+
+KappokStatus kappok_compile(KappokRuntime *runtime, const char *source, KappokProgram **program, char **error) {
+    if (program != NULL) {
+        *program = NULL;
+    }
+    if (error != NULL) {
+        *error = NULL;
+    }
+    if (runtime == NULL || source == NULL || program == NULL) {
+        return report(KAPPOK_ERROR_ARGUMENT, copy_message("エラー: kappok_compile の引数が不正です"), error);
+    }
+
+    Lexer *lexer = lexer_create((char *)source); // 字句解析はソースを書き換えない
+    begin_syntax_error_capture();
+    ASTNode *program_node = parse(lexer);
+    char *syntax_errors = end_syntax_error_capture();
+    lexer_destroy(lexer);
+    if (program_node == NULL) {
+        if (syntax_errors == NULL) {
+            syntax_errors = copy_message("エラー: 構文解析に失敗しました");
+        }
+        return report(KAPPOK_ERROR_SYNTAX, syntax_errors, error);
+    }
+    free(syntax_errors); // 構文解析を続けられた字句のエラーは、コマンドラインと同じく実行を妨げない
+
+    KappokProgram *compiled = malloc(sizeof(KappokProgram));
+    if (compiled == NULL) {
+        perror("Failed to allocate program");
+        exit(EXIT_FAILURE);
+    }
+    CompileJob job = { &compiled->loaded, program_node, &runtime->load_options };
+    char *message = run_trapping_errors(compile_body, &job);
+    if (message != NULL) {
+        unload_program(&compiled->loaded);
+        destroy_ast(program_node);
+        free(compiled);
+        return report(KAPPOK_ERROR_COMPILE, message, error);
+    }
+    *program = compiled;
+    return KAPPOK_OK;
+}
+
+KappokStatus kappok_compile_file(KappokRuntime *runtime, const char *path, KappokProgram **program, char **error) {
+    if (program != NULL) {
+        *program = NULL;
+    }
+    if (error != NULL) {
+        *error = NULL;
+    }
+    if (path == NULL) {
+        return report(KAPPOK_ERROR_ARGUMENT, copy_message("エラー: kappok_compile_file の引数が不正です"), error);
+    }
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        const char *format = "エラー: ファイル '%s' を開けません";
+        char *message = malloc(strlen(format) + strlen(path) + 1);
+        if (message == NULL) {
+            perror("Failed to allocate error message");
+            exit(EXIT_FAILURE);
+        }
+        sprintf(message, format, path);
+        return report(KAPPOK_ERROR_IO, message, error);
+    }
+
+    // ファイル内容を読み込み
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *source = (file_size >= 0) ? malloc((size_t)file_size + 1) : NULL;
+    if (source == NULL) {
+        fclose(file);
+        return report(KAPPOK_ERROR_IO, copy_message("エラー: メモリ割り当てに失敗しました"), error);
+    }
+    size_t bytes_read = fread(source, 1, (size_t)file_size, file);
+    source[bytes_read] = '\0';
+    fclose(file);
+
+    KappokStatus status = kappok_compile(runtime, source, program, error);
+    free(source);
+    return status;
+}
+
+void kappok_program_free(KappokProgram *program) {
+    if (program == NULL) {
+        return;
+    }
+    unload_program(&program->loaded);
+    destroy_ast(program->loaded.ast);
+    free(program);
+}
+
+static void run_body(void *arg) {
+    RunJob *job = arg;
+    run_main(job->program, &job->state);
+}
+
+// main を out に出力しながら実行する
+static KappokStatus run_program(const KappokProgram *program, OutputWriter *out, char **error) {
+    TaskGroup tasks;
+    task_group_init(&tasks);
+    RunJob job;
+    job.program = &program->loaded;
+    init_exec_state(&job.state, program->loaded.globals, out, &tasks);
+
+    char *message = run_trapping_errors(run_body, &job);
+    if (message != NULL) {
+        // 打ち切られた print の途中までの行を書き、この実行のタスクが AST と出力先を使い終えてから片付ける
+        output_write_partial_line();
+        discard_tasks(&tasks);
+        for (int i = 0; i < job.state.stack_top; i++) {
+            free_value_data(job.state.stack[i]);
+        }
+    } else {
+        output_newline(out);
+    }
+    free(job.state.stack);
+    task_group_destroy(&tasks);
+    output_release_line_buffer();
+    if (message != NULL) {
+        return report(KAPPOK_ERROR_RUNTIME, message, error);
+    }
+    return KAPPOK_OK;
+}
+
+KappokStatus kappok_run(const KappokProgram *program, int output_fd, char **error) {
+    if (error != NULL) {
+        *error = NULL;
+    }
+    if (program == NULL || output_fd < 0) {
+        return report(KAPPOK_ERROR_ARGUMENT, copy_message("エラー: kappok_run の引数が不正です"), error);
+    }
+    OutputWriter out;
+    output_open(&out, output_fd, OUTPUT_BUFFER_AUTO);
+    KappokStatus status = run_program(program, &out, error);
+    output_close(&out);
+    return status;
+}
+
+KappokStatus kappok_run_capture(const KappokProgram *program, char **output, size_t *length, char **error) {
+    if (error != NULL) {
+        *error = NULL;
+    }
+    if (program == NULL || output == NULL) {
+        return report(KAPPOK_ERROR_ARGUMENT, copy_message("エラー: kappok_run_capture の引数が不正です"), error);
+    }
+    OutputWriter out;
+    output_open(&out, -1, OUTPUT_BUFFER_MEMORY);
+    KappokStatus status = run_program(program, &out, error);
+    output_char(&out, '\0');
+    *output = out.buffer;
+    if (length != NULL) {
+        *length = out.length - 1;
+    }
+    out.buffer = NULL; // 取り込んだ出力は呼び出し側に渡す
+    output_close(&out);
+    return status;
+}
+
+const char *kappok_status_name(KappokStatus status) {
+    switch (status) {
+        case KAPPOK_OK:
+            return "成功";
+        case KAPPOK_ERROR_SYNTAX:
+            return "構文エラー";
+        case KAPPOK_ERROR_COMPILE:
+            return "コンパイルエラー";
+        case KAPPOK_ERROR_RUNTIME:
+            return "実行時エラー";
+        case KAPPOK_ERROR_IO:
+            return "入出力エラー";
+        case KAPPOK_ERROR_ARGUMENT:
+            return "引数エラー";
+    }
+    return "不明なエラー";
+}
@@ -0,0 +1,277 @@
+#include "kappok.h"
+
+// 数値配列 (int[] と double[])
+// ヘッダと要素を一度の確保で持ち、要素の先頭は KARRAY_ALIGNMENT バイト境界に揃える。
+// 要素ごとの演算と集約は simd.c のカーネルで行う。
+// 演算の結果は、入力の配列を他から参照されていなければ (参照カウント1) その領域に上書きし、
+// a = a * 2.0 + b のような式で途中の配列を確保し直さない。
+
+// 要素の前のヘッダの大きさ (要素の先頭が境界に揃うよう切り上げる)
+#define KARRAY_HEADER_SIZE ((sizeof(KArray) + KARRAY_ALIGNMENT - 1) / KARRAY_ALIGNMENT * KARRAY_ALIGNMENT)
+
+// 長さ length の配列を作る (参照カウント1、要素は未初期化)
+KArray *karray_new(ValueType element_type, size_t length, int line) {
+    if (length > (SIZE_MAX - KARRAY_HEADER_SIZE) / sizeof(double)) {
+        runtime_error(line, "配列が大きすぎます (長さ %zu)。", length);
+    }
+    void *memory = NULL;
+    if (posix_memalign(&memory, KARRAY_ALIGNMENT, KARRAY_HEADER_SIZE + length * sizeof(double)) != 0) {
+        perror("Failed to allocate array");
+        exit(EXIT_FAILURE);
+    }
+    KArray *array = memory;
+    array->refcount = 1;
+    array->element_type = element_type;
+    array->length = length;
+    array->columns = 0;
+    array->data.ints = (long *)(void *)((char *)memory + KARRAY_HEADER_SIZE); // long と double はどちらも8バイト
+    return array;
+}
+
+void karray_retain(KArray *array) {
+    __atomic_fetch_add(&array->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void karray_release(KArray *array) {
+    // 最後の参照を落としたスレッドだけが解放する
+    if (__atomic_sub_fetch(&array->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(array);
+    }
+}
+
+// 呼び出し側が唯一の参照を持っているか (そうなら中身を書き換えてよい)
+static bool karray_is_exclusive(KArray *array) {
+    return __atomic_load_n(&array->refcount, __ATOMIC_ACQUIRE) == 1;
+}
+
+// 書き換える前に、他の値と共有されていれば複製して呼び出し側だけが持つ配列にする
+// (array の参照を受け取り、書き換えてよい配列の参照を返す)
+KArray *karray_unshare(KArray *array, int line) {
+    if (karray_is_exclusive(array)) {
+        return array;
+    }
+    KArray *copy = karray_new(array->element_type, array->length, line);
+    copy->columns = array->columns;
+    memcpy(copy->data.ints, array->data.ints, array->length * sizeof(long));
+    karray_release(array);
+    return copy;
+}
+
+// int[] を double[] に変換する (値の参照を受け取る。double[] はそのまま返す)
+Value array_to_double(Value value) {
+    KArray *array = AS_ARRAY(value);
+    if (array->element_type == VALUE_TYPE_DOUBLE) {
+        return value;
+    }
+    KArray *converted = karray_new(VALUE_TYPE_DOUBLE, array->length, 0);
+    for (size_t i = 0; i < array->length; i++) {
+        converted->data.doubles[i] = (double)array->data.ints[i];
+    }
+    karray_release(array);
+    return ARRAY_VAL(converted);
+}
+
+// 除数に 0 が含まれるか (double に揃える前の値で調べる。int, bool の 0 は 0.0 になる)
+static bool has_zero_divisor(Value divisor) {
+    if (!VAL_IS_ARRAY(divisor)) {
+        switch (VAL_TYPE(divisor)) {
+            case VALUE_TYPE_INT:
+                return AS_INT(divisor) == 0;
+            case VALUE_TYPE_BOOL:
+                return !AS_BOOL(divisor);
+            default:
+                return AS_DOUBLE(divisor) == 0.0;
+        }
+    }
+    const KArray *array = AS_ARRAY(divisor);
+    if (array->element_type == VALUE_TYPE_DOUBLE) {
+        return simd_double_has_zero(array->data.doubles, array->length);
+    }
+    for (size_t i = 0; i < array->length; i++) {
+        if (array->data.ints[i] == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 結果を書き込む配列: 入力 a を書き換えてよければそれを、なければ新しく確保する
+static KArray *result_array(KArray *a, ValueType element_type, size_t length, int line) {
+    if (a->element_type == element_type && karray_is_exclusive(a)) {
+        karray_retain(a); // 呼び出し側は入力の参照を解放するので、結果の分を足しておく
+        return a;
+    }
+    return karray_new(element_type, length, line);
+}
+
+// 配列同士の要素ごとの演算 (長さと除数は検査済み)
+static Value array_array_arithmetic(ArrayOp op, KArray *left, KArray *right, int line) {
+    size_t n = left->length;
+    ValueType element_type = left->element_type;
+    KArray *out = result_array(karray_is_exclusive(left) ? left : right, element_type, n, line);
+
+    if (element_type == VALUE_TYPE_DOUBLE) {
+        simd_double_op(op, left->data.doubles, right->data.doubles, out->data.doubles, n);
+    } else if (op == ARRAY_OP_DIVIDE) {
+        for (size_t i = 0; i < n; i++) {
+            out->data.ints[i] = divide_ints(left->data.ints[i], right->data.ints[i]);
+        }
+    } else {
+        simd_int_op(op, left->data.ints, right->data.ints, out->data.ints, n);
+    }
+    return ARRAY_VAL(out);
+}
+
+// 配列とスカラーの演算 (scalar_left なら スカラー op 配列。除数は検査済み)
+static Value array_scalar_arithmetic(ArrayOp op, KArray *array, Value scalar, bool scalar_left, int line) {
+    size_t n = array->length;
+    KArray *out = result_array(array, array->element_type, n, line);
+    if (array->element_type == VALUE_TYPE_DOUBLE) {
+        simd_double_op_scalar(op, array->data.doubles, AS_DOUBLE(scalar), out->data.doubles, n, scalar_left);
+    } else if (op == ARRAY_OP_DIVIDE) {
+        long s = AS_INT(scalar);
+        for (size_t i = 0; i < n; i++) {
+            out->data.ints[i] = scalar_left ? divide_ints(s, array->data.ints[i]) : divide_ints(array->data.ints[i], s);
+        }
+    } else {
+        simd_int_op_scalar(op, array->data.ints, AS_INT(scalar), out->data.ints, n, scalar_left);
+    }
+    return ARRAY_VAL(out);
+}
+
+// 配列を含む四則演算の被演算子の型と除数を検査し、失敗する理由があればそのメッセージを返す
+// (長さの一致は呼び出し側で確かめる)
+static const char *check_array_operands(ArrayOp op, Value left, Value right) {
+    bool left_array = VAL_IS_ARRAY(left);
+    bool right_array = VAL_IS_ARRAY(right);
+    ValueType left_element = left_array ? AS_ARRAY(left)->element_type : VAL_TYPE(left);
+    ValueType right_element = right_array ? AS_ARRAY(right)->element_type : VAL_TYPE(right);
+    if (!left_array || !right_array) {
+        // スカラーとの演算はスカラー同士の規則に合わせる (bool は double との演算でだけ使える)
+        ValueType type = left_array ? right_element : left_element;
+        bool use_double = (left_element == VALUE_TYPE_DOUBLE || right_element == VALUE_TYPE_DOUBLE);
+        if (type != VALUE_TYPE_INT && type != VALUE_TYPE_DOUBLE && !(type == VALUE_TYPE_BOOL && use_double)) {
+            return "算術演算子に互換性のない型です。";
+        }
+    }
+    if (op == ARRAY_OP_DIVIDE && has_zero_divisor(right)) {
+        return "0による除算です。";
+    }
+    return NULL;
+}
+
+// 配列を含む四則演算 (両辺の参照を受け取る)
+// 配列同士は要素ごと、配列とスカラーは各要素とスカラーの演算になる。
+// どちらかの要素 (またはスカラー) が double なら結果は double[]、そうでなければ int[]。
+// 失敗するときは両辺を解放してから報告する (変換や結果の確保より前に全て検査する)。
+Value array_arithmetic(ArrayOp op, Value left, Value right, int line) {
+    bool left_array = VAL_IS_ARRAY(left);
+    bool right_array = VAL_IS_ARRAY(right);
+    if (left_array && right_array && AS_ARRAY(left)->length != AS_ARRAY(right)->length) {
+        size_t left_length = AS_ARRAY(left)->length;
+        size_t right_length = AS_ARRAY(right)->length;
+        free_value_data(left);
+        free_value_data(right);
+        runtime_error(line, "配列の長さが一致しません (%zu と %zu)。", left_length, right_length);
+    }
+    const char *error = check_array_operands(op, left, right);
+    if (error != NULL) {
+        free_value_data(left);
+        free_value_data(right);
+        runtime_error(line, "%s", error);
+    }
+
+    // どちらかが double なら両辺を double に揃える
+    ValueType left_element = left_array ? AS_ARRAY(left)->element_type : VAL_TYPE(left);
+    ValueType right_element = right_array ? AS_ARRAY(right)->element_type : VAL_TYPE(right);
+    if (left_element == VALUE_TYPE_DOUBLE || right_element == VALUE_TYPE_DOUBLE) {
+        if (left_array) {
+            left = array_to_double(left);
+        } else {
+            Value converted = convert_value_to_double(left, line);
+            free_value_data(left);
+            left = converted;
+        }
+        if (right_array) {
+            right = array_to_double(right);
+        } else {
+            Value converted = convert_value_to_double(right, line);
+            free_value_data(right);
+            right = converted;
+        }
+    }
+
+    Value result;
+    if (left_array && right_array) {
+        result = array_array_arithmetic(op, AS_ARRAY(left), AS_ARRAY(right), line);
+    } else if (left_array) {
+        result = array_scalar_arithmetic(op, AS_ARRAY(left), right, false, line);
+    } else {
+        result = array_scalar_arithmetic(op, AS_ARRAY(right), left, true, line);
+    }
+    free_value_data(left);
+    free_value_data(right);
+    return result;
+}
+
+// 添字を検査して配列内の位置を返す
+static size_t checked_index(const KArray *array, Value index, int line) {
+    long i;
+    if (VAL_TYPE(index) == VALUE_TYPE_INT) {
+        i = AS_INT(index);
+    } else if (VAL_TYPE(index) == VALUE_TYPE_BOOL) {
+        i = AS_BOOL(index) ? 1 : 0;
+    } else {
+        runtime_error(line, "配列の添字は整数でなければなりません。");
+    }
+    if (i < 0 || (size_t)i >= array->length) {
+        runtime_error(line, "配列の添字 %ld は範囲外です (長さ %zu)。", i, array->length);
+    }
+    return (size_t)i;
+}
+
+// 配列の要素を読む (array と index は借りるだけで解放しない)
+Value array_element(Value array, Value index, int line) {
+    if (VAL_IS_MAT(array)) {
+        runtime_error(line, "行列の要素は [行, 列] の2つの添字で指定します。");
+    }
+    if (!VAL_IS_ARRAY(array)) {
+        runtime_error(line, "配列でない値に添字を付けようとしました。");
+    }
+    const KArray *a = AS_ARRAY(array);
+    size_t i = checked_index(a, index, line);
+    if (a->element_type == VALUE_TYPE_DOUBLE) {
+        return DOUBLE_VAL(a->data.doubles[i]);
+    }
+    return INT_VAL(a->data.ints[i]);
+}
+
+// 変数 name が持つ配列の要素に代入する (index と value は借りるだけで解放しない)
+// 配列が他の値と共有されていれば、先に複製して変数だけが持つ配列にする。
+void array_store_element(Value *target, Value index, Value value, const char *name, int line) {
+    if (VAL_IS_MAT(*target)) {
+        runtime_error(line, "行列の要素は [行, 列] の2つの添字で指定します。");
+    }
+    if (!VAL_IS_ARRAY(*target)) {
+        runtime_error(line, "配列でない変数 '%s' に添字を付けて代入しようとしました。", name);
+    }
+    KArray *array = AS_ARRAY(*target);
+    size_t i = checked_index(array, index, line);
+
+    ValueType type = VAL_TYPE(value);
+    bool compatible = (type == VALUE_TYPE_INT || type == VALUE_TYPE_BOOL ||
+                       (type == VALUE_TYPE_DOUBLE && array->element_type == VALUE_TYPE_DOUBLE));
+    if (!compatible) {
+        runtime_error(line, "'%s' の要素に互換性のない型の値を代入しようとしました。", name);
+    }
+
+    array = karray_unshare(array, line);
+    *target = ARRAY_VAL(array);
+
+    if (array->element_type == VALUE_TYPE_DOUBLE) {
+        Value converted = convert_value_to_double(value, line);
+        array->data.doubles[i] = AS_DOUBLE(converted);
+    } else {
+        array->data.ints[i] = (type == VALUE_TYPE_BOOL) ? (AS_BOOL(value) ? 1 : 0) : AS_INT(value);
+    }
+}
@@ -0,0 +1,323 @@
+#include "kappok.h"
+
+// 自動並列化 (--auto-parallel)
+// 互いに独立な重い部分式を、スレッドプールのタスクで並行に評価する。
+// 式を「領域」に分けて考える: 領域は文の式 (print 文は引数全体) から、print の引数・組み込み関数
+// (round など) の引数・算術演算の左右をたどって届く範囲で、ユーザー定義関数の呼び出しで終わる。
+// 呼び出しの引数はそれぞれ別の領域になる。
+//
+// 領域の中の呼び出しは左から順に評価される。その前に重い式が評価される呼び出しを、
+// 領域を評価し始めるところでタスクにして始めておき、評価が呼び出しの位置に来たら join する
+// (前の式を呼び出し元のスレッドが評価する間に、作業スレッドが呼び出しを評価する)。
+// タスクにするのは次の条件を満たす呼び出し:
+//   - 呼び出し先が純粋 (print を呼ばず、副作用のあるホスト関数を呼ばず、再帰しない) で、
+//     ジェネレータ関数でない
+//   - 引数が失敗しない純粋な式 (PURITY_TOTAL)。引数は領域の前の式より先に評価するため
+//   - 呼び出しも、その前に評価する式も、見積もりコストが AUTO_PARALLEL_MIN_COST 以上
+// 純粋な呼び出しは出力せず、呼び出し元の変数も書き換えないので、前の式と並行に動いても
+// 結果と出力は逐次実行と変わらない。結果は呼び出しの位置で受け取るので、呼び出しの中の
+// 実行時エラーも、前の式のエラーより後に、逐次実行と同じメッセージで報告される。
+//
+// タスクの future は関数のフレームの隠れたスロットに置く (呼び出しごとに1つ、ここで割り当てる)。
+// 実行時エラーで領域が捨てられても、future はフレームと一緒に解放される。
+
+#define AUTO_PARALLEL_MIN_COST 5000       // タスクにする重さの下限 (評価するノードの数の見積もり)
+#define AUTO_PARALLEL_UNKNOWN_TRIPS 1000  // 範囲が定数でないループの反復回数の見積もり
+#define AUTO_PARALLEL_COST_LIMIT (1L << 40) // 見積もりの上限 (再帰する関数など。溢れないよう飽和させる)
+
+#define COST_UNKNOWN (-1)    // 関数の見積もりがまだない
+#define COST_ESTIMATING (-2) // 関数を見積もり中 (ここに戻ってきたら再帰呼び出し)
+
+static long add_cost(long a, long b) {
+    long sum = a + b;
+    return (sum > AUTO_PARALLEL_COST_LIMIT) ? AUTO_PARALLEL_COST_LIMIT : sum;
+}
+
+static long multiply_cost(long count, long cost) {
+    if (count > 0 && cost > AUTO_PARALLEL_COST_LIMIT / count) {
+        return AUTO_PARALLEL_COST_LIMIT;
+    }
+    return count * cost;
+}
+
+static long function_cost(ASTNode *func_def);
+
+// 式・文を一度評価する重さの見積もり (評価するノードの数)
+// ループは反復回数を掛け、ユーザー定義関数の呼び出しは呼び出し先の本体の重さを足す。
+static long estimate_cost(const ASTNode *node) {
+    if (node == NULL) {
+        return 0;
+    }
+    long cost = 1;
+    switch (node->type) {
+        case NODE_BLOCK:
+            cost = 0;
+            for (int i = 0; i < node->data.block.num_statements; i++) {
+                cost = add_cost(cost, estimate_cost(node->data.block.statements[i]));
+            }
+            break;
+        case NODE_RETURN_STATEMENT:
+            cost = add_cost(cost, estimate_cost(node->data.return_stmt.value));
+            break;
+        case NODE_YIELD:
+            cost = add_cost(cost, estimate_cost(node->data.yield_stmt.value));
+            break;
+        case NODE_PRINT_STATEMENT:
+            for (int i = 0; i < node->data.print_stmt.num_arguments; i++) {
+                cost = add_cost(cost, estimate_cost(node->data.print_stmt.arguments[i]));
+            }
+            break;
+        case NODE_FUNCTION_CALL:
+            for (int i = 0; i < node->data.func_call.num_arguments; i++) {
+                cost = add_cost(cost, estimate_cost(node->data.func_call.arguments[i]));
+            }
+            // spawn した呼び出しの本体は別のタスクで実行される
+            if (node->data.func_call.native == NULL && !node->data.func_call.spawned && node->data.func_call.callee != NULL) {
+                cost = add_cost(cost, function_cost(node->data.func_call.callee));
+            }
+            break;
+        case NODE_VAR_DECLARATION:
+            cost = add_cost(cost, estimate_cost(node->data.var_decl.initializer));
+            break;
+        case NODE_ASSIGNMENT:
+            cost = add_cost(cost, estimate_cost(node->data.assignment.value));
+            break;
+        case NODE_INDEX_ASSIGNMENT:
+            cost = add_cost(cost, estimate_cost(node->data.index_assignment.index));
+            cost = add_cost(cost, estimate_cost(node->data.index_assignment.column));
+            cost = add_cost(cost, estimate_cost(node->data.index_assignment.value));
+            break;
+        case NODE_CONVERT:
+            cost = add_cost(cost, estimate_cost(node->data.convert.operand));
+            break;
+        case NODE_ARRAY_LITERAL:
+            for (int i = 0; i < node->data.array_literal.num_elements; i++) {
+                cost = add_cost(cost, estimate_cost(node->data.array_literal.elements[i]));
+            }
+            break;
+        case NODE_INDEX:
+            cost = add_cost(cost, estimate_cost(node->data.index_expr.target));
+            cost = add_cost(cost, estimate_cost(node->data.index_expr.index));
+            cost = add_cost(cost, estimate_cost(node->data.index_expr.column));
+            break;
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE:
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_DIVIDE_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE:
+        case NODE_CONCAT:
+            cost = add_cost(cost, estimate_cost(node->data.binary_expr.left));
+            cost = add_cost(cost, estimate_cost(node->data.binary_expr.right));
+            break;
+        case NODE_FOR: {
+            // 範囲が整数リテラルなら反復回数が分かる。ジェネレータを回す回数は分からない
+            const ASTNode *start = node->data.for_stmt.start;
+            const ASTNode *end = node->data.for_stmt.end;
+            long trips = AUTO_PARALLEL_UNKNOWN_TRIPS;
+            if (start != NULL && end != NULL && start->type == NODE_NUMBER_LITERAL && end->type == NODE_NUMBER_LITERAL) {
+                long first = start->data.number_literal.value;
+                long last = end->data.number_literal.value;
+                // 差が long に収まらないことがあるので符号なしで求める
+                unsigned long span = (last > first) ? (unsigned long)last - (unsigned long)first : 0;
+                trips = (span > (unsigned long)LONG_MAX) ? LONG_MAX : (long)span;
+            }
+            cost = add_cost(cost, estimate_cost(start));
+            cost = add_cost(cost, estimate_cost(end));
+            cost = add_cost(cost, estimate_cost(node->data.for_stmt.iterable));
+            cost = add_cost(cost, multiply_cost(trips, estimate_cost(node->data.for_stmt.body)));
+            break;
+        }
+        case NODE_FORK:
+            cost = estimate_cost(node->data.fork_expr.body);
+            break;
+        default:
+            break;
+    }
+    return cost;
+}
+
+// 関数の本体を一度実行する重さの見積もり (結果は関数定義に記録する)
+// 再帰する関数は分岐がないので必ず無限に再帰する。上限の重さとして扱う。
+static long function_cost(ASTNode *func_def) {
+    long cost = func_def->data.func_def.cost_estimate;
+    if (cost == COST_ESTIMATING) {
+        return AUTO_PARALLEL_COST_LIMIT;
+    }
+    if (cost != COST_UNKNOWN) {
+        return cost;
+    }
+    func_def->data.func_def.cost_estimate = COST_ESTIMATING;
+    cost = estimate_cost(func_def->data.func_def.body);
+    func_def->data.func_def.cost_estimate = cost;
+    return cost;
+}
+
+// タスクにしてよい呼び出しか (重さは呼び出し側で調べる)
+static bool is_forkable_call(const ASTNode *node) {
+    const ASTNode *callee = node->data.func_call.callee;
+    if (node->data.func_call.native != NULL || node->data.func_call.spawned || !node->data.func_call.checked
+        || callee == NULL || callee->data.func_def.generator) {
+        return false;
+    }
+    if (analyze_purity(node->data.func_call.callee) == PURITY_IMPURE) {
+        return false;
+    }
+    for (int i = 0; i < node->data.func_call.num_arguments; i++) {
+        if (expression_purity(node->data.func_call.arguments[i]) != PURITY_TOTAL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 領域を走査する状態
+typedef struct ForkScan {
+    ASTNode *func_def; // 隠れたスロットを割り当てる関数
+    long evaluated;    // 領域の中でここまでに評価する式の重さ
+    bool forked;       // タスクにする呼び出しがある
+} ForkScan;
+
+static void parallelize_region(ASTNode **ref, ASTNode *func_def);
+
+// 領域の中を評価の順にたどり、タスクにする呼び出しに隠れたスロットを割り当てる
+static void scan_region(ASTNode **ref, ForkScan *scan) {
+    ASTNode *node = *ref;
+    if (node == NULL) {
+        return;
+    }
+    switch (node->type) {
+        case NODE_PRINT_STATEMENT:
+            for (int i = 0; i < node->data.print_stmt.num_arguments; i++) {
+                scan_region(&node->data.print_stmt.arguments[i], scan);
+            }
+            break;
+        case NODE_CONVERT:
+            scan_region(&node->data.convert.operand, scan);
+            break;
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE:
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_DIVIDE_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE:
+        case NODE_CONCAT:
+            scan_region(&node->data.binary_expr.left, scan);
+            scan_region(&node->data.binary_expr.right, scan);
+            break;
+        case NODE_FUNCTION_CALL: {
+            if (node->data.func_call.native != NULL) {
+                for (int i = 0; i < node->data.func_call.num_arguments; i++) {
+                    scan_region(&node->data.func_call.arguments[i], scan);
+                }
+                break;
+            }
+            // ユーザー定義関数の呼び出しで領域は終わる (引数はそれぞれ別の領域)
+            for (int i = 0; i < node->data.func_call.num_arguments; i++) {
+                parallelize_region(&node->data.func_call.arguments[i], scan->func_def);
+            }
+            long cost = estimate_cost(node);
+            if (scan->evaluated >= AUTO_PARALLEL_MIN_COST && cost >= AUTO_PARALLEL_MIN_COST && is_forkable_call(node)) {
+                node->data.func_call.fork_slot = scan->func_def->data.func_def.frame_size++;
+                scan->forked = true;
+            }
+            scan->evaluated = add_cost(scan->evaluated, cost);
+            return;
+        }
+        case NODE_ARRAY_LITERAL:
+            // 配列リテラルと添字の中はそれぞれ別の領域
+            for (int i = 0; i < node->data.array_literal.num_elements; i++) {
+                parallelize_region(&node->data.array_literal.elements[i], scan->func_def);
+            }
+            scan->evaluated = add_cost(scan->evaluated, estimate_cost(node));
+            return;
+        case NODE_INDEX:
+            parallelize_region(&node->data.index_expr.target, scan->func_def);
+            parallelize_region(&node->data.index_expr.index, scan->func_def);
+            parallelize_region(&node->data.index_expr.column, scan->func_def);
+            scan->evaluated = add_cost(scan->evaluated, estimate_cost(node));
+            return;
+        default:
+            scan->evaluated = add_cost(scan->evaluated, estimate_cost(node));
+            return;
+    }
+    scan->evaluated = add_cost(scan->evaluated, 1);
+}
+
+// 領域の根の式・文を走査し、タスクにする呼び出しがあれば NODE_FORK で包む
+static void parallelize_region(ASTNode **ref, ASTNode *func_def) {
+    if (*ref == NULL) {
+        return;
+    }
+    ForkScan scan;
+    scan.func_def = func_def;
+    scan.evaluated = 0;
+    scan.forked = false;
+    scan_region(ref, &scan);
+    if (scan.forked) {
+        ASTNode *fork = create_ast_node(NODE_FORK, (*ref)->line);
+        fork->data.fork_expr.body = *ref;
+        *ref = fork;
+    }
+}
+
+static void parallelize_block(ASTNode *body, ASTNode *func_def) {
+    for (int i = 0; i < body->data.block.num_statements; i++) {
+        ASTNode *statement = body->data.block.statements[i];
+        switch (statement->type) {
+            case NODE_RETURN_STATEMENT:
+                parallelize_region(&statement->data.return_stmt.value, func_def);
+                break;
+            case NODE_YIELD:
+                parallelize_region(&statement->data.yield_stmt.value, func_def);
+                break;
+            case NODE_VAR_DECLARATION:
+                parallelize_region(&statement->data.var_decl.initializer, func_def);
+                break;
+            case NODE_ASSIGNMENT:
+                parallelize_region(&statement->data.assignment.value, func_def);
+                break;
+            case NODE_INDEX_ASSIGNMENT:
+                parallelize_region(&statement->data.index_assignment.index, func_def);
+                parallelize_region(&statement->data.index_assignment.column, func_def);
+                parallelize_region(&statement->data.index_assignment.value, func_def);
+                break;
+            case NODE_FOR:
+                parallelize_region(&statement->data.for_stmt.start, func_def);
+                parallelize_region(&statement->data.for_stmt.end, func_def);
+                parallelize_region(&statement->data.for_stmt.iterable, func_def);
+                parallelize_block(statement->data.for_stmt.body, func_def);
+                break;
+            default:
+                // print 文は引数全体で1つの領域
+                parallelize_region(&body->data.block.statements[i], func_def);
+                break;
+        }
+    }
+}
+
+// 並行に評価する呼び出しを決める (型検査とコンパイル時評価の後、main の実行前に呼ぶ)
+// enabled (--auto-parallel) でなければ何もしない。
+void configure_auto_parallel(ASTNode *program_node, bool enabled) {
+    if (!enabled || program_node == NULL || program_node->type != NODE_PROGRAM) {
+        return;
+    }
+    for (int i = 0; i < program_node->data.program.num_statements; i++) {
+        ASTNode *statement = program_node->data.program.statements[i];
+        if (statement->type == NODE_FUNCTION_DEFINITION) {
+            parallelize_block(statement->data.func_def.body, statement);
+        }
+    }
+}
@@ -0,0 +1,452 @@
+#include "kappok.h"
+
+// ネイティブ関数のレジストリ
+// 組み込み関数とホストプログラムが登録した関数を同じ表で管理する。
+// リゾルバが呼び出しノードごとに一度だけ名前を引き、実行時はエントリの関数ポインタを直接呼ぶ。
+// エントリは個別に確保するので、表が伸びても呼び出しノードが持つポインタは無効にならない。
+// 埋め込み API では複数のスレッドが同時にプログラムを読み込むので、表はロックして読み書きする
+// (実行時は呼び出しノードがエントリを直接指すので、ロックを取らない)。
+static NativeFunctionEntry **natives = NULL;
+static int num_natives = 0;
+static int capacity_natives = 0;
+static pthread_once_t builtins_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t natives_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// round(数値, 精度): 指定された桁数で四捨五入した結果を文字列で返す
+static Value builtin_round(Value *args, int num_args, int line) {
+    (void)num_args;
+    (void)line;
+    double val_to_round;
+    if (VAL_TYPE(args[0]) == VALUE_TYPE_INT) {
+        val_to_round = (double)AS_INT(args[0]);
+    } else { // VALUE_TYPE_DOUBLE
+        val_to_round = AS_DOUBLE(args[0]);
+    }
+    int precision = (int)AS_INT(args[1]);
+
+    // 指定された精度で四捨五入
+    double factor = exact_pow10(precision);
+    double rounded_val = round(val_to_round * factor) / factor;
+
+    // ここで直接文字列にフォーマットして返す。
+    // round 関数は指定された精度で厳密に表示するため、末尾のゼロ削除は行わない。
+    // (負の精度は printf と同じく6桁として扱う)
+    int digits = (precision < 0) ? 6 : precision;
+    char stack_buffer[400];
+    char *buffer = stack_buffer;
+    if (FORMAT_FIXED_MAX_LENGTH(digits) > sizeof(stack_buffer)) {
+        buffer = malloc(FORMAT_FIXED_MAX_LENGTH(digits));
+        if (buffer == NULL) {
+            perror("Failed to allocate number buffer");
+            exit(EXIT_FAILURE);
+        }
+    }
+    int length = format_double_fixed(rounded_val, digits, buffer);
+
+    Value result = make_string_value(buffer, (size_t)length);
+    if (buffer != stack_buffer) {
+        free(buffer);
+    }
+    return result;
+}
+
+#define NUMERIC_ARRAY_TYPES (VALUE_TYPE_MASK(VALUE_TYPE_INT_ARRAY) | VALUE_TYPE_MASK(VALUE_TYPE_DOUBLE_ARRAY))
+
+// len(配列): 要素数
+static Value builtin_len(Value *args, int num_args, int line) {
+    (void)num_args;
+    (void)line;
+    return INT_VAL((long)AS_ARRAY(args[0])->length);
+}
+
+// sum(配列): 要素の総和 (空の配列は 0)
+static Value builtin_sum(Value *args, int num_args, int line) {
+    (void)num_args;
+    (void)line;
+    const KArray *array = AS_ARRAY(args[0]);
+    if (array->element_type == VALUE_TYPE_DOUBLE) {
+        return DOUBLE_VAL(simd_double_sum(array->data.doubles, array->length));
+    }
+    return INT_VAL(simd_int_sum(array->data.ints, array->length));
+}
+
+static Value array_extreme(Value *args, int line, const char *name, bool maximum) {
+    const KArray *array = AS_ARRAY(args[0]);
+    if (array->length == 0) {
+        runtime_error(line, "'%s' 関数に空の配列が渡されました。", name);
+    }
+    if (array->element_type == VALUE_TYPE_DOUBLE) {
+        return DOUBLE_VAL(simd_double_extreme(array->data.doubles, array->length, maximum));
+    }
+    return INT_VAL(simd_int_extreme(array->data.ints, array->length, maximum));
+}
+
+// min(配列), max(配列): 最小・最大の要素 (double の要素に NaN があれば NaN)
+static Value builtin_min(Value *args, int num_args, int line) {
+    (void)num_args;
+    return array_extreme(args, line, "min", false);
+}
+
+static Value builtin_max(Value *args, int num_args, int line) {
+    (void)num_args;
+    return array_extreme(args, line, "max", true);
+}
+
+// dot(配列, 配列): 内積 (どちらかが double[] なら double で計算する)
+static Value builtin_dot(Value *args, int num_args, int line) {
+    (void)num_args;
+    const KArray *a = AS_ARRAY(args[0]);
+    const KArray *b = AS_ARRAY(args[1]);
+    if (a->length != b->length) {
+        runtime_error(line, "配列の長さが一致しません (%zu と %zu)。", a->length, b->length);
+    }
+    if (a->element_type == VALUE_TYPE_INT && b->element_type == VALUE_TYPE_INT) {
+        return INT_VAL(simd_int_dot(a->data.ints, b->data.ints, a->length));
+    }
+    Value x = array_to_double(copy_value(args[0]));
+    Value y = array_to_double(copy_value(args[1]));
+    double result = simd_double_dot(AS_ARRAY(x)->data.doubles, AS_ARRAY(y)->data.doubles, a->length);
+    free_value_data(x);
+    free_value_data(y);
+    return DOUBLE_VAL(result);
+}
+
+static KArray *new_filled_array(ValueType element_type, Value length, int line, const char *name) {
+    long n = AS_INT(length);
+    if (n < 0) {
+        runtime_error(line, "'%s' 関数の長さが負です。", name);
+    }
+    return karray_new(element_type, (size_t)n, line);
+}
+
+// int_array(長さ, 値), double_array(長さ, 値): 全ての要素が値の配列
+static Value builtin_int_array(Value *args, int num_args, int line) {
+    (void)num_args;
+    KArray *array = new_filled_array(VALUE_TYPE_INT, args[0], line, "int_array");
+    long value = AS_INT(args[1]);
+    for (size_t i = 0; i < array->length; i++) {
+        array->data.ints[i] = value;
+    }
+    return ARRAY_VAL(array);
+}
+
+static Value builtin_double_array(Value *args, int num_args, int line) {
+    (void)num_args;
+    KArray *array = new_filled_array(VALUE_TYPE_DOUBLE, args[0], line, "double_array");
+    double value = (VAL_TYPE(args[1]) == VALUE_TYPE_INT) ? (double)AS_INT(args[1]) : AS_DOUBLE(args[1]);
+    for (size_t i = 0; i < array->length; i++) {
+        array->data.doubles[i] = value;
+    }
+    return ARRAY_VAL(array);
+}
+
+// matrix(行数, 列数, 値): 全ての要素が値の行列、または配列の要素を行優先に並べた行列
+static Value builtin_matrix(Value *args, int num_args, int line) {
+    (void)num_args;
+    KArray *matrix = matrix_new(AS_INT(args[0]), AS_INT(args[1]), line);
+    Value fill = args[2];
+    if (VAL_IS_ARRAY(fill)) {
+        const KArray *source = AS_ARRAY(fill);
+        if (source->length != matrix->length) {
+            size_t length = matrix->length;
+            karray_release(matrix);
+            runtime_error(line, "'matrix' 関数の配列の長さ %zu が要素数 %zu と一致しません。",
+                    source->length, length);
+        }
+        for (size_t i = 0; i < matrix->length; i++) {
+            matrix->data.doubles[i] = (source->element_type == VALUE_TYPE_DOUBLE) ? source->data.doubles[i] : (double)source->data.ints[i];
+        }
+    } else {
+        double value = (VAL_TYPE(fill) == VALUE_TYPE_INT) ? (double)AS_INT(fill) : AS_DOUBLE(fill);
+        for (size_t i = 0; i < matrix->length; i++) {
+            matrix->data.doubles[i] = value;
+        }
+    }
+    return MAT_VAL(matrix);
+}
+
+// rows(行列), cols(行列): 行数と列数
+static Value builtin_rows(Value *args, int num_args, int line) {
+    (void)num_args;
+    (void)line;
+    return INT_VAL((long)MAT_ROWS(AS_ARRAY(args[0])));
+}
+
+static Value builtin_cols(Value *args, int num_args, int line) {
+    (void)num_args;
+    (void)line;
+    return INT_VAL((long)AS_ARRAY(args[0])->columns);
+}
+
+// transpose(行列): 転置
+static Value builtin_transpose(Value *args, int num_args, int line) {
+    (void)num_args;
+    return MAT_VAL(matrix_transpose(AS_ARRAY(args[0]), line));
+}
+
+// matmul(行列, 行列): 行列の積 (左の列数と右の行数が一致すること)
+static Value builtin_matmul(Value *args, int num_args, int line) {
+    (void)num_args;
+    return MAT_VAL(matrix_multiply(AS_ARRAY(args[0]), AS_ARRAY(args[1]), line));
+}
+
+// join(future): spawn したタスクの結果 (終わっていなければ待つ。タスクの実行時エラーはここで報告する)
+static Value builtin_join(Value *args, int num_args, int line) {
+    (void)num_args;
+    (void)line;
+    return join_task(AS_TASK(args[0]));
+}
+
+// 表から名前で探す (表を読み書きする側がロックを持つこと)
+static NativeFunctionEntry *lookup_native_function(const char *name, unsigned int hash) {
+    for (int i = 0; i < num_natives; i++) {
+        if (natives[i]->hash == hash && strcmp(natives[i]->name, name) == 0) {
+            return natives[i];
+        }
+    }
+    return NULL;
+}
+
+// 登録したエントリを返す (登録できなければ NULL)
+static NativeFunctionEntry *add_native_function(const char *name, NativeFunction function, ValueType return_type, Purity purity, const NativeParam *params, int num_params) {
+    if (num_params < 0 || num_params > NATIVE_MAX_PARAMS) {
+        return NULL;
+    }
+    unsigned int hash = hash_symbol_name(name);
+    if (lookup_native_function(name, hash) != NULL) {
+        return NULL; // 先に登録された関数 (組み込み関数を含む) が優先される
+    }
+
+    if (num_natives >= capacity_natives) {
+        int new_capacity = (capacity_natives == 0) ? 8 : capacity_natives * 2;
+        natives = realloc(natives, sizeof(NativeFunctionEntry *) * new_capacity);
+        if (natives == NULL) {
+            perror("Failed to reallocate native functions");
+            exit(EXIT_FAILURE);
+        }
+        capacity_natives = new_capacity;
+    }
+
+    NativeFunctionEntry *entry = malloc(sizeof(NativeFunctionEntry));
+    if (entry == NULL) {
+        perror("Failed to allocate native function");
+        exit(EXIT_FAILURE);
+    }
+    entry->name = strdup(name);
+    if (entry->name == NULL) {
+        perror("Failed to duplicate native function name");
+        exit(EXIT_FAILURE);
+    }
+    entry->hash = hash;
+    entry->function = function;
+    entry->return_type = return_type;
+    entry->element_result = false;
+    entry->maps_function = false;
+    entry->purity = purity;
+    entry->num_params = num_params;
+    for (int i = 0; i < num_params; i++) {
+        entry->params[i] = params[i];
+    }
+    natives[num_natives++] = entry;
+    return entry;
+}
+
+static void register_builtin_functions(void) {
+    static const NativeParam round_params[] = {
+        { "数値", VALUE_TYPE_MASK(VALUE_TYPE_INT) | VALUE_TYPE_MASK(VALUE_TYPE_DOUBLE) },
+        { "精度", VALUE_TYPE_MASK(VALUE_TYPE_INT) },
+    };
+    add_native_function("round", builtin_round, VALUE_TYPE_STR, PURITY_TOTAL, round_params, 2);
+
+    // 配列の関数 (len と sum は失敗しない。min, max は空の配列、dot は長さの不一致で失敗する)
+    static const NativeParam array_params[] = {
+        { "配列", NUMERIC_ARRAY_TYPES },
+    };
+    static const NativeParam dot_params[] = {
+        { "配列", NUMERIC_ARRAY_TYPES },
+        { "配列", NUMERIC_ARRAY_TYPES },
+    };
+    static const NativeParam int_array_params[] = {
+        { "長さ", VALUE_TYPE_MASK(VALUE_TYPE_INT) },
+        { "値", VALUE_TYPE_MASK(VALUE_TYPE_INT) },
+    };
+    static const NativeParam double_array_params[] = {
+        { "長さ", VALUE_TYPE_MASK(VALUE_TYPE_INT) },
+        { "値", VALUE_TYPE_MASK(VALUE_TYPE_INT) | VALUE_TYPE_MASK(VALUE_TYPE_DOUBLE) },
+    };
+    add_native_function("len", builtin_len, VALUE_TYPE_INT, PURITY_TOTAL, array_params, 1);
+    add_native_function("sum", builtin_sum, VALUE_TYPE_UNKNOWN, PURITY_TOTAL, array_params, 1)->element_result = true;
+    add_native_function("min", builtin_min, VALUE_TYPE_UNKNOWN, PURITY_PURE, array_params, 1)->element_result = true;
+    add_native_function("max", builtin_max, VALUE_TYPE_UNKNOWN, PURITY_PURE, array_params, 1)->element_result = true;
+    add_native_function("dot", builtin_dot, VALUE_TYPE_UNKNOWN, PURITY_PURE, dot_params, 2)->element_result = true;
+    add_native_function("int_array", builtin_int_array, VALUE_TYPE_INT_ARRAY, PURITY_PURE, int_array_params, 2);
+    add_native_function("double_array", builtin_double_array, VALUE_TYPE_DOUBLE_ARRAY, PURITY_PURE, double_array_params, 2);
+
+    // 行列の関数 (matrix は大きさ、matmul は行列の大きさの不一致で失敗する)
+    static const NativeParam matrix_params[] = {
+        { "行数", VALUE_TYPE_MASK(VALUE_TYPE_INT) },
+        { "列数", VALUE_TYPE_MASK(VALUE_TYPE_INT) },
+        { "値", VALUE_TYPE_MASK(VALUE_TYPE_INT) | VALUE_TYPE_MASK(VALUE_TYPE_DOUBLE) | NUMERIC_ARRAY_TYPES },
+    };
+    static const NativeParam mat_params[] = {
+        { "行列", VALUE_TYPE_MASK(VALUE_TYPE_MAT) },
+    };
+    static const NativeParam matmul_params[] = {
+        { "行列", VALUE_TYPE_MASK(VALUE_TYPE_MAT) },
+        { "行列", VALUE_TYPE_MASK(VALUE_TYPE_MAT) },
+    };
+    add_native_function("matrix", builtin_matrix, VALUE_TYPE_MAT, PURITY_PURE, matrix_params, 3);
+    add_native_function("rows", builtin_rows, VALUE_TYPE_INT, PURITY_TOTAL, mat_params, 1);
+    add_native_function("cols", builtin_cols, VALUE_TYPE_INT, PURITY_TOTAL, mat_params, 1);
+    add_native_function("transpose", builtin_transpose, VALUE_TYPE_MAT, PURITY_TOTAL, mat_params, 1);
+    add_native_function("matmul", builtin_matmul, VALUE_TYPE_MAT, PURITY_PURE, matmul_params, 2);
+
+    // 純粋な関数を配列の各要素にスレッドプールで並列に適用する (parallel.c)
+    // 結果の型は関数の戻り値の型で決まるので、型検査が呼び出しごとに求める。
+    static const NativeParam parallel_map_params[] = {
+        { "関数", VALUE_TYPE_MASK(VALUE_TYPE_FUNCTION) },
+        { "配列", NUMERIC_ARRAY_TYPES },
+    };
+    add_native_function("parallel_map", NULL, VALUE_TYPE_UNKNOWN, PURITY_PURE, parallel_map_params, 2)->maps_function = true;
+
+    // spawn したタスクの結果を受け取る (結果の型はタスクの関数によるので動的)
+    static const NativeParam join_params[] = {
+        { "future", VALUE_TYPE_MASK(VALUE_TYPE_FUTURE) },
+    };
+    add_native_function("join", builtin_join, VALUE_TYPE_UNKNOWN, PURITY_IMPURE, join_params, 1);
+}
+
+// ホストプログラムからネイティブ関数を登録する
+// 同名の関数が既にある場合 (組み込み関数を含む) は登録せずに false を返す。
+// 戻り値の型は宣言されないので、型検査では呼び出し結果を動的な型として扱う。
+// 副作用があり得るので、ロード時の定数評価では呼び出さない。
+bool kappok_register_native(const char *name, NativeFunction function, const NativeParam *params, int num_params) {
+    pthread_once(&builtins_once, register_builtin_functions);
+    pthread_mutex_lock(&natives_lock);
+    NativeFunctionEntry *entry = add_native_function(name, function, VALUE_TYPE_UNKNOWN, PURITY_IMPURE, params, num_params);
+    pthread_mutex_unlock(&natives_lock);
+    return entry != NULL;
+}
+
+// 名前からネイティブ関数を探す (見つからなければ NULL)
+const NativeFunctionEntry *find_native_function(const char *name, unsigned int hash) {
+    pthread_once(&builtins_once, register_builtin_functions);
+    pthread_mutex_lock(&natives_lock);
+    const NativeFunctionEntry *entry = lookup_native_function(name, hash);
+    pthread_mutex_unlock(&natives_lock);
+    return entry;
+}
+
+// エラーメッセージ用の型の呼び名
+static const char *describe_type_mask(unsigned int types) {
+    if (types == (VALUE_TYPE_MASK(VALUE_TYPE_INT) | VALUE_TYPE_MASK(VALUE_TYPE_DOUBLE))) {
+        return "数値";
+    }
+    if (types == VALUE_TYPE_MASK(VALUE_TYPE_INT)) {
+        return "整数";
+    }
+    if (types == VALUE_TYPE_MASK(VALUE_TYPE_DOUBLE)) {
+        return "浮動小数点数";
+    }
+    if (types == VALUE_TYPE_MASK(VALUE_TYPE_STR)) {
+        return "文字列";
+    }
+    if (types == VALUE_TYPE_MASK(VALUE_TYPE_BOOL)) {
+        return "真偽値";
+    }
+    if (types == NUMERIC_ARRAY_TYPES) {
+        return "配列";
+    }
+    if (types == VALUE_TYPE_MASK(VALUE_TYPE_MAT)) {
+        return "行列";
+    }
+    if (types == VALUE_TYPE_MASK(VALUE_TYPE_FUNCTION)) {
+        return "関数";
+    }
+    if (types == VALUE_TYPE_MASK(VALUE_TYPE_FUTURE)) {
+        return "future";
+    }
+    return "値";
+}
+
+// 型検査 (エラー) と実行時 (実行時エラー) で共通のメッセージを報告する
+static void report_native_error(bool at_runtime, int line, const char *message) {
+    if (at_runtime) {
+        runtime_error(line, "%s", message);
+    }
+    compile_error(line, "%s", message);
+}
+
+static void report_native_arity_error(bool at_runtime, int line, const NativeFunctionEntry *native) {
+    char message[512];
+    int length = snprintf(message, sizeof(message), "'%s' 関数は%dつの引数 (", native->name, native->num_params);
+    for (int i = 0; i < native->num_params && length < (int)sizeof(message); i++) {
+        length += snprintf(message + length, sizeof(message) - length, "%s%s", (i > 0) ? ", " : "", native->params[i].name);
+    }
+    if (length < (int)sizeof(message)) {
+        snprintf(message + length, sizeof(message) - length, ") を取ります。");
+    }
+    report_native_error(at_runtime, line, message);
+}
+
+static void report_native_type_error(bool at_runtime, int line, const NativeFunctionEntry *native) {
+    char message[512];
+    int length = snprintf(message, sizeof(message), "'%s' 関数の引数の型が不正です。%s(", native->name, native->name);
+    for (int i = 0; i < native->num_params && length < (int)sizeof(message); i++) {
+        length += snprintf(message + length, sizeof(message) - length, "%s%s", (i > 0) ? ", " : "", describe_type_mask(native->params[i].types));
+    }
+    if (length < (int)sizeof(message)) {
+        snprintf(message + length, sizeof(message) - length, ") が期待されます。");
+    }
+    report_native_error(at_runtime, line, message);
+}
+
+// 型検査: 静的に分かっている引数の型を検査する (VALUE_TYPE_UNKNOWN の引数は実行時に検査する)
+void check_native_call(const NativeFunctionEntry *native, int line, int num_args, const ValueType *arg_types) {
+    if (num_args != native->num_params) {
+        report_native_arity_error(false, line, native);
+    }
+    for (int i = 0; i < num_args; i++) {
+        if (arg_types[i] != VALUE_TYPE_UNKNOWN && (VALUE_TYPE_MASK(arg_types[i]) & native->params[i].types) == 0) {
+            report_native_type_error(false, line, native);
+        }
+    }
+}
+
+// リゾルバが結び付けたネイティブ関数を呼び出す
+// 引数の個数と型はここで検査するので、ネイティブ関数は宣言どおりの引数を受け取る前提で書ける。
+// 型検査で確認済みの呼び出し (checked) は検査を省く。
+Value call_native_function(const NativeFunctionEntry *native, ASTNode *node, Environment *env) {
+    int num_args = node->data.func_call.num_arguments;
+    bool checked = node->data.func_call.checked;
+    if (!checked && num_args != native->num_params) {
+        report_native_arity_error(true, node->line, native);
+    }
+
+    // 引数は呼び出しが終わるまで値スタックに積んでおく (評価や呼び出しが実行時エラーで
+    // 打ち切られても値スタックと一緒に解放される)。関数には値を写した配列を渡す。
+    ExecState *state = env->state;
+    int base = state->stack_top;
+    Value args[NATIVE_MAX_PARAMS];
+    for (int i = 0; i < num_args; i++) {
+        args[i] = interpret_node(node->data.func_call.arguments[i], env);
+        push_temporary(state, args[i]);
+    }
+    if (!checked) {
+        for (int i = 0; i < num_args; i++) {
+            if ((VALUE_TYPE_MASK(VAL_TYPE(args[i])) & native->params[i].types) == 0) {
+                report_native_type_error(true, node->line, native);
+            }
+        }
+    }
+
+    // parallel_map は関数を呼び出すので、呼び出し元の実行状態 (グローバルスコープ) を渡す
+    Value result = native->maps_function
+        ? parallel_map(args[0], args[1], state, node->line)
+        : native->function(args, num_args, node->line);
+    state->stack_top = base;
+    for (int i = 0; i < num_args; i++) {
+        free_value_data(args[i]); // 引数は呼び出し側が所有する
+    }
+    return result;
+}
@@ -0,0 +1,378 @@
+#include "kappok.h"
+
+// コンパイル時評価
+// 型検査の後、main を実行する前に、値が定数だけで決まる式をロード時に評価してリテラルに置き換える。
+//   - const 宣言の初期化式は必ず評価する。評価できない式と、評価がステップ数の上限を超える式は
+//     エラーにし、評価中の実行時エラーは元の式の行番号で報告される。
+//   - それ以外の式は、失敗しないことが分かっている場合 (PURITY_TOTAL) だけ評価する。
+//     評価に失敗し得る式をロード時に評価すると、それより前の print の出力が失われるため。
+//     評価がステップ数の上限を超えたら打ち切り、式は実行時に評価する (ロードに時間をかけすぎないように)。
+
+static Purity min_purity(Purity a, Purity b) {
+    return (a < b) ? a : b;
+}
+
+// 0 でない数値リテラルか (除算が失敗しない)
+static bool is_nonzero_literal(const ASTNode *node) {
+    return (node->type == NODE_NUMBER_LITERAL && node->data.number_literal.value != 0)
+        || (node->type == NODE_FLOAT_LITERAL && node->data.float_literal.value != 0.0);
+}
+
+// 式の純粋性 (自動並列化がタスクにする呼び出しの引数を調べるのにも使う)
+Purity expression_purity(const ASTNode *node) {
+    if (node == NULL) {
+        return PURITY_TOTAL;
+    }
+    switch (node->type) {
+        case NODE_NUMBER_LITERAL:
+        case NODE_FLOAT_LITERAL:
+        case NODE_STRING_LITERAL:
+        case NODE_IDENTIFIER_EXPR: // 宣言済みであることは型検査で確認済み
+            return PURITY_TOTAL;
+        case NODE_CONVERT:
+            return expression_purity(node->data.convert.operand);
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_CONCAT:
+            return min_purity(expression_purity(node->data.binary_expr.left), expression_purity(node->data.binary_expr.right));
+        case NODE_DIVIDE_INT:
+        case NODE_DIVIDE_DOUBLE: {
+            Purity purity = min_purity(expression_purity(node->data.binary_expr.left), expression_purity(node->data.binary_expr.right));
+            return is_nonzero_literal(node->data.binary_expr.right) ? purity : min_purity(purity, PURITY_PURE);
+        }
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE: {
+            // 型が実行時に決まる演算は型エラーになり得る
+            Purity purity = min_purity(expression_purity(node->data.binary_expr.left), expression_purity(node->data.binary_expr.right));
+            return min_purity(purity, PURITY_PURE);
+        }
+        case NODE_ARRAY_LITERAL: {
+            Purity purity = PURITY_TOTAL;
+            for (int i = 0; i < node->data.array_literal.num_elements; i++) {
+                purity = min_purity(purity, expression_purity(node->data.array_literal.elements[i]));
+            }
+            // 要素の型が確定していなければ実行時に型エラーになり得る
+            return (node->data.array_literal.element_type != VALUE_TYPE_UNKNOWN) ? purity : min_purity(purity, PURITY_PURE);
+        }
+        case NODE_INDEX: {
+            // 添字は範囲外になり得る
+            Purity purity = min_purity(expression_purity(node->data.index_expr.target), expression_purity(node->data.index_expr.index));
+            purity = min_purity(purity, expression_purity(node->data.index_expr.column)); // 行列の列 (NULL なら影響しない)
+            return min_purity(purity, PURITY_PURE);
+        }
+        case NODE_FUNCTION_CALL: {
+            if (node->data.func_call.spawned) {
+                return PURITY_IMPURE; // 作ったタスクは join するまで結果が分からない
+            }
+            Purity purity = PURITY_TOTAL;
+            for (int i = 0; i < node->data.func_call.num_arguments; i++) {
+                purity = min_purity(purity, expression_purity(node->data.func_call.arguments[i]));
+            }
+            const NativeFunctionEntry *native = node->data.func_call.native;
+            if (native != NULL) {
+                purity = min_purity(purity, native->purity);
+            } else if (node->data.func_call.callee != NULL) {
+                purity = min_purity(purity, analyze_purity(node->data.func_call.callee));
+            } else {
+                return PURITY_IMPURE;
+            }
+            // 型検査で確認できなかった呼び出しは引数の検査で失敗し得る
+            return node->data.func_call.checked ? purity : min_purity(purity, PURITY_PURE);
+        }
+        case NODE_FORK:
+            return expression_purity(node->data.fork_expr.body);
+        default:
+            return PURITY_IMPURE;
+    }
+}
+
+static Purity statement_purity(const ASTNode *node) {
+    switch (node->type) {
+        case NODE_PRINT_STATEMENT:
+            return PURITY_IMPURE;
+        case NODE_RETURN_STATEMENT:
+            return expression_purity(node->data.return_stmt.value);
+        case NODE_VAR_DECLARATION: {
+            Purity purity = expression_purity(node->data.var_decl.initializer);
+            return node->data.var_decl.checked ? purity : min_purity(purity, PURITY_PURE);
+        }
+        case NODE_ASSIGNMENT: {
+            Purity purity = expression_purity(node->data.assignment.value);
+            return node->data.assignment.checked ? purity : min_purity(purity, PURITY_PURE);
+        }
+        case NODE_INDEX_ASSIGNMENT: {
+            // 書き換えるのは関数のローカル変数の配列だけ (共有されていれば複製される)。添字は範囲外になり得る
+            Purity purity = min_purity(expression_purity(node->data.index_assignment.index), expression_purity(node->data.index_assignment.value));
+            purity = min_purity(purity, expression_purity(node->data.index_assignment.column)); // 行列の列 (NULL なら影響しない)
+            return min_purity(purity, PURITY_PURE);
+        }
+        case NODE_YIELD:
+            return PURITY_IMPURE; // 値は呼び出し側に渡される
+        case NODE_FOR: {
+            if (node->data.for_stmt.iterable != NULL) {
+                return PURITY_IMPURE; // ジェネレータの本体はループの中で少しずつ実行される
+            }
+            // 範囲は有限なので、本体が失敗しなければループも失敗しない
+            Purity purity = min_purity(expression_purity(node->data.for_stmt.start), expression_purity(node->data.for_stmt.end));
+            if (!node->data.for_stmt.checked) {
+                purity = min_purity(purity, PURITY_PURE); // 範囲の型は実行時に検査する
+            }
+            const ASTNode *body = node->data.for_stmt.body;
+            for (int i = 0; i < body->data.block.num_statements && purity != PURITY_IMPURE; i++) {
+                purity = min_purity(purity, statement_purity(body->data.block.statements[i]));
+            }
+            return purity;
+        }
+        case NODE_FORK:
+            return statement_purity(node->data.fork_expr.body);
+        default:
+            return expression_purity(node);
+    }
+}
+
+// 関数の純粋性を解析する (結果は関数定義に記録する)
+// 再帰する関数は分岐がないので必ず無限に再帰する。評価の対象にしないよう純粋でないものとして扱う。
+Purity analyze_purity(ASTNode *func_def) {
+    int state = func_def->data.func_def.purity;
+    if (state == PURITY_ANALYZING) {
+        return PURITY_IMPURE;
+    }
+    if (state != PURITY_UNKNOWN) {
+        return (Purity)state;
+    }
+    func_def->data.func_def.purity = PURITY_ANALYZING;
+
+    Purity purity = PURITY_TOTAL;
+    ASTNode *body = func_def->data.func_def.body;
+    for (int i = 0; i < body->data.block.num_statements && purity != PURITY_IMPURE; i++) {
+        purity = min_purity(purity, statement_purity(body->data.block.statements[i]));
+    }
+    func_def->data.func_def.purity = purity;
+    return purity;
+}
+
+// 関数本体の評価の状態
+typedef struct ConstScope {
+    ASTNode *func_def;
+    Environment *globals;
+    ASTNode **values; // スロットごとの const の値 (リテラルノード、NULL は定数でない)
+} ConstScope;
+
+// ノードを評価した値のリテラルに置き換える (リテラルで表せない値なら置き換えない)
+// 評価がステップ数の上限を超えたら置き換えない。required (const の初期化式) ならエラーにする。
+static bool replace_with_value(ASTNode **ref, ConstScope *scope, bool required) {
+    ASTNode *node = *ref;
+    Value value;
+    if (!evaluate_at_load(node, scope->globals, &value)) {
+        if (required) {
+            compile_error(node->line, "定数の初期化式の評価がロード時のステップ数の上限を超えました。");
+        }
+        return false;
+    }
+    ASTNode *literal = make_literal_node(value, node->line);
+    if (literal == NULL) {
+        return false;
+    }
+    destroy_ast(node);
+    *ref = literal;
+    return true;
+}
+
+// 式を葉から評価し、リテラルになったら true を返す
+// required が true (const の初期化式) なら、失敗し得る純粋な式も評価する。
+static bool fold_expression(ASTNode **ref, ConstScope *scope, bool required) {
+    ASTNode *node = *ref;
+    switch (node->type) {
+        case NODE_NUMBER_LITERAL:
+        case NODE_FLOAT_LITERAL:
+        case NODE_STRING_LITERAL:
+            return true;
+        case NODE_IDENTIFIER_EXPR: {
+            int slot = node->data.identifier_expr.slot;
+            if (slot < 0 || scope->values[slot] == NULL) {
+                return false;
+            }
+            *ref = clone_ast(scope->values[slot]);
+            destroy_ast(node);
+            return true;
+        }
+        case NODE_CONVERT:
+            if (!fold_expression(&node->data.convert.operand, scope, required)) {
+                return false;
+            }
+            return is_literal_node(node) || replace_with_value(ref, scope, required);
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE:
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_DIVIDE_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE:
+        case NODE_CONCAT: {
+            bool left = fold_expression(&node->data.binary_expr.left, scope, required);
+            bool right = fold_expression(&node->data.binary_expr.right, scope, required);
+            if (!left || !right || (!required && expression_purity(node) != PURITY_TOTAL)) {
+                return false;
+            }
+            return replace_with_value(ref, scope, required);
+        }
+        case NODE_ARRAY_LITERAL: {
+            // 要素が全て定数なら、配列リテラルはそのまま定数として扱う
+            bool constant_elements = true;
+            for (int i = 0; i < node->data.array_literal.num_elements; i++) {
+                constant_elements = fold_expression(&node->data.array_literal.elements[i], scope, required) && constant_elements;
+            }
+            return constant_elements;
+        }
+        case NODE_FUNCTION_CALL: {
+            bool constant_args = true;
+            for (int i = 0; i < node->data.func_call.num_arguments; i++) {
+                constant_args = fold_expression(&node->data.func_call.arguments[i], scope, required) && constant_args;
+            }
+            if (!constant_args) {
+                return false;
+            }
+            Purity purity = expression_purity(node);
+            if (purity == PURITY_IMPURE || (!required && purity != PURITY_TOTAL)) {
+                return false;
+            }
+            return replace_with_value(ref, scope, required);
+        }
+        default:
+            return false;
+    }
+}
+
+static void fold_statement(ASTNode **ref, ConstScope *scope);
+
+// ループの本体 (入れ子のループを含む) で宣言・代入される変数を定数でないものとして扱う
+// (本体は何度でも実行され得るので、宣言の位置の値がループの他の箇所でも成り立つとは限らない)
+static void forget_loop_values(const ASTNode *body, ConstScope *scope) {
+    for (int i = 0; i < body->data.block.num_statements; i++) {
+        const ASTNode *statement = body->data.block.statements[i];
+        if (statement->type == NODE_VAR_DECLARATION && statement->data.var_decl.slot >= 0) {
+            scope->values[statement->data.var_decl.slot] = NULL;
+        } else if (statement->type == NODE_ASSIGNMENT && statement->data.assignment.slot >= 0) {
+            scope->values[statement->data.assignment.slot] = NULL;
+        } else if (statement->type == NODE_FOR) {
+            scope->values[statement->data.for_stmt.slot] = NULL;
+            forget_loop_values(statement->data.for_stmt.body, scope);
+        }
+    }
+}
+
+static void fold_statement(ASTNode **ref, ConstScope *scope) {
+    ASTNode *statement = *ref;
+    switch (statement->type) {
+        case NODE_RETURN_STATEMENT:
+            fold_expression(&statement->data.return_stmt.value, scope, false);
+            break;
+        case NODE_YIELD:
+            fold_expression(&statement->data.yield_stmt.value, scope, false);
+            break;
+        case NODE_PRINT_STATEMENT:
+            for (int j = 0; j < statement->data.print_stmt.num_arguments; j++) {
+                fold_expression(&statement->data.print_stmt.arguments[j], scope, false);
+            }
+            break;
+        case NODE_VAR_DECLARATION: {
+            bool is_const = statement->data.var_decl.is_const;
+            bool constant = fold_expression(&statement->data.var_decl.initializer, scope, is_const);
+            if (is_const && !constant) {
+                compile_error(statement->line, "定数 '%s' の初期化式はコンパイル時に評価できません。",
+                        statement->data.var_decl.name);
+            }
+            // 配列の定数は使う箇所に複製せず、変数のまま一つの配列を共有する
+            ASTNode *initializer = statement->data.var_decl.initializer;
+            int slot = statement->data.var_decl.slot;
+            if (slot >= 0) {
+                scope->values[slot] = (is_const && initializer->type != NODE_ARRAY_LITERAL) ? initializer : NULL;
+            }
+            break;
+        }
+        case NODE_ASSIGNMENT:
+            fold_expression(&statement->data.assignment.value, scope, false);
+            if (statement->data.assignment.slot >= 0) {
+                scope->values[statement->data.assignment.slot] = NULL;
+            }
+            break;
+        case NODE_INDEX_ASSIGNMENT:
+            fold_expression(&statement->data.index_assignment.index, scope, false);
+            if (statement->data.index_assignment.column != NULL) {
+                fold_expression(&statement->data.index_assignment.column, scope, false);
+            }
+            fold_expression(&statement->data.index_assignment.value, scope, false);
+            break;
+        case NODE_FOR: {
+            if (statement->data.for_stmt.iterable != NULL) {
+                fold_expression(&statement->data.for_stmt.iterable, scope, false);
+            } else {
+                fold_expression(&statement->data.for_stmt.start, scope, false);
+                fold_expression(&statement->data.for_stmt.end, scope, false);
+            }
+            ASTNode *body = statement->data.for_stmt.body;
+            scope->values[statement->data.for_stmt.slot] = NULL;
+            forget_loop_values(body, scope);
+            for (int j = 0; j < body->data.block.num_statements; j++) {
+                fold_statement(&body->data.block.statements[j], scope);
+            }
+            forget_loop_values(body, scope); // 本体が実行されたかどうかはループの後では分からない
+            break;
+        }
+        default:
+            fold_expression(ref, scope, false);
+            break;
+    }
+}
+
+static void fold_body(void *arg) {
+    ConstScope *scope = arg;
+    ASTNode *body = scope->func_def->data.func_def.body;
+    for (int i = 0; i < body->data.block.num_statements; i++) {
+        fold_statement(&body->data.block.statements[i], scope);
+    }
+}
+
+// 関数本体の定数式を評価する
+// const の初期化式のエラーは、定数の表を解放してから呼び出し側の戻り先へ報告し直す。
+static void fold_function(ASTNode *func_def, Environment *globals) {
+    ConstScope scope;
+    scope.func_def = func_def;
+    scope.globals = globals;
+    int frame_size = func_def->data.func_def.frame_size;
+    scope.values = calloc(frame_size > 0 ? frame_size : 1, sizeof(ASTNode *));
+    if (scope.values == NULL) {
+        perror("Failed to allocate constant table");
+        exit(EXIT_FAILURE);
+    }
+
+    char *message = run_trapping_errors(fold_body, &scope);
+    free(scope.values);
+    if (message != NULL) {
+        raise_error_message(message);
+    }
+}
+
+// 全ての関数の定数式を評価する (型検査の後、main の実行前に呼ぶ)
+void evaluate_constants(ASTNode *program_node, Environment *globals) {
+    if (program_node == NULL || program_node->type != NODE_PROGRAM) {
+        return;
+    }
+    for (int i = 0; i < program_node->data.program.num_statements; i++) {
+        ASTNode *statement = program_node->data.program.statements[i];
+        if (statement->type == NODE_FUNCTION_DEFINITION) {
+            fold_function(statement, globals);
+        }
+    }
+}
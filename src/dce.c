@@ -0,0 +1,391 @@
+#include "kappok.h"
+
+// 不要コードの除去
+// 実行されることのないコードは型検査の前に取り除く:
+//   - main から呼び出し (または参照) をたどって到達しない関数
+//   - return より後の文 (関数本体は分岐を持たないので return は必ず実行される)
+// 型検査の後には、読まれることのない値を書き込むだけの宣言と代入 (不要な書き込み) を取り除く。
+
+// 到達可能性の解析の状態
+typedef struct Reachability {
+    Environment *functions; // 関数名 → 最初の定義の添字 (int値として保存)
+    bool *reachable;        // 添字ごとの到達可能フラグ
+    int *worklist;          // 本体を未走査の関数の添字
+    int num_pending;
+} Reachability;
+
+// 名前の関数を到達可能にし、未走査なら作業リストに積む
+static void mark_function(Reachability *reach, const char *name, unsigned int hash) {
+    SymbolEntry *entry = get_local_symbol_hashed(reach->functions, name, hash);
+    if (entry == NULL) {
+        return; // 未定義の関数は型検査 (または実行時) に報告される
+    }
+    int index = (int)AS_INT(entry->value);
+    if (!reach->reachable[index]) {
+        reach->reachable[index] = true;
+        reach->worklist[reach->num_pending++] = index;
+    }
+}
+
+// 部分木から参照されるユーザー定義関数をたどる
+static void collect_references(ASTNode *node, Reachability *reach) {
+    if (node == NULL) {
+        return;
+    }
+
+    switch (node->type) {
+        case NODE_BLOCK:
+            for (int i = 0; i < node->data.block.num_statements; i++) {
+                collect_references(node->data.block.statements[i], reach);
+            }
+            break;
+        case NODE_RETURN_STATEMENT:
+            collect_references(node->data.return_stmt.value, reach);
+            break;
+        case NODE_YIELD:
+            collect_references(node->data.yield_stmt.value, reach);
+            break;
+        case NODE_PRINT_STATEMENT:
+            for (int i = 0; i < node->data.print_stmt.num_arguments; i++) {
+                collect_references(node->data.print_stmt.arguments[i], reach);
+            }
+            break;
+        case NODE_FUNCTION_CALL:
+            if (node->data.func_call.native == NULL) {
+                mark_function(reach, node->data.func_call.function_name, node->data.func_call.name_hash);
+            }
+            for (int i = 0; i < node->data.func_call.num_arguments; i++) {
+                collect_references(node->data.func_call.arguments[i], reach);
+            }
+            break;
+        case NODE_VAR_DECLARATION:
+            collect_references(node->data.var_decl.initializer, reach);
+            break;
+        case NODE_ASSIGNMENT:
+            collect_references(node->data.assignment.value, reach);
+            break;
+        case NODE_INDEX_ASSIGNMENT:
+            collect_references(node->data.index_assignment.index, reach);
+            collect_references(node->data.index_assignment.column, reach);
+            collect_references(node->data.index_assignment.value, reach);
+            break;
+        case NODE_ARRAY_LITERAL:
+            for (int i = 0; i < node->data.array_literal.num_elements; i++) {
+                collect_references(node->data.array_literal.elements[i], reach);
+            }
+            break;
+        case NODE_INDEX:
+            collect_references(node->data.index_expr.target, reach);
+            collect_references(node->data.index_expr.index, reach);
+            collect_references(node->data.index_expr.column, reach);
+            break;
+        case NODE_FOR:
+            collect_references(node->data.for_stmt.start, reach);
+            collect_references(node->data.for_stmt.end, reach);
+            collect_references(node->data.for_stmt.iterable, reach);
+            collect_references(node->data.for_stmt.body, reach);
+            break;
+        case NODE_IDENTIFIER_EXPR:
+            if (node->data.identifier_expr.slot < 0) { // 関数を値として参照している
+                mark_function(reach, node->data.identifier_expr.name, node->data.identifier_expr.name_hash);
+            }
+            break;
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE:
+            collect_references(node->data.binary_expr.left, reach);
+            collect_references(node->data.binary_expr.right, reach);
+            break;
+        default:
+            break;
+    }
+}
+
+// ブロックの最初の return より後の文を取り除く
+static void truncate_after_return(ASTNode *block) {
+    int num_statements = block->data.block.num_statements;
+    for (int i = 0; i < num_statements; i++) {
+        if (block->data.block.statements[i]->type == NODE_RETURN_STATEMENT) {
+            for (int j = i + 1; j < num_statements; j++) {
+                destroy_ast(block->data.block.statements[j]);
+            }
+            block->data.block.num_statements = i + 1;
+            return;
+        }
+    }
+}
+
+// main から到達しない関数と return より後の文を取り除く (リゾルバの後、関数の登録前に呼ぶ)
+// 同名の関数が複数ある場合は、名前が到達可能なら全て残して重複定義のエラーを報告させる。
+void eliminate_unreachable_code(ASTNode *program_node) {
+    if (program_node == NULL || program_node->type != NODE_PROGRAM) {
+        return;
+    }
+    int num_statements = program_node->data.program.num_statements;
+    ASTNode **statements = program_node->data.program.statements;
+
+    Reachability reach;
+    reach.functions = create_environment(NULL);
+    reach.reachable = calloc(num_statements > 0 ? num_statements : 1, sizeof(bool));
+    reach.worklist = malloc(sizeof(int) * (num_statements > 0 ? num_statements : 1));
+    reach.num_pending = 0;
+    if (reach.reachable == NULL || reach.worklist == NULL) {
+        perror("Failed to allocate reachability state");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < num_statements; i++) {
+        ASTNode *statement = statements[i];
+        if (statement->type != NODE_FUNCTION_DEFINITION) {
+            continue;
+        }
+        const char *name = statement->data.func_def.name;
+        unsigned int hash = statement->data.func_def.name_hash;
+        if (get_local_symbol_hashed(reach.functions, name, hash) == NULL) {
+            define_symbol_hashed(reach.functions, name, hash, INT_VAL(i));
+        }
+    }
+
+    mark_function(&reach, "main", hash_symbol_name("main"));
+    while (reach.num_pending > 0) {
+        ASTNode *func_def = statements[reach.worklist[--reach.num_pending]];
+        collect_references(func_def->data.func_def.body, &reach);
+    }
+
+    // 到達しない関数を解放して文の並びを詰める
+    int kept = 0;
+    for (int i = 0; i < num_statements; i++) {
+        ASTNode *statement = statements[i];
+        if (statement->type == NODE_FUNCTION_DEFINITION) {
+            SymbolEntry *entry = get_local_symbol_hashed(reach.functions, statement->data.func_def.name, statement->data.func_def.name_hash);
+            if (!reach.reachable[AS_INT(entry->value)]) {
+                destroy_ast(statement);
+                continue;
+            }
+            truncate_after_return(statement->data.func_def.body);
+        }
+        statements[kept++] = statement;
+    }
+    program_node->data.program.num_statements = kept;
+
+    free(reach.reachable);
+    free(reach.worklist);
+    destroy_environment(reach.functions);
+}
+
+// --- 不要な書き込みの除去 ---
+
+// スロットに対する次のアクセス (文を後ろから走査して求める)
+typedef enum {
+    ACCESS_NONE,   // 以降アクセスされない
+    ACCESS_READ,   // 次に読まれる
+    ACCESS_ASSIGN, // 次に代入される (宣言済みであることが前提)
+    ACCESS_DECLARE // 次に再宣言される
+} SlotAccess;
+
+// 評価しても失敗も副作用もない式か (型検査済みの式だけを対象にする)
+bool is_pure_expression(const ASTNode *node) {
+    switch (node->type) {
+        case NODE_NUMBER_LITERAL:
+        case NODE_FLOAT_LITERAL:
+        case NODE_STRING_LITERAL:
+        case NODE_IDENTIFIER_EXPR: // 宣言済みであることは型検査で確認済み
+            return true;
+        case NODE_CONVERT:
+            return is_pure_expression(node->data.convert.operand);
+        case NODE_DIVIDE_INT:
+        case NODE_DIVIDE_DOUBLE: {
+            // 0 による除算は実行時エラーなので、除数が 0 でないリテラルの場合だけ
+            const ASTNode *right = node->data.binary_expr.right;
+            bool nonzero = (right->type == NODE_NUMBER_LITERAL && right->data.number_literal.value != 0)
+                || (right->type == NODE_FLOAT_LITERAL && right->data.float_literal.value != 0.0);
+            return nonzero && is_pure_expression(node->data.binary_expr.left);
+        }
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_CONCAT:
+            return is_pure_expression(node->data.binary_expr.left) && is_pure_expression(node->data.binary_expr.right);
+        default:
+            return false; // 関数呼び出しと型の確定していない演算
+    }
+}
+
+// 式が読むスロットを記録する
+static void mark_reads(const ASTNode *node, SlotAccess *access) {
+    if (node == NULL) {
+        return;
+    }
+
+    switch (node->type) {
+        case NODE_IDENTIFIER_EXPR:
+            if (node->data.identifier_expr.slot >= 0) {
+                access[node->data.identifier_expr.slot] = ACCESS_READ;
+            }
+            break;
+        case NODE_RETURN_STATEMENT:
+            mark_reads(node->data.return_stmt.value, access);
+            break;
+        case NODE_YIELD:
+            mark_reads(node->data.yield_stmt.value, access);
+            break;
+        case NODE_PRINT_STATEMENT:
+            for (int i = 0; i < node->data.print_stmt.num_arguments; i++) {
+                mark_reads(node->data.print_stmt.arguments[i], access);
+            }
+            break;
+        case NODE_FUNCTION_CALL:
+            for (int i = 0; i < node->data.func_call.num_arguments; i++) {
+                mark_reads(node->data.func_call.arguments[i], access);
+            }
+            break;
+        case NODE_CONVERT:
+            mark_reads(node->data.convert.operand, access);
+            break;
+        case NODE_INDEX_ASSIGNMENT:
+            // 要素への代入は配列の他の要素を残すので、変数を読むのと同じ扱いにする
+            if (node->data.index_assignment.slot >= 0) {
+                access[node->data.index_assignment.slot] = ACCESS_READ;
+            }
+            mark_reads(node->data.index_assignment.index, access);
+            mark_reads(node->data.index_assignment.column, access);
+            mark_reads(node->data.index_assignment.value, access);
+            break;
+        case NODE_ARRAY_LITERAL:
+            for (int i = 0; i < node->data.array_literal.num_elements; i++) {
+                mark_reads(node->data.array_literal.elements[i], access);
+            }
+            break;
+        case NODE_INDEX:
+            mark_reads(node->data.index_expr.target, access);
+            mark_reads(node->data.index_expr.index, access);
+            mark_reads(node->data.index_expr.column, access);
+            break;
+        case NODE_FOR: {
+            // 本体は何度 (0回も含む) 実行されるか分からないので、本体で宣言・代入される変数も
+            // 読まれるものとして扱い、ループの前の書き込みを残す
+            mark_reads(node->data.for_stmt.start, access);
+            mark_reads(node->data.for_stmt.end, access);
+            mark_reads(node->data.for_stmt.iterable, access);
+            access[node->data.for_stmt.slot] = ACCESS_READ;
+            const ASTNode *body = node->data.for_stmt.body;
+            for (int i = 0; i < body->data.block.num_statements; i++) {
+                const ASTNode *statement = body->data.block.statements[i];
+                if (statement->type == NODE_VAR_DECLARATION) {
+                    if (statement->data.var_decl.slot >= 0) {
+                        access[statement->data.var_decl.slot] = ACCESS_READ;
+                    }
+                    mark_reads(statement->data.var_decl.initializer, access);
+                } else if (statement->type == NODE_ASSIGNMENT) {
+                    if (statement->data.assignment.slot >= 0) {
+                        access[statement->data.assignment.slot] = ACCESS_READ;
+                    }
+                    mark_reads(statement->data.assignment.value, access);
+                } else {
+                    mark_reads(statement, access);
+                }
+            }
+            break;
+        }
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE:
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_DIVIDE_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE:
+        case NODE_CONCAT:
+            mark_reads(node->data.binary_expr.left, access);
+            mark_reads(node->data.binary_expr.right, access);
+            break;
+        default:
+            break;
+    }
+}
+
+// 文が不要な書き込みなら true
+// 宣言は後で代入されるなら残す (代入は宣言済みの変数にしかできない)。
+static bool is_dead_store(const ASTNode *statement, const SlotAccess *access) {
+    if (statement->type == NODE_VAR_DECLARATION) {
+        int slot = statement->data.var_decl.slot;
+        return slot >= 0 && statement->data.var_decl.checked
+            && (access[slot] == ACCESS_NONE || access[slot] == ACCESS_DECLARE)
+            && is_pure_expression(statement->data.var_decl.initializer);
+    }
+    if (statement->type == NODE_ASSIGNMENT) {
+        int slot = statement->data.assignment.slot;
+        return slot >= 0 && statement->data.assignment.checked
+            && access[slot] != ACCESS_READ
+            && is_pure_expression(statement->data.assignment.value);
+    }
+    return false;
+}
+
+static void eliminate_dead_stores_in_function(ASTNode *func_def) {
+    ASTNode *body = func_def->data.func_def.body;
+    int num_statements = body->data.block.num_statements;
+    if (num_statements < 2) {
+        return;
+    }
+    int frame_size = func_def->data.func_def.frame_size;
+    SlotAccess *access = calloc(frame_size > 0 ? frame_size : 1, sizeof(SlotAccess)); // ACCESS_NONE
+    if (access == NULL) {
+        perror("Failed to allocate slot access table");
+        exit(EXIT_FAILURE);
+    }
+
+    // 後ろから走査する。最後の文は関数の結果になるので残す。
+    ASTNode **statements = body->data.block.statements;
+    for (int i = num_statements - 1; i >= 0; i--) {
+        ASTNode *statement = statements[i];
+        if (i < num_statements - 1 && is_dead_store(statement, access)) {
+            destroy_ast(statement);
+            statements[i] = NULL;
+            continue;
+        }
+        if (statement->type == NODE_VAR_DECLARATION) {
+            if (statement->data.var_decl.slot >= 0) {
+                access[statement->data.var_decl.slot] = ACCESS_DECLARE;
+            }
+            mark_reads(statement->data.var_decl.initializer, access);
+        } else if (statement->type == NODE_ASSIGNMENT) {
+            if (statement->data.assignment.slot >= 0) {
+                access[statement->data.assignment.slot] = ACCESS_ASSIGN;
+            }
+            mark_reads(statement->data.assignment.value, access);
+        } else {
+            mark_reads(statement, access);
+        }
+    }
+    free(access);
+
+    int kept = 0;
+    for (int i = 0; i < num_statements; i++) {
+        if (statements[i] != NULL) {
+            statements[kept++] = statements[i];
+        }
+    }
+    body->data.block.num_statements = kept;
+}
+
+// 型検査済みの全ての関数から不要な書き込みを取り除く (main の実行前に呼ぶ)
+void eliminate_dead_stores(ASTNode *program_node) {
+    if (program_node == NULL || program_node->type != NODE_PROGRAM) {
+        return;
+    }
+    for (int i = 0; i < program_node->data.program.num_statements; i++) {
+        ASTNode *statement = program_node->data.program.statements[i];
+        if (statement->type == NODE_FUNCTION_DEFINITION) {
+            eliminate_dead_stores_in_function(statement);
+        }
+    }
+}
@@ -0,0 +1,394 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS / MAP_NORESERVE
+#include "kappok.h"
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#endif
+#if defined(__SANITIZE_THREAD__)
+#include <sanitizer/tsan_interface.h>
+#endif
+
+// ジェネレータ (yield を含む関数)
+// 本体はそれぞれ自分の C スタックを持つコルーチンとして実行する。for が次の値を求めると
+// 本体のスタックへ切り替え、本体が yield すると値を置いて for のスタックへ戻る。
+// スレッドは使わず、切り替えは呼び出し先保存レジスタとスタックポインタを入れ替えるだけ
+// (x86-64 は手書きのアセンブリ、それ以外は ucontext)。
+//
+// 本体の値は全て自分の値スタック (exec) に置き、yield で止まっている間 C の変数に値を持たない。
+// 最後まで回されずに捨てられたジェネレータは、値スタックを解放してスタックを再利用に回すだけで
+// 片付けられる (止まっている C のフレームは巻き戻さない)。
+//
+// ジェネレータは値として共有できるが、同時に回せるのは一つのスレッドだけ。止まっている
+// ジェネレータは別のスレッドから再開してよいので、本体の側では切り替えをまたいで
+// スレッドローカル変数を使わない。
+
+#define GENERATOR_STACK_SIZE (1024 * 1024) // 本体の C スタック (仮想的に確保し、触ったページだけが使われる)
+#define GENERATOR_STACK_RESERVE (256 * 1024) // 本体の呼び出しの深さの上限に達した後に残すスタック
+#define GENERATOR_STACK_CACHE 16          // スレッドごとに取っておく使い終わったスタックの数
+
+typedef enum {
+    GENERATOR_CREATED,   // 本体をまだ始めていない
+    GENERATOR_SUSPENDED, // yield で止まっている
+    GENERATOR_RUNNING,   // どこかのスレッドが本体を実行中
+    GENERATOR_FINISHED   // 本体が終わった (実行時エラーで打ち切られた場合を含む)
+} GeneratorStatus;
+
+// --- コンテキストの切り替え ---
+
+#if defined(__x86_64__) && defined(__ELF__)
+// 呼び出し先保存レジスタ (rbp, rbx, r12-r15) と MXCSR・x87 制御ワードを今のスタックに積み、
+// スタックポインタを *save_sp に保存して resume_sp のスタックから同じ形で戻す。
+typedef struct {
+    void *sp;
+} CoroutineContext;
+
+void kappok_coroutine_switch(void **save_sp, void *resume_sp);
+void kappok_coroutine_start(void);
+
+__asm__(
+    ".text\n"
+    ".globl kappok_coroutine_switch\n"
+    ".type kappok_coroutine_switch, @function\n"
+    "kappok_coroutine_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size kappok_coroutine_switch, .-kappok_coroutine_switch\n"
+    // 新しいスタックで最初に戻る先: r13 の関数を r12 を引数にして呼ぶ (戻ってはこない)
+    ".globl kappok_coroutine_start\n"
+    ".type kappok_coroutine_start, @function\n"
+    "kappok_coroutine_start:\n"
+    "    movq %r12, %rdi\n"
+    "    callq *%r13\n"
+    "    ud2\n"
+    ".size kappok_coroutine_start, .-kappok_coroutine_start\n"
+);
+
+// スタックの上端に、kappok_coroutine_switch が戻ると entry(arg) を始める初期フレームを作る
+static void context_init(CoroutineContext *context, char *stack, size_t size, void (*entry)(void *), void *arg) {
+    uintptr_t top = ((uintptr_t)(stack + size)) & ~(uintptr_t)15;
+    uint64_t *frame = (uint64_t *)(top - 80); // 戻った後の rsp (frame + 8 語) が 16 バイト境界になる
+    uint32_t control = 0x1F80;                 // MXCSR の既定値
+    uint16_t fpu_control = 0x037F;             // x87 制御ワードの既定値
+    memcpy(&frame[0], &control, sizeof(control));
+    memcpy((char *)&frame[0] + 4, &fpu_control, sizeof(fpu_control));
+    frame[1] = 0;                    // r15
+    frame[2] = 0;                    // r14
+    frame[3] = (uint64_t)(uintptr_t)entry; // r13
+    frame[4] = (uint64_t)(uintptr_t)arg;   // r12
+    frame[5] = 0;                    // rbx
+    frame[6] = 0;                    // rbp
+    frame[7] = (uint64_t)(uintptr_t)kappok_coroutine_start;
+    context->sp = frame;
+}
+
+static void context_switch(CoroutineContext *from, CoroutineContext *to) {
+    kappok_coroutine_switch(&from->sp, to->sp);
+}
+#else
+#include <ucontext.h>
+
+typedef struct {
+    ucontext_t context;
+} CoroutineContext;
+
+static void generator_entry(void *arg);
+
+// makecontext は int の引数しか渡せないので、ポインタを上位と下位に分けて渡す
+static void context_start(unsigned int high, unsigned int low) {
+    uintptr_t arg = ((uintptr_t)high << 16 << 16) | (uintptr_t)low;
+    generator_entry((void *)arg);
+}
+
+static void context_init(CoroutineContext *context, char *stack, size_t size, void (*entry)(void *), void *arg) {
+    (void)entry; // 始める関数は generator_entry だけ
+    if (getcontext(&context->context) != 0) {
+        perror("Failed to initialize generator context");
+        exit(EXIT_FAILURE);
+    }
+    context->context.uc_stack.ss_sp = stack;
+    context->context.uc_stack.ss_size = size;
+    context->context.uc_link = NULL;
+    uintptr_t value = (uintptr_t)arg;
+    makecontext(&context->context, (void (*)(void))context_start, 2,
+            (unsigned int)(value >> 16 >> 16), (unsigned int)(value & 0xFFFFFFFFu));
+}
+
+static void context_switch(CoroutineContext *from, CoroutineContext *to) {
+    swapcontext(&from->context, &to->context);
+}
+#endif
+
+struct KGenerator {
+    unsigned int refcount;      // 値が増えるたびに増える (別のスレッドからも増減する)
+    int status;                 // GeneratorStatus (実行権は CAS で取る)
+    ASTNode *func_def;
+    int line;                   // ジェネレータ関数を呼び出した行
+    Value *args;                // 本体を始めるまで持っておく引数
+    int num_args;
+    ExecState exec;             // 本体の値スタック
+    Value yielded;              // yield された値 (消費者に渡すまで)
+    bool finished;              // 本体が終わった (本体の側が立て、消費者が status に反映する)
+    char *error;                // 本体を打ち切った実行時エラーのメッセージ
+    TaskFailure *trap;          // 止まっている本体の実行時エラーの戻り先
+    char *stack;                // 本体の C スタック (先頭はガードページ)
+    CoroutineContext body;      // 止まっている本体
+    CoroutineContext consumer;  // 本体を再開した側
+#if defined(__SANITIZE_ADDRESS__)
+    void *body_fake_stack;
+    const void *consumer_bottom; // 再開した側のスタック (本体から戻るときに ASan に教える)
+    size_t consumer_size;
+#endif
+#if defined(__SANITIZE_THREAD__)
+    void *body_fiber;
+    void *consumer_fiber;
+#endif
+};
+
+// --- スタック ---
+// mmap した領域の先頭 1 ページをガードページにして、溢れたら書き込まずにすぐ落ちるようにする。
+// 使い終わったスタックはスレッドごとに少しだけ取っておき、次のジェネレータで使い回す。
+
+static __thread char *stack_cache[GENERATOR_STACK_CACHE];
+static __thread int num_cached_stacks = 0;
+
+static size_t guard_size(void) {
+    long page = sysconf(_SC_PAGESIZE);
+    return (page > 0) ? (size_t)page : 4096;
+}
+
+static char *acquire_stack(void) {
+    if (num_cached_stacks > 0) {
+        return stack_cache[--num_cached_stacks];
+    }
+    size_t guard = guard_size();
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+#ifdef MAP_STACK
+    flags |= MAP_STACK;
+#endif
+    char *stack = mmap(NULL, guard + GENERATOR_STACK_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (stack == MAP_FAILED) {
+        perror("Failed to allocate generator stack");
+        exit(EXIT_FAILURE);
+    }
+    if (mprotect(stack, guard, PROT_NONE) != 0) {
+        perror("Failed to protect generator stack");
+        exit(EXIT_FAILURE);
+    }
+    return stack;
+}
+
+static void release_stack(char *stack) {
+#if defined(__SANITIZE_ADDRESS__)
+    // 巻き戻さずに捨てたフレームの毒を消しておく
+    ASAN_UNPOISON_MEMORY_REGION(stack + guard_size(), GENERATOR_STACK_SIZE);
+#endif
+    if (num_cached_stacks < GENERATOR_STACK_CACHE) {
+        stack_cache[num_cached_stacks++] = stack;
+        return;
+    }
+    munmap(stack, guard_size() + GENERATOR_STACK_SIZE);
+}
+
+// --- 本体 ---
+
+// 本体の側から再開した側へ戻る (last なら本体は二度と再開されない)
+static void switch_to_consumer(KGenerator *generator, bool last) {
+#if defined(__SANITIZE_ADDRESS__)
+    __sanitizer_start_switch_fiber(last ? NULL : &generator->body_fake_stack,
+            generator->consumer_bottom, generator->consumer_size);
+#else
+    (void)last;
+#endif
+#if defined(__SANITIZE_THREAD__)
+    __tsan_switch_to_fiber(generator->consumer_fiber, 0);
+#endif
+    context_switch(&generator->body, &generator->consumer);
+#if defined(__SANITIZE_ADDRESS__)
+    __sanitizer_finish_switch_fiber(generator->body_fake_stack, &generator->consumer_bottom, &generator->consumer_size);
+#endif
+}
+
+static void run_generator_body(void *arg) {
+    KGenerator *generator = arg;
+    // 引数の参照は本体のフレームに移る (型は呼び出したときに変換済み)
+    free_value_data(enter_function(generator->func_def, generator->args, generator->num_args, &generator->exec, generator->line));
+}
+
+// 本体のスタックで最初に実行する関数 (戻らない)
+static void generator_entry(void *arg) {
+    KGenerator *generator = arg;
+#if defined(__SANITIZE_ADDRESS__)
+    __sanitizer_finish_switch_fiber(NULL, &generator->consumer_bottom, &generator->consumer_size);
+#endif
+    generator->error = run_trapping_errors(run_generator_body, generator);
+    free(generator->args);
+    generator->args = NULL;
+    generator->finished = true;
+    switch_to_consumer(generator, true);
+    abort(); // 終わった本体は再開されない
+}
+
+// yield: 値を消費者に渡し、次の値を求められるまで止まる (値の参照を受け取る)
+void generator_yield(ExecState *state, Value value) {
+    KGenerator *generator = state->generator;
+    generator->yielded = value;
+    switch_to_consumer(generator, false);
+}
+
+// --- 消費者の側 ---
+
+// ジェネレータを作る (引数の配列の所有権と、宣言型に変換済みの引数の参照を受け取る)
+Value generator_new(ASTNode *func_def, Value *args, int num_args, int line) {
+    KGenerator *generator = malloc(sizeof(KGenerator));
+    if (generator == NULL) {
+        perror("Failed to allocate generator");
+        exit(EXIT_FAILURE);
+    }
+    generator->refcount = 1;
+    generator->status = GENERATOR_CREATED;
+    generator->func_def = func_def;
+    generator->line = line;
+    generator->args = args;
+    generator->num_args = num_args;
+    generator->exec.stack = NULL;
+    generator->exec.stack_top = 0;
+    generator->exec.stack_capacity = 0;
+    generator->exec.globals = NULL;
+    generator->exec.out = NULL;
+    generator->exec.load_budget = NULL;
+    generator->exec.generator = generator;
+    generator->exec.tasks = NULL;
+    generator->yielded = VOID_VAL;
+    generator->finished = false;
+    generator->error = NULL;
+    generator->trap = NULL;
+    generator->stack = NULL;
+    return GENERATOR_VAL(generator);
+}
+
+// 本体の値スタックと C スタックを手放す
+// (エラーで打ち切られたり途中で捨てられたりした本体のフレームの値もここで解放する)
+static void discard_body(KGenerator *generator) {
+    for (int i = 0; i < generator->exec.stack_top; i++) {
+        free_value_data(generator->exec.stack[i]);
+    }
+    free(generator->args); // 止まったまま捨てられた本体なら、値はフレームに移った後の配列だけが残る
+    generator->args = NULL;
+    free(generator->exec.stack);
+    generator->exec.stack = NULL;
+    generator->exec.stack_top = 0;
+    generator->exec.stack_capacity = 0;
+    if (generator->stack != NULL) {
+        release_stack(generator->stack);
+        generator->stack = NULL;
+    }
+#if defined(__SANITIZE_THREAD__)
+    __tsan_destroy_fiber(generator->body_fiber);
+#endif
+}
+
+// 次の値を取り出す (呼び出し側はジェネレータの参照を持っていること)
+// 値があれば *value に参照を入れて true を、本体が終わっていれば false を返す。
+// 本体の実行時エラーは、ここで呼び出し側のエラーとして報告し直す。
+bool generator_next(KGenerator *generator, ExecState *state, Value *value, int line) {
+    int status = __atomic_load_n(&generator->status, __ATOMIC_ACQUIRE);
+    do {
+        if (status == GENERATOR_FINISHED) {
+            return false;
+        }
+        if (status == GENERATOR_RUNNING) {
+            runtime_error(line, "ジェネレータ '%s' は既に実行中です。", generator->func_def->data.func_def.name);
+        }
+    } while (!__atomic_compare_exchange_n(&generator->status, &status, GENERATOR_RUNNING, false,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    if (status == GENERATOR_CREATED) {
+        generator->stack = acquire_stack();
+        context_init(&generator->body, generator->stack + guard_size(), GENERATOR_STACK_SIZE, generator_entry, generator);
+#if defined(__SANITIZE_THREAD__)
+        generator->body_fiber = __tsan_create_fiber(0);
+#endif
+    }
+    // 本体は再開した側のグローバルスコープと出力先で実行する (作ったタスクも再開した側の組に入る)
+    generator->exec.globals = state->globals;
+    generator->exec.out = state->out;
+    generator->exec.load_budget = state->load_budget;
+    generator->exec.tasks = state->tasks;
+
+    TaskFailure *outer = exchange_error_trap(generator->trap);
+    char *outer_floor = exchange_stack_floor(generator->stack + guard_size() + GENERATOR_STACK_RESERVE);
+#if defined(__SANITIZE_ADDRESS__)
+    void *fake_stack = NULL;
+    __sanitizer_start_switch_fiber(&fake_stack, generator->stack + guard_size(), GENERATOR_STACK_SIZE);
+#endif
+#if defined(__SANITIZE_THREAD__)
+    generator->consumer_fiber = __tsan_get_current_fiber();
+    __tsan_switch_to_fiber(generator->body_fiber, 0);
+#endif
+    context_switch(&generator->consumer, &generator->body);
+#if defined(__SANITIZE_ADDRESS__)
+    __sanitizer_finish_switch_fiber(fake_stack, NULL, NULL);
+#endif
+    generator->trap = exchange_error_trap(outer);
+    exchange_stack_floor(outer_floor);
+
+    if (!generator->finished) {
+        *value = generator->yielded;
+        generator->yielded = VOID_VAL;
+        __atomic_store_n(&generator->status, GENERATOR_SUSPENDED, __ATOMIC_RELEASE);
+        return true;
+    }
+    discard_body(generator);
+    char *error = generator->error;
+    generator->error = NULL;
+    __atomic_store_n(&generator->status, GENERATOR_FINISHED, __ATOMIC_RELEASE);
+    if (error != NULL) {
+        raise_error_message(error);
+    }
+    return false;
+}
+
+void kgenerator_retain(KGenerator *generator) {
+    __atomic_fetch_add(&generator->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void kgenerator_release(KGenerator *generator) {
+    // 最後の参照を落としたスレッドだけが解放する
+    if (__atomic_sub_fetch(&generator->refcount, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    int status = __atomic_load_n(&generator->status, __ATOMIC_ACQUIRE);
+    if (status == GENERATOR_CREATED) {
+        for (int i = 0; i < generator->num_args; i++) {
+            free_value_data(generator->args[i]);
+        }
+        free(generator->args);
+    } else if (status == GENERATOR_SUSPENDED) {
+        discard_body(generator);
+    }
+    free(generator);
+}
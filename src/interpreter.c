@@ -1,5 +1,27 @@
 #include "kappok.h"
 
+#ifdef KAPPOK_NAN_BOXING
+// 添字は (符号ビット << 3) | ビット48-50。タグ0は正規化された NaN (double)
+const ValueType nanbox_type_table[16] = {
+    VALUE_TYPE_DOUBLE,   // 0x7FF8: NaN
+    VALUE_TYPE_INT,      // 0x7FF9: 48ビット int
+    VALUE_TYPE_BOOL,     // 0x7FFA
+    VALUE_TYPE_VOID,     // 0x7FFB
+    VALUE_TYPE_UNKNOWN,  // 0x7FFC
+    VALUE_TYPE_FUNCTION, // 0x7FFD
+    VALUE_TYPE_STR,      // 0x7FFE: インライン文字列
+    VALUE_TYPE_UNKNOWN,  // 0x7FFF: 未使用
+    VALUE_TYPE_DOUBLE,   // 0xFFF8: -NaN
+    VALUE_TYPE_INT,      // 0xFFF9: ヒープ上の int
+    VALUE_TYPE_STR,      // 0xFFFA
+    VALUE_TYPE_INT_ARRAY,    // 0xFFFB
+    VALUE_TYPE_DOUBLE_ARRAY, // 0xFFFC
+    VALUE_TYPE_MAT,      // 0xFFFD
+    VALUE_TYPE_FUTURE,   // 0xFFFE
+    VALUE_TYPE_GENERATOR // 0xFFFF
+};
+#endif
+
 Environment *create_environment(Environment *parent) {
     Environment *env = malloc(sizeof(Environment));
     if (env == NULL) {
@@ -9,10 +31,79 @@ Environment *create_environment(Environment *parent) {
     env->symbols = NULL;
     env->num_symbols = 0;
     env->capacity_symbols = 0;
+    env->slots = NULL;
+    env->capacity_slots = 0;
     env->parent = parent;
+    env->state = NULL;
+    env->frame_base = 0;
+    // 0 は「未解決」を表すので 1 から始める
+    env->function_epoch = 1;
+    return env;
+}
+
+// 関数の世代番号を持つグローバルスコープ
+// 呼び出しノードは解決した関数と一緒にプログラムのグローバルスコープの世代番号を覚え、一致する間は
+// キャッシュをそのまま使う。世代番号はプログラムごとなので、別のプログラムを読み込んでも無効にならない。
+// (parallel_map の作業スレッドも同じノードを使うので、原子的に読み書きする)
+static Environment *global_scope(Environment *env) {
+    while (env->parent != NULL) {
+        env = env->parent;
+    }
     return env;
 }
 
+// 値スタック上のフレームを表す環境を初期化する (Cのスタック上に置くためヒープ確保はしない)
+static void init_frame_environment(Environment *frame, ExecState *state, int frame_base) {
+    frame->symbols = NULL;
+    frame->num_symbols = 0;
+    frame->capacity_symbols = 0;
+    frame->slots = NULL;
+    frame->capacity_slots = 0;
+    frame->parent = state->globals;
+    frame->state = state;
+    frame->frame_base = frame_base;
+    frame->function_epoch = 0;
+}
+
+// 値スタックに少なくとも needed 個分の領域を確保する
+static void reserve_stack(ExecState *state, int needed) {
+    if (needed <= state->stack_capacity) {
+        return;
+    }
+    int new_capacity = (state->stack_capacity == 0) ? 256 : state->stack_capacity * 2;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    state->stack = realloc(state->stack, sizeof(Value) * new_capacity);
+    if (state->stack == NULL) {
+        perror("Failed to reallocate value stack");
+        exit(EXIT_FAILURE);
+    }
+    state->stack_capacity = new_capacity;
+}
+
+// フレーム内のスロット (スタックは realloc され得るので、使うたびに引き直す)
+#define FRAME_SLOT(env, slot) ((env)->state->stack[(env)->frame_base + (slot)])
+
+// 評価の途中の値を値スタックの先頭に積む (値の参照を受け取る)
+// 続きの評価が実行時エラーで打ち切られても、積んだ値は値スタックと一緒に解放される。
+void push_temporary(ExecState *state, Value value) {
+    reserve_stack(state, state->stack_top + 1);
+    state->stack[state->stack_top++] = value;
+}
+
+// 最後に積んだ値を取り出す (値の参照は呼び出し側に戻る)
+Value pop_temporary(ExecState *state) {
+    return state->stack[--state->stack_top];
+}
+
+// base より上に積んだ値を解放して、スタックを base の高さに戻す
+static void release_temporaries(ExecState *state, int base) {
+    while (state->stack_top > base) {
+        free_value_data(state->stack[--state->stack_top]);
+    }
+}
+
 void destroy_environment(Environment *env) {
     if (env == NULL) {
         return;
@@ -23,27 +114,127 @@ void destroy_environment(Environment *env) {
         free_value_data(env->symbols[i].value);
     }
     free(env->symbols);
+    free(env->slots);
     free(env);
 }
 
 // 動的に割り当てられたValueデータを解放する
 void free_value_data(Value value) {
-    if (value.type == VALUE_TYPE_STR && value.data.str_value != NULL) {
-        free(value.data.str_value);
+    if (VAL_IS_HEAP_STR(value)) {
+        kstring_release(AS_KSTRING(value));
+    } else if (VAL_IS_BIGINT(value)) {
+        free(AS_BIGINT_PTR(value));
+    } else if (VAL_IS_ARRAY(value) || VAL_IS_MAT(value)) {
+        karray_release(AS_ARRAY(value));
+    } else if (VAL_IS_FUTURE(value)) {
+        ktask_release(AS_TASK(value));
+    } else if (VAL_IS_GENERATOR(value)) {
+        kgenerator_release(AS_GENERATOR(value));
     }
-    // double, bool, int, void, function は動的メモリを持たないため、ここではfreeしない
+    // double, bool, void, function とインラインの int・文字列は動的メモリを持たないため、ここではfreeしない
 }
 
-void define_symbol(Environment *env, const char *name, Value value) {
-    // 既存のシンボルがあれば更新 (現状は同名変数宣言は許容しないが、代入時に使う)
+// 値を複製する (元の値とは独立に解放できる)
+// 文字列は不変なので参照カウントを増やすだけで、中身はコピーしない
+// 配列も参照カウントを増やすだけで、要素への代入の前に複製する (コピーオンライト)
+Value copy_value(Value value) {
+    if (VAL_IS_HEAP_STR(value)) {
+        kstring_retain(AS_KSTRING(value));
+        return value;
+    }
+    if (VAL_IS_ARRAY(value) || VAL_IS_MAT(value)) {
+        karray_retain(AS_ARRAY(value));
+        return value;
+    }
+    if (VAL_IS_FUTURE(value)) {
+        ktask_retain(AS_TASK(value));
+        return value;
+    }
+    if (VAL_IS_GENERATOR(value)) {
+        kgenerator_retain(AS_GENERATOR(value));
+        return value;
+    }
+    if (VAL_IS_BIGINT(value)) {
+        return INT_VAL(AS_INT(value));
+    }
+    return value;
+}
+
+// シンボル名のハッシュ (FNV-1a)
+// パーサーが識別子ごとに一度だけ計算してASTに保存し、実行時は再計算しない
+unsigned int hash_symbol_name(const char *name) {
+    unsigned int hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// ハッシュ索引に symbols[index] を挿入する (空きスロットがあることは呼び出し側が保証する)
+static void insert_symbol_slot(Environment *env, unsigned int hash, int index) {
+    unsigned int mask = (unsigned int)env->capacity_slots - 1;
+    unsigned int i = hash & mask;
+    while (env->slots[i].index >= 0) {
+        i = (i + 1) & mask; // 線形プローブ
+    }
+    env->slots[i].hash = hash;
+    env->slots[i].index = index;
+}
+
+// ハッシュ索引を new_capacity で作り直す
+static void rebuild_symbol_slots(Environment *env, int new_capacity) {
+    free(env->slots);
+    env->slots = malloc(sizeof(SymbolSlot) * new_capacity);
+    if (env->slots == NULL) {
+        perror("Failed to allocate symbol index");
+        exit(EXIT_FAILURE);
+    }
+    env->capacity_slots = new_capacity;
+    for (int i = 0; i < new_capacity; i++) {
+        env->slots[i].index = -1;
+    }
     for (int i = 0; i < env->num_symbols; i++) {
-        if (strcmp(env->symbols[i].name, name) == 0) {
-            // 既存の値を解放してから新しい値をコピー
-            free_value_data(env->symbols[i].value);
-            env->symbols[i].value = value;
-            env->symbols[i].type = value.type; // 型も更新
-            return;
+        insert_symbol_slot(env, env->symbols[i].hash, i);
+    }
+}
+
+// この環境だけを探索する (親スコープは見ない)
+SymbolEntry *get_local_symbol_hashed(Environment *env, const char *name, unsigned int hash) {
+    if (env->slots != NULL) {
+        unsigned int mask = (unsigned int)env->capacity_slots - 1;
+        unsigned int i = hash & mask;
+        while (env->slots[i].index >= 0) {
+            if (env->slots[i].hash == hash) {
+                SymbolEntry *entry = &env->symbols[env->slots[i].index];
+                if (strcmp(entry->name, name) == 0) {
+                    return entry;
+                }
+            }
+            i = (i + 1) & mask;
         }
+        return NULL;
+    }
+    for (int i = 0; i < env->num_symbols; i++) {
+        if (env->symbols[i].hash == hash && strcmp(env->symbols[i].name, name) == 0) {
+            return &env->symbols[i];
+        }
+    }
+    return NULL;
+}
+
+void define_symbol(Environment *env, const char *name, Value value) {
+    define_symbol_hashed(env, name, hash_symbol_name(name), value);
+}
+
+void define_symbol_hashed(Environment *env, const char *name, unsigned int hash, Value value) {
+    // 既存のシンボルがあれば更新 (現状は同名変数宣言は許容しないが、代入時に使う)
+    SymbolEntry *existing = get_local_symbol_hashed(env, name, hash);
+    if (existing != NULL) {
+        // 既存の値を解放してから新しい値をコピー
+        free_value_data(existing->value);
+        existing->value = value;
+        return;
     }
 
     // 新しいシンボルとして追加
@@ -57,23 +248,38 @@ void define_symbol(Environment *env, const char *name, Value value) {
         env->capacity_symbols = new_capacity;
     }
 
-    env->symbols[env->num_symbols].name = strdup(name);
-    if (env->symbols[env->num_symbols].name == NULL) {
+    SymbolEntry *entry = &env->symbols[env->num_symbols];
+    entry->name = strdup(name);
+    if (entry->name == NULL) {
         perror("Failed to duplicate symbol name");
         exit(EXIT_FAILURE);
     }
-    env->symbols[env->num_symbols].value = value;
-    env->symbols[env->num_symbols].type = value.type; // 型も保存
+    entry->hash = hash;
+    entry->value = value;
     env->num_symbols++;
+
+    // 索引の負荷率を 1/2 以下に保つ
+    if (env->slots != NULL && env->num_symbols * 2 <= env->capacity_slots) {
+        insert_symbol_slot(env, hash, env->num_symbols - 1);
+    } else if (env->num_symbols > SYMBOL_INDEX_THRESHOLD) {
+        int new_capacity = (env->capacity_slots == 0) ? 32 : env->capacity_slots * 2;
+        while (env->num_symbols * 2 > new_capacity) {
+            new_capacity *= 2;
+        }
+        rebuild_symbol_slots(env, new_capacity);
+    }
 }
 
 SymbolEntry *get_symbol(Environment *env, const char *name) {
+    return get_symbol_hashed(env, name, hash_symbol_name(name));
+}
+
+SymbolEntry *get_symbol_hashed(Environment *env, const char *name, unsigned int hash) {
     Environment *current_env = env;
     while (current_env != NULL) {
-        for (int i = 0; i < current_env->num_symbols; i++) {
-            if (strcmp(current_env->symbols[i].name, name) == 0) {
-                return &current_env->symbols[i];
-            }
+        SymbolEntry *entry = get_local_symbol_hashed(current_env, name, hash);
+        if (entry != NULL) {
+            return entry;
         }
         current_env = current_env->parent;
     }
@@ -81,82 +287,694 @@ SymbolEntry *get_symbol(Environment *env, const char *name) {
 }
 
 // なんでこんなこと始めちゃったんだろう
-// 値を標準出力に表示する関数
-void print_value(Value val, int precision) {
-    switch (val.type) {
-        case VALUE_TYPE_INT:
-            printf("%ld", val.data.int_value);
+// 値を出力バッファに書き込む関数
+void print_value(OutputWriter *out, Value val, int precision) {
+    switch (VAL_TYPE(val)) {
+        case VALUE_TYPE_INT: {
+            char buffer[FORMAT_INT_MAX_LENGTH];
+            int length = format_int(AS_INT(val), buffer);
+            output_write(out, buffer, (size_t)length);
             break;
-        case VALUE_TYPE_STR:
-            printf("%s", val.data.str_value);
+        }
+        case VALUE_TYPE_STR: {
+            StrView view;
+            string_view(val, &view);
+            output_write(out, view.data, view.length);
             break;
+        }
         case VALUE_TYPE_DOUBLE: {
-            char buffer[100]; // 十分な大きさのバッファ
             if (precision >= 0) {
                 // 指定された精度でフォーマット
-                sprintf(buffer, "%.*f", precision, val.data.double_value);
+                char stack_buffer[400];
+                char *buffer = stack_buffer;
+                if (FORMAT_FIXED_MAX_LENGTH(precision) > sizeof(stack_buffer)) {
+                    buffer = malloc(FORMAT_FIXED_MAX_LENGTH(precision));
+                    if (buffer == NULL) {
+                        perror("Failed to allocate number buffer");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                int length = format_double_fixed(AS_DOUBLE(val), precision, buffer);
                 
                 // 不要な末尾のゼロと小数点以下が全てゼロの場合は小数点を削除
                 // ただし、今回は round 関数からの結果は string 型として返されるため、
                 // このロジックは print("元のpi", pi) のような直接 double を print する場合に適用される
-                char *dot = strchr(buffer, '.');
-                if (dot) {
-                    char *end = buffer + strlen(buffer) - 1;
-                    while (end > dot && *end == '0') {
-                        *end = '\0'; // ゼロを削除
-                        end--;
+                if (memchr(buffer, '.', length) != NULL) {
+                    while (buffer[length - 1] == '0') {
+                        length--; // ゼロを削除
                     }
-                    if (*end == '.') { // 小数点以下が全てゼロになった場合、小数点も削除
-                        *end = '\0';
+                    if (buffer[length - 1] == '.') { // 小数点以下が全てゼロになった場合、小数点も削除
+                        length--;
                     }
                 }
-                printf("%s", buffer);
+                output_write(out, buffer, (size_t)length);
+                if (buffer != stack_buffer) {
+                    free(buffer);
+                }
             } else {
                 // precision が指定されていない場合、デフォルトの浮動小数点数表示
-                // これは %f で冗長な0が付くから%gをつかう
-                sprintf(buffer, "%g", val.data.double_value);
-                printf("%s", buffer);
+                // これは %f で冗長な0が付くから%gと同じ表記にする
+                char buffer[FORMAT_DOUBLE_MAX_LENGTH];
+                int length = format_double_general(AS_DOUBLE(val), buffer);
+                output_write(out, buffer, (size_t)length);
             }
             break;
         }
         case VALUE_TYPE_BOOL:
-            printf("%s", val.data.bool_value ? "True" : "False");
+            output_string(out, AS_BOOL(val) ? "True" : "False");
             break;
         case VALUE_TYPE_VOID:
-            printf("void"); // 通常はprintされないが、デバッグ用
+            output_string(out, "void"); // 通常はprintされないが、デバッグ用
             break;
         case VALUE_TYPE_FUNCTION:
-            printf("<function %s>", val.data.func_ptr.name);
+            output_string(out, "<function ");
+            output_string(out, AS_FUNC(val)->data.func_def.name);
+            output_char(out, '>');
+            break;
+        case VALUE_TYPE_INT_ARRAY:
+        case VALUE_TYPE_DOUBLE_ARRAY: {
+            // [1, 2, 3] の形で、要素は同じ型のスカラーと同じ表記にする
+            const KArray *array = AS_ARRAY(val);
+            output_char(out, '[');
+            for (size_t i = 0; i < array->length; i++) {
+                if (i > 0) {
+                    output_string(out, ", ");
+                }
+                if (array->element_type == VALUE_TYPE_DOUBLE) {
+                    print_value(out, DOUBLE_VAL(array->data.doubles[i]), precision);
+                } else {
+                    char buffer[FORMAT_INT_MAX_LENGTH];
+                    int length = format_int(array->data.ints[i], buffer);
+                    output_write(out, buffer, (size_t)length);
+                }
+            }
+            output_char(out, ']');
+            break;
+        }
+        case VALUE_TYPE_MAT: {
+            // [[1, 2], [3, 4]] の形で、行ごとに配列と同じ表記にする
+            const KArray *matrix = AS_ARRAY(val);
+            size_t rows = MAT_ROWS(matrix);
+            output_char(out, '[');
+            for (size_t i = 0; i < rows; i++) {
+                output_string(out, (i > 0) ? ", [" : "[");
+                for (size_t j = 0; j < matrix->columns; j++) {
+                    if (j > 0) {
+                        output_string(out, ", ");
+                    }
+                    print_value(out, DOUBLE_VAL(matrix->data.doubles[i * matrix->columns + j]), precision);
+                }
+                output_char(out, ']');
+            }
+            output_char(out, ']');
+            break;
+        }
+        case VALUE_TYPE_FUTURE:
+            output_string(out, "<future>");
+            break;
+        case VALUE_TYPE_GENERATOR:
+            output_string(out, "<generator>");
             break;
         case VALUE_TYPE_UNKNOWN:
-            printf("<unknown value type>");
+            output_string(out, "<unknown value type>");
             break;
     }
     // print文の最後に改行を出力するのはinterpret_nodeで行う
 }
 
+// int, bool, double のいずれか (double に変換できる値) か
+static bool is_scalar_number(Value val) {
+    ValueType type = VAL_TYPE(val);
+    return type == VALUE_TYPE_INT || type == VALUE_TYPE_BOOL || type == VALUE_TYPE_DOUBLE;
+}
+
 // 値をdouble型に変換するヘルパー関数
-// int, bool から double への変換をサポート
-Value convert_value_to_double(Value val) {
+// int, bool から double への変換をサポート (それ以外の型は line の実行時エラーにする)
+Value convert_value_to_double(Value val, int line) {
     Value new_val;
-    new_val.type = VALUE_TYPE_DOUBLE;
-    if (val.type == VALUE_TYPE_INT) {
-        new_val.data.double_value = (double)val.data.int_value;
-    } else if (val.type == VALUE_TYPE_BOOL) {
-        new_val.data.double_value = val.data.bool_value ? 1.0 : 0.0;
-    } else if (val.type == VALUE_TYPE_DOUBLE) {
-        new_val.data.double_value = val.data.double_value;
+    if (VAL_TYPE(val) == VALUE_TYPE_INT) {
+        new_val = DOUBLE_VAL((double)AS_INT(val));
+    } else if (VAL_TYPE(val) == VALUE_TYPE_BOOL) {
+        new_val = DOUBLE_VAL(AS_BOOL(val) ? 1.0 : 0.0);
+    } else if (VAL_TYPE(val) == VALUE_TYPE_DOUBLE) {
+        new_val = val;
     } else {
-        fprintf(stderr, "型変換エラー: double型に変換できない型です。\n");
-        exit(EXIT_FAILURE);
+        runtime_error(line, "'%s' 型の値を double 型に変換できません。", value_type_name(VAL_TYPE(val)));
     }
     return new_val;
 }
 
+typedef enum {
+    COERCE_OK,
+    COERCE_INCOMPATIBLE,
+    COERCE_UNKNOWN_TYPE
+} CoerceResult;
+
+// 宣言された型 (変数宣言・関数の引数) に合わせて値を変換する
+static CoerceResult coerce_to_declared_type(ValueType declared, Value *value) {
+    ValueType type = VAL_TYPE(*value);
+    switch (declared) {
+        case VALUE_TYPE_INT:
+            if (type != VALUE_TYPE_INT && type != VALUE_TYPE_BOOL) {
+                return COERCE_INCOMPATIBLE;
+            }
+            // bool (1/0) は int に変換可能
+            if (type == VALUE_TYPE_BOOL) {
+                *value = INT_VAL(AS_BOOL(*value) ? 1 : 0);
+            }
+            break;
+        case VALUE_TYPE_STR:
+            if (type != VALUE_TYPE_STR) {
+                return COERCE_INCOMPATIBLE;
+            }
+            break;
+        case VALUE_TYPE_DOUBLE: {
+            if (type != VALUE_TYPE_DOUBLE && type != VALUE_TYPE_INT && type != VALUE_TYPE_BOOL) {
+                return COERCE_INCOMPATIBLE;
+            }
+            // int/bool から double への暗黙の変換を許可 (型は上で確認済み)
+            Value converted = convert_value_to_double(*value, 0);
+            free_value_data(*value);
+            *value = converted;
+            break;
+        }
+        case VALUE_TYPE_BOOL:
+            if (type != VALUE_TYPE_BOOL && type != VALUE_TYPE_INT) {
+                return COERCE_INCOMPATIBLE;
+            }
+            // int (1/0) から bool へ
+            if (type == VALUE_TYPE_INT) {
+                Value converted = BOOL_VAL(AS_INT(*value) != 0); // 0はFalse, それ以外はTrue
+                free_value_data(*value);
+                *value = converted;
+            }
+            break;
+        case VALUE_TYPE_INT_ARRAY:
+            if (type != VALUE_TYPE_INT_ARRAY) {
+                return COERCE_INCOMPATIBLE;
+            }
+            break;
+        case VALUE_TYPE_DOUBLE_ARRAY:
+            if (type != VALUE_TYPE_DOUBLE_ARRAY && type != VALUE_TYPE_INT_ARRAY) {
+                return COERCE_INCOMPATIBLE;
+            }
+            // int[] から double[] への暗黙の変換を許可
+            *value = array_to_double(*value);
+            break;
+        case VALUE_TYPE_MAT:
+            if (type != VALUE_TYPE_MAT) {
+                return COERCE_INCOMPATIBLE;
+            }
+            break;
+        case VALUE_TYPE_FUTURE:
+            if (type != VALUE_TYPE_FUTURE) {
+                return COERCE_INCOMPATIBLE;
+            }
+            break;
+        case VALUE_TYPE_GENERATOR:
+            if (type != VALUE_TYPE_GENERATOR) {
+                return COERCE_INCOMPATIBLE;
+            }
+            break;
+        default:
+            return COERCE_UNKNOWN_TYPE;
+    }
+    return COERCE_OK;
+}
+
+// 型検査が挿入した変換ノードを評価する (変換元の型は静的に確定している)
+static Value convert_value(Value value, ValueType to) {
+    switch (to) {
+        case VALUE_TYPE_DOUBLE: {
+            Value converted = convert_value_to_double(value, 0);
+            free_value_data(value);
+            return converted;
+        }
+        case VALUE_TYPE_INT:
+            if (VAL_TYPE(value) == VALUE_TYPE_BOOL) {
+                return INT_VAL(AS_BOOL(value) ? 1 : 0);
+            }
+            return value;
+        case VALUE_TYPE_BOOL:
+            if (VAL_TYPE(value) == VALUE_TYPE_INT) {
+                Value converted = BOOL_VAL(AS_INT(value) != 0);
+                free_value_data(value);
+                return converted;
+            }
+            return value;
+        case VALUE_TYPE_DOUBLE_ARRAY:
+            return array_to_double(value);
+        default:
+            return value;
+    }
+}
+
+// メモ化する関数の本体を解釈する: 同じ引数での呼び出しは記録した結果を返す
+// (キーの配列を interpret_node のスタックフレームに置かないよう別の関数にしている)
+static Value interpret_memoized_body(ASTNode *func_def, ASTNode *body, Environment *frame) {
+    int num_parameters = func_def->data.func_def.num_parameters;
+    Value *args = (num_parameters > 0) ? &FRAME_SLOT(frame, 0) : NULL;
+    Value result;
+    if (memo_lookup(func_def, args, num_parameters, &result)) {
+        return result;
+    }
+    // 本体が引数に代入しても記録するキーが変わらないよう、実行前に引数を複製しておく
+    // (本体が実行時エラーで打ち切られても解放されるよう、キーはフレームの上に積む)
+    ExecState *state = frame->state;
+    int key_base = state->stack_top;
+    for (int i = 0; i < num_parameters; i++) {
+        push_temporary(state, copy_value(FRAME_SLOT(frame, i)));
+    }
+    result = interpret_node(body, frame);
+    Value key[MEMO_MAX_ARGS];
+    for (int i = 0; i < num_parameters; i++) {
+        key[i] = state->stack[key_base + i];
+    }
+    state->stack_top = key_base;
+    memo_store(func_def, key, num_parameters, result);
+    return result;
+}
+
+// ロード時の評価1回あたりのステップ数の上限 (関数の呼び出しと range のループの周回を1ステップと数える)
+#define LOAD_STEP_BUDGET (1L << 20)
+
+// ロード時の評価のステップを1つ使う (使い切ったら評価を打ち切る。evaluate_at_load がエラーを捨てる)
+static void spend_load_step(long *load_budget, int line) {
+    if (__atomic_sub_fetch(load_budget, 1, __ATOMIC_RELAXED) < 0) {
+        runtime_error(line, "ロード時の評価が %ld ステップを超えました。", LOAD_STEP_BUDGET);
+    }
+}
+
+// 呼び出す本体を選び、フレームのスロット数を frame_size に返す
+// 最適化済みの本体が公開されていればそちらを使い、なければ呼び出しを数える
+// (最適化済みの本体はインライン展開した関数のローカル変数の分だけスロットが多い)
+static ASTNode *select_function_body(ASTNode *func_def, ExecState *state, int *frame_size) {
+    ASTNode *body = __atomic_load_n(&func_def->data.func_def.optimized_body, __ATOMIC_ACQUIRE);
+    if (body != NULL) {
+        *frame_size = func_def->data.func_def.optimized_frame_size;
+        return body;
+    }
+    if (state->load_budget == NULL) {
+        tier_count_call(func_def);
+    }
+    *frame_size = func_def->data.func_def.frame_size;
+    return func_def->data.func_def.body;
+}
+
+// 引数を書き込み済みのフレームで関数本体を実行し、フレームを破棄する
+// (スロット [frame_base, frame_base + 引数の個数) に引数が入っていること)
+// 呼び出しが深すぎて C スタックが足りなければ、本体に入らずに line の実行時エラーにする
+// (引数は値スタックに積まれているので、エラーを受け取った側が解放する)。
+static Value run_function_frame(ASTNode *func_def, ASTNode *body, int frame_size, ExecState *state, int frame_base, int line) {
+    check_call_depth(line);
+    if (state->load_budget != NULL) {
+        spend_load_step(state->load_budget, line);
+    }
+    for (int i = func_def->data.func_def.num_parameters; i < frame_size; i++) {
+        state->stack[frame_base + i] = UNKNOWN_VAL; // 未宣言のローカル変数
+    }
+    state->stack_top = frame_base + frame_size;
+
+    // 関数本体のブロックを解釈 (親スコープはグローバル)
+    Environment frame;
+    init_frame_environment(&frame, state, frame_base);
+    Value result;
+    if (func_def->data.func_def.memoized) {
+        result = interpret_memoized_body(func_def, body, &frame);
+    } else {
+        result = interpret_node(body, &frame);
+    }
+
+    // フレームを破棄: スロットの値を解放してスタックを戻す
+    for (int i = 0; i < frame_size; i++) {
+        free_value_data(state->stack[frame_base + i]);
+    }
+    state->stack_top = frame_base;
+    return result;
+}
+
+static void report_incompatible_argument(ASTNode *func_def, int index, int line) {
+    ASTNode *param = func_def->data.func_def.parameters[index];
+    runtime_error(line, "関数 '%s' の '%s' 型の引数 '%s' に互換性のない型の値を渡そうとしました。",
+            func_def->data.func_def.name, param->data.var_decl.type_name, param->data.var_decl.name);
+}
+
+// 引数を関数の宣言した型に変換する (変換できなければ *arg はそのまま残る)
+static void coerce_argument(ASTNode *func_def, int index, Value *arg, int line) {
+    ASTNode *param = func_def->data.func_def.parameters[index];
+    if (coerce_to_declared_type(param->data.var_decl.decl_type, arg) != COERCE_OK) {
+        report_incompatible_argument(func_def, index, line);
+    }
+}
+
+// 受け取った引数の個数を確かめ、宣言した型に変換する
+// 呼び出せなければ全ての引数を解放してから報告する。
+static void accept_arguments(ASTNode *func_def, Value *args, int num_args, int line) {
+    int num_parameters = func_def->data.func_def.num_parameters;
+    if (num_args != num_parameters) {
+        for (int i = 0; i < num_args; i++) {
+            free_value_data(args[i]);
+        }
+        runtime_error(line, "関数 '%s' は %d 個の引数を取りますが、%d 個が渡されました。",
+                func_def->data.func_def.name, num_parameters, num_args);
+    }
+    for (int i = 0; i < num_args; i++) {
+        ASTNode *param = func_def->data.func_def.parameters[i];
+        if (coerce_to_declared_type(param->data.var_decl.decl_type, &args[i]) != COERCE_OK) {
+            for (int j = 0; j < num_args; j++) {
+                free_value_data(args[j]);
+            }
+            report_incompatible_argument(func_def, i, line);
+        }
+    }
+}
+
+// 評価済みの引数で関数を呼び出す (引数の参照を受け取る)
+// parallel_map の作業スレッドが、それぞれの実行状態の値スタックの上で要素ごとに呼び出す。
+// ジェネレータ関数は本体を実行せず、引数を持ったジェネレータを返す。
+Value call_function(ASTNode *func_def, Value *args, int num_args, ExecState *state, int line) {
+    if (!func_def->data.func_def.generator) {
+        return enter_function(func_def, args, num_args, state, line);
+    }
+    accept_arguments(func_def, args, num_args, line);
+    Value *owned = malloc(sizeof(Value) * (num_args > 0 ? num_args : 1));
+    if (owned == NULL) {
+        perror("Failed to allocate generator arguments");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_args; i++) {
+        owned[i] = args[i];
+    }
+    return generator_new(func_def, owned, num_args, line);
+}
+
+// 関数の本体を state の値スタックの上で実行する (引数の参照を受け取る)
+// ジェネレータ関数でも本体をそのまま実行する (generator.c が本体を始めるのに使う)。
+Value enter_function(ASTNode *func_def, Value *args, int num_args, ExecState *state, int line) {
+    accept_arguments(func_def, args, num_args, line);
+
+    int frame_base = state->stack_top;
+    int frame_size;
+    ASTNode *body = select_function_body(func_def, state, &frame_size);
+    reserve_stack(state, frame_base + frame_size);
+    for (int i = 0; i < num_args; i++) {
+        state->stack[frame_base + i] = args[i];
+    }
+    state->stack_top = frame_base + num_args;
+    return run_function_frame(func_def, body, frame_size, state, frame_base, line);
+}
+
+// ユーザー定義関数の呼び出し先を求める
+// 呼び出し先はノードにキャッシュし、関数の定義が変わっていなければ名前で探し直さない
+// (parallel_map の作業スレッドも同じノードを使うので、世代番号は関数より後に公開する)
+static ASTNode *resolve_call_target(ASTNode *node, Environment *env) {
+    unsigned int epoch = __atomic_load_n(&global_scope(env)->function_epoch, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&node->data.func_call.cached_epoch, __ATOMIC_ACQUIRE) == epoch) {
+        return __atomic_load_n(&node->data.func_call.cached_target, __ATOMIC_RELAXED);
+    }
+    const char *func_name = node->data.func_call.function_name;
+    SymbolEntry *func_entry = get_symbol_hashed(env, func_name, node->data.func_call.name_hash);
+    if (func_entry == NULL || VAL_TYPE(func_entry->value) != VALUE_TYPE_FUNCTION) {
+        runtime_error(node->line, "未定義の関数 '%s' を呼び出そうとしました。", func_name);
+    }
+    ASTNode *func_def = AS_FUNC(func_entry->value);
+    __atomic_store_n(&node->data.func_call.cached_target, func_def, __ATOMIC_RELAXED);
+    __atomic_store_n(&node->data.func_call.cached_epoch, epoch, __ATOMIC_RELEASE);
+    return func_def;
+}
+
+// 呼び出しの実引数を評価し、値を持つ配列 (呼び出し側が所有する) を返す
+// 評価の間は値を値スタックに積んでおき、全て評価し終えてから配列に移す。
+// func_def が NULL でなければ、評価した引数を順に宣言した型に変換する。
+static Value *evaluate_arguments(ASTNode *node, ASTNode *func_def, Environment *env, const char *what) {
+    ExecState *state = env->state;
+    int num_arguments = node->data.func_call.num_arguments;
+    int base = state->stack_top;
+    for (int i = 0; i < num_arguments; i++) {
+        push_temporary(state, interpret_node(node->data.func_call.arguments[i], env));
+        if (func_def != NULL) {
+            coerce_argument(func_def, i, &state->stack[base + i], node->line);
+        }
+    }
+    Value *args = malloc(sizeof(Value) * (num_arguments > 0 ? num_arguments : 1));
+    if (args == NULL) {
+        perror(what);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_arguments; i++) {
+        args[i] = state->stack[base + i];
+    }
+    state->stack_top = base;
+    return args;
+}
+
+// spawn f(...): 引数を評価してタスクを作り、future を返す
+// (引数は呼び出した時点の値で、タスクは自分の値スタックの上で関数を実行する)
+static Value spawn_call(ASTNode *node, ASTNode *func_def, Environment *env) {
+    Value *args = evaluate_arguments(node, NULL, env, "Failed to allocate task arguments");
+    return spawn_task(func_def, args, node->data.func_call.num_arguments, env->state, node->line);
+}
+
+// ジェネレータ関数の呼び出し: 引数を評価してジェネレータに持たせる (本体は値を取り出すときに実行する)
+static Value generator_call(ASTNode *node, ASTNode *func_def, Environment *env) {
+    Value *args = evaluate_arguments(node, node->data.func_call.checked ? NULL : func_def, env,
+            "Failed to allocate generator arguments");
+    return generator_new(func_def, args, node->data.func_call.num_arguments, node->line);
+}
+
+// 自動並列化: NODE_FORK が包んだ式の中の、タスクにする呼び出しを評価の順に始める
+// (autopar.c が印を付けた呼び出しは、print と組み込み関数の引数・算術演算の左右をたどって届く。
+//  ユーザー定義関数の引数はその呼び出しの中の別の NODE_FORK が受け持つので、その先はたどらない)
+// future はフレームの隠れたスロットに置き、式を評価して呼び出しの位置に来たところで join する。
+static void start_forks(ASTNode *node, Environment *env) {
+    switch (node->type) {
+        case NODE_PRINT_STATEMENT:
+            for (int i = 0; i < node->data.print_stmt.num_arguments; i++) {
+                start_forks(node->data.print_stmt.arguments[i], env);
+            }
+            break;
+        case NODE_CONVERT:
+            start_forks(node->data.convert.operand, env);
+            break;
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE:
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_DIVIDE_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE:
+        case NODE_CONCAT:
+            start_forks(node->data.binary_expr.left, env);
+            start_forks(node->data.binary_expr.right, env);
+            break;
+        case NODE_FUNCTION_CALL: {
+            if (node->data.func_call.native != NULL) {
+                for (int i = 0; i < node->data.func_call.num_arguments; i++) {
+                    start_forks(node->data.func_call.arguments[i], env);
+                }
+                break;
+            }
+            int fork_slot = node->data.func_call.fork_slot;
+            if (fork_slot < 0) {
+                break;
+            }
+            ASTNode *func_def = resolve_call_target(node, env);
+            if (func_def->data.func_def.generator) {
+                break; // その場で呼び出す (ジェネレータを作るだけ)
+            }
+            // 引数は失敗しない純粋な式なので、前の被演算子より先に評価してよい
+            Value *args = evaluate_arguments(node, NULL, env, "Failed to allocate forked call arguments");
+            Value future = fork_task(func_def, args, node->data.func_call.num_arguments, env->state, node->line);
+            Value *slot = &FRAME_SLOT(env, fork_slot);
+            free_value_data(*slot);
+            *slot = future;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// 先に始めた呼び出しの結果を受け取り、隠れたスロットを空に戻す
+// (join が実行時エラーを報告し直すときは future をスロットに残し、フレームと一緒に解放させる)
+static Value join_forked_call(int fork_slot, Environment *env) {
+    Value result = join_task(AS_TASK(FRAME_SLOT(env, fork_slot)));
+    // join がこのスレッドでタスクを実行するとスタックが伸長され得るので、スロットは引き直す
+    Value *slot = &FRAME_SLOT(env, fork_slot);
+    free_value_data(*slot);
+    *slot = UNKNOWN_VAL;
+    return result;
+}
+
+// for x in <ジェネレータ>: 取り出した値をループ変数に入れて本体を実行する
+// ジェネレータはフレームの隠れたスロットに置き、C の変数には持たない
+// (本体の yield で止まったまま捨てられたジェネレータは、値スタックを解放するだけで片付く)。
+// 周回を段階的実行の回数に数える関数 (ロード時の評価では数えない)
+static ASTNode *loop_tier_function(ASTNode *node, Environment *env) {
+    return (env->state->load_budget != NULL) ? NULL : node->data.for_stmt.function;
+}
+
+static void iterate_generator(ASTNode *node, Environment *env) {
+    Value iterable = interpret_node(node->data.for_stmt.iterable, env);
+    if (!VAL_IS_GENERATOR(iterable)) {
+        ValueType type = VAL_TYPE(iterable);
+        free_value_data(iterable);
+        runtime_error(node->line, "'for' で回せるのは range(...) かジェネレータだけですが、'%s' 型の値が渡されました。",
+                value_type_name(type));
+    }
+    int iterator_slot = node->data.for_stmt.iterator_slot;
+    int slot = node->data.for_stmt.slot;
+    ASTNode **statements = node->data.for_stmt.body->data.block.statements;
+    int num_statements = node->data.for_stmt.body->data.block.num_statements;
+    ASTNode *function = loop_tier_function(node, env);
+    FRAME_SLOT(env, iterator_slot) = iterable;
+
+    Value value;
+    unsigned int iterations = 0;
+    while (generator_next(AS_GENERATOR(FRAME_SLOT(env, iterator_slot)), env->state, &value, node->line)) {
+        if (function != NULL && ++iterations == TIER_LOOP_BATCH) {
+            tier_count_iterations(function, iterations);
+            iterations = 0;
+        }
+        // 本体の呼び出しでスタックが伸長され得るので、スロットは毎回引き直す
+        Value *variable = &FRAME_SLOT(env, slot);
+        free_value_data(*variable);
+        *variable = value;
+        for (int j = 0; j < num_statements; j++) {
+            free_value_data(interpret_node(statements[j], env));
+        }
+    }
+    if (function != NULL && iterations > 0) {
+        tier_count_iterations(function, iterations);
+    }
+    Value *iterator = &FRAME_SLOT(env, iterator_slot);
+    free_value_data(*iterator);
+    *iterator = UNKNOWN_VAL;
+}
+
+// range の範囲の値を整数にする (値の参照を受け取る)
+static long range_bound(Value bound, int line) {
+    long value;
+    if (VAL_TYPE(bound) == VALUE_TYPE_INT) {
+        value = AS_INT(bound);
+    } else if (VAL_TYPE(bound) == VALUE_TYPE_BOOL) {
+        value = AS_BOOL(bound) ? 1 : 0;
+    } else {
+        free_value_data(bound);
+        runtime_error(line, "range の範囲は整数でなければなりません。");
+    }
+    free_value_data(bound);
+    return value;
+}
+
+// 型検査で int と確定した被演算子を評価する
+// 変数と整数リテラルは値を複製せずに直接読む (ループの本体で繰り返し評価される式の近道)。
+// 型検査の済んだ式が読む変数は、その時点で必ず宣言済み。
+static long int_operand(ASTNode *operand, Environment *env) {
+    if (operand->type == NODE_IDENTIFIER_EXPR && operand->data.identifier_expr.slot >= 0) {
+        return AS_INT(FRAME_SLOT(env, operand->data.identifier_expr.slot));
+    }
+    if (operand->type == NODE_NUMBER_LITERAL) {
+        return operand->data.number_literal.value;
+    }
+    Value value = interpret_node(operand, env);
+    long i = AS_INT(value);
+    free_value_data(value);
+    return i;
+}
+
+// 配列リテラルを評価する
+// (深く入れ子になった式を評価する interpret_node のスタックフレームを大きくしないよう、
+//  インライン展開させない別の関数にしている。assign_element も同じ)
+__attribute__((noinline)) static Value evaluate_array_literal(ASTNode *node, Environment *env) {
+    int num_elements = node->data.array_literal.num_elements;
+    ValueType element_type = node->data.array_literal.element_type;
+    ExecState *state = env->state;
+    if (element_type != VALUE_TYPE_UNKNOWN) {
+        // 要素の式は型検査で要素の型に揃えてある
+        // (要素の評価が失敗しても解放されるよう、作った配列は値スタックに積んでおく)
+        KArray *array = karray_new(element_type, (size_t)num_elements, node->line);
+        push_temporary(state, ARRAY_VAL(array));
+        for (int i = 0; i < num_elements; i++) {
+            Value element = interpret_node(node->data.array_literal.elements[i], env);
+            if (element_type == VALUE_TYPE_DOUBLE) {
+                array->data.doubles[i] = AS_DOUBLE(element);
+            } else {
+                array->data.ints[i] = AS_INT(element);
+                free_value_data(element);
+            }
+        }
+        return pop_temporary(state);
+    }
+    // 要素の型が静的に分からなければ、評価した値で決める (どれかが double なら double[])
+    // 評価した要素は値スタックに積んでおき、型が決まってから配列に写す
+    int base = state->stack_top;
+    element_type = VALUE_TYPE_INT;
+    for (int i = 0; i < num_elements; i++) {
+        Value element = interpret_node(node->data.array_literal.elements[i], env);
+        push_temporary(state, element);
+        ValueType type = VAL_TYPE(element);
+        if (type == VALUE_TYPE_DOUBLE) {
+            element_type = VALUE_TYPE_DOUBLE;
+        } else if (type != VALUE_TYPE_INT && type != VALUE_TYPE_BOOL) {
+            runtime_error(node->line, "配列の要素に使えない型の値です。");
+        }
+    }
+    KArray *array = karray_new(element_type, (size_t)num_elements, node->line);
+    const Value *elements = &state->stack[base];
+    for (int i = 0; i < num_elements; i++) {
+        if (element_type == VALUE_TYPE_DOUBLE) {
+            array->data.doubles[i] = AS_DOUBLE(convert_value_to_double(elements[i], node->line));
+        } else {
+            array->data.ints[i] = (VAL_TYPE(elements[i]) == VALUE_TYPE_BOOL) ? (AS_BOOL(elements[i]) ? 1 : 0) : AS_INT(elements[i]);
+        }
+    }
+    release_temporaries(state, base);
+    return ARRAY_VAL(array);
+}
+
+// 変数の配列 (行列) の要素に代入する: name[index] = value, name[row, column] = value
+__attribute__((noinline)) static void assign_element(ASTNode *node, Environment *env) {
+    const char *var_name = node->data.index_assignment.name;
+    int slot_index = node->data.index_assignment.slot;
+    SymbolEntry *entry = NULL;
+    if (slot_index >= 0) {
+        if (VAL_TYPE(FRAME_SLOT(env, slot_index)) == VALUE_TYPE_UNKNOWN) {
+            runtime_error(node->line, "未定義の変数 '%s' に代入しようとしました。", var_name);
+        }
+    } else {
+        entry = get_symbol_hashed(env, var_name, node->data.index_assignment.name_hash);
+        if (entry == NULL) {
+            runtime_error(node->line, "未定義の変数 '%s' に代入しようとしました。", var_name);
+        }
+    }
+    // 添字と右辺は値スタックに積んで評価し、代入し終えてから解放する
+    ExecState *state = env->state;
+    int base = state->stack_top;
+    bool matrix_index = (node->data.index_assignment.column != NULL);
+    push_temporary(state, interpret_node(node->data.index_assignment.index, env));
+    if (matrix_index) {
+        push_temporary(state, interpret_node(node->data.index_assignment.column, env));
+    }
+    push_temporary(state, interpret_node(node->data.index_assignment.value, env));
+    // 右辺の評価中にスタックが伸長され得るので、代入先はここで引き直す
+    Value *target = (slot_index >= 0) ? &FRAME_SLOT(env, slot_index) : &entry->value;
+    if (matrix_index) {
+        matrix_store_element(target, state->stack[base], state->stack[base + 1], state->stack[base + 2], var_name, node->line);
+    } else {
+        array_store_element(target, state->stack[base], state->stack[base + 1], var_name, node->line);
+    }
+    release_temporaries(state, base);
+}
+
 // ASTノードを解釈し、値を返す関数
 Value interpret_node(ASTNode *node, Environment *env) {
-    Value result;
-    result.type = VALUE_TYPE_VOID; // デフォルト値
+    Value result = VOID_VAL; // デフォルト値
 
     if (node == NULL) {
         return result;
@@ -165,22 +983,30 @@ Value interpret_node(ASTNode *node, Environment *env) {
     switch (node->type) {
         case NODE_PROGRAM:
         case NODE_BLOCK: {
+            // ブロックの値は最後に実行した文の値 (途中の文の値は捨てる)
             for (int i = 0; i < node->data.block.num_statements; i++) {
-                result = interpret_node(node->data.block.statements[i], env);
-                // 関数からのreturnを処理 (ただし、今はmain関数のみなので単純に継続)
-                // return文での関数終了ロジックを正確に実装する
+                free_value_data(result);
+                ASTNode *statement = node->data.block.statements[i];
+                result = interpret_node(statement, env);
+                // 関数本体は分岐を持たないので、return はそのまま関数の終了になる
+                if (statement->type == NODE_RETURN_STATEMENT) {
+                    break;
+                }
             }
             break;
         }
         case NODE_FUNCTION_DEFINITION: {
+            // 同じスコープでの再定義はロード時にエラーにする
+            if (get_local_symbol_hashed(env, node->data.func_def.name, node->data.func_def.name_hash) != NULL) {
+                compile_error(node->line, "関数 '%s' は既に定義されています。", node->data.func_def.name);
+            }
+
             // 関数をシンボルテーブルに登録
-            Value func_val;
-            func_val.type = VALUE_TYPE_FUNCTION;
-            func_val.data.func_ptr.name = strdup(node->data.func_def.name);
-            func_val.data.func_ptr.body = node->data.func_def.body;
-            // parametersもfunc_ptrに設定する
+            Value func_val = FUNC_VAL(node);
 
-            define_symbol(env, node->data.func_def.name, func_val);
+            define_symbol_hashed(env, node->data.func_def.name, node->data.func_def.name_hash, func_val);
+            // このプログラムの呼び出しノードのキャッシュを全て無効にする
+            __atomic_add_fetch(&global_scope(env)->function_epoch, 1, __ATOMIC_ACQ_REL);
             break;
         }
         case NODE_RETURN_STATEMENT: {
@@ -191,97 +1017,94 @@ Value interpret_node(ASTNode *node, Environment *env) {
         }
         case NODE_PRINT_STATEMENT: {
             // print 文の引数を順に評価し、出力
+            // 1行はスレッドごとのバッファに組み立て、改行でまとめて書く (spawn したタスクの行と混ざらない)
+            OutputWriter *line = output_begin_line(env->state->out);
             for (int i = 0; i < node->data.print_stmt.num_arguments; i++) {
                 Value arg_val = interpret_node(node->data.print_stmt.arguments[i], env);
                 
-                // round関数からの結果が string 型として返されることを考慮
-                if (arg_val.type == VALUE_TYPE_STR) {
-                    printf("%s", arg_val.data.str_value);
-                } else {
-                    // print_value に -1 を渡すことで、デフォルトの表示を行う
-                    print_value(arg_val, -1);
-                }
-                free_value_data(arg_val);
+                // print_value に -1 を渡すことで、デフォルトの表示を行う
+                // (round関数からの結果は string 型としてそのまま出力される)
+                print_value(line, arg_val, -1);
+                free_value_data(arg_val); // 一時的な値なら最後の参照なのでここで解放される
                 // 最後の引数でない場合はスペースを出力（カンマの後のスペース）
                 if (i < node->data.print_stmt.num_arguments - 1) {
-                    printf(" ");
+                    output_char(line, ' ');
                 }
             }
-            printf("\n"); // print文の最後に改行を出力
+            output_end_line(env->state->out); // print文の最後に改行を出力
             break;
         }
         case NODE_STRING_LITERAL: {
-            result.type = VALUE_TYPE_STR;
-            result.data.str_value = strdup(node->data.string_literal.value);
+            // ASTが持つ文字列を共有する (参照カウントを増やすだけ)
+            result = copy_value(node->data.string_literal.cached);
             break;
         }
         case NODE_NUMBER_LITERAL: {
-            result.type = VALUE_TYPE_INT;
-            result.data.int_value = node->data.number_literal.value;
+            result = INT_VAL(node->data.number_literal.value);
             break;
         }
         case NODE_FLOAT_LITERAL: {
-            result.type = VALUE_TYPE_DOUBLE;
-            result.data.double_value = node->data.float_literal.value;
+            result = DOUBLE_VAL(node->data.float_literal.value);
             break;
         }
         case NODE_FUNCTION_CALL: {
             const char *func_name = node->data.func_call.function_name;
 
-            // 組み込み関数の処理
-            if (strcmp(func_name, "round") == 0) {
-                if (node->data.func_call.num_arguments != 2) {
-                    fprintf(stderr, "実行時エラー (行 %d): 'round' 関数は2つの引数 (数値, 精度) を取ります。\n", node->line);
-                    exit(EXIT_FAILURE);
-                }
-                Value num_val = interpret_node(node->data.func_call.arguments[0], env);
-                Value precision_val = interpret_node(node->data.func_call.arguments[1], env);
+            // 組み込み関数・ホスト関数の処理 (リゾルバが結び付け済み)
+            if (node->data.func_call.native != NULL) {
+                result = call_native_function(node->data.func_call.native, node, env);
+                break;
+            }
 
-                if ((num_val.type != VALUE_TYPE_INT && num_val.type != VALUE_TYPE_DOUBLE) || precision_val.type != VALUE_TYPE_INT) {
-                    fprintf(stderr, "実行時エラー (行 %d): 'round' 関数の引数の型が不正です。round(数値, 整数) が期待されます。\n", node->line);
-                    exit(EXIT_FAILURE);
-                }
+            // ユーザー定義関数の処理
+            // 自動並列化で先に始めた呼び出しなら、タスクの結果を受け取る
+            int fork_slot = node->data.func_call.fork_slot;
+            if (fork_slot >= 0 && VAL_IS_FUTURE(FRAME_SLOT(env, fork_slot))) {
+                result = join_forked_call(fork_slot, env);
+                break;
+            }
+            ASTNode *func_def = resolve_call_target(node, env);
+            // 型検査で確認済みの呼び出しは引数の個数と型の検査を省く
+            bool checked = node->data.func_call.checked;
+            int num_parameters = func_def->data.func_def.num_parameters;
+            if (!checked && node->data.func_call.num_arguments != num_parameters) {
+                runtime_error(node->line, "関数 '%s' は %d 個の引数を取りますが、%d 個が渡されました。",
+                        func_name, num_parameters, node->data.func_call.num_arguments);
+            }
 
-                double val_to_round;
-                if (num_val.type == VALUE_TYPE_INT) {
-                    val_to_round = (double)num_val.data.int_value;
-                } else { // VALUE_TYPE_DOUBLE
-                    val_to_round = num_val.data.double_value;
+            ExecState *state = env->state;
+            if (node->data.func_call.spawned) {
+                if (func_def->data.func_def.generator) {
+                    runtime_error(node->line, "ジェネレータ関数 '%s' は spawn できません。", func_name);
                 }
-                int precision = (int)precision_val.data.int_value;
-
-                // 指定された精度で四捨五入
-                double factor = pow(10, precision);
-                double rounded_val = round(val_to_round * factor) / factor;
-                
-                // ここで直接文字列にフォーマットして返す。
-                // round 関数は指定された精度で厳密に表示するため、末尾のゼロ削除は行わない。
-                char buffer[100]; // 十分な大きさのバッファ
-                sprintf(buffer, "%.*f", precision, rounded_val);
-
-                result.type = VALUE_TYPE_STR;
-                result.data.str_value = strdup(buffer); // 動的に割り当てられた文字列を返す
-                free_value_data(num_val); // 元の数値のメモリを解放（文字列の場合のみ）
-                free_value_data(precision_val);
+                result = spawn_call(node, func_def, env);
+                break;
+            }
+            if (func_def->data.func_def.generator) {
+                result = generator_call(node, func_def, env);
                 break;
             }
 
-            // ユーザー定義関数の処理
-            SymbolEntry *func_entry = get_symbol(env, func_name);
-            if (func_entry == NULL || func_entry->type != VALUE_TYPE_FUNCTION) {
-                fprintf(stderr, "実行時エラー (行 %d): 未定義の関数 '%s' を呼び出そうとしました。\n", node->line, func_name);
-                exit(EXIT_FAILURE);
-            }
-            
-            // 新しい関数スコープを作成
-            Environment *func_env = create_environment(env);
-            // 引数を func_env にバインドする
-            
-            // 関数本体のブロックを解釈
-            result = interpret_node(func_entry->value.data.func_ptr.body, func_env);
-            
-            // 関数スコープを破棄
-            destroy_environment(func_env);
+            // 新しいフレームを値スタックの先頭に切り出す
+            int frame_base = state->stack_top;
+            int frame_size;
+            ASTNode *body = select_function_body(func_def, state, &frame_size);
+            reserve_stack(state, frame_base + frame_size);
+
+            // 実引数は評価した順に呼び出し先のスロットへ直接書き込む
+            // (評価中の入れ子の呼び出しは書き込み済みの引数より上にフレームを作る)
+            for (int i = 0; i < num_parameters; i++) {
+                ASTNode *param = func_def->data.func_def.parameters[i];
+                Value arg_val = interpret_node(node->data.func_call.arguments[i], env);
+                if (!checked && coerce_to_declared_type(param->data.var_decl.decl_type, &arg_val) != COERCE_OK) {
+                    free_value_data(arg_val);
+                    runtime_error(node->line, "関数 '%s' の '%s' 型の引数 '%s' に互換性のない型の値を渡そうとしました。",
+                            func_name, param->data.var_decl.type_name, param->data.var_decl.name);
+                }
+                state->stack[frame_base + i] = arg_val;
+                state->stack_top = frame_base + i + 1;
+            }
+            result = run_function_frame(func_def, body, frame_size, state, frame_base, node->line);
             break;
         }
         case NODE_VAR_DECLARATION: { 
@@ -291,224 +1114,523 @@ Value interpret_node(ASTNode *node, Environment *env) {
 
             Value initial_value = interpret_node(initializer, env);
 
-            if (strcmp(type_name, "int") == 0) {
-                if (initial_value.type != VALUE_TYPE_INT && initial_value.type != VALUE_TYPE_BOOL) {
-                    fprintf(stderr, "実行時エラー (行 %d): '%s' 型の変数 '%s' に互換性のない型の値を初期化しようとしました。\n", node->line, type_name, var_name);
-                    exit(EXIT_FAILURE);
-                }
-                // bool (1/0) は int に変換可能
-                if (initial_value.type == VALUE_TYPE_BOOL) {
-                    initial_value.type = VALUE_TYPE_INT;
-                    initial_value.data.int_value = initial_value.data.bool_value ? 1 : 0;
-                }
-                define_symbol(env, var_name, initial_value);
-            } else if (strcmp(type_name, "str") == 0) {
-                if (initial_value.type != VALUE_TYPE_STR) {
-                    fprintf(stderr, "実行時エラー (行 %d): '%s' 型の変数 '%s' に互換性のない型の値を初期化しようとしました。\n", node->line, type_name, var_name);
-                    exit(EXIT_FAILURE);
-                }
-                define_symbol(env, var_name, initial_value);
-            } else if (strcmp(type_name, "double") == 0) {
-                if (initial_value.type != VALUE_TYPE_DOUBLE && initial_value.type != VALUE_TYPE_INT && initial_value.type != VALUE_TYPE_BOOL) {
-                    fprintf(stderr, "実行時エラー (行 %d): '%s' 型の変数 '%s' に互換性のない型の値を初期化しようとしました。\n", node->line, type_name, var_name);
-                    exit(EXIT_FAILURE);
-                }
-                // int/bool から double への暗黙の変換を許可
-                initial_value = convert_value_to_double(initial_value);
-                define_symbol(env, var_name, initial_value);
-            } else if (strcmp(type_name, "bool") == 0) {
-                if (initial_value.type != VALUE_TYPE_BOOL && initial_value.type != VALUE_TYPE_INT) {
-                    fprintf(stderr, "実行時エラー (行 %d): '%s' 型の変数 '%s' に互換性のない型の値を初期化しようとしました。\n", node->line, type_name, var_name);
-                    exit(EXIT_FAILURE);
-                }
-                // int (1/0) から bool へ
-                if (initial_value.type == VALUE_TYPE_INT) {
-                    initial_value.type = VALUE_TYPE_BOOL;
-                    initial_value.data.bool_value = (initial_value.data.int_value != 0); // 0はFalse, それ以外はTrue
-                }
-                define_symbol(env, var_name, initial_value);
+            // 型検査で確認済みなら初期化式は既に宣言型の値を返す
+            CoerceResult coerced = node->data.var_decl.checked
+                ? COERCE_OK : coerce_to_declared_type(node->data.var_decl.decl_type, &initial_value);
+            if (coerced != COERCE_OK) {
+                free_value_data(initial_value);
             }
-            else {
-                fprintf(stderr, "実行時エラー (行 %d): 不明な型 '%s' です。\n", node->line, type_name);
-                exit(EXIT_FAILURE);
+            if (coerced == COERCE_INCOMPATIBLE) {
+                runtime_error(node->line, "'%s' 型の変数 '%s' に互換性のない型の値を初期化しようとしました。", type_name, var_name);
+            } else if (coerced == COERCE_UNKNOWN_TYPE) {
+                runtime_error(node->line, "不明な型 '%s' です。", type_name);
+            }
+
+            if (node->data.var_decl.slot >= 0) {
+                Value *slot = &FRAME_SLOT(env, node->data.var_decl.slot);
+                free_value_data(*slot); // 同名の再宣言なら古い値を解放
+                *slot = initial_value;
+            } else {
+                define_symbol_hashed(env, var_name, node->data.var_decl.name_hash, initial_value);
             }
             break;
         }
         case NODE_ASSIGNMENT: { 
             const char *var_name = node->data.assignment.name;
             ASTNode *value_expr = node->data.assignment.value;
+            int slot_index = node->data.assignment.slot;
 
-            SymbolEntry *entry = get_symbol(env, var_name);
-            if (entry == NULL) {
-                fprintf(stderr, "実行時エラー (行 %d): 未定義の変数 '%s' に代入しようとしました。\n", node->line, var_name);
-                exit(EXIT_FAILURE);
+            SymbolEntry *entry = NULL;
+            if (slot_index >= 0) {
+                if (VAL_TYPE(FRAME_SLOT(env, slot_index)) == VALUE_TYPE_UNKNOWN) {
+                    runtime_error(node->line, "未定義の変数 '%s' に代入しようとしました。", var_name);
+                }
+            } else {
+                entry = get_symbol_hashed(env, var_name, node->data.assignment.name_hash);
+                if (entry == NULL) {
+                    runtime_error(node->line, "未定義の変数 '%s' に代入しようとしました。", var_name);
+                }
             }
 
             Value new_value = interpret_node(value_expr, env);
 
+            // 右辺の評価中にスタックが伸長され得るので、代入先はここで引き直す
+            Value *target = (slot_index >= 0) ? &FRAME_SLOT(env, slot_index) : &entry->value;
+
+            // 型検査で確認済みなら右辺は既に代入先と同じ型の値を返す
+            if (node->data.assignment.checked) {
+                free_value_data(*target);
+                *target = new_value;
+                break;
+            }
+
             // 型チェックと代入
-            if (entry->type == VALUE_TYPE_INT) {
-                if (new_value.type == VALUE_TYPE_INT) {
-                    entry->value.data.int_value = new_value.data.int_value;
-                } else if (new_value.type == VALUE_TYPE_BOOL) { // boolからintへ
-                    entry->value.data.int_value = new_value.data.bool_value ? 1 : 0;
+            ValueType target_type = VAL_TYPE(*target);
+            ValueType new_type = VAL_TYPE(new_value);
+            Value assigned;
+            if (target_type == VALUE_TYPE_INT) {
+                if (new_type == VALUE_TYPE_INT) {
+                    assigned = new_value;
+                } else if (new_type == VALUE_TYPE_BOOL) { // boolからintへ
+                    assigned = INT_VAL(AS_BOOL(new_value) ? 1 : 0);
                 } else {
-                    fprintf(stderr, "実行時エラー (行 %d): '%s' 変数に互換性のない型の値を代入しようとしました。\n", node->line, var_name);
-                    exit(EXIT_FAILURE);
+                    free_value_data(new_value);
+                    runtime_error(node->line, "'%s' 変数に互換性のない型の値を代入しようとしました。", var_name);
                 }
-            } else if (entry->type == VALUE_TYPE_STR) {
-                if (new_value.type == VALUE_TYPE_STR) {
-                    // 既存の文字列を解放してから新しい文字列をコピー
-                    free_value_data(entry->value);
-                    entry->value.data.str_value = new_value.data.str_value; // strdupされたものがそのまま来る
+            } else if (target_type == VALUE_TYPE_STR) {
+                if (new_type == VALUE_TYPE_STR) {
+                    assigned = new_value; // 一時的な値はそのまま移す (コピーしない)
                 } else {
-                    fprintf(stderr, "実行時エラー (行 %d): '%s' 変数に互換性のない型の値を代入しようとしました。\n", node->line, var_name);
-                    exit(EXIT_FAILURE);
+                    free_value_data(new_value);
+                    runtime_error(node->line, "'%s' 変数に互換性のない型の値を代入しようとしました。", var_name);
                 }
-            } else if (entry->type == VALUE_TYPE_DOUBLE) {
-                if (new_value.type == VALUE_TYPE_DOUBLE) {
-                    entry->value.data.double_value = new_value.data.double_value;
-                } else if (new_value.type == VALUE_TYPE_INT) { // intからdoubleへ
-                    entry->value.data.double_value = (double)new_value.data.int_value;
-                } else if (new_value.type == VALUE_TYPE_BOOL) { // boolからdoubleへ
-                    entry->value.data.double_value = new_value.data.bool_value ? 1.0 : 0.0;
+            } else if (target_type == VALUE_TYPE_DOUBLE) {
+                if (new_type == VALUE_TYPE_DOUBLE) {
+                    assigned = new_value;
+                } else if (new_type == VALUE_TYPE_INT) { // intからdoubleへ
+                    assigned = DOUBLE_VAL((double)AS_INT(new_value));
+                    free_value_data(new_value);
+                } else if (new_type == VALUE_TYPE_BOOL) { // boolからdoubleへ
+                    assigned = DOUBLE_VAL(AS_BOOL(new_value) ? 1.0 : 0.0);
                 } else {
-                    fprintf(stderr, "実行時エラー (行 %d): '%s' 変数に互換性のない型の値を代入しようとしました。\n", node->line, var_name);
-                    exit(EXIT_FAILURE);
+                    free_value_data(new_value);
+                    runtime_error(node->line, "'%s' 変数に互換性のない型の値を代入しようとしました。", var_name);
                 }
-            } else if (entry->type == VALUE_TYPE_BOOL) {
-                if (new_value.type == VALUE_TYPE_BOOL) {
-                    entry->value.data.bool_value = new_value.data.bool_value;
-                } else if (new_value.type == VALUE_TYPE_INT) { // int (1/0)からboolへ
-                    entry->value.data.bool_value = (new_value.data.int_value != 0);
+            } else if (target_type == VALUE_TYPE_BOOL) {
+                if (new_type == VALUE_TYPE_BOOL) {
+                    assigned = new_value;
+                } else if (new_type == VALUE_TYPE_INT) { // int (1/0)からboolへ
+                    assigned = BOOL_VAL(AS_INT(new_value) != 0);
+                    free_value_data(new_value);
                 } else {
-                    fprintf(stderr, "実行時エラー (行 %d): '%s' 変数に互換性のない型の値を代入しようとしました。\n", node->line, var_name);
-                    exit(EXIT_FAILURE);
+                    free_value_data(new_value);
+                    runtime_error(node->line, "'%s' 変数に互換性のない型の値を代入しようとしました。", var_name);
+                }
+            } else if (target_type == VALUE_TYPE_INT_ARRAY || target_type == VALUE_TYPE_DOUBLE_ARRAY || target_type == VALUE_TYPE_MAT ||
+                       target_type == VALUE_TYPE_FUTURE) {
+                assigned = new_value;
+                if (coerce_to_declared_type(target_type, &assigned) != COERCE_OK) {
+                    free_value_data(new_value);
+                    runtime_error(node->line, "'%s' 変数に互換性のない型の値を代入しようとしました。", var_name);
                 }
             }
             else {
-                fprintf(stderr, "実行時エラー (行 %d): '%s' 変数への代入がサポートされていない型です。\n", node->line, var_name);
-                exit(EXIT_FAILURE);
+                free_value_data(new_value);
+                runtime_error(node->line, "'%s' 変数への代入がサポートされていない型です。", var_name);
             }
+            // 既存の値 (文字列やヒープ上の int) を解放してから置き換える
+            free_value_data(*target);
+            *target = assigned;
             break;
         }
         case NODE_IDENTIFIER_EXPR: { 
-            SymbolEntry *entry = get_symbol(env, node->data.identifier_expr.name);
-            if (entry == NULL) {
-                fprintf(stderr, "実行時エラー (行 %d): 未定義の識別子 '%s' です。\n", node->line, node->data.identifier_expr.name);
-                exit(EXIT_FAILURE);
-            }
-            result = entry->value;
-            if (result.type == VALUE_TYPE_STR && result.data.str_value != NULL) {
-                result.data.str_value = strdup(result.data.str_value);
+            if (node->data.identifier_expr.slot >= 0) {
+                result = FRAME_SLOT(env, node->data.identifier_expr.slot);
+                if (VAL_TYPE(result) == VALUE_TYPE_UNKNOWN) {
+                    runtime_error(node->line, "未定義の識別子 '%s' です。", node->data.identifier_expr.name);
+                }
+            } else {
+                SymbolEntry *entry = get_symbol_hashed(env, node->data.identifier_expr.name, node->data.identifier_expr.name_hash);
+                if (entry == NULL) {
+                    runtime_error(node->line, "未定義の識別子 '%s' です。", node->data.identifier_expr.name);
+                }
+                result = entry->value;
             }
+            result = copy_value(result);
             break;
         }
         case NODE_ADD:
         case NODE_SUBTRACT:
         case NODE_MULTIPLY:
         case NODE_DIVIDE: { 
-            Value left_val = interpret_node(node->data.binary_expr.left, env);
+            // 右辺の評価中に実行時エラーが起きても左辺が解放されるよう、評価の間は値スタックに積んでおく
+            push_temporary(env->state, interpret_node(node->data.binary_expr.left, env));
             Value right_val = interpret_node(node->data.binary_expr.right, env);
+            Value left_val = pop_temporary(env->state);
+
+            // 配列を含む演算は要素ごと (両方の参照を結果に移す)
+            if (VAL_IS_ARRAY(left_val) || VAL_IS_ARRAY(right_val)) {
+                ArrayOp op = (node->type == NODE_ADD) ? ARRAY_OP_ADD
+                           : (node->type == NODE_SUBTRACT) ? ARRAY_OP_SUBTRACT
+                           : (node->type == NODE_MULTIPLY) ? ARRAY_OP_MULTIPLY : ARRAY_OP_DIVIDE;
+                result = array_arithmetic(op, left_val, right_val, node->line);
+                break;
+            }
+
+            // str + str は連結 (両方の参照を結果に移す)
+            if (node->type == NODE_ADD && VAL_TYPE(left_val) == VALUE_TYPE_STR && VAL_TYPE(right_val) == VALUE_TYPE_STR) {
+                result = concat_string_values(left_val, right_val);
+                break;
+            }
 
             // 演算の型を決定: どちらかがdoubleなら結果もdouble、両方intなら結果もint
-            bool use_double = (left_val.type == VALUE_TYPE_DOUBLE || right_val.type == VALUE_TYPE_DOUBLE);
+            bool use_double = (VAL_TYPE(left_val) == VALUE_TYPE_DOUBLE || VAL_TYPE(right_val) == VALUE_TYPE_DOUBLE);
 
             if (use_double) {
-                Value d_left = convert_value_to_double(left_val);
-                Value d_right = convert_value_to_double(right_val);
-                result.type = VALUE_TYPE_DOUBLE;
+                if (!is_scalar_number(left_val) || !is_scalar_number(right_val)) {
+                    free_value_data(left_val);
+                    free_value_data(right_val);
+                    runtime_error(node->line, "算術演算子に互換性のない型です。");
+                }
+                double d_left = AS_DOUBLE(convert_value_to_double(left_val, node->line));
+                double d_right = AS_DOUBLE(convert_value_to_double(right_val, node->line));
                 switch (node->type) {
                     case NODE_ADD:
-                        result.data.double_value = d_left.data.double_value + d_right.data.double_value;
+                        result = DOUBLE_VAL(d_left + d_right);
                         break;
                     case NODE_SUBTRACT:
-                        result.data.double_value = d_left.data.double_value - d_right.data.double_value;
+                        result = DOUBLE_VAL(d_left - d_right);
                         break;
                     case NODE_MULTIPLY:
-                        result.data.double_value = d_left.data.double_value * d_right.data.double_value;
+                        result = DOUBLE_VAL(d_left * d_right);
                         break;
                     case NODE_DIVIDE:
-                        if (d_right.data.double_value == 0.0) {
-                            fprintf(stderr, "実行時エラー (行 %d): 0による除算です。\n", node->line);
-                            exit(EXIT_FAILURE);
+                        if (d_right == 0.0) {
+                            free_value_data(left_val);
+                            free_value_data(right_val);
+                            runtime_error(node->line, "0による除算です。");
                         }
-                        result.data.double_value = d_left.data.double_value / d_right.data.double_value;
+                        result = DOUBLE_VAL(d_left / d_right);
                         break;
                     default: break;
                 }
-            } else if (left_val.type == VALUE_TYPE_INT && right_val.type == VALUE_TYPE_INT) {
-                result.type = VALUE_TYPE_INT;
+            } else if (VAL_TYPE(left_val) == VALUE_TYPE_INT && VAL_TYPE(right_val) == VALUE_TYPE_INT) {
+                long i_left = AS_INT(left_val);
+                long i_right = AS_INT(right_val);
                 switch (node->type) {
                     case NODE_ADD:
-                        result.data.int_value = left_val.data.int_value + right_val.data.int_value;
+                        result = INT_VAL(add_ints(i_left, i_right));
                         break;
                     case NODE_SUBTRACT:
-                        result.data.int_value = left_val.data.int_value - right_val.data.int_value;
+                        result = INT_VAL(subtract_ints(i_left, i_right));
                         break;
                     case NODE_MULTIPLY:
-                        result.data.int_value = left_val.data.int_value * right_val.data.int_value;
+                        result = INT_VAL(multiply_ints(i_left, i_right));
                         break;
                     case NODE_DIVIDE:
-                        if (right_val.data.int_value == 0) {
-                            fprintf(stderr, "実行時エラー (行 %d): 0による除算です。\n", node->line);
-                            exit(EXIT_FAILURE);
+                        if (i_right == 0) {
+                            free_value_data(left_val);
+                            free_value_data(right_val);
+                            runtime_error(node->line, "0による除算です。");
                         }
-                        result.data.int_value = left_val.data.int_value / right_val.data.int_value;
+                        result = INT_VAL(divide_ints(i_left, i_right));
                         break;
                     default: break;
                 }
             } else {
-                fprintf(stderr, "実行時エラー (行 %d): 算術演算子に互換性のない型です。\n", node->line);
-                exit(EXIT_FAILURE);
+                free_value_data(left_val);
+                free_value_data(right_val);
+                runtime_error(node->line, "算術演算子に互換性のない型です。");
+            }
+            free_value_data(left_val); // 中間結果の文字列やヒープ上の int があれば解放
+            free_value_data(right_val);
+            break;
+        }
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_DIVIDE_INT: {
+            // 両辺とも int であることを型検査で確認済み
+            long i_left = int_operand(node->data.binary_expr.left, env);
+            long i_right = int_operand(node->data.binary_expr.right, env);
+            switch (node->type) {
+                case NODE_ADD_INT:
+                    result = INT_VAL(add_ints(i_left, i_right));
+                    break;
+                case NODE_SUBTRACT_INT:
+                    result = INT_VAL(subtract_ints(i_left, i_right));
+                    break;
+                case NODE_MULTIPLY_INT:
+                    result = INT_VAL(multiply_ints(i_left, i_right));
+                    break;
+                default:
+                    if (i_right == 0) {
+                        runtime_error(node->line, "0による除算です。");
+                    }
+                    result = INT_VAL(divide_ints(i_left, i_right));
+                    break;
+            }
+            break;
+        }
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE: {
+            // 両辺とも double であることを型検査で確認済み (int, bool は変換ノードで広げてある)
+            double d_left = AS_DOUBLE(interpret_node(node->data.binary_expr.left, env));
+            double d_right = AS_DOUBLE(interpret_node(node->data.binary_expr.right, env));
+            switch (node->type) {
+                case NODE_ADD_DOUBLE:
+                    result = DOUBLE_VAL(d_left + d_right);
+                    break;
+                case NODE_SUBTRACT_DOUBLE:
+                    result = DOUBLE_VAL(d_left - d_right);
+                    break;
+                case NODE_MULTIPLY_DOUBLE:
+                    result = DOUBLE_VAL(d_left * d_right);
+                    break;
+                default:
+                    if (d_right == 0.0) {
+                        runtime_error(node->line, "0による除算です。");
+                    }
+                    result = DOUBLE_VAL(d_left / d_right);
+                    break;
+            }
+            break;
+        }
+        case NODE_CONCAT: {
+            push_temporary(env->state, interpret_node(node->data.binary_expr.left, env));
+            Value right_val = interpret_node(node->data.binary_expr.right, env);
+            Value left_val = pop_temporary(env->state);
+            result = concat_string_values(left_val, right_val);
+            break;
+        }
+        case NODE_CONVERT: {
+            result = convert_value(interpret_node(node->data.convert.operand, env), node->data.convert.to);
+            break;
+        }
+        case NODE_ARRAY_LITERAL: {
+            result = evaluate_array_literal(node, env);
+            break;
+        }
+        case NODE_INDEX: {
+            // 添字の評価や検査が失敗しても解放されるよう、対象と添字は値スタックに積んで読む
+            ExecState *state = env->state;
+            int base = state->stack_top;
+            push_temporary(state, interpret_node(node->data.index_expr.target, env));
+            push_temporary(state, interpret_node(node->data.index_expr.index, env));
+            if (node->data.index_expr.column != NULL) {
+                push_temporary(state, interpret_node(node->data.index_expr.column, env));
+                result = matrix_element(state->stack[base], state->stack[base + 1], state->stack[base + 2], node->line);
+            } else {
+                result = array_element(state->stack[base], state->stack[base + 1], node->line);
+            }
+            release_temporaries(state, base);
+            break;
+        }
+        case NODE_INDEX_ASSIGNMENT: {
+            assign_element(node, env);
+            break;
+        }
+        case NODE_YIELD: {
+            // 値を消費者に渡し、次の値を求められるまで止まる
+            generator_yield(env->state, interpret_node(node->data.yield_stmt.value, env));
+            break;
+        }
+        case NODE_FORK: {
+            // 重い呼び出しを作業スレッドに渡してから、式をいつもの順に評価する
+            // (プールのスレッドが1つなら、呼び出しはそれぞれの位置でそのまま実行する)
+            if (parallel_pool_size() > 1) {
+                start_forks(node->data.fork_expr.body, env);
+            }
+            result = interpret_node(node->data.fork_expr.body, env);
+            break;
+        }
+        case NODE_FOR: {
+            if (node->data.for_stmt.iterable != NULL) {
+                iterate_generator(node, env);
+                break;
+            }
+            // 範囲は一度だけ評価し、ループ変数は C の long で数えてスロットに直接書き込む
+            long start = range_bound(interpret_node(node->data.for_stmt.start, env), node->line);
+            long end = range_bound(interpret_node(node->data.for_stmt.end, env), node->line);
+            int slot = node->data.for_stmt.slot;
+            ASTNode **statements = node->data.for_stmt.body->data.block.statements;
+            int num_statements = node->data.for_stmt.body->data.block.num_statements;
+            ASTNode *function = loop_tier_function(node, env);
+            long *load_budget = env->state->load_budget;
+            for (long i = start; i < end; i++) {
+                if (load_budget != NULL) {
+                    spend_load_step(load_budget, node->line);
+                }
+                if (function != NULL && (i - start) % TIER_LOOP_BATCH == TIER_LOOP_BATCH - 1) {
+                    tier_count_iterations(function, TIER_LOOP_BATCH);
+                }
+                // 本体の呼び出しでスタックが伸長され得るので、スロットは毎回引き直す
+                Value *counter = &FRAME_SLOT(env, slot);
+                free_value_data(*counter); // 本体で代入された値 (ヒープ上の int) を解放
+                *counter = INT_VAL(i);
+                for (int j = 0; j < num_statements; j++) {
+                    free_value_data(interpret_node(statements[j], env));
+                }
+            }
+            if (function != NULL && end > start) {
+                tier_count_iterations(function, (unsigned int)((end - start) % TIER_LOOP_BATCH)); // 端数
             }
-            free_value_data(left_val); // 中間結果の文字列があれば解放
-            free_value_data(right_val); // 中間結果の文字列があれば解放
             break;
         }
         default: 
-            fprintf(stderr, "実行時エラー (行 %d): 未知のASTノードタイプ: %d\n", node->line, node->type);
-            exit(EXIT_FAILURE);
+            runtime_error(node->line, "未知のASTノードタイプ: %d", node->type);
     }
     return result;
 }
 
-// ASTを解釈するエントリポイント
-void interpret_ast(ASTNode *program_node) {
-    Environment *global_env = create_environment(NULL); // グローバルスコープ
+// 空の値スタックの実行状態を用意する
+void init_exec_state(ExecState *state, Environment *globals, OutputWriter *out, TaskGroup *tasks) {
+    state->stack = NULL;
+    state->stack_top = 0;
+    state->stack_capacity = 0;
+    state->globals = globals;
+    state->out = out;
+    state->load_budget = NULL;
+    state->generator = NULL;
+    state->tasks = tasks;
+}
+
+typedef struct LoadEvaluation {
+    ASTNode *node;
+    Environment *frame;
+    Value value;
+} LoadEvaluation;
+
+static void evaluate_load_body(void *arg) {
+    LoadEvaluation *evaluation = arg;
+    evaluation->value = interpret_node(evaluation->node, evaluation->frame);
+}
+
+// ロード時に式を評価して *value に入れる (consteval.c が純粋な関数の呼び出しを評価するのに使う)
+// 専用の値スタックで評価し、段階的実行のための呼び出し回数は数えない。
+// 評価が LOAD_STEP_BUDGET を使い切ったら打ち切って false を返す (式は実行時に評価する)。
+// 実行時エラーは値スタックを片付けてから呼び出し側の戻り先へ報告し直す。
+bool evaluate_at_load(ASTNode *node, Environment *globals, Value *value) {
+    TaskGroup tasks; // parallel_map のチャンク (評価を終える前に全て終わる)
+    task_group_init(&tasks);
+    ExecState state;
+    init_exec_state(&state, globals, NULL, &tasks); // 純粋な関数は print しない
+    long budget = LOAD_STEP_BUDGET; // parallel_map のチャンクと共有する (原子的に読み書きする)
+    state.load_budget = &budget;
+    Environment root_frame;
+    init_frame_environment(&root_frame, &state, 0);
+
+    LoadEvaluation evaluation = { node, &root_frame, VOID_VAL };
+    char *message = run_trapping_errors(evaluate_load_body, &evaluation);
+    if (message != NULL) {
+        for (int i = 0; i < state.stack_top; i++) {
+            free_value_data(state.stack[i]);
+        }
+    }
+    free(state.stack);
+    task_group_destroy(&tasks);
+    if (message != NULL && __atomic_load_n(&budget, __ATOMIC_SEQ_CST) < 0) {
+        free(message);
+        return false;
+    }
+    if (message != NULL) {
+        raise_error_message(message);
+    }
+    *value = evaluation.value;
+    return true;
+}
+
+// プログラムを読み込み、main を実行できる状態にする (AST は呼び出し側が所有し続ける)
+// 静的なエラーは compile_error で報告する。その戻り先で打ち切られても、
+// それまでに作ったものは unload_program で片付けられる。
+void load_program(LoadedProgram *program, ASTNode *program_node, const LoadOptions *options) {
+    program->ast = program_node;
+    program->globals = NULL;
+    program->main_call = NULL;
+    program->memoized = false;
+
+    // ローカル変数と引数をフレーム内のスロットに解決する
+    resolve_program(program_node);
+
+    // 実行されることのない関数と文を取り除く (以降の登録や型検査の対象にしない)
+    eliminate_unreachable_code(program_node);
+
+    program->globals = create_environment(NULL); // グローバルスコープ
 
     // プログラム内の全てのトップレベル文（関数定義など）を処理し、シンボルテーブルに登録
     // この段階では関数は「定義」されるだけで「実行」はされない
     if (program_node->type == NODE_PROGRAM) {
         for (int i = 0; i < program_node->data.program.num_statements; i++) {
-            interpret_node(program_node->data.program.statements[i], global_env);
-        }
-    }
-
-    // ここで 'main' 関数を検索し、存在すれば呼び出す
-    SymbolEntry *main_func_entry = get_symbol(global_env, "main");
-    if (main_func_entry != NULL && main_func_entry->type == VALUE_TYPE_FUNCTION) {
-        // main 関数呼び出しのASTノードを仮想的に作成
-        ASTNode *main_call_node = create_ast_node(NODE_FUNCTION_CALL, 0); // 行番号は適当
-        main_call_node->data.func_call.function_name = strdup("main");
-        // main関数は引数なしを想定
-        main_call_node->data.func_call.arguments = NULL; 
-        main_call_node->data.func_call.num_arguments = 0;
-        main_call_node->data.func_call.capacity_arguments = 0;
-        
-        // main 関数を実行
-        Value return_value = interpret_node(main_call_node, global_env);
-        
-        // main関数の戻り値が存在する場合は表示
-        if (return_value.type != VALUE_TYPE_VOID) {
-            print_value(return_value, -1); // mainの戻り値は通常精度で表示
-            free_value_data(return_value); // 文字列の場合の解放
+            interpret_node(program_node->data.program.statements[i], program->globals);
         }
+    }
+
+    // main を実行する前に全ての関数を型検査し、型の確定した式を特殊化する
+    typecheck_program(program_node, program->globals);
+    evaluate_constants(program_node, program->globals);
+    eliminate_dead_stores(program_node);
+    program->memoized = configure_memoization(program_node, options->memoize_all);
+    configure_auto_parallel(program_node, options->auto_parallel);
+
+    // ここで 'main' 関数を検索し、存在すれば呼び出すノードを作る
+    SymbolEntry *main_func_entry = get_symbol(program->globals, "main");
+    if (main_func_entry == NULL || VAL_TYPE(main_func_entry->value) != VALUE_TYPE_FUNCTION) {
+        return;
+    }
+    const ASTNode *main_def = AS_FUNC(main_func_entry->value);
+    if (main_def->data.func_def.generator) {
+        // 呼び出しても本体が実行されない
+        compile_error(main_def->line, "main 関数に 'yield' を書くことはできません。");
+    }
+    // main 関数呼び出しのASTノードを仮想的に作成
+    ASTNode *main_call_node = create_ast_node(NODE_FUNCTION_CALL, 0); // 行番号は適当
+    main_call_node->data.func_call.function_name = strdup("main");
+    main_call_node->data.func_call.name_hash = hash_symbol_name("main");
+    // main関数は引数なしを想定
+    main_call_node->data.func_call.arguments = NULL;
+    main_call_node->data.func_call.num_arguments = 0;
+    main_call_node->data.func_call.capacity_arguments = 0;
+    program->main_call = main_call_node;
+}
 
+// 読み込んだプログラムを片付ける (AST は解放しない。実行中のものがあってはならない)
+void unload_program(LoadedProgram *program) {
+    // このプログラムの関数の最適化が残っていれば、ASTが解放される前に終わらせる
+    tier_wait_for_compiles(program->ast);
+    if (program->main_call != NULL) {
         // 仮想ノードの解放
-        free(main_call_node->data.func_call.function_name);
-        free(main_call_node);
-    } 
+        free(program->main_call->data.func_call.function_name);
+        free(program->main_call);
+        program->main_call = NULL;
+    }
+    // メモは関数定義のアドレスで引くので、このプログラムの関数の記録を捨てる (他のプログラムの記録は残す)
+    if (program->memoized) {
+        memo_forget_program(program->ast);
+        program->memoized = false;
+    }
+    if (program->globals != NULL) {
+        destroy_environment(program->globals);
+        program->globals = NULL;
+    }
+}
+
+// main を実行し、戻り値があれば出力する (state は init_exec_state で用意した、この実行だけの状態)
+// 実行時エラーは runtime_error で報告する。戻り先で打ち切られたら、呼び出し側が state の組の
+// タスクを discard_tasks で終わらせてから値スタックを片付ける。
+void run_main(const LoadedProgram *program, ExecState *state) {
+    if (program->main_call == NULL) {
+        return;
+    }
+    Environment root_frame;
+    init_frame_environment(&root_frame, state, 0);
+
+    // main 関数を実行
+    Value return_value = interpret_node(program->main_call, &root_frame);
+    // join されていない spawn したタスクが残っていれば、終わるまで待つ
+    wait_for_tasks(state->tasks);
 
-    destroy_environment(global_env);
-}
\ No newline at end of file
+    // main関数の戻り値が存在する場合は表示
+    if (VAL_TYPE(return_value) != VALUE_TYPE_VOID) {
+        print_value(state->out, return_value, -1); // mainの戻り値は通常精度で表示
+        free_value_data(return_value); // 文字列の場合の解放
+    }
+}
+
+// ASTを解釈するエントリポイント (コマンドライン用: エラーは報告して終了する)
+void interpret_ast(ASTNode *program_node, OutputWriter *out, const LoadOptions *options) {
+    LoadedProgram program;
+    load_program(&program, program_node, options);
+
+    // 全ての呼び出しフレームが共有する値スタック
+    TaskGroup tasks;
+    task_group_init(&tasks);
+    ExecState state;
+    init_exec_state(&state, program.globals, out, &tasks);
+    run_main(&program, &state);
+    free(state.stack);
+    task_group_destroy(&tasks);
+
+    unload_program(&program);
+}
@@ -0,0 +1,188 @@
+#include "kappok.h"
+
+// 参照カウント付きの不変文字列を作る (参照カウント1で返す)
+KString *kstring_new(const char *data, size_t length) {
+    KString *str = malloc(sizeof(KString) + length + 1);
+    if (str == NULL) {
+        perror("Failed to allocate string");
+        exit(EXIT_FAILURE);
+    }
+    str->refcount = 1;
+    str->is_rope = false;
+    str->length = length;
+    str->left = NULL;
+    str->right = NULL;
+    memcpy(str->data, data, length);
+    str->data[length] = '\0';
+    str->chars = str->data;
+    return str;
+}
+
+// left と right の参照を1つずつ受け取ってロープ節を作る
+static KString *kstring_new_rope(KString *left, KString *right) {
+    KString *str = malloc(sizeof(KString));
+    if (str == NULL) {
+        perror("Failed to allocate rope");
+        exit(EXIT_FAILURE);
+    }
+    str->refcount = 1;
+    str->is_rope = true;
+    str->length = left->length + right->length;
+    str->chars = NULL;
+    str->left = left;
+    str->right = right;
+    return str;
+}
+
+void kstring_retain(KString *str) {
+    __atomic_fetch_add(&str->refcount, 1, __ATOMIC_RELAXED);
+}
+
+// ロープをたどるための明示的なスタック (長い連結の連鎖でも再帰しない)
+typedef struct KStringStack {
+    KString **items;
+    int count;
+    int capacity;
+} KStringStack;
+
+static void push_kstring(KStringStack *stack, KString *str) {
+    if (stack->count >= stack->capacity) {
+        int new_capacity = (stack->capacity == 0) ? 16 : stack->capacity * 2;
+        stack->items = realloc(stack->items, sizeof(KString *) * new_capacity);
+        if (stack->items == NULL) {
+            perror("Failed to reallocate rope stack");
+            exit(EXIT_FAILURE);
+        }
+        stack->capacity = new_capacity;
+    }
+    stack->items[stack->count++] = str;
+}
+
+void kstring_release(KString *str) {
+    KStringStack stack = { NULL, 0, 0 };
+    while (str != NULL) {
+        // 最後の参照を落としたスレッドだけが解放する
+        if (__atomic_sub_fetch(&str->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+            if (str->is_rope) {
+                if (str->chars != NULL) {
+                    free((char *)str->chars);
+                }
+                push_kstring(&stack, str->right);
+                KString *left = str->left;
+                free(str);
+                str = left;
+                continue;
+            }
+            free(str);
+        }
+        str = (stack.count > 0) ? stack.items[--stack.count] : NULL;
+    }
+    free(stack.items);
+}
+
+// ロープを平坦化した文字列を返す (結果は節にキャッシュされ、2回目以降はそのまま返る)
+static const char *kstring_flatten(KString *str) {
+    const char *chars = __atomic_load_n(&str->chars, __ATOMIC_ACQUIRE);
+    if (chars != NULL) {
+        return chars;
+    }
+
+    char *buffer = malloc(str->length + 1);
+    if (buffer == NULL) {
+        perror("Failed to allocate flattened string");
+        exit(EXIT_FAILURE);
+    }
+
+    // 左から順に葉 (または平坦化済みの節) をコピーする
+    KStringStack stack = { NULL, 0, 0 };
+    size_t pos = 0;
+    push_kstring(&stack, str);
+    while (stack.count > 0) {
+        KString *node = stack.items[--stack.count];
+        const char *node_chars = __atomic_load_n(&node->chars, __ATOMIC_ACQUIRE);
+        if (node_chars != NULL) {
+            memcpy(buffer + pos, node_chars, node->length);
+            pos += node->length;
+        } else {
+            push_kstring(&stack, node->right);
+            push_kstring(&stack, node->left);
+        }
+    }
+    free(stack.items);
+    buffer[pos] = '\0';
+
+    // 他のスレッドが先に平坦化していたらそちらを使う
+    const char *expected = NULL;
+    if (!__atomic_compare_exchange_n(&str->chars, &expected, buffer, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(buffer);
+        return expected;
+    }
+    return buffer;
+}
+
+// 文字列値を作る: 短ければ Value にインラインで持ち、長ければ KString を確保する
+Value make_string_value(const char *data, size_t length) {
+    if (length <= SMALL_STR_MAX) {
+        return small_str_value(data, length);
+    }
+    return STR_VAL(kstring_new(data, length));
+}
+
+// 文字列値から KString の参照を1つ取り出す (インライン文字列はヒープに移す)
+static KString *take_kstring(Value value) {
+    if (VAL_IS_HEAP_STR(value)) {
+        return AS_KSTRING(value);
+    }
+    char buf[8];
+    size_t length = small_str_copy(value, buf);
+    return kstring_new(buf, length);
+}
+
+static size_t string_value_length(Value value) {
+    return VAL_IS_HEAP_STR(value) ? AS_KSTRING(value)->length : small_str_length(value);
+}
+
+// 2つの文字列値を連結する (両方の参照を受け取る)
+// 長い結果は左右を共有するロープ節にするので、繰り返し連結しても1回あたり O(1) で済む
+Value concat_string_values(Value left, Value right) {
+    size_t left_length = string_value_length(left);
+    size_t right_length = string_value_length(right);
+
+    if (right_length == 0) {
+        free_value_data(right);
+        return left;
+    }
+    if (left_length == 0) {
+        free_value_data(left);
+        return right;
+    }
+
+    size_t length = left_length + right_length;
+    if (length < ROPE_MIN_LENGTH) {
+        // 短い結果はその場でコピーする (ロープ節より小さく、平坦化も不要)
+        char buf[ROPE_MIN_LENGTH];
+        StrView left_view;
+        StrView right_view;
+        string_view(left, &left_view);
+        string_view(right, &right_view);
+        memcpy(buf, left_view.data, left_length);
+        memcpy(buf + left_length, right_view.data, right_length);
+        free_value_data(left);
+        free_value_data(right);
+        return make_string_value(buf, length);
+    }
+
+    return STR_VAL(kstring_new_rope(take_kstring(left), take_kstring(right)));
+}
+
+// 文字列値の中身を参照する (ロープはここで平坦化する)
+void string_view(Value value, StrView *view) {
+    if (VAL_IS_HEAP_STR(value)) {
+        KString *str = AS_KSTRING(value);
+        view->data = str->is_rope ? kstring_flatten(str) : str->chars;
+        view->length = str->length;
+    } else {
+        view->length = small_str_copy(value, view->inline_buf);
+        view->data = view->inline_buf;
+    }
+}
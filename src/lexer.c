@@ -48,7 +48,7 @@ Token *read_string(Lexer *lexer) {
         lexer->pos++; // 終了の '"' をスキップ
     } else {
         // エラー: 閉じられていない文字列リテラル
-        fprintf(stderr, "エラー (行 %d): 閉じられていない文字列リテラルです。\n", token->line);
+        syntax_error(token->line, "閉じられていない文字列リテラルです。");
         token->type = TOKEN_UNKNOWN; // エラーを示す
     }
     
@@ -102,10 +102,26 @@ Token *read_identifier(Lexer *lexer) {
         token->type = TOKEN_DOUBLE;
     } else if (strcmp(token->value, "bool") == 0) {
         token->type = TOKEN_BOOL;
+    } else if (strcmp(token->value, "mat") == 0) {
+        token->type = TOKEN_MAT;
     } else if (strcmp(token->value, "True") == 0) {
         token->type = TOKEN_TRUE;
     } else if (strcmp(token->value, "False") == 0) {
         token->type = TOKEN_FALSE;
+    } else if (strcmp(token->value, "const") == 0) {
+        token->type = TOKEN_CONST;
+    } else if (strcmp(token->value, "for") == 0) {
+        token->type = TOKEN_FOR;
+    } else if (strcmp(token->value, "in") == 0) {
+        token->type = TOKEN_IN;
+    } else if (strcmp(token->value, "future") == 0) {
+        token->type = TOKEN_FUTURE;
+    } else if (strcmp(token->value, "spawn") == 0) {
+        token->type = TOKEN_SPAWN;
+    } else if (strcmp(token->value, "generator") == 0) {
+        token->type = TOKEN_GENERATOR;
+    } else if (strcmp(token->value, "yield") == 0) {
+        token->type = TOKEN_YIELD;
     }
     
     return token;
@@ -181,6 +197,7 @@ Token *lexer_next_token(Lexer *lexer) {
         exit(EXIT_FAILURE);
     }
     token->line = lexer->line;
+    token->value = NULL;
     
     switch (lexer->source[lexer->pos]) {
         case '(':
@@ -201,6 +218,18 @@ Token *lexer_next_token(Lexer *lexer) {
             if (token->value == NULL) { perror("strdup failed"); exit(EXIT_FAILURE); }
             lexer->pos++;
             break;
+        case '[':
+            token->type = TOKEN_LBRACKET;
+            token->value = strdup("[");
+            if (token->value == NULL) { perror("strdup failed"); exit(EXIT_FAILURE); }
+            lexer->pos++;
+            break;
+        case ']':
+            token->type = TOKEN_RBRACKET;
+            token->value = strdup("]");
+            if (token->value == NULL) { perror("strdup failed"); exit(EXIT_FAILURE); }
+            lexer->pos++;
+            break;
         case '{':
             token->type = TOKEN_LBRACE;
             token->value = strdup("{");
@@ -243,6 +272,12 @@ Token *lexer_next_token(Lexer *lexer) {
             if (token->value == NULL) { perror("strdup failed"); exit(EXIT_FAILURE); }
             lexer->pos++;
             break;
+        case '@':
+            token->type = TOKEN_AT;
+            token->value = strdup("@");
+            if (token->value == NULL) { perror("strdup failed"); exit(EXIT_FAILURE); }
+            lexer->pos++;
+            break;
         case '"':
             token_destroy(token);
             return read_string(lexer);
@@ -263,7 +298,7 @@ Token *lexer_next_token(Lexer *lexer) {
                 }
                 token->value[0] = lexer->source[lexer->pos];
                 token->value[1] = '\0';
-                fprintf(stderr, "エラー (行 %d): 不明な文字 '%c' です。\n", token->line, lexer->source[lexer->pos]);
+                syntax_error(token->line, "不明な文字 '%c' です。", lexer->source[lexer->pos]);
                 lexer->pos++;
             }
     }
@@ -1,17 +1,117 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <unistd.h>
 #include "kappok.h"
+#include "kappok_api.h"
+
+static void print_usage(const char *program) {
+    printf("使用方法: %s [--buffer line|full|none] [--tier-threshold N] [--memoize] [--simd avx2|sse2|scalar] [--threads N] [--auto-parallel] <ファイル名>\n", program);
+    printf("          %s --serve <ソケット> [--workers N] [--tier-threshold N] [--memoize] [--simd avx2|sse2|scalar] [--threads N] [--auto-parallel]\n", program);
+    printf("          %s --client <ソケット> <ファイル名>\n", program);
+}
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("使用方法: %s <ファイル名>\n", argv[0]);
+    OutputBufferMode buffer_mode = OUTPUT_BUFFER_AUTO;
+    KappokOptions options;
+    kappok_options_init(&options);
+    const char *filename = NULL;
+    const char *serve_path = NULL;
+    const char *client_path = NULL;
+    int workers = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--buffer") == 0 && i + 1 < argc) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "line") == 0) {
+                buffer_mode = OUTPUT_BUFFER_LINE;
+            } else if (strcmp(mode, "full") == 0) {
+                buffer_mode = OUTPUT_BUFFER_FULL;
+            } else if (strcmp(mode, "none") == 0) {
+                buffer_mode = OUTPUT_BUFFER_NONE;
+            } else {
+                printf("エラー: 不明なバッファモード '%s' です (line, full, none のいずれか)\n", mode);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--tier-threshold") == 0 && i + 1 < argc) {
+            // 関数を最適化するまでの呼び出し回数 (0 で無効)
+            char *end;
+            long threshold = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || threshold < 0 || threshold > INT_MAX) {
+                printf("エラー: --tier-threshold には 0 以上の整数を指定してください\n");
+                return 1;
+            }
+            options.tier_threshold = (int)threshold;
+        } else if (strcmp(argv[i], "--memoize") == 0) {
+            // 純粋な関数の呼び出し結果を全てメモ化する
+            options.memoize = true;
+        } else if (strcmp(argv[i], "--simd") == 0 && i + 1 < argc) {
+            // 配列演算で使う命令セットの上限 (既定は CPU が対応する最も広いもの)
+            const char *level = argv[++i];
+            if (strcmp(level, "avx2") == 0) {
+                set_simd_level(SIMD_AVX2);
+            } else if (strcmp(level, "sse2") == 0) {
+                set_simd_level(SIMD_SSE2);
+            } else if (strcmp(level, "scalar") == 0) {
+                set_simd_level(SIMD_SCALAR);
+            } else {
+                printf("エラー: 不明な SIMD レベル '%s' です (avx2, sse2, scalar のいずれか)\n", level);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            // parallel_map が並列に使うスレッドの数 (0 で CPU のコア数)
+            char *end;
+            long threads = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || threads < 0 || threads > 1024) {
+                printf("エラー: --threads には 0 から 1024 までの整数を指定してください\n");
+                return 1;
+            }
+            options.threads = (int)threads;
+        } else if (strcmp(argv[i], "--auto-parallel") == 0) {
+            // 互いに独立な重い純粋な呼び出しをスレッドプールで並行に評価する
+            options.auto_parallel = true;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            // 常駐してソケットで受けた実行の要求を処理する
+            serve_path = argv[++i];
+        } else if (strcmp(argv[i], "--client") == 0 && i + 1 < argc) {
+            // --serve で動いているサーバに実行を頼む
+            client_path = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            // サーバが同時に実行する要求の数 (0 で CPU のコア数)
+            char *end;
+            long count = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || count < 0 || count > 1024) {
+                printf("エラー: --workers には 0 から 1024 までの整数を指定してください\n");
+                return 1;
+            }
+            workers = (int)count;
+        } else if (filename == NULL && argv[i][0] != '-') {
+            filename = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (serve_path != NULL && client_path == NULL && filename == NULL) {
+        return run_server(serve_path, workers, &options);
+    }
+    if (client_path != NULL && serve_path == NULL && filename != NULL) {
+        return run_client(client_path, filename);
+    }
+    if (filename == NULL || serve_path != NULL || client_path != NULL) {
+        print_usage(argv[0]);
         return 1;
     }
+    if (options.tier_threshold >= 0) {
+        set_tier_threshold(options.tier_threshold);
+    }
+    set_parallel_threads(options.threads);
+    LoadOptions load_options = { options.memoize, options.auto_parallel };
     
-    FILE *file = fopen(argv[1], "r");
+    FILE *file = fopen(filename, "r");
     if (!file) {
-        printf("エラー: ファイル '%s' を開けません\n", argv[1]);
+        printf("エラー: ファイル '%s' を開けません\n", filename);
         return 1;
     }
     
@@ -36,10 +136,14 @@ int main(int argc, char *argv[]) {
     
     // ASTを構築
     ASTNode *program_node = parse(lexer);
+
+    // 標準出力への書き込みはすべてこのバッファを通す
+    OutputWriter out;
+    output_open(&out, STDOUT_FILENO, buffer_mode);
     
     // ASTを解釈・実行
     if (program_node) { // AST構築が成功した場合のみ実行
-        interpret_ast(program_node);
+        interpret_ast(program_node, &out, &load_options);
         // ASTを解放
         destroy_ast(program_node);
     }
@@ -47,6 +151,7 @@ int main(int argc, char *argv[]) {
     // レクサーを解放
     lexer_destroy(lexer);
     free(source); // ソースコードのメモリを解放
-    printf("\n");
+    output_newline(&out);
+    output_close(&out);
     return 0;
 }
@@ -0,0 +1,320 @@
+#include "kappok.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define KAPPOK_SIMD_X86 1
+#endif
+
+// 行列 (mat)
+// 要素は double で、KArray の領域に行優先で並べる (columns が列数、length / columns が行数)。
+// 要素への代入は配列と同じくコピーオンライト。
+//
+// 積は行列をキャッシュに収まる大きさのブロックに分けて計算する (GotoBLAS と同じ構成)。
+// B の KC 行 x NC 列と A の MC 行 x KC 列を、マイクロカーネルが順に読む形に詰め直し、
+// マイクロカーネルは C の MR x NR の小行列をレジスタに置いたまま KC 回の積和を行う。
+// C の各要素は k = 0, 1, ... の順に「積を丸めてから足す」ので、命令セットによらず
+// 素朴な三重ループ (c += a * b) とビット単位で同じ結果になる。
+
+#define MATMUL_MR 4   // マイクロカーネルが受け持つ C の行数
+#define MATMUL_NR 8   // マイクロカーネルが受け持つ C の列数
+#define MATMUL_KC 256 // 一度に詰める k の長さ (A と B のパネルが L1/L2 に収まる)
+#define MATMUL_MC 64  // 一度に詰める A の行数 (MATMUL_MR の倍数)
+#define MATMUL_NC 512 // 一度に詰める B の列数 (MATMUL_NR の倍数)
+
+// 行数 rows、列数 columns の行列を作る (要素は未初期化)
+KArray *matrix_new(long rows, long columns, int line) {
+    if (rows < 1 || columns < 1) {
+        runtime_error(line, "行列の行数と列数は1以上でなければなりません (%ld 行 %ld 列)。", rows, columns);
+    }
+    if ((unsigned long)rows > SIZE_MAX / (unsigned long)columns) {
+        runtime_error(line, "行列が大きすぎます (%ld 行 %ld 列)。", rows, columns);
+    }
+    KArray *matrix = karray_new(VALUE_TYPE_DOUBLE, (size_t)rows * (size_t)columns, line);
+    matrix->columns = (size_t)columns;
+    return matrix;
+}
+
+// 行と列の添字を検査して要素の位置を返す
+static size_t checked_position(const KArray *matrix, Value row, Value column, int line) {
+    ValueType row_type = VAL_TYPE(row);
+    ValueType column_type = VAL_TYPE(column);
+    if ((row_type != VALUE_TYPE_INT && row_type != VALUE_TYPE_BOOL) || (column_type != VALUE_TYPE_INT && column_type != VALUE_TYPE_BOOL)) {
+        runtime_error(line, "行列の添字は整数でなければなりません。");
+    }
+    long i = (row_type == VALUE_TYPE_BOOL) ? (AS_BOOL(row) ? 1 : 0) : AS_INT(row);
+    long j = (column_type == VALUE_TYPE_BOOL) ? (AS_BOOL(column) ? 1 : 0) : AS_INT(column);
+    size_t rows = MAT_ROWS(matrix);
+    if (i < 0 || (size_t)i >= rows || j < 0 || (size_t)j >= matrix->columns) {
+        runtime_error(line, "行列の添字 [%ld, %ld] は範囲外です (%zu 行 %zu 列)。",
+                i, j, rows, matrix->columns);
+    }
+    return (size_t)i * matrix->columns + (size_t)j;
+}
+
+// 行列の要素 m[row, column] を読む (引数は借りるだけで解放しない)
+Value matrix_element(Value matrix, Value row, Value column, int line) {
+    if (!VAL_IS_MAT(matrix)) {
+        runtime_error(line, "行列でない値に [行, 列] の添字を付けようとしました。");
+    }
+    const KArray *m = AS_ARRAY(matrix);
+    return DOUBLE_VAL(m->data.doubles[checked_position(m, row, column, line)]);
+}
+
+// 変数 name が持つ行列の要素に代入する (添字と value は借りるだけで解放しない)
+void matrix_store_element(Value *target, Value row, Value column, Value value, const char *name, int line) {
+    if (!VAL_IS_MAT(*target)) {
+        runtime_error(line, "行列でない変数 '%s' に [行, 列] の添字を付けて代入しようとしました。", name);
+    }
+    KArray *matrix = AS_ARRAY(*target);
+    size_t position = checked_position(matrix, row, column, line);
+    ValueType type = VAL_TYPE(value);
+    if (type != VALUE_TYPE_INT && type != VALUE_TYPE_BOOL && type != VALUE_TYPE_DOUBLE) {
+        runtime_error(line, "'%s' の要素に互換性のない型の値を代入しようとしました。", name);
+    }
+    matrix = karray_unshare(matrix, line);
+    *target = MAT_VAL(matrix);
+    matrix->data.doubles[position] = AS_DOUBLE(convert_value_to_double(value, line));
+}
+
+// 転置: 32 x 32 のタイルごとに写し、読み書きのどちらもキャッシュの行をまとめて使う
+#define TRANSPOSE_TILE 32
+
+KArray *matrix_transpose(const KArray *matrix, int line) {
+    size_t rows = MAT_ROWS(matrix);
+    size_t columns = matrix->columns;
+    KArray *result = matrix_new((long)columns, (long)rows, line);
+    const double *src = matrix->data.doubles;
+    double *dst = result->data.doubles;
+    for (size_t i0 = 0; i0 < rows; i0 += TRANSPOSE_TILE) {
+        size_t i_end = (i0 + TRANSPOSE_TILE < rows) ? i0 + TRANSPOSE_TILE : rows;
+        for (size_t j0 = 0; j0 < columns; j0 += TRANSPOSE_TILE) {
+            size_t j_end = (j0 + TRANSPOSE_TILE < columns) ? j0 + TRANSPOSE_TILE : columns;
+            for (size_t i = i0; i < i_end; i++) {
+                for (size_t j = j0; j < j_end; j++) {
+                    dst[j * rows + i] = src[i * columns + j];
+                }
+            }
+        }
+    }
+    return result;
+}
+
+// --- パック ---
+
+// A の mc 行 x kc 列 (行の間隔 lda) を MR 行ずつのパネルに詰める
+// パネル内は k ごとに MR 個の要素が並ぶ。行が MR に満たない端は 0 で埋める。
+static void pack_a(const double *a, size_t lda, size_t mc, size_t kc, double *packed) {
+    for (size_t i = 0; i < mc; i += MATMUL_MR) {
+        size_t mr = (mc - i < MATMUL_MR) ? mc - i : MATMUL_MR;
+        for (size_t p = 0; p < kc; p++) {
+            for (size_t r = 0; r < MATMUL_MR; r++) {
+                *packed++ = (r < mr) ? a[(i + r) * lda + p] : 0.0;
+            }
+        }
+    }
+}
+
+// B の kc 行 x nc 列 (行の間隔 ldb) を NR 列ずつのパネルに詰める
+static void pack_b(const double *b, size_t ldb, size_t kc, size_t nc, double *packed) {
+    for (size_t j = 0; j < nc; j += MATMUL_NR) {
+        size_t nr = (nc - j < MATMUL_NR) ? nc - j : MATMUL_NR;
+        for (size_t p = 0; p < kc; p++) {
+            const double *row = b + p * ldb + j;
+            for (size_t c = 0; c < MATMUL_NR; c++) {
+                *packed++ = (c < nr) ? row[c] : 0.0;
+            }
+        }
+    }
+}
+
+// --- マイクロカーネル ---
+// C の MR x NR の小行列 (行の間隔 ldc) に、詰めた A と B のパネルの積を足す。
+// accumulate が false なら 0 から始める (k の最初のブロック)。
+
+typedef void (*MatmulKernel)(size_t kc, const double *a, const double *b, double *c, size_t ldc, bool accumulate);
+
+static void scalar_kernel(size_t kc, const double *a, const double *b, double *c, size_t ldc, bool accumulate) {
+    double acc[MATMUL_MR][MATMUL_NR];
+    for (size_t r = 0; r < MATMUL_MR; r++) {
+        for (size_t j = 0; j < MATMUL_NR; j++) {
+            acc[r][j] = accumulate ? c[r * ldc + j] : 0.0;
+        }
+    }
+    for (size_t p = 0; p < kc; p++) {
+        for (size_t r = 0; r < MATMUL_MR; r++) {
+            double x = a[p * MATMUL_MR + r];
+            for (size_t j = 0; j < MATMUL_NR; j++) {
+                acc[r][j] += x * b[p * MATMUL_NR + j];
+            }
+        }
+    }
+    for (size_t r = 0; r < MATMUL_MR; r++) {
+        for (size_t j = 0; j < MATMUL_NR; j++) {
+            c[r * ldc + j] = acc[r][j];
+        }
+    }
+}
+
+#ifdef KAPPOK_SIMD_X86
+
+// SSE2: 16本のレジスタに 4 x 8 全体は置けないので、4列ずつ2回に分ける
+static void sse2_kernel(size_t kc, const double *a, const double *b, double *c, size_t ldc, bool accumulate) {
+    for (size_t half = 0; half < MATMUL_NR; half += 4) {
+        __m128d c00, c01, c10, c11, c20, c21, c30, c31;
+        double *c0 = c + half;
+        if (accumulate) {
+            c00 = _mm_loadu_pd(c0);               c01 = _mm_loadu_pd(c0 + 2);
+            c10 = _mm_loadu_pd(c0 + ldc);         c11 = _mm_loadu_pd(c0 + ldc + 2);
+            c20 = _mm_loadu_pd(c0 + 2 * ldc);     c21 = _mm_loadu_pd(c0 + 2 * ldc + 2);
+            c30 = _mm_loadu_pd(c0 + 3 * ldc);     c31 = _mm_loadu_pd(c0 + 3 * ldc + 2);
+        } else {
+            c00 = c01 = c10 = c11 = c20 = c21 = c30 = c31 = _mm_setzero_pd();
+        }
+        for (size_t p = 0; p < kc; p++) {
+            const double *bp = b + p * MATMUL_NR + half;
+            const double *ap = a + p * MATMUL_MR;
+            __m128d b0 = _mm_load_pd(bp);
+            __m128d b1 = _mm_load_pd(bp + 2);
+            __m128d x = _mm_set1_pd(ap[0]);
+            c00 = _mm_add_pd(c00, _mm_mul_pd(x, b0)); c01 = _mm_add_pd(c01, _mm_mul_pd(x, b1));
+            x = _mm_set1_pd(ap[1]);
+            c10 = _mm_add_pd(c10, _mm_mul_pd(x, b0)); c11 = _mm_add_pd(c11, _mm_mul_pd(x, b1));
+            x = _mm_set1_pd(ap[2]);
+            c20 = _mm_add_pd(c20, _mm_mul_pd(x, b0)); c21 = _mm_add_pd(c21, _mm_mul_pd(x, b1));
+            x = _mm_set1_pd(ap[3]);
+            c30 = _mm_add_pd(c30, _mm_mul_pd(x, b0)); c31 = _mm_add_pd(c31, _mm_mul_pd(x, b1));
+        }
+        _mm_storeu_pd(c0, c00);               _mm_storeu_pd(c0 + 2, c01);
+        _mm_storeu_pd(c0 + ldc, c10);         _mm_storeu_pd(c0 + ldc + 2, c11);
+        _mm_storeu_pd(c0 + 2 * ldc, c20);     _mm_storeu_pd(c0 + 2 * ldc + 2, c21);
+        _mm_storeu_pd(c0 + 3 * ldc, c30);     _mm_storeu_pd(c0 + 3 * ldc + 2, c31);
+    }
+}
+
+// AVX2: 4 x 8 の小行列を8本のレジスタに置く
+// (FMA は使わない: 積を丸めてから足す順をスカラーのループと揃える)
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+
+static AVX2_FUNCTION void avx2_kernel(size_t kc, const double *a, const double *b, double *c, size_t ldc, bool accumulate) {
+    __m256d c00, c01, c10, c11, c20, c21, c30, c31;
+    if (accumulate) {
+        c00 = _mm256_loadu_pd(c);               c01 = _mm256_loadu_pd(c + 4);
+        c10 = _mm256_loadu_pd(c + ldc);         c11 = _mm256_loadu_pd(c + ldc + 4);
+        c20 = _mm256_loadu_pd(c + 2 * ldc);     c21 = _mm256_loadu_pd(c + 2 * ldc + 4);
+        c30 = _mm256_loadu_pd(c + 3 * ldc);     c31 = _mm256_loadu_pd(c + 3 * ldc + 4);
+    } else {
+        c00 = c01 = c10 = c11 = c20 = c21 = c30 = c31 = _mm256_setzero_pd();
+    }
+    for (size_t p = 0; p < kc; p++) {
+        const double *bp = b + p * MATMUL_NR;
+        const double *ap = a + p * MATMUL_MR;
+        __m256d b0 = _mm256_load_pd(bp);
+        __m256d b1 = _mm256_load_pd(bp + 4);
+        __m256d x = _mm256_broadcast_sd(ap);
+        c00 = _mm256_add_pd(c00, _mm256_mul_pd(x, b0)); c01 = _mm256_add_pd(c01, _mm256_mul_pd(x, b1));
+        x = _mm256_broadcast_sd(ap + 1);
+        c10 = _mm256_add_pd(c10, _mm256_mul_pd(x, b0)); c11 = _mm256_add_pd(c11, _mm256_mul_pd(x, b1));
+        x = _mm256_broadcast_sd(ap + 2);
+        c20 = _mm256_add_pd(c20, _mm256_mul_pd(x, b0)); c21 = _mm256_add_pd(c21, _mm256_mul_pd(x, b1));
+        x = _mm256_broadcast_sd(ap + 3);
+        c30 = _mm256_add_pd(c30, _mm256_mul_pd(x, b0)); c31 = _mm256_add_pd(c31, _mm256_mul_pd(x, b1));
+    }
+    _mm256_storeu_pd(c, c00);               _mm256_storeu_pd(c + 4, c01);
+    _mm256_storeu_pd(c + ldc, c10);         _mm256_storeu_pd(c + ldc + 4, c11);
+    _mm256_storeu_pd(c + 2 * ldc, c20);     _mm256_storeu_pd(c + 2 * ldc + 4, c21);
+    _mm256_storeu_pd(c + 3 * ldc, c30);     _mm256_storeu_pd(c + 3 * ldc + 4, c31);
+}
+
+#endif // KAPPOK_SIMD_X86
+
+static MatmulKernel select_kernel(void) {
+    switch (simd_level()) {
+#ifdef KAPPOK_SIMD_X86
+        case SIMD_AVX2:
+            return avx2_kernel;
+        case SIMD_SSE2:
+            return sse2_kernel;
+#endif
+        default:
+            return scalar_kernel;
+    }
+}
+
+static double *allocate_panel(size_t count) {
+    void *memory = NULL;
+    if (posix_memalign(&memory, KARRAY_ALIGNMENT, count * sizeof(double)) != 0) {
+        perror("Failed to allocate matrix panel");
+        exit(EXIT_FAILURE);
+    }
+    return memory;
+}
+
+// c (m x n) = a (m x k) * b (k x n)。どれも行優先で、c は a や b と重ならないこと
+void matrix_multiply_kernel(const double *a, const double *b, double *c, size_t m, size_t k, size_t n) {
+    if (m == 0 || n == 0) {
+        return;
+    }
+    if (k == 0) {
+        memset(c, 0, m * n * sizeof(double));
+        return;
+    }
+    MatmulKernel kernel = select_kernel();
+    double *packed_a = allocate_panel(MATMUL_MC * MATMUL_KC);
+    double *packed_b = allocate_panel(MATMUL_KC * MATMUL_NC);
+    double edge[MATMUL_MR * MATMUL_NR]; // 端の小行列は一度ここに計算してから C に写す
+
+    for (size_t jc = 0; jc < n; jc += MATMUL_NC) {
+        size_t nc = (n - jc < MATMUL_NC) ? n - jc : MATMUL_NC;
+        for (size_t pc = 0; pc < k; pc += MATMUL_KC) {
+            size_t kc = (k - pc < MATMUL_KC) ? k - pc : MATMUL_KC;
+            bool accumulate = (pc > 0);
+            pack_b(b + pc * n + jc, n, kc, nc, packed_b);
+            for (size_t ic = 0; ic < m; ic += MATMUL_MC) {
+                size_t mc = (m - ic < MATMUL_MC) ? m - ic : MATMUL_MC;
+                pack_a(a + ic * k + pc, k, mc, kc, packed_a);
+                for (size_t jr = 0; jr < nc; jr += MATMUL_NR) {
+                    size_t nr = (nc - jr < MATMUL_NR) ? nc - jr : MATMUL_NR;
+                    const double *panel_b = packed_b + jr * kc;
+                    for (size_t ir = 0; ir < mc; ir += MATMUL_MR) {
+                        size_t mr = (mc - ir < MATMUL_MR) ? mc - ir : MATMUL_MR;
+                        const double *panel_a = packed_a + ir * kc;
+                        double *tile = c + (ic + ir) * n + jc + jr;
+                        if (mr == MATMUL_MR && nr == MATMUL_NR) {
+                            kernel(kc, panel_a, panel_b, tile, n, accumulate);
+                            continue;
+                        }
+                        if (accumulate) {
+                            for (size_t r = 0; r < mr; r++) {
+                                for (size_t j = 0; j < nr; j++) {
+                                    edge[r * MATMUL_NR + j] = tile[r * n + j];
+                                }
+                            }
+                        }
+                        kernel(kc, panel_a, panel_b, edge, MATMUL_NR, accumulate);
+                        for (size_t r = 0; r < mr; r++) {
+                            for (size_t j = 0; j < nr; j++) {
+                                tile[r * n + j] = edge[r * MATMUL_NR + j];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    free(packed_a);
+    free(packed_b);
+}
+
+// 行列の積 (左の列数と右の行数が一致すること)
+KArray *matrix_multiply(const KArray *left, const KArray *right, int line) {
+    size_t m = MAT_ROWS(left);
+    size_t k = left->columns;
+    size_t n = right->columns;
+    if (MAT_ROWS(right) != k) {
+        runtime_error(line, "行列の積の大きさが合いません (%zu 行 %zu 列 と %zu 行 %zu 列)。",
+                m, k, MAT_ROWS(right), n);
+    }
+    KArray *result = matrix_new((long)m, (long)n, line);
+    matrix_multiply_kernel(left->data.doubles, right->data.doubles, result->data.doubles, m, k, n);
+    return result;
+}
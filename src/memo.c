@@ -0,0 +1,409 @@
+#include "kappok.h"
+#include <pthread.h>
+
+// 純粋な関数の呼び出し結果のメモ化
+// 関数と引数の値をキーに戻り値を記録し、同じ引数での呼び出しは本体を実行せずに記録した値を返す。
+// 表の大きさには上限があり、一杯になったら最も長く使われていないエントリ (LRU) を追い出す。
+//   - エントリは一つの配列に並べ、引数は固定長の配列でエントリ内に持つ (キーの比較で別の領域を読まない)。
+//   - 索引は開番地法 (線形探索) のハッシュ表で、ハッシュの下位32ビットとエントリ番号の組を持つ。
+//     探索中はハッシュが一致したときだけエントリを読む。削除は後方シフトで墓標を残さない。
+//   - LRU の順序はエントリ番号で繋いだ双方向リストで持つ。
+// 表は全ての呼び出しで共有するので、探索と更新はロックの中で行う。
+// プログラムを解放するときは、そのプログラムの関数のエントリだけを取り除く (memo_forget_program)。
+
+#define MEMO_CAPACITY 4096                  // エントリ数の上限
+#define MEMO_INDEX_SIZE (MEMO_CAPACITY * 2) // 索引の大きさ (2の冪。負荷率は 1/2 以下)
+#define MEMO_NONE (-1)
+
+typedef struct MemoEntry {
+    ASTNode *func_def;
+    uint64_t hash;
+    int num_args;
+    int prev; // LRU リスト (先頭が最も最近使われたエントリ)
+    int next;
+    Value result;
+    Value args[MEMO_MAX_ARGS];
+} MemoEntry;
+
+typedef struct MemoIndexSlot {
+    uint32_t hash;  // ハッシュの下位32ビット
+    int entry;      // エントリ番号 (MEMO_NONE は空き)
+} MemoIndexSlot;
+
+static MemoEntry *entries = NULL;
+static MemoIndexSlot *index_slots = NULL;
+static int num_entries = 0;
+static int lru_head = MEMO_NONE;
+static int lru_tail = MEMO_NONE;
+static pthread_mutex_t memo_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// メモ化する関数を決める (型検査とコンパイル時評価の後、main の実行前に呼ぶ)
+// @memoize 注釈の付いた関数がメモ化できなければエラーにする。memoize_all (--memoize) では
+// 純粋な関数を全て対象にし、メモ化できないものは黙って外す。メモ化する関数があれば true を返す。
+bool configure_memoization(ASTNode *program_node, bool memoize_all) {
+    bool any = false;
+    if (program_node == NULL || program_node->type != NODE_PROGRAM) {
+        return false;
+    }
+    for (int i = 0; i < program_node->data.program.num_statements; i++) {
+        ASTNode *func_def = program_node->data.program.statements[i];
+        if (func_def->type != NODE_FUNCTION_DEFINITION) {
+            continue;
+        }
+        bool annotated = func_def->data.func_def.memoize_annotated;
+        if (!annotated && !memoize_all) {
+            continue;
+        }
+        if (func_def->data.func_def.num_parameters > MEMO_MAX_ARGS) {
+            if (annotated) {
+                compile_error(func_def->line, "関数 '%s' は引数が多すぎるためメモ化できません (最大 %d 個)。",
+                        func_def->data.func_def.name, MEMO_MAX_ARGS);
+            }
+            continue;
+        }
+        if (analyze_purity(func_def) < PURITY_PURE) {
+            if (annotated) {
+                compile_error(func_def->line, "関数 '%s' は副作用があるためメモ化できません。",
+                        func_def->data.func_def.name);
+            }
+            continue;
+        }
+        func_def->data.func_def.memoized = true;
+        any = true;
+    }
+    return any;
+}
+
+static uint64_t mix_hash(uint64_t hash, uint64_t word) {
+    hash ^= word + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+// 引数の値のハッシュ (値として等しい引数は同じハッシュになる)
+static uint64_t hash_value(uint64_t hash, Value value) {
+    ValueType type = VAL_TYPE(value);
+    hash = mix_hash(hash, (uint64_t)type);
+    switch (type) {
+        case VALUE_TYPE_INT:
+            return mix_hash(hash, (uint64_t)AS_INT(value));
+        case VALUE_TYPE_DOUBLE: {
+            double d = AS_DOUBLE(value);
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            return mix_hash(hash, bits);
+        }
+        case VALUE_TYPE_BOOL:
+            return mix_hash(hash, AS_BOOL(value) ? 1 : 0);
+        case VALUE_TYPE_FUNCTION:
+            return mix_hash(hash, (uint64_t)(uintptr_t)AS_FUNC(value));
+        case VALUE_TYPE_FUTURE:
+            return mix_hash(hash, (uint64_t)(uintptr_t)AS_TASK(value));
+        case VALUE_TYPE_GENERATOR:
+            return mix_hash(hash, (uint64_t)(uintptr_t)AS_GENERATOR(value));
+        case VALUE_TYPE_STR: {
+            StrView view;
+            string_view(value, &view);
+            uint64_t h = 0xCBF29CE484222325ULL; // FNV-1a
+            for (size_t i = 0; i < view.length; i++) {
+                h = (h ^ (unsigned char)view.data[i]) * 0x100000001B3ULL;
+            }
+            return mix_hash(hash, h);
+        }
+        case VALUE_TYPE_INT_ARRAY:
+        case VALUE_TYPE_DOUBLE_ARRAY:
+        case VALUE_TYPE_MAT: {
+            // 要素はビット列で混ぜる (long と double はどちらも8バイト)
+            const KArray *array = AS_ARRAY(value);
+            hash = mix_hash(hash, (uint64_t)array->length);
+            hash = mix_hash(hash, (uint64_t)array->columns);
+            const uint64_t *words = (const uint64_t *)(const void *)array->data.ints;
+            for (size_t i = 0; i < array->length; i++) {
+                hash = mix_hash(hash, words[i]);
+            }
+            return hash;
+        }
+        default:
+            return hash;
+    }
+}
+
+static uint64_t hash_call(const ASTNode *func_def, const Value *args, int num_args) {
+    uint64_t hash = mix_hash(0, (uint64_t)(uintptr_t)func_def);
+    for (int i = 0; i < num_args; i++) {
+        hash = hash_value(hash, args[i]);
+    }
+    return hash;
+}
+
+// 引数として同じ値か (double はビット列で比べるので 0.0 と -0.0 は区別し、NaN 同士は等しい)
+static bool same_value(Value a, Value b) {
+    ValueType type = VAL_TYPE(a);
+    if (type != VAL_TYPE(b)) {
+        return false;
+    }
+    switch (type) {
+        case VALUE_TYPE_INT:
+            return AS_INT(a) == AS_INT(b);
+        case VALUE_TYPE_DOUBLE: {
+            double x = AS_DOUBLE(a);
+            double y = AS_DOUBLE(b);
+            return memcmp(&x, &y, sizeof(double)) == 0;
+        }
+        case VALUE_TYPE_BOOL:
+            return AS_BOOL(a) == AS_BOOL(b);
+        case VALUE_TYPE_FUNCTION:
+            return AS_FUNC(a) == AS_FUNC(b);
+        case VALUE_TYPE_FUTURE:
+            return AS_TASK(a) == AS_TASK(b); // 別々に spawn したタスクは結果が同じでも区別する
+        case VALUE_TYPE_GENERATOR:
+            return AS_GENERATOR(a) == AS_GENERATOR(b);
+        case VALUE_TYPE_STR: {
+            StrView x;
+            StrView y;
+            string_view(a, &x);
+            string_view(b, &y);
+            return x.length == y.length && memcmp(x.data, y.data, x.length) == 0;
+        }
+        case VALUE_TYPE_INT_ARRAY:
+        case VALUE_TYPE_DOUBLE_ARRAY:
+        case VALUE_TYPE_MAT: {
+            const KArray *x = AS_ARRAY(a);
+            const KArray *y = AS_ARRAY(b);
+            return x == y || (x->length == y->length && x->columns == y->columns &&
+                              memcmp(x->data.ints, y->data.ints, x->length * sizeof(long)) == 0);
+        }
+        default:
+            return true;
+    }
+}
+
+// キーに一致するエントリの索引の位置を探す (なければ MEMO_NONE)
+static int find_slot(const ASTNode *func_def, uint64_t hash, const Value *args, int num_args) {
+    if (index_slots == NULL) {
+        return MEMO_NONE;
+    }
+    unsigned int mask = MEMO_INDEX_SIZE - 1;
+    for (unsigned int i = (unsigned int)hash & mask; index_slots[i].entry != MEMO_NONE; i = (i + 1) & mask) {
+        if (index_slots[i].hash != (uint32_t)hash) {
+            continue;
+        }
+        const MemoEntry *entry = &entries[index_slots[i].entry];
+        if (entry->func_def != func_def || entry->hash != hash || entry->num_args != num_args) {
+            continue;
+        }
+        bool match = true;
+        for (int j = 0; j < num_args && match; j++) {
+            match = same_value(entry->args[j], args[j]);
+        }
+        if (match) {
+            return (int)i;
+        }
+    }
+    return MEMO_NONE;
+}
+
+static void lru_unlink(int e) {
+    MemoEntry *entry = &entries[e];
+    if (entry->prev != MEMO_NONE) {
+        entries[entry->prev].next = entry->next;
+    } else {
+        lru_head = entry->next;
+    }
+    if (entry->next != MEMO_NONE) {
+        entries[entry->next].prev = entry->prev;
+    } else {
+        lru_tail = entry->prev;
+    }
+}
+
+static void lru_push_front(int e) {
+    entries[e].prev = MEMO_NONE;
+    entries[e].next = lru_head;
+    if (lru_head != MEMO_NONE) {
+        entries[lru_head].prev = e;
+    } else {
+        lru_tail = e;
+    }
+    lru_head = e;
+}
+
+// 索引からエントリ e を取り除き、後続のスロットを詰める (後方シフト削除)
+static void index_remove(int e) {
+    unsigned int mask = MEMO_INDEX_SIZE - 1;
+    unsigned int i = (unsigned int)entries[e].hash & mask;
+    while (index_slots[i].entry != e) {
+        i = (i + 1) & mask;
+    }
+    unsigned int j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (index_slots[j].entry == MEMO_NONE) {
+            break;
+        }
+        // j のエントリの本来の位置が (i, j] の外なら i へ移せる
+        unsigned int home = index_slots[j].hash & mask;
+        bool movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+        if (movable) {
+            index_slots[i] = index_slots[j];
+            i = j;
+        }
+    }
+    index_slots[i].entry = MEMO_NONE;
+}
+
+static void release_entry(MemoEntry *entry) {
+    for (int i = 0; i < entry->num_args; i++) {
+        free_value_data(entry->args[i]);
+    }
+    free_value_data(entry->result);
+}
+
+// 記録した結果を探す。見つかれば結果の複製を result に入れて true を返す
+bool memo_lookup(ASTNode *func_def, const Value *args, int num_args, Value *result) {
+    uint64_t hash = hash_call(func_def, args, num_args);
+    pthread_mutex_lock(&memo_lock);
+    int slot = find_slot(func_def, hash, args, num_args);
+    if (slot == MEMO_NONE) {
+        pthread_mutex_unlock(&memo_lock);
+        return false;
+    }
+    int e = index_slots[slot].entry;
+    if (e != lru_head) {
+        lru_unlink(e);
+        lru_push_front(e);
+    }
+    *result = copy_value(entries[e].result);
+    pthread_mutex_unlock(&memo_lock);
+    return true;
+}
+
+// 呼び出しの結果を記録する
+// args の値の所有権は表に移る (既に記録されていれば解放する)。result は複製して記録する。
+void memo_store(ASTNode *func_def, Value *args, int num_args, Value result) {
+    uint64_t hash = hash_call(func_def, args, num_args);
+    pthread_mutex_lock(&memo_lock);
+    if (entries == NULL) {
+        entries = malloc(sizeof(MemoEntry) * MEMO_CAPACITY);
+        index_slots = malloc(sizeof(MemoIndexSlot) * MEMO_INDEX_SIZE);
+        if (entries == NULL || index_slots == NULL) {
+            perror("Failed to allocate memo table");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < MEMO_INDEX_SIZE; i++) {
+            index_slots[i].entry = MEMO_NONE;
+        }
+    }
+    if (find_slot(func_def, hash, args, num_args) != MEMO_NONE) {
+        // 別のスレッドが同じ呼び出しを先に記録した
+        pthread_mutex_unlock(&memo_lock);
+        for (int i = 0; i < num_args; i++) {
+            free_value_data(args[i]);
+        }
+        return;
+    }
+
+    int e;
+    if (num_entries < MEMO_CAPACITY) {
+        e = num_entries++;
+    } else {
+        // 最も長く使われていないエントリを追い出して再利用する
+        e = lru_tail;
+        index_remove(e);
+        lru_unlink(e);
+        release_entry(&entries[e]);
+    }
+    MemoEntry *entry = &entries[e];
+    entry->func_def = func_def;
+    entry->hash = hash;
+    entry->num_args = num_args;
+    for (int i = 0; i < num_args; i++) {
+        entry->args[i] = args[i];
+    }
+    entry->result = copy_value(result);
+    lru_push_front(e);
+
+    unsigned int mask = MEMO_INDEX_SIZE - 1;
+    unsigned int i = (unsigned int)hash & mask;
+    while (index_slots[i].entry != MEMO_NONE) {
+        i = (i + 1) & mask;
+    }
+    index_slots[i].hash = (uint32_t)hash;
+    index_slots[i].entry = e;
+    pthread_mutex_unlock(&memo_lock);
+}
+
+// エントリ e を表から取り除いて解放し、最後のエントリを e に移して詰める
+static void remove_entry(int e) {
+    index_remove(e);
+    lru_unlink(e);
+    release_entry(&entries[e]);
+    int last = --num_entries;
+    if (e == last) {
+        return;
+    }
+    entries[e] = entries[last];
+    MemoEntry *moved = &entries[e];
+    unsigned int mask = MEMO_INDEX_SIZE - 1;
+    unsigned int i = (unsigned int)moved->hash & mask;
+    while (index_slots[i].entry != last) {
+        i = (i + 1) & mask;
+    }
+    index_slots[i].entry = e;
+    if (moved->prev != MEMO_NONE) {
+        entries[moved->prev].next = e;
+    } else {
+        lru_head = e;
+    }
+    if (moved->next != MEMO_NONE) {
+        entries[moved->next].prev = e;
+    } else {
+        lru_tail = e;
+    }
+}
+
+static int compare_pointers(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(ASTNode *const *)a;
+    uintptr_t y = (uintptr_t)*(ASTNode *const *)b;
+    return (x > y) - (x < y);
+}
+
+// プログラムの関数の記録を全て解放する (プログラムを解放する前に呼ぶ)
+// 表は関数定義のアドレスで引くので、後で同じアドレスに確保された関数と取り違えないよう捨てる。
+// 他のプログラムの記録は残し、表が空になったら表そのものも解放する。
+void memo_forget_program(ASTNode *program_node) {
+    if (program_node == NULL || program_node->type != NODE_PROGRAM) {
+        return;
+    }
+    // エントリごとに二分探索できるよう、メモ化する関数の定義をアドレス順に並べる
+    int num_functions = 0;
+    ASTNode **functions = malloc(sizeof(ASTNode *) * (size_t)(program_node->data.program.num_statements + 1));
+    if (functions == NULL) {
+        perror("Failed to allocate memoized function list");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < program_node->data.program.num_statements; i++) {
+        ASTNode *func_def = program_node->data.program.statements[i];
+        if (func_def->type == NODE_FUNCTION_DEFINITION && func_def->data.func_def.memoized) {
+            functions[num_functions++] = func_def;
+        }
+    }
+    qsort(functions, (size_t)num_functions, sizeof(ASTNode *), compare_pointers);
+
+    pthread_mutex_lock(&memo_lock);
+    for (int e = num_entries - 1; e >= 0; e--) {
+        // 後ろから調べるので、詰めるために移ってくるエントリは調べ終えたものだけ
+        if (bsearch(&entries[e].func_def, functions, (size_t)num_functions, sizeof(ASTNode *), compare_pointers) != NULL) {
+            remove_entry(e);
+        }
+    }
+    if (num_entries == 0) {
+        free(entries);
+        free(index_slots);
+        entries = NULL;
+        index_slots = NULL;
+        lru_head = MEMO_NONE;
+        lru_tail = MEMO_NONE;
+    }
+    pthread_mutex_unlock(&memo_lock);
+    free(functions);
+}
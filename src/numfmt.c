@@ -0,0 +1,619 @@
+#include "kappok.h"
+#include "ryu_tables.h"
+
+// 数値の10進フォーマット
+// 出力は全て呼び出し側のバッファに直接書き、libc の printf 系は使わない。
+// - 整数: 2桁ずつの表引きで変換する
+// - double (%g 互換): Ryu で最短桁を求めてから6桁に丸める
+// - double (%.*f 互換): 多くは double 演算だけで確定し、丸め境界に近いときだけ多倍長で厳密に計算する
+
+static const char DIGIT_PAIRS[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint64_t POW10_U64[20] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+    100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+    10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+    100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull
+};
+
+// 10^0 〜 10^22 は double で正確に表せる
+static const double POW10_DOUBLE[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// 10^exponent (表の範囲外だけ pow に任せる)
+double exact_pow10(int exponent) {
+    if (exponent >= 0 && exponent <= 22) {
+        return POW10_DOUBLE[exponent];
+    }
+    return pow(10, exponent);
+}
+
+// 10進の桁数 (ビット長から見積もって1回の比較で補正する)
+static int decimal_length(uint64_t value) {
+    int bits = 64 - __builtin_clzll(value | 1);
+    int guess = (bits * 1233) >> 12; // bits * log10(2)
+    return guess + 1 - ((value | 1) < POW10_U64[guess]);
+}
+
+// 符号なし整数を buffer に書き、桁数を返す (終端の '\0' は書かない)
+static int write_u64(char *buffer, uint64_t value) {
+    int length = decimal_length(value);
+    char *p = buffer + length;
+    while (value >= 100) {
+        uint64_t index = (value % 100) * 2;
+        value /= 100;
+        p -= 2;
+        memcpy(p, DIGIT_PAIRS + index, 2);
+    }
+    if (value >= 10) {
+        memcpy(p - 2, DIGIT_PAIRS + value * 2, 2);
+    } else {
+        *--p = (char)('0' + value);
+    }
+    return length;
+}
+
+// 整数を10進で書く。buffer は FORMAT_INT_MAX_LENGTH バイト以上
+int format_int(long value, char *buffer) {
+    int length = 0;
+    uint64_t magnitude = (uint64_t)value;
+    if (value < 0) {
+        buffer[length++] = '-';
+        magnitude = 0 - magnitude;
+    }
+    length += write_u64(buffer + length, magnitude);
+    buffer[length] = '\0';
+    return length;
+}
+
+
+// --- Ryu: 最短で元の値に戻る10進表現 ---
+
+#if defined(__SIZEOF_INT128__)
+static uint64_t mul_shift64(uint64_t m, const uint64_t *mul, int shift) {
+    unsigned __int128 b0 = (unsigned __int128)m * mul[0];
+    unsigned __int128 b2 = (unsigned __int128)m * mul[1];
+    return (uint64_t)(((b0 >> 64) + b2) >> (shift - 64));
+}
+#else
+static uint64_t umul128(uint64_t a, uint64_t b, uint64_t *high) {
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t b00 = a_lo * b_lo, b01 = a_lo * b_hi, b10 = a_hi * b_lo, b11 = a_hi * b_hi;
+    uint64_t mid1 = b10 + (b00 >> 32);
+    uint64_t mid2 = b01 + (uint32_t)mid1;
+    *high = b11 + (mid1 >> 32) + (mid2 >> 32);
+    return (mid2 << 32) | (uint32_t)b00;
+}
+
+static uint64_t mul_shift64(uint64_t m, const uint64_t *mul, int shift) {
+    uint64_t high0, high1;
+    umul128(m, mul[0], &high0);
+    uint64_t low1 = umul128(m, mul[1], &high1);
+    uint64_t sum = high0 + low1;
+    if (sum < high0) {
+        high1++;
+    }
+    int dist = shift - 64; // 0 < dist < 64
+    return (high1 << (64 - dist)) | (sum >> dist);
+}
+#endif
+
+static int pow5_bits(int e) {
+    return (int)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+static int log10_pow2(int e) {
+    return (int)(((uint32_t)e * 78913) >> 18);
+}
+
+static int log10_pow5(int e) {
+    return (int)(((uint32_t)e * 732923) >> 20);
+}
+
+static bool multiple_of_pow5(uint64_t value, int p) {
+    int count = 0;
+    while (value % 5 == 0) {
+        value /= 5;
+        count++;
+    }
+    return count >= p;
+}
+
+static bool multiple_of_pow2(uint64_t value, int p) {
+    return (value & ((1ull << p) - 1)) == 0;
+}
+
+// 有限の正の double を digits * 10^exponent の最短表現に変換する (digits の末尾に0は残さない)
+static void ryu_shortest(uint64_t ieee_mantissa, int ieee_exponent, uint64_t *digits, int *exponent) {
+    int e2;
+    uint64_t m2;
+    if (ieee_exponent == 0) {
+        e2 = 1 - 1023 - 52 - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = ieee_exponent - 1023 - 52 - 2;
+        m2 = (1ull << 52) | ieee_mantissa;
+    }
+    bool accept_bounds = (m2 & 1) == 0;
+
+    // 区間 [vm, vp] に入る10進数のうち、桁数が最小で vr に最も近いものを探す
+    uint64_t mv = 4 * m2;
+    uint32_t mm_shift = (ieee_mantissa != 0 || ieee_exponent <= 1);
+    uint64_t vr, vp, vm;
+    int e10;
+    bool vm_is_trailing_zeros = false;
+    bool vr_is_trailing_zeros = false;
+    if (e2 >= 0) {
+        int q = log10_pow2(e2) - (e2 > 3);
+        e10 = q;
+        int k = DOUBLE_POW5_INV_BITCOUNT + pow5_bits(q) - 1;
+        int i = -e2 + q + k;
+        vr = mul_shift64(4 * m2, DOUBLE_POW5_INV_SPLIT[q], i);
+        vp = mul_shift64(4 * m2 + 2, DOUBLE_POW5_INV_SPLIT[q], i);
+        vm = mul_shift64(4 * m2 - 1 - mm_shift, DOUBLE_POW5_INV_SPLIT[q], i);
+        if (q <= 21) {
+            if (mv % 5 == 0) {
+                vr_is_trailing_zeros = multiple_of_pow5(mv, q);
+            } else if (accept_bounds) {
+                vm_is_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+            } else {
+                vp -= multiple_of_pow5(mv + 2, q);
+            }
+        }
+    } else {
+        int q = log10_pow5(-e2) - (-e2 > 1);
+        e10 = q + e2;
+        int i = -e2 - q;
+        int k = pow5_bits(i) - DOUBLE_POW5_BITCOUNT;
+        int j = q - k;
+        vr = mul_shift64(4 * m2, DOUBLE_POW5_SPLIT[i], j);
+        vp = mul_shift64(4 * m2 + 2, DOUBLE_POW5_SPLIT[i], j);
+        vm = mul_shift64(4 * m2 - 1 - mm_shift, DOUBLE_POW5_SPLIT[i], j);
+        if (q <= 1) {
+            vr_is_trailing_zeros = true;
+            if (accept_bounds) {
+                vm_is_trailing_zeros = (mm_shift == 1);
+            } else {
+                vp--;
+            }
+        } else if (q < 63) {
+            vr_is_trailing_zeros = multiple_of_pow2(mv, q);
+        }
+    }
+
+    int removed = 0;
+    int last_removed_digit = 0;
+    uint64_t output;
+    if (vm_is_trailing_zeros || vr_is_trailing_zeros) {
+        // 境界ちょうどや偶数丸めが絡むまれなケース
+        while (vp / 10 > vm / 10) {
+            vm_is_trailing_zeros &= (vm % 10 == 0);
+            vr_is_trailing_zeros &= (last_removed_digit == 0);
+            last_removed_digit = (int)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vm_is_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_is_trailing_zeros &= (last_removed_digit == 0);
+                last_removed_digit = (int)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        if (vr_is_trailing_zeros && last_removed_digit == 5 && vr % 2 == 0) {
+            last_removed_digit = 4; // ちょうど半分なら偶数に丸める
+        }
+        output = vr + ((vr == vm && (!accept_bounds || !vm_is_trailing_zeros)) || last_removed_digit >= 5);
+    } else {
+        bool round_up = false;
+        while (vp / 100 > vm / 100) {
+            round_up = (vr % 100 >= 50);
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        if (vp / 10 > vm / 10) {
+            round_up = (vr % 10 >= 5);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+
+    while (output % 10 == 0) {
+        output /= 10;
+        removed++;
+    }
+    *digits = output;
+    *exponent = e10 + removed;
+}
+
+
+// --- 厳密な10進丸め (多倍長整数) ---
+
+// double の 10^±1074 倍程度までを保持できる大きさ
+#define BIGNUM_LIMBS 128
+
+typedef struct BigNum {
+    uint32_t limbs[BIGNUM_LIMBS]; // 下位から
+    int length;
+} BigNum;
+
+static void bignum_set(BigNum *n, uint64_t value) {
+    n->limbs[0] = (uint32_t)value;
+    n->limbs[1] = (uint32_t)(value >> 32);
+    n->length = (value >> 32) ? 2 : (value ? 1 : 0);
+}
+
+static void bignum_mul_small(BigNum *n, uint32_t factor) {
+    uint64_t carry = 0;
+    for (int i = 0; i < n->length; i++) {
+        uint64_t product = (uint64_t)n->limbs[i] * factor + carry;
+        n->limbs[i] = (uint32_t)product;
+        carry = product >> 32;
+    }
+    if (carry) {
+        n->limbs[n->length++] = (uint32_t)carry;
+    }
+}
+
+static void bignum_shift_left(BigNum *n, int bits) {
+    if (n->length == 0) {
+        return;
+    }
+    int words = bits / 32;
+    int rest = bits % 32;
+    n->limbs[n->length] = 0;
+    for (int i = n->length; i >= 0; i--) {
+        uint32_t value = n->limbs[i] << rest;
+        if (rest != 0 && i > 0) {
+            value |= n->limbs[i - 1] >> (32 - rest);
+        }
+        n->limbs[i + words] = value;
+    }
+    for (int i = 0; i < words; i++) {
+        n->limbs[i] = 0;
+    }
+    n->length += words + 1;
+    while (n->length > 0 && n->limbs[n->length - 1] == 0) {
+        n->length--;
+    }
+}
+
+// 切り捨てたビットに1があれば true を返す
+static bool bignum_shift_right(BigNum *n, int bits) {
+    int words = bits / 32;
+    int rest = bits % 32;
+    bool inexact = false;
+    if (words >= n->length) {
+        inexact = (n->length > 0);
+        n->length = 0;
+        return inexact;
+    }
+    for (int i = 0; i < words; i++) {
+        inexact |= (n->limbs[i] != 0);
+    }
+    if (rest != 0) {
+        inexact |= (n->limbs[words] & ((1u << rest) - 1)) != 0;
+    }
+    int new_length = n->length - words;
+    for (int i = 0; i < new_length; i++) {
+        uint32_t value = n->limbs[i + words] >> rest;
+        if (rest != 0 && i + words + 1 < n->length) {
+            value |= n->limbs[i + words + 1] << (32 - rest);
+        }
+        n->limbs[i] = value;
+    }
+    n->length = new_length;
+    while (n->length > 0 && n->limbs[n->length - 1] == 0) {
+        n->length--;
+    }
+    return inexact;
+}
+
+// 余りを返す
+static uint32_t bignum_div_small(BigNum *n, uint32_t divisor) {
+    uint64_t remainder = 0;
+    for (int i = n->length - 1; i >= 0; i--) {
+        uint64_t current = (remainder << 32) | n->limbs[i];
+        n->limbs[i] = (uint32_t)(current / divisor);
+        remainder = current % divisor;
+    }
+    while (n->length > 0 && n->limbs[n->length - 1] == 0) {
+        n->length--;
+    }
+    return (uint32_t)remainder;
+}
+
+static void bignum_add_one(BigNum *n) {
+    for (int i = 0; i < n->length; i++) {
+        if (++n->limbs[i] != 0) {
+            return;
+        }
+    }
+    n->limbs[n->length++] = 1;
+}
+
+// 10進文字列にして桁数を返す (0 は "0")
+static int bignum_to_decimal(BigNum *n, char *buffer) {
+    uint32_t chunks[BIGNUM_LIMBS * 2];
+    int num_chunks = 0;
+    while (n->length > 0) {
+        chunks[num_chunks++] = bignum_div_small(n, 1000000000u);
+    }
+    if (num_chunks == 0) {
+        buffer[0] = '0';
+        return 1;
+    }
+    int length = write_u64(buffer, chunks[num_chunks - 1]);
+    for (int i = num_chunks - 2; i >= 0; i--) {
+        // 下位のチャンクは9桁にゼロ埋めする
+        int chunk_length = decimal_length(chunks[i]);
+        memset(buffer + length, '0', 9 - chunk_length);
+        write_u64(buffer + length + 9 - chunk_length, chunks[i]);
+        length += 9;
+    }
+    return length;
+}
+
+// |value| を 10^-fraction_digits の倍数に最近接偶数丸めし、その倍数 (整数) を result に入れる
+// fraction_digits は負でもよい (10, 100, ... の位で丸める)
+static void round_exact(double value, int fraction_digits, BigNum *result) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t mantissa = bits & ((1ull << 52) - 1);
+    int biased_exponent = (int)((bits >> 52) & 0x7FF);
+    int e2 = (biased_exponent == 0) ? -1074 : biased_exponent - 1075;
+    if (biased_exponent != 0) {
+        mantissa |= 1ull << 52;
+    }
+
+    // 2 * |value| * 10^fraction_digits を整数に切り捨てる (最下位ビットが 0.5 の位)
+    bignum_set(result, mantissa);
+    bignum_shift_left(result, 1);
+    if (e2 > 0) {
+        bignum_shift_left(result, e2);
+    }
+    for (int d = fraction_digits; d > 0; d -= 9) {
+        bignum_mul_small(result, (uint32_t)POW10_U64[d < 9 ? d : 9]);
+    }
+    int shift = (e2 < 0) ? -e2 : 0;
+    bool inexact = false;
+    for (int d = -fraction_digits; d > 0; d -= 13) {
+        // 10^d = 2^d * 5^d のうち 5^d を割り、2^d はシフトにまとめる
+        int chunk = d < 13 ? d : 13;
+        uint32_t divisor = 1;
+        for (int i = 0; i < chunk; i++) {
+            divisor *= 5;
+        }
+        inexact |= (bignum_div_small(result, divisor) != 0);
+        shift += chunk;
+    }
+    inexact |= bignum_shift_right(result, shift);
+
+    bool half = (result->length > 0) && (result->limbs[0] & 1);
+    bignum_shift_right(result, 1);
+    bool odd = (result->length > 0) && (result->limbs[0] & 1);
+    if (half && (inexact || odd)) {
+        bignum_add_one(result);
+    }
+}
+
+
+// --- double のフォーマット ---
+
+static int format_non_finite(double value, char *buffer) {
+    int length = 0;
+    if (signbit(value)) {
+        buffer[length++] = '-';
+    }
+    memcpy(buffer + length, isnan(value) ? "nan" : "inf", 3);
+    length += 3;
+    buffer[length] = '\0';
+    return length;
+}
+
+// printf("%g") と同じ表記で書く (有効数字6桁、末尾の0と小数点は削る)
+// buffer は FORMAT_DOUBLE_MAX_LENGTH バイト以上
+int format_double_general(double value, char *buffer) {
+    if (!isfinite(value)) {
+        return format_non_finite(value, buffer);
+    }
+    int length = 0;
+    if (signbit(value)) {
+        buffer[length++] = '-';
+    }
+    if (value == 0) {
+        buffer[length++] = '0';
+        buffer[length] = '\0';
+        return length;
+    }
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t digits;
+    int exponent;
+    ryu_shortest(bits & ((1ull << 52) - 1), (int)((bits >> 52) & 0x7FF), &digits, &exponent);
+
+    int num_digits = decimal_length(digits);
+    if (((bits >> 52) & 0x7FF) == 0) {
+        // 非正規化数は精度が低く、最短表現を6桁に丸めても %g と一致するとは限らないので、
+        // 元の値を厳密に6桁へ丸める。先頭桁の位置は最短表現から見積もり、外れていたらずらす
+        int lead = num_digits + exponent - 1;
+        for (;;) {
+            BigNum rounded;
+            round_exact(value, 5 - lead, &rounded);
+            uint64_t head = (rounded.length > 0) ? rounded.limbs[0] : 0;
+            if (rounded.length > 1 || head >= 1000000) {
+                lead++;
+            } else if (head < 100000) {
+                lead--;
+            } else {
+                digits = head;
+                exponent = lead - 5;
+                break;
+            }
+        }
+    } else if (num_digits > 6) {
+        // 最短表現を6桁に丸める。最短表現が7桁で末尾が5のときだけは元の値が
+        // ちょうど中間より上か下か分からないので、厳密に丸め直す
+        int removed = num_digits - 6;
+        uint64_t divisor = POW10_U64[removed];
+        uint64_t head = digits / divisor;
+        uint64_t tail = digits % divisor;
+        uint64_t half = divisor / 2;
+        if (removed == 1 && tail == 5) {
+            BigNum rounded;
+            round_exact(value, -(exponent + 1), &rounded);
+            head = rounded.limbs[0];
+        } else if (tail > half || (tail == half && removed > 1)) {
+            head++;
+        }
+        exponent += removed;
+        digits = head;
+    }
+    while (digits % 10 == 0) {
+        digits /= 10;
+        exponent++;
+    }
+    num_digits = decimal_length(digits);
+
+    char digit_chars[20];
+    write_u64(digit_chars, digits);
+    int point = num_digits + exponent; // 先頭桁の10進指数 + 1
+
+    if (point - 1 < -4 || point - 1 >= 6) {
+        // 指数表記: d.ddddde±XX
+        buffer[length++] = digit_chars[0];
+        if (num_digits > 1) {
+            buffer[length++] = '.';
+            memcpy(buffer + length, digit_chars + 1, num_digits - 1);
+            length += num_digits - 1;
+        }
+        int exp10 = point - 1;
+        buffer[length++] = 'e';
+        buffer[length++] = (exp10 < 0) ? '-' : '+';
+        if (exp10 < 0) {
+            exp10 = -exp10;
+        }
+        if (exp10 < 10) {
+            buffer[length++] = '0';
+        }
+        length += write_u64(buffer + length, (uint64_t)exp10);
+    } else if (point <= 0) {
+        // 0.000ddd
+        buffer[length++] = '0';
+        buffer[length++] = '.';
+        memset(buffer + length, '0', -point);
+        length += -point;
+        memcpy(buffer + length, digit_chars, num_digits);
+        length += num_digits;
+    } else if (point >= num_digits) {
+        // ddd000
+        memcpy(buffer + length, digit_chars, num_digits);
+        length += num_digits;
+        memset(buffer + length, '0', point - num_digits);
+        length += point - num_digits;
+    } else {
+        // ddd.ddd
+        memcpy(buffer + length, digit_chars, point);
+        length += point;
+        buffer[length++] = '.';
+        memcpy(buffer + length, digit_chars + point, num_digits - point);
+        length += num_digits - point;
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+// 整数 digits (length 桁) の下位 fraction_digits 桁を小数部として書き、さらに0を zero_padding 個続ける
+static int layout_fixed(char *buffer, const char *digits, int length, int fraction_digits, int zero_padding) {
+    int out = 0;
+    int integer_digits = length - fraction_digits;
+    if (integer_digits <= 0) {
+        buffer[out++] = '0';
+    } else {
+        memcpy(buffer, digits, integer_digits);
+        out += integer_digits;
+    }
+    if (fraction_digits + zero_padding > 0) {
+        buffer[out++] = '.';
+        if (integer_digits < 0) {
+            memset(buffer + out, '0', -integer_digits);
+            out += -integer_digits;
+            memcpy(buffer + out, digits, length);
+            out += length;
+        } else {
+            memcpy(buffer + out, digits + integer_digits, fraction_digits);
+            out += fraction_digits;
+        }
+        memset(buffer + out, '0', zero_padding);
+        out += zero_padding;
+    }
+    buffer[out] = '\0';
+    return out;
+}
+
+// printf("%.*f", precision, value) と同じ表記で書く (precision >= 0)
+// buffer は FORMAT_FIXED_MAX_LENGTH(precision) バイト以上
+int format_double_fixed(double value, int precision, char *buffer) {
+    if (!isfinite(value)) {
+        return format_non_finite(value, buffer);
+    }
+    int length = 0;
+    if (signbit(value)) {
+        buffer[length++] = '-';
+    }
+    double magnitude = fabs(value);
+
+    // 速い経路: |value| * 10^precision が小さければ double の積の誤差は 2^-14 未満なので、
+    // 小数部が 0.5 から十分離れていれば丸めの向きが確定する
+    if (precision <= 22) {
+        double scaled = magnitude * POW10_DOUBLE[precision];
+        if (scaled < 1099511627776.0) { // 2^40
+            uint64_t integer = (uint64_t)scaled;
+            double fraction = scaled - (double)integer;
+            if (fabs(fraction - 0.5) > 0.000244140625) { // 2^-12
+                integer += (fraction > 0.5);
+                char digits[24];
+                int num_digits = write_u64(digits, integer);
+                return length + layout_fixed(buffer + length, digits, num_digits, precision, 0);
+            }
+        }
+    }
+
+    // double の小数部は2進で高々1074桁 (= 10進で高々1074桁) なので、それより先は0
+    uint64_t bits;
+    memcpy(&bits, &magnitude, sizeof(bits));
+    int biased_exponent = (int)((bits >> 52) & 0x7FF);
+    int e2 = (biased_exponent == 0) ? -1074 : biased_exponent - 1075;
+    int max_fraction = (e2 < 0) ? -e2 : 0;
+    int exact_digits = precision < max_fraction ? precision : max_fraction;
+
+    BigNum rounded;
+    round_exact(magnitude, exact_digits, &rounded);
+    char digits[BIGNUM_LIMBS * 10];
+    int num_digits = bignum_to_decimal(&rounded, digits);
+    return length + layout_fixed(buffer + length, digits, num_digits, exact_digits, precision - exact_digits);
+}
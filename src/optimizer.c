@@ -0,0 +1,1066 @@
+#include "kappok.h"
+
+// 最適化パス
+// 段階的実行で関数が「熱く」なったときに、本体の複製に対して実行する。
+// 元のASTは実行中のスレッドがそのまま使い続けるので、ここでは一切書き換えない。
+// 小さな関数のインライン展開を先に行い、展開後の式を定数畳み込みの対象にする。
+
+#define INLINE_MAX_NODES 32 // インライン展開する関数本体の最大ノード数
+#define INLINE_MAX_DEPTH 4  // 展開した本体の中をさらに展開する深さ
+
+// インライン展開の状態
+typedef struct InlineState {
+    ASTNode *caller;            // 最適化中の関数 (自分自身は展開しない)
+    int frame_size;             // 呼び出し元のスロット数 (展開した関数のローカル変数の分だけ増える)
+    ASTNode **hoisted;          // 処理中の文の前に挿入する宣言
+    int num_hoisted;
+    int capacity_hoisted;
+    ASTNode *active[INLINE_MAX_DEPTH]; // 展開中の関数 (再帰呼び出しは展開しない)
+    int depth;
+} InlineState;
+
+static ASTNode *inline_expression(ASTNode *node, InlineState *state);
+
+// 部分木のノード数 (上限を超えたら数えるのをやめる)
+static int count_nodes(const ASTNode *node, int limit) {
+    if (node == NULL || limit <= 0) {
+        return 0;
+    }
+    int count = 1;
+    switch (node->type) {
+        case NODE_BLOCK:
+            for (int i = 0; i < node->data.block.num_statements && count <= limit; i++) {
+                count += count_nodes(node->data.block.statements[i], limit - count);
+            }
+            break;
+        case NODE_RETURN_STATEMENT:
+            count += count_nodes(node->data.return_stmt.value, limit - count);
+            break;
+        case NODE_FUNCTION_CALL:
+            for (int i = 0; i < node->data.func_call.num_arguments && count <= limit; i++) {
+                count += count_nodes(node->data.func_call.arguments[i], limit - count);
+            }
+            break;
+        case NODE_VAR_DECLARATION:
+            count += count_nodes(node->data.var_decl.initializer, limit - count);
+            break;
+        case NODE_CONVERT:
+            count += count_nodes(node->data.convert.operand, limit - count);
+            break;
+        case NODE_ARRAY_LITERAL:
+            for (int i = 0; i < node->data.array_literal.num_elements && count <= limit; i++) {
+                count += count_nodes(node->data.array_literal.elements[i], limit - count);
+            }
+            break;
+        case NODE_INDEX:
+            count += count_nodes(node->data.index_expr.target, limit - count);
+            count += count_nodes(node->data.index_expr.index, limit - count);
+            count += count_nodes(node->data.index_expr.column, limit - count);
+            break;
+        case NODE_INDEX_ASSIGNMENT:
+            count += count_nodes(node->data.index_assignment.index, limit - count);
+            count += count_nodes(node->data.index_assignment.column, limit - count);
+            count += count_nodes(node->data.index_assignment.value, limit - count);
+            break;
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE:
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_DIVIDE_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE:
+        case NODE_CONCAT:
+            count += count_nodes(node->data.binary_expr.left, limit - count);
+            count += count_nodes(node->data.binary_expr.right, limit - count);
+            break;
+        case NODE_FORK:
+            count += count_nodes(node->data.fork_expr.body, limit - count);
+            break;
+        default:
+            break;
+    }
+    return count;
+}
+
+// 式の中でスロットが読まれる回数
+static int count_slot_uses(const ASTNode *node, int slot) {
+    if (node == NULL) {
+        return 0;
+    }
+    switch (node->type) {
+        case NODE_IDENTIFIER_EXPR:
+            return node->data.identifier_expr.slot == slot ? 1 : 0;
+        case NODE_BLOCK: {
+            int uses = 0;
+            for (int i = 0; i < node->data.block.num_statements; i++) {
+                uses += count_slot_uses(node->data.block.statements[i], slot);
+            }
+            return uses;
+        }
+        case NODE_RETURN_STATEMENT:
+            return count_slot_uses(node->data.return_stmt.value, slot);
+        case NODE_VAR_DECLARATION:
+            return count_slot_uses(node->data.var_decl.initializer, slot);
+        case NODE_FUNCTION_CALL: {
+            int uses = 0;
+            for (int i = 0; i < node->data.func_call.num_arguments; i++) {
+                uses += count_slot_uses(node->data.func_call.arguments[i], slot);
+            }
+            return uses;
+        }
+        case NODE_CONVERT:
+            return count_slot_uses(node->data.convert.operand, slot);
+        case NODE_ARRAY_LITERAL: {
+            int uses = 0;
+            for (int i = 0; i < node->data.array_literal.num_elements; i++) {
+                uses += count_slot_uses(node->data.array_literal.elements[i], slot);
+            }
+            return uses;
+        }
+        case NODE_INDEX:
+            return count_slot_uses(node->data.index_expr.target, slot) + count_slot_uses(node->data.index_expr.index, slot)
+                + count_slot_uses(node->data.index_expr.column, slot);
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE:
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_DIVIDE_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE:
+        case NODE_CONCAT:
+            return count_slot_uses(node->data.binary_expr.left, slot) + count_slot_uses(node->data.binary_expr.right, slot);
+        case NODE_FORK:
+            return count_slot_uses(node->data.fork_expr.body, slot);
+        default:
+            return 0;
+    }
+}
+
+// 式の複製の中の引数・ローカル変数の参照を replacement の複製に置き換える
+static ASTNode *substitute_slots(ASTNode *node, ASTNode **replacement) {
+    if (node == NULL) {
+        return NULL;
+    }
+    switch (node->type) {
+        case NODE_IDENTIFIER_EXPR: {
+            int slot = node->data.identifier_expr.slot;
+            if (slot < 0) {
+                return node; // 関数の参照
+            }
+            destroy_ast(node);
+            return clone_ast(replacement[slot]);
+        }
+        case NODE_FUNCTION_CALL:
+            for (int i = 0; i < node->data.func_call.num_arguments; i++) {
+                node->data.func_call.arguments[i] = substitute_slots(node->data.func_call.arguments[i], replacement);
+            }
+            // 自動並列化の隠れたスロットは呼び出し元のフレームにないので、展開した式は逐次に評価する
+            node->data.func_call.fork_slot = -1;
+            break;
+        case NODE_CONVERT:
+            node->data.convert.operand = substitute_slots(node->data.convert.operand, replacement);
+            break;
+        case NODE_ARRAY_LITERAL:
+            for (int i = 0; i < node->data.array_literal.num_elements; i++) {
+                node->data.array_literal.elements[i] = substitute_slots(node->data.array_literal.elements[i], replacement);
+            }
+            break;
+        case NODE_INDEX:
+            node->data.index_expr.target = substitute_slots(node->data.index_expr.target, replacement);
+            node->data.index_expr.index = substitute_slots(node->data.index_expr.index, replacement);
+            node->data.index_expr.column = substitute_slots(node->data.index_expr.column, replacement);
+            break;
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE:
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_DIVIDE_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE:
+        case NODE_CONCAT:
+            node->data.binary_expr.left = substitute_slots(node->data.binary_expr.left, replacement);
+            node->data.binary_expr.right = substitute_slots(node->data.binary_expr.right, replacement);
+            break;
+        case NODE_FORK: {
+            ASTNode *body = substitute_slots(node->data.fork_expr.body, replacement);
+            node->data.fork_expr.body = NULL;
+            destroy_ast(node);
+            return body;
+        }
+        default:
+            break;
+    }
+    return node;
+}
+
+// 展開できる関数か: 副作用のない宣言の並びと、値を返す最後の式だけからなる小さな関数
+static bool is_inlinable(ASTNode *callee, const InlineState *state) {
+    // メモ化する関数は展開すると記録した結果を使えなくなる。ジェネレータは呼び出しで本体を実行しない
+    if (callee == state->caller || callee->data.func_def.memoized || callee->data.func_def.generator) {
+        return false;
+    }
+    for (int i = 0; i < state->depth; i++) {
+        if (state->active[i] == callee) {
+            return false;
+        }
+    }
+    ASTNode *body = callee->data.func_def.body;
+    int num_statements = body->data.block.num_statements;
+    if (num_statements == 0 || count_nodes(body, INLINE_MAX_NODES + 1) > INLINE_MAX_NODES) {
+        return false;
+    }
+    for (int i = 0; i < num_statements - 1; i++) {
+        ASTNode *statement = body->data.block.statements[i];
+        if (statement->type != NODE_VAR_DECLARATION || !statement->data.var_decl.checked
+            || !is_pure_expression(statement->data.var_decl.initializer)) {
+            return false;
+        }
+    }
+    ASTNode *last = body->data.block.statements[num_statements - 1];
+    return last->type != NODE_PRINT_STATEMENT && last->type != NODE_VAR_DECLARATION && last->type != NODE_ASSIGNMENT
+        && last->type != NODE_INDEX_ASSIGNMENT && last->type != NODE_FOR;
+}
+
+// 呼び出し元のフレームに新しいスロットを割り当て、値を束縛する宣言を処理中の文の前に挿入する
+// 返り値はそのスロットを読む式 (置き換えの雛形)
+static ASTNode *hoist_binding(InlineState *state, const ASTNode *decl, ASTNode *value) {
+    int slot = state->frame_size++;
+    ASTNode *binding = create_ast_node(NODE_VAR_DECLARATION, value->line);
+    binding->data.var_decl.type_name = strdup(decl->data.var_decl.type_name);
+    binding->data.var_decl.name = strdup(decl->data.var_decl.name);
+    if (binding->data.var_decl.type_name == NULL || binding->data.var_decl.name == NULL) {
+        perror("Failed to duplicate inlined variable name");
+        exit(EXIT_FAILURE);
+    }
+    binding->data.var_decl.decl_type = decl->data.var_decl.decl_type;
+    binding->data.var_decl.name_hash = decl->data.var_decl.name_hash;
+    binding->data.var_decl.initializer = value;
+    binding->data.var_decl.slot = slot;
+    binding->data.var_decl.checked = true; // 値は既に宣言型に変換済み
+
+    if (state->num_hoisted >= state->capacity_hoisted) {
+        int new_capacity = (state->capacity_hoisted == 0) ? 4 : state->capacity_hoisted * 2;
+        state->hoisted = realloc(state->hoisted, sizeof(ASTNode *) * new_capacity);
+        if (state->hoisted == NULL) {
+            perror("Failed to reallocate inlined bindings");
+            exit(EXIT_FAILURE);
+        }
+        state->capacity_hoisted = new_capacity;
+    }
+    state->hoisted[state->num_hoisted++] = binding;
+
+    ASTNode *reference = create_ast_node(NODE_IDENTIFIER_EXPR, value->line);
+    reference->data.identifier_expr.name = strdup(decl->data.var_decl.name);
+    if (reference->data.identifier_expr.name == NULL) {
+        perror("Failed to duplicate inlined variable name");
+        exit(EXIT_FAILURE);
+    }
+    reference->data.identifier_expr.name_hash = decl->data.var_decl.name_hash;
+    reference->data.identifier_expr.slot = slot;
+    return reference;
+}
+
+// 呼び出しを関数本体の式に置き換える (展開できなければ呼び出しをそのまま返す)
+static ASTNode *inline_call(ASTNode *call, InlineState *state) {
+    ASTNode *callee = call->data.func_call.callee;
+    // 自動並列化でタスクにする呼び出しは展開しない (呼び出し先は展開しても得にならないほど重い)
+    if (call->data.func_call.native != NULL || call->data.func_call.spawned || call->data.func_call.fork_slot >= 0
+        || !call->data.func_call.checked || callee == NULL
+        || state->depth >= INLINE_MAX_DEPTH || !is_inlinable(callee, state)) {
+        return call;
+    }
+    // 引数は本体の中で評価順が変わったり評価されなかったりするので、副作用のない式に限る
+    for (int i = 0; i < call->data.func_call.num_arguments; i++) {
+        if (!is_pure_expression(call->data.func_call.arguments[i])) {
+            return call;
+        }
+    }
+
+    ASTNode *body = callee->data.func_def.body;
+    int callee_slots = callee->data.func_def.frame_size;
+    ASTNode **replacement = calloc(callee_slots > 0 ? callee_slots : 1, sizeof(ASTNode *));
+    ASTNode **owned = calloc(callee_slots > 0 ? callee_slots : 1, sizeof(ASTNode *)); // 新しいスロットの参照
+    if (replacement == NULL || owned == NULL) {
+        perror("Failed to allocate inline substitution");
+        exit(EXIT_FAILURE);
+    }
+
+    // 引数の束縛: リテラルや変数、一度しか使われない式はそのまま埋め込み、それ以外は新しいスロットに入れる
+    for (int i = 0; i < callee->data.func_def.num_parameters; i++) {
+        ASTNode *param = callee->data.func_def.parameters[i];
+        ASTNode *arg = call->data.func_call.arguments[i];
+        int slot = param->data.var_decl.slot;
+        const ASTNode *operand = (arg->type == NODE_CONVERT) ? arg->data.convert.operand : arg;
+        bool trivial = (operand->type == NODE_NUMBER_LITERAL || operand->type == NODE_FLOAT_LITERAL
+                        || operand->type == NODE_STRING_LITERAL || operand->type == NODE_IDENTIFIER_EXPR);
+        if (trivial || count_slot_uses(body, slot) <= 1) {
+            replacement[slot] = arg;
+        } else {
+            owned[slot] = hoist_binding(state, param, clone_ast(arg));
+            replacement[slot] = owned[slot];
+        }
+    }
+
+    // ローカル変数は呼び出し元の新しいスロットに名前を付け替える
+    int num_statements = body->data.block.num_statements;
+    for (int i = 0; i < num_statements - 1; i++) {
+        ASTNode *decl = body->data.block.statements[i];
+        ASTNode *value = substitute_slots(clone_ast(decl->data.var_decl.initializer), replacement);
+        ASTNode *reference = hoist_binding(state, decl, value);
+        int slot = decl->data.var_decl.slot;
+        destroy_ast(owned[slot]); // 同名の再宣言なら前のスロットの参照を置き換える
+        owned[slot] = reference;
+        replacement[slot] = reference;
+    }
+
+    ASTNode *last = body->data.block.statements[num_statements - 1];
+    ASTNode *expression = (last->type == NODE_RETURN_STATEMENT) ? last->data.return_stmt.value : last;
+    ASTNode *inlined = substitute_slots(clone_ast(expression), replacement);
+
+    for (int i = 0; i < callee_slots; i++) {
+        destroy_ast(owned[i]);
+    }
+    free(owned);
+    free(replacement);
+    destroy_ast(call);
+
+    // 展開した式の中の呼び出しも予算の範囲で展開する
+    state->active[state->depth++] = callee;
+    inlined = inline_expression(inlined, state);
+    state->depth--;
+    return inlined;
+}
+
+static ASTNode *inline_expression(ASTNode *node, InlineState *state) {
+    if (node == NULL) {
+        return NULL;
+    }
+    switch (node->type) {
+        case NODE_FUNCTION_CALL:
+            for (int i = 0; i < node->data.func_call.num_arguments; i++) {
+                node->data.func_call.arguments[i] = inline_expression(node->data.func_call.arguments[i], state);
+            }
+            return inline_call(node, state);
+        case NODE_CONVERT:
+            node->data.convert.operand = inline_expression(node->data.convert.operand, state);
+            break;
+        case NODE_ARRAY_LITERAL:
+            for (int i = 0; i < node->data.array_literal.num_elements; i++) {
+                node->data.array_literal.elements[i] = inline_expression(node->data.array_literal.elements[i], state);
+            }
+            break;
+        case NODE_INDEX:
+            node->data.index_expr.target = inline_expression(node->data.index_expr.target, state);
+            node->data.index_expr.index = inline_expression(node->data.index_expr.index, state);
+            node->data.index_expr.column = inline_expression(node->data.index_expr.column, state);
+            break;
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE:
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_DIVIDE_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE:
+        case NODE_CONCAT:
+            node->data.binary_expr.left = inline_expression(node->data.binary_expr.left, state);
+            node->data.binary_expr.right = inline_expression(node->data.binary_expr.right, state);
+            break;
+        case NODE_FORK:
+            node->data.fork_expr.body = inline_expression(node->data.fork_expr.body, state);
+            break;
+        case NODE_PRINT_STATEMENT: // NODE_FORK が包んだ print 文
+            for (int i = 0; i < node->data.print_stmt.num_arguments; i++) {
+                node->data.print_stmt.arguments[i] = inline_expression(node->data.print_stmt.arguments[i], state);
+            }
+            break;
+        default:
+            break;
+    }
+    return node;
+}
+
+// 関数本体の呼び出しを展開し、束縛の宣言をそれぞれの文の前に挿入する
+static void inline_calls(ASTNode *body, InlineState *state) {
+    int num_statements = body->data.block.num_statements;
+    ASTNode **statements = body->data.block.statements;
+    ASTNode **result = NULL;
+    int num_result = 0;
+    int capacity_result = 0;
+
+    for (int i = 0; i < num_statements; i++) {
+        ASTNode *statement = statements[i];
+        state->num_hoisted = 0;
+        switch (statement->type) {
+            case NODE_RETURN_STATEMENT:
+                statement->data.return_stmt.value = inline_expression(statement->data.return_stmt.value, state);
+                break;
+            case NODE_YIELD:
+                statement->data.yield_stmt.value = inline_expression(statement->data.yield_stmt.value, state);
+                break;
+            case NODE_PRINT_STATEMENT:
+                for (int j = 0; j < statement->data.print_stmt.num_arguments; j++) {
+                    statement->data.print_stmt.arguments[j] = inline_expression(statement->data.print_stmt.arguments[j], state);
+                }
+                break;
+            case NODE_VAR_DECLARATION:
+                statement->data.var_decl.initializer = inline_expression(statement->data.var_decl.initializer, state);
+                break;
+            case NODE_ASSIGNMENT:
+                statement->data.assignment.value = inline_expression(statement->data.assignment.value, state);
+                break;
+            case NODE_INDEX_ASSIGNMENT:
+                statement->data.index_assignment.index = inline_expression(statement->data.index_assignment.index, state);
+                statement->data.index_assignment.column = inline_expression(statement->data.index_assignment.column, state);
+                statement->data.index_assignment.value = inline_expression(statement->data.index_assignment.value, state);
+                break;
+            case NODE_FOR:
+                // 本体の束縛は本体の文の前に入るので、範囲の束縛より先に済ませる
+                inline_calls(statement->data.for_stmt.body, state);
+                state->num_hoisted = 0;
+                statement->data.for_stmt.start = inline_expression(statement->data.for_stmt.start, state);
+                statement->data.for_stmt.end = inline_expression(statement->data.for_stmt.end, state);
+                statement->data.for_stmt.iterable = inline_expression(statement->data.for_stmt.iterable, state);
+                break;
+            default:
+                statement = inline_expression(statement, state);
+                break;
+        }
+
+        int needed = num_result + state->num_hoisted + 1;
+        if (needed > capacity_result) {
+            int new_capacity = (capacity_result == 0) ? num_statements : capacity_result * 2;
+            while (new_capacity < needed) {
+                new_capacity *= 2;
+            }
+            result = realloc(result, sizeof(ASTNode *) * new_capacity);
+            if (result == NULL) {
+                perror("Failed to reallocate inlined statements");
+                exit(EXIT_FAILURE);
+            }
+            capacity_result = new_capacity;
+        }
+        for (int j = 0; j < state->num_hoisted; j++) {
+            result[num_result++] = state->hoisted[j];
+        }
+        result[num_result++] = statement;
+    }
+
+    free(statements);
+    body->data.block.statements = result;
+    body->data.block.num_statements = num_result;
+    body->data.block.capacity_statements = capacity_result;
+}
+
+static bool is_numeric_literal(const ASTNode *node) {
+    return node->type == NODE_NUMBER_LITERAL || node->type == NODE_FLOAT_LITERAL;
+}
+
+static bool is_zero_literal(const ASTNode *node) {
+    return (node->type == NODE_NUMBER_LITERAL && node->data.number_literal.value == 0)
+        || (node->type == NODE_FLOAT_LITERAL && node->data.float_literal.value == 0.0);
+}
+
+// 定数だけの二項演算をインタプリタと同じ規則で評価し、リテラルに置き換える
+// 0 による除算は実行時エラーのまま残すため畳み込まない。
+static ASTNode *fold_binary(ASTNode *node) {
+    ASTNode *left = node->data.binary_expr.left;
+    ASTNode *right = node->data.binary_expr.right;
+    bool numeric = is_numeric_literal(left) && is_numeric_literal(right);
+    bool strings = (node->type == NODE_ADD || node->type == NODE_CONCAT) && left->type == NODE_STRING_LITERAL && right->type == NODE_STRING_LITERAL;
+    if (!numeric && !strings) {
+        return node;
+    }
+    bool divide = (node->type == NODE_DIVIDE || node->type == NODE_DIVIDE_INT || node->type == NODE_DIVIDE_DOUBLE);
+    if (divide && is_zero_literal(right)) {
+        return node;
+    }
+
+    // リテラル同士の演算は環境に触れない
+    ASTNode *folded = make_literal_node(interpret_node(node, NULL), node->line);
+    destroy_ast(node);
+    return folded;
+}
+
+// 整数リテラルの double への変換をリテラルに置き換える
+// (bool への変換は対応するリテラルがないので実行時に残す)
+static ASTNode *fold_convert(ASTNode *node) {
+    ASTNode *operand = node->data.convert.operand;
+    if (node->data.convert.to != VALUE_TYPE_DOUBLE || operand->type != NODE_NUMBER_LITERAL) {
+        return node;
+    }
+    ASTNode *folded = create_ast_node(NODE_FLOAT_LITERAL, node->line);
+    folded->data.float_literal.value = (double)operand->data.number_literal.value;
+    destroy_ast(node);
+    return folded;
+}
+
+static bool is_int_literal(const ASTNode *node, long value) {
+    return node->type == NODE_NUMBER_LITERAL && node->data.number_literal.value == value;
+}
+
+// 符号まで含めて一致する double リテラルか (0.0 と -0.0 を区別する)
+static bool is_double_literal(const ASTNode *node, double value) {
+    return node->type == NODE_FLOAT_LITERAL && node->data.float_literal.value == value
+        && signbit(node->data.float_literal.value) == signbit(value);
+}
+
+// 2 の冪で、逆数も正確に表せる double か (x / c と x * (1 / c) が全ての x で一致する)
+static bool has_exact_reciprocal(double value) {
+    int exponent;
+    if (!isfinite(value) || value == 0.0 || fabs(frexp(value, &exponent)) != 0.5) {
+        return false;
+    }
+    double reciprocal = 1.0 / value;
+    return isfinite(reciprocal) && fabs(frexp(reciprocal, &exponent)) == 0.5;
+}
+
+// 型の確定した演算の代数的な簡約
+// IEEE 754 の結果が全ての入力で変わらないものだけを行う (x + 0.0 は -0.0 で結果が変わるので残す)。
+static ASTNode *simplify_binary(ASTNode *node) {
+    ASTNode *left = node->data.binary_expr.left;
+    ASTNode *right = node->data.binary_expr.right;
+    ASTNode *keep = NULL;
+    switch (node->type) {
+        case NODE_ADD_INT:
+            keep = is_int_literal(right, 0) ? left : (is_int_literal(left, 0) ? right : NULL);
+            break;
+        case NODE_SUBTRACT_INT:
+            keep = is_int_literal(right, 0) ? left : NULL;
+            break;
+        case NODE_MULTIPLY_INT:
+            keep = is_int_literal(right, 1) ? left : (is_int_literal(left, 1) ? right : NULL);
+            break;
+        case NODE_DIVIDE_INT:
+            keep = is_int_literal(right, 1) ? left : NULL;
+            break;
+        case NODE_ADD_DOUBLE:
+            keep = is_double_literal(right, -0.0) ? left : (is_double_literal(left, -0.0) ? right : NULL);
+            break;
+        case NODE_SUBTRACT_DOUBLE:
+            keep = is_double_literal(right, 0.0) ? left : NULL;
+            break;
+        case NODE_MULTIPLY_DOUBLE:
+            keep = is_double_literal(right, 1.0) ? left : (is_double_literal(left, 1.0) ? right : NULL);
+            break;
+        case NODE_DIVIDE_DOUBLE:
+            if (is_double_literal(right, 1.0)) {
+                keep = left;
+            } else if (right->type == NODE_FLOAT_LITERAL && has_exact_reciprocal(right->data.float_literal.value)) {
+                // 除算を逆数の乗算にする (逆数が正確なので丸めの結果は同じ)
+                node->type = NODE_MULTIPLY_DOUBLE;
+                right->data.float_literal.value = 1.0 / right->data.float_literal.value;
+            }
+            break;
+        default:
+            break;
+    }
+    if (keep == NULL) {
+        return node;
+    }
+    if (keep == left) {
+        node->data.binary_expr.left = NULL;
+    } else {
+        node->data.binary_expr.right = NULL;
+    }
+    destroy_ast(node);
+    return keep;
+}
+
+// 部分木の定数を畳み込み、置き換え後のノードを返す
+static ASTNode *fold_constants(ASTNode *node) {
+    if (node == NULL) {
+        return NULL;
+    }
+
+    switch (node->type) {
+        case NODE_PROGRAM:
+        case NODE_BLOCK:
+            for (int i = 0; i < node->data.block.num_statements; i++) {
+                node->data.block.statements[i] = fold_constants(node->data.block.statements[i]);
+            }
+            break;
+        case NODE_RETURN_STATEMENT:
+            node->data.return_stmt.value = fold_constants(node->data.return_stmt.value);
+            break;
+        case NODE_YIELD:
+            node->data.yield_stmt.value = fold_constants(node->data.yield_stmt.value);
+            break;
+        case NODE_PRINT_STATEMENT:
+            for (int i = 0; i < node->data.print_stmt.num_arguments; i++) {
+                node->data.print_stmt.arguments[i] = fold_constants(node->data.print_stmt.arguments[i]);
+            }
+            break;
+        case NODE_FUNCTION_CALL:
+            for (int i = 0; i < node->data.func_call.num_arguments; i++) {
+                node->data.func_call.arguments[i] = fold_constants(node->data.func_call.arguments[i]);
+            }
+            break;
+        case NODE_VAR_DECLARATION:
+            node->data.var_decl.initializer = fold_constants(node->data.var_decl.initializer);
+            break;
+        case NODE_ASSIGNMENT:
+            node->data.assignment.value = fold_constants(node->data.assignment.value);
+            break;
+        case NODE_INDEX_ASSIGNMENT:
+            node->data.index_assignment.index = fold_constants(node->data.index_assignment.index);
+            node->data.index_assignment.column = fold_constants(node->data.index_assignment.column);
+            node->data.index_assignment.value = fold_constants(node->data.index_assignment.value);
+            break;
+        case NODE_ARRAY_LITERAL:
+            for (int i = 0; i < node->data.array_literal.num_elements; i++) {
+                node->data.array_literal.elements[i] = fold_constants(node->data.array_literal.elements[i]);
+            }
+            break;
+        case NODE_INDEX:
+            node->data.index_expr.target = fold_constants(node->data.index_expr.target);
+            node->data.index_expr.index = fold_constants(node->data.index_expr.index);
+            node->data.index_expr.column = fold_constants(node->data.index_expr.column);
+            break;
+        case NODE_FOR:
+            node->data.for_stmt.start = fold_constants(node->data.for_stmt.start);
+            node->data.for_stmt.end = fold_constants(node->data.for_stmt.end);
+            node->data.for_stmt.iterable = fold_constants(node->data.for_stmt.iterable);
+            node->data.for_stmt.body = fold_constants(node->data.for_stmt.body);
+            break;
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE:
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_DIVIDE_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE:
+        case NODE_CONCAT:
+            node->data.binary_expr.left = fold_constants(node->data.binary_expr.left);
+            node->data.binary_expr.right = fold_constants(node->data.binary_expr.right);
+            return simplify_binary(fold_binary(node));
+        case NODE_CONVERT:
+            node->data.convert.operand = fold_constants(node->data.convert.operand);
+            return fold_convert(node);
+        case NODE_FORK:
+            node->data.fork_expr.body = fold_constants(node->data.fork_expr.body);
+            break;
+        default:
+            break;
+    }
+    return node;
+}
+
+// --- 共通部分式の除去 ---
+// 関数本体 (分岐のない文の並び) を先頭から走査し、同じ値になる副作用のない式を
+// 一度だけ計算して隠れた一時変数に入れる。変数への書き込みがあれば、その変数を読む式は以降一致させない。
+
+// 計算済みの式
+typedef struct CseEntry {
+    ASTNode *expression;  // 最初に現れた式 (一時変数を作った後はその初期化式)
+    ASTNode **location;   // 最初に現れた位置 (一時変数を作るまで使う)
+    unsigned int hash;
+    int statement;        // 最初に現れた文の添字
+    int temp_slot;        // 一時変数のスロット (-1 は未作成)
+} CseEntry;
+
+// 文の前に挿入する一時変数の宣言
+typedef struct CseBinding {
+    int statement;
+    ASTNode *declaration;
+} CseBinding;
+
+typedef struct CseState {
+    CseEntry *entries;
+    int num_entries;
+    int capacity_entries;
+    CseBinding *bindings;
+    int num_bindings;
+    int capacity_bindings;
+    int frame_size;
+    int statement; // 走査中の文の添字
+} CseState;
+
+static bool is_typed_binary(const ASTNode *node) {
+    switch (node->type) {
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_DIVIDE_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE:
+        case NODE_CONCAT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// 同じ値を計算する式か (構造が同じで、同じスロットとリテラルを使う)
+static bool same_expression(const ASTNode *a, const ASTNode *b) {
+    if (a->type != b->type) {
+        return false;
+    }
+    switch (a->type) {
+        case NODE_NUMBER_LITERAL:
+            return a->data.number_literal.value == b->data.number_literal.value;
+        case NODE_FLOAT_LITERAL:
+            return memcmp(&a->data.float_literal.value, &b->data.float_literal.value, sizeof(double)) == 0;
+        case NODE_STRING_LITERAL:
+            return strcmp(a->data.string_literal.value, b->data.string_literal.value) == 0;
+        case NODE_IDENTIFIER_EXPR:
+            if (a->data.identifier_expr.slot != b->data.identifier_expr.slot) {
+                return false;
+            }
+            return a->data.identifier_expr.slot >= 0 || strcmp(a->data.identifier_expr.name, b->data.identifier_expr.name) == 0;
+        case NODE_CONVERT:
+            return a->data.convert.to == b->data.convert.to && same_expression(a->data.convert.operand, b->data.convert.operand);
+        default:
+            return is_typed_binary(a)
+                && same_expression(a->data.binary_expr.left, b->data.binary_expr.left)
+                && same_expression(a->data.binary_expr.right, b->data.binary_expr.right);
+    }
+}
+
+static unsigned int mix_hash(unsigned int hash, unsigned int value) {
+    return (hash ^ value) * 16777619u;
+}
+
+static unsigned int literal_hash(const void *data, size_t size) {
+    unsigned int hash = 2166136261u;
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = mix_hash(hash, bytes[i]);
+    }
+    return hash;
+}
+
+// 一時変数の宣言と、その値を読む式を作る
+static ASTNode *make_temporary(ASTNode *expression, int slot) {
+    ValueType type;
+    const char *type_name;
+    switch (expression->type) {
+        case NODE_CONCAT:
+            type = VALUE_TYPE_STR;
+            type_name = "str";
+            break;
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE:
+            type = VALUE_TYPE_DOUBLE;
+            type_name = "double";
+            break;
+        default:
+            type = VALUE_TYPE_INT;
+            type_name = "int";
+            break;
+    }
+    ASTNode *declaration = create_ast_node(NODE_VAR_DECLARATION, expression->line);
+    declaration->data.var_decl.type_name = strdup(type_name);
+    declaration->data.var_decl.name = strdup("(一時変数)");
+    if (declaration->data.var_decl.type_name == NULL || declaration->data.var_decl.name == NULL) {
+        perror("Failed to duplicate temporary name");
+        exit(EXIT_FAILURE);
+    }
+    declaration->data.var_decl.decl_type = type;
+    declaration->data.var_decl.name_hash = hash_symbol_name(declaration->data.var_decl.name);
+    declaration->data.var_decl.initializer = expression;
+    declaration->data.var_decl.slot = slot;
+    declaration->data.var_decl.checked = true;
+    return declaration;
+}
+
+static ASTNode *make_temporary_reference(int slot, int line) {
+    ASTNode *reference = create_ast_node(NODE_IDENTIFIER_EXPR, line);
+    reference->data.identifier_expr.name = strdup("(一時変数)");
+    if (reference->data.identifier_expr.name == NULL) {
+        perror("Failed to duplicate temporary name");
+        exit(EXIT_FAILURE);
+    }
+    reference->data.identifier_expr.name_hash = hash_symbol_name(reference->data.identifier_expr.name);
+    reference->data.identifier_expr.slot = slot;
+    return reference;
+}
+
+// 計算済みの式と一致すれば一時変数の参照に置き換え、一致しなければ新しく登録する
+static void reuse_or_record(ASTNode **location, unsigned int hash, CseState *state) {
+    ASTNode *node = *location;
+    for (int i = 0; i < state->num_entries; i++) {
+        CseEntry *entry = &state->entries[i];
+        if (entry->hash != hash || !same_expression(entry->expression, node)) {
+            continue;
+        }
+        if (entry->temp_slot < 0) {
+            // 二度目に現れたので、最初の位置の式を一時変数に移す
+            entry->temp_slot = state->frame_size++;
+            *entry->location = make_temporary_reference(entry->temp_slot, entry->expression->line);
+            if (state->num_bindings >= state->capacity_bindings) {
+                int new_capacity = (state->capacity_bindings == 0) ? 4 : state->capacity_bindings * 2;
+                state->bindings = realloc(state->bindings, sizeof(CseBinding) * new_capacity);
+                if (state->bindings == NULL) {
+                    perror("Failed to reallocate temporaries");
+                    exit(EXIT_FAILURE);
+                }
+                state->capacity_bindings = new_capacity;
+            }
+            state->bindings[state->num_bindings].statement = entry->statement;
+            state->bindings[state->num_bindings].declaration = make_temporary(entry->expression, entry->temp_slot);
+            state->num_bindings++;
+            entry->location = NULL;
+        }
+        *location = make_temporary_reference(entry->temp_slot, node->line);
+        destroy_ast(node);
+        return;
+    }
+
+    if (state->num_entries >= state->capacity_entries) {
+        int new_capacity = (state->capacity_entries == 0) ? 16 : state->capacity_entries * 2;
+        state->entries = realloc(state->entries, sizeof(CseEntry) * new_capacity);
+        if (state->entries == NULL) {
+            perror("Failed to reallocate expressions");
+            exit(EXIT_FAILURE);
+        }
+        state->capacity_entries = new_capacity;
+    }
+    CseEntry *entry = &state->entries[state->num_entries++];
+    entry->expression = node;
+    entry->location = location;
+    entry->hash = hash;
+    entry->statement = state->statement;
+    entry->temp_slot = -1;
+}
+
+// 式を葉から順に走査し、式のハッシュを返す
+// 子を先に置き換えるので、新しく作る一時変数は既にある一時変数を使う側になり、宣言は作った順に並べればよい。
+static unsigned int eliminate_common_subexpressions(ASTNode **location, CseState *state) {
+    ASTNode *node = *location;
+    unsigned int hash = mix_hash(2166136261u, (unsigned int)node->type);
+    switch (node->type) {
+        case NODE_NUMBER_LITERAL:
+            return mix_hash(hash, literal_hash(&node->data.number_literal.value, sizeof(node->data.number_literal.value)));
+        case NODE_FLOAT_LITERAL:
+            return mix_hash(hash, literal_hash(&node->data.float_literal.value, sizeof(double)));
+        case NODE_STRING_LITERAL:
+            return mix_hash(hash, hash_symbol_name(node->data.string_literal.value));
+        case NODE_IDENTIFIER_EXPR:
+            return mix_hash(hash, (unsigned int)node->data.identifier_expr.slot);
+        case NODE_FUNCTION_CALL:
+            for (int i = 0; i < node->data.func_call.num_arguments; i++) {
+                eliminate_common_subexpressions(&node->data.func_call.arguments[i], state);
+            }
+            return hash;
+        case NODE_CONVERT:
+            hash = mix_hash(hash, (unsigned int)node->data.convert.to);
+            return mix_hash(hash, eliminate_common_subexpressions(&node->data.convert.operand, state));
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE:
+            eliminate_common_subexpressions(&node->data.binary_expr.left, state);
+            eliminate_common_subexpressions(&node->data.binary_expr.right, state);
+            return hash;
+        case NODE_ARRAY_LITERAL:
+            for (int i = 0; i < node->data.array_literal.num_elements; i++) {
+                eliminate_common_subexpressions(&node->data.array_literal.elements[i], state);
+            }
+            return hash;
+        case NODE_INDEX:
+            eliminate_common_subexpressions(&node->data.index_expr.target, state);
+            eliminate_common_subexpressions(&node->data.index_expr.index, state);
+            if (node->data.index_expr.column != NULL) {
+                eliminate_common_subexpressions(&node->data.index_expr.column, state);
+            }
+            return hash;
+        default:
+            break;
+    }
+    if (!is_typed_binary(node)) {
+        return hash;
+    }
+    hash = mix_hash(hash, eliminate_common_subexpressions(&node->data.binary_expr.left, state));
+    hash = mix_hash(hash, eliminate_common_subexpressions(&node->data.binary_expr.right, state));
+    if (is_pure_expression(*location)) {
+        reuse_or_record(location, hash, state);
+    }
+    return hash;
+}
+
+// スロットへの書き込みの後、そのスロットを読む計算済みの式を忘れる
+static bool reads_slot(const ASTNode *node, int slot) {
+    switch (node->type) {
+        case NODE_IDENTIFIER_EXPR:
+            return node->data.identifier_expr.slot == slot;
+        case NODE_CONVERT:
+            return reads_slot(node->data.convert.operand, slot);
+        default:
+            return is_typed_binary(node)
+                && (reads_slot(node->data.binary_expr.left, slot) || reads_slot(node->data.binary_expr.right, slot));
+    }
+}
+
+static void invalidate_slot(CseState *state, int slot) {
+    if (slot < 0) {
+        return;
+    }
+    int kept = 0;
+    for (int i = 0; i < state->num_entries; i++) {
+        if (!reads_slot(state->entries[i].expression, slot)) {
+            state->entries[kept++] = state->entries[i];
+        }
+    }
+    state->num_entries = kept;
+}
+
+static void eliminate_common_subexpressions_in_block(ASTNode *body, int *frame_size);
+
+// for 文: 範囲はループの前に一度だけ評価されるのでループの外の式と共有し、
+// 本体は繰り返すたびに計算し直す別のブロックとして処理する
+static void eliminate_common_subexpressions_in_loop(ASTNode *statement, CseState *state) {
+    if (statement->data.for_stmt.iterable != NULL) {
+        eliminate_common_subexpressions(&statement->data.for_stmt.iterable, state);
+    } else {
+        eliminate_common_subexpressions(&statement->data.for_stmt.start, state);
+        eliminate_common_subexpressions(&statement->data.for_stmt.end, state);
+    }
+    eliminate_common_subexpressions_in_block(statement->data.for_stmt.body, &state->frame_size);
+    // 本体がどの変数に書き込んだかは追わず、ループの後は計算済みの式を全て忘れる
+    state->num_entries = 0;
+}
+
+static void eliminate_common_subexpressions_in_block(ASTNode *body, int *frame_size) {
+    CseState state;
+    state.entries = NULL;
+    state.num_entries = 0;
+    state.capacity_entries = 0;
+    state.bindings = NULL;
+    state.num_bindings = 0;
+    state.capacity_bindings = 0;
+    state.frame_size = *frame_size;
+
+    int num_statements = body->data.block.num_statements;
+    ASTNode **statements = body->data.block.statements;
+    for (int i = 0; i < num_statements; i++) {
+        ASTNode *statement = statements[i];
+        state.statement = i;
+        switch (statement->type) {
+            case NODE_RETURN_STATEMENT:
+                eliminate_common_subexpressions(&statement->data.return_stmt.value, &state);
+                break;
+            case NODE_YIELD:
+                eliminate_common_subexpressions(&statement->data.yield_stmt.value, &state);
+                break;
+            case NODE_PRINT_STATEMENT:
+                for (int j = 0; j < statement->data.print_stmt.num_arguments; j++) {
+                    eliminate_common_subexpressions(&statement->data.print_stmt.arguments[j], &state);
+                }
+                break;
+            case NODE_VAR_DECLARATION:
+                eliminate_common_subexpressions(&statement->data.var_decl.initializer, &state);
+                invalidate_slot(&state, statement->data.var_decl.slot);
+                break;
+            case NODE_ASSIGNMENT:
+                eliminate_common_subexpressions(&statement->data.assignment.value, &state);
+                invalidate_slot(&state, statement->data.assignment.slot);
+                break;
+            case NODE_INDEX_ASSIGNMENT:
+                eliminate_common_subexpressions(&statement->data.index_assignment.index, &state);
+                if (statement->data.index_assignment.column != NULL) {
+                    eliminate_common_subexpressions(&statement->data.index_assignment.column, &state);
+                }
+                eliminate_common_subexpressions(&statement->data.index_assignment.value, &state);
+                invalidate_slot(&state, statement->data.index_assignment.slot);
+                break;
+            case NODE_FOR:
+                eliminate_common_subexpressions_in_loop(statement, &state);
+                break;
+            default:
+                eliminate_common_subexpressions(&statements[i], &state);
+                break;
+        }
+    }
+
+    if (state.num_bindings > 0) {
+        // 宣言はそれぞれ最初に現れた文の前に、同じ文の前では作った順に並べる
+        // (作った順は文の添字の順とは限らないので、文ごとの個数から挿入位置を求める)
+        int *first_binding = calloc(num_statements + 1, sizeof(int));
+        ASTNode **ordered = malloc(sizeof(ASTNode *) * state.num_bindings);
+        ASTNode **result = malloc(sizeof(ASTNode *) * (num_statements + state.num_bindings));
+        if (first_binding == NULL || ordered == NULL || result == NULL) {
+            perror("Failed to allocate statements");
+            exit(EXIT_FAILURE);
+        }
+        for (int j = 0; j < state.num_bindings; j++) {
+            first_binding[state.bindings[j].statement + 1]++;
+        }
+        for (int i = 0; i < num_statements; i++) {
+            first_binding[i + 1] += first_binding[i];
+        }
+        for (int j = 0; j < state.num_bindings; j++) {
+            ordered[first_binding[state.bindings[j].statement]++] = state.bindings[j].declaration;
+        }
+
+        int num_result = 0;
+        int next = 0;
+        for (int i = 0; i < num_statements; i++) {
+            // first_binding[i] は文 i の宣言の終わりを指している
+            while (next < first_binding[i]) {
+                result[num_result++] = ordered[next++];
+            }
+            result[num_result++] = statements[i];
+        }
+        free(first_binding);
+        free(ordered);
+        free(statements);
+        body->data.block.statements = result;
+        body->data.block.num_statements = num_result;
+        body->data.block.capacity_statements = num_result;
+    }
+
+    free(state.entries);
+    free(state.bindings);
+    *frame_size = state.frame_size;
+}
+
+// 関数本体の最適化済みの複製を作る
+// 複製は元の本体のスロット番号をそのまま使い、インライン展開で追加したスロットはその後ろに置く。
+// 複製に必要なスロット数を frame_size に返す。
+ASTNode *optimize_function_body(ASTNode *func_def, int *frame_size) {
+    ASTNode *body = clone_ast(func_def->data.func_def.body);
+
+    InlineState state;
+    state.caller = func_def;
+    state.frame_size = func_def->data.func_def.frame_size;
+    state.hoisted = NULL;
+    state.num_hoisted = 0;
+    state.capacity_hoisted = 0;
+    state.depth = 0;
+    inline_calls(body, &state);
+    free(state.hoisted);
+
+    body = fold_constants(body);
+    *frame_size = state.frame_size;
+    eliminate_common_subexpressions_in_block(body, frame_size);
+    return body;
+}
@@ -0,0 +1,229 @@
+#include "kappok.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+// 終了時にフラッシュする書き込み先の一覧 (exit() で抜ける実行時エラーでも出力を失わない)
+// 埋め込み API では実行ごとに書き込み先を開閉するので、一覧はロックして読み書きする。
+static OutputWriter *open_writers = NULL;
+static bool exit_handler_registered = false;
+static pthread_mutex_t writers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// print の1行を組み立てるスレッドごとのバッファ
+// 行は改行のときにまとめて書き先へ移すので、spawn したタスクの print と行の途中で混ざらない。
+// 引数の評価中に入れ子の print があっても、同じスレッドの同じバッファに続けて書く。
+static __thread OutputWriter line_buffer;
+static __thread OutputWriter *line_target = NULL; // 組み立て中の行の書き先
+static __thread size_t line_start = 0;            // 組み立て中の行の先頭 (それより前は脇に置いた行)
+
+static void flush_open_writers(void) {
+    // 実行時エラーで終了するスレッドが組み立てていた途中の行も書き出す
+    output_write_partial_line();
+    pthread_mutex_lock(&writers_lock);
+    for (OutputWriter *out = open_writers; out != NULL; out = out->next) {
+        // 他のスレッドが書いている途中の行は、書き終えてからフラッシュする
+        pthread_mutex_lock(&out->lock);
+        output_flush(out);
+        pthread_mutex_unlock(&out->lock);
+    }
+    pthread_mutex_unlock(&writers_lock);
+}
+
+// iov を全て書き切る (部分書き込みと EINTR を処理する)
+static void write_all(OutputWriter *out, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0 && !out->failed) {
+        ssize_t written = writev(out->fd, iov, iovcnt);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // パイプの読み手が閉じた場合などは以降の出力を捨てる
+            out->failed = true;
+            return;
+        }
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+void output_open(OutputWriter *out, int fd, OutputBufferMode mode) {
+    if (mode == OUTPUT_BUFFER_AUTO) {
+        // 端末なら行単位、パイプやファイルならバッファが埋まるまで溜める
+        mode = isatty(fd) ? OUTPUT_BUFFER_LINE : OUTPUT_BUFFER_FULL;
+    }
+    out->fd = fd;
+    out->mode = mode;
+    out->length = 0;
+    out->capacity = OUTPUT_BUFFER_SIZE;
+    out->failed = false;
+    pthread_mutex_init(&out->lock, NULL);
+    out->buffer = malloc(out->capacity);
+    if (out->buffer == NULL) {
+        perror("Failed to allocate output buffer");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&writers_lock);
+    out->next = open_writers;
+    open_writers = out;
+    if (!exit_handler_registered) {
+        atexit(flush_open_writers);
+        exit_handler_registered = true;
+    }
+    pthread_mutex_unlock(&writers_lock);
+}
+
+void output_close(OutputWriter *out) {
+    output_flush(out);
+    pthread_mutex_lock(&writers_lock);
+    for (OutputWriter **link = &open_writers; *link != NULL; link = &(*link)->next) {
+        if (*link == out) {
+            *link = out->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&writers_lock);
+    free(out->buffer);
+    out->buffer = NULL;
+    pthread_mutex_destroy(&out->lock);
+}
+
+// 溜める一方のバッファを広げる
+static void grow_memory_buffer(OutputWriter *out, size_t needed) {
+    size_t capacity = out->capacity;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    out->buffer = realloc(out->buffer, capacity);
+    if (out->buffer == NULL) {
+        perror("Failed to reallocate output buffer");
+        exit(EXIT_FAILURE);
+    }
+    out->capacity = capacity;
+}
+
+void output_flush(OutputWriter *out) {
+    if (out->length == 0 || out->mode == OUTPUT_BUFFER_MEMORY) {
+        return;
+    }
+    struct iovec iov = { out->buffer, out->length };
+    write_all(out, &iov, 1);
+    out->length = 0;
+}
+
+void output_write(OutputWriter *out, const char *data, size_t length) {
+    if (out->mode == OUTPUT_BUFFER_MEMORY && out->length + length > out->capacity) {
+        grow_memory_buffer(out, out->length + length);
+    }
+    if (out->length + length > out->capacity) {
+        if (length >= out->capacity / 2) {
+            // 大きな断片はコピーせず、溜まっている分と合わせて1回の writev で書く
+            struct iovec iov[2] = { { out->buffer, out->length }, { (char *)data, length } };
+            write_all(out, iov, 2);
+            out->length = 0;
+            return;
+        }
+        output_flush(out);
+    }
+    memcpy(out->buffer + out->length, data, length);
+    out->length += length;
+    if (out->mode == OUTPUT_BUFFER_NONE) {
+        output_flush(out);
+    }
+}
+
+void output_char(OutputWriter *out, char c) {
+    if (out->length >= out->capacity) {
+        if (out->mode == OUTPUT_BUFFER_MEMORY) {
+            grow_memory_buffer(out, out->length + 1);
+        } else {
+            output_flush(out);
+        }
+    }
+    out->buffer[out->length++] = c;
+    if (out->mode == OUTPUT_BUFFER_NONE) {
+        output_flush(out);
+    }
+}
+
+void output_string(OutputWriter *out, const char *str) {
+    output_write(out, str, strlen(str));
+}
+
+// 改行を書き、行バッファモードならここでフラッシュする
+void output_newline(OutputWriter *out) {
+    output_char(out, '\n');
+    if (out->mode == OUTPUT_BUFFER_LINE) {
+        output_flush(out);
+    }
+}
+
+// print の1行を組み立て始める: 書き先 out の代わりに書き込むバッファを返す
+OutputWriter *output_begin_line(OutputWriter *out) {
+    if (line_buffer.buffer == NULL) {
+        line_buffer.fd = -1;
+        line_buffer.mode = OUTPUT_BUFFER_MEMORY;
+        line_buffer.length = 0;
+        line_buffer.capacity = 256;
+        line_buffer.failed = false;
+        line_buffer.next = NULL;
+        line_buffer.buffer = malloc(line_buffer.capacity);
+        if (line_buffer.buffer == NULL) {
+            perror("Failed to allocate line buffer");
+            exit(EXIT_FAILURE);
+        }
+    }
+    line_target = out;
+    return &line_buffer;
+}
+
+// 組み立てた行に改行を付けて、他のスレッドの行と混ざらないよう書き先へまとめて書く
+void output_end_line(OutputWriter *out) {
+    pthread_mutex_lock(&out->lock);
+    output_write(out, line_buffer.buffer + line_start, line_buffer.length - line_start);
+    output_newline(out);
+    pthread_mutex_unlock(&out->lock);
+    line_buffer.length = line_start;
+}
+
+// 組み立て中の行を脇に置き、以降の print を新しい行から始める
+// (join したスレッドがその場でタスクを実行するとき、print の引数の途中の行にタスクの行を繋げない)
+size_t output_set_aside_line(void) {
+    size_t saved = line_start;
+    line_start = line_buffer.length;
+    return saved;
+}
+
+// 脇に置いた行に戻る (実行時エラーで終わったタスクが組み立てかけた行は捨てる)
+void output_resume_line(size_t saved) {
+    line_buffer.length = line_start;
+    line_start = saved;
+}
+
+// このスレッドが組み立てていた途中の行を (脇に置いた行も含めて) 書き先へ書き、行を空にする
+// (実行時エラーで打ち切られた print の途中までの出力。終了時と、埋め込み API の実行の後に使う)
+void output_write_partial_line(void) {
+    if (line_target != NULL && line_buffer.length > 0) {
+        pthread_mutex_lock(&line_target->lock);
+        output_write(line_target, line_buffer.buffer, line_buffer.length);
+        pthread_mutex_unlock(&line_target->lock);
+    }
+    line_buffer.length = 0;
+    line_start = 0;
+}
+
+// このスレッドの行バッファを解放する (埋め込み API の実行の後。実行したスレッドが終わっても残らない)
+void output_release_line_buffer(void) {
+    free(line_buffer.buffer);
+    line_buffer.buffer = NULL;
+    line_buffer.length = 0;
+    line_start = 0;
+    line_target = NULL;
+}
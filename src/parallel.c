@@ -0,0 +1,1112 @@
+#define _GNU_SOURCE // pthread_getattr_np
+#include "kappok.h"
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+// 並列実行 (spawn / join、parallel_map と自動並列化の呼び出し)
+// 作業スレッドはそれぞれタスクの両端キュー (Chase–Lev) を持つ。自分が作ったタスクはキューの底に
+// 積んで底から取り (LIFO)、仕事のなくなったスレッドは他のスレッドのキューの天井からロックを
+// 取らずに盗む (FIFO)。作業スレッドでないスレッド (main を実行するスレッド) が作ったタスクは、
+// ミューテックスで守った投入キューに入れる。作業スレッドが1つもなければ (--threads 1) タスクは
+// キューに入れず、作った実行の組に後回しにして、join したときか main が終わったときに実行する。
+//
+// どのスレッドがタスクを実行するかは、状態を PENDING から RUNNING に CAS できたかで決まる。
+// join したタスクがまだ始まっていなければ join したスレッドがその場で実行し、他のスレッドが
+// 実行中なら、終わるまで待つタスクの部分木の仕事を手伝う。
+//   - 自分のキューの、いま実行中のタスクを始めたときの底 (floor) より上: 実行中のタスクが積んだもの
+//   - 待つタスクを実行しているスレッドのキューの、そのタスクを始めたときの底より上 (leapfrogging)
+// 無関係なタスクを手伝うと、それがこのスレッドの下で待っているタスクを join したときに先へ進めなく
+// なる。部分木のタスクは、作られる前のタスクの future しか受け取れないので、下で待っているタスクを
+// join することはない。手伝えるものがなければ、タスクが終わるか相手が新しく積むまで眠る。
+//
+// スレッドはそれぞれ自分の実行状態 (値スタック) を持ち、関数フレームはその上に切り出す。
+// スレッド間で共有するのはグローバルスコープとASTで、実行中はどちらも読むだけ
+// (呼び出しノードのキャッシュと段階的実行の状態はアトミックに更新する)。
+//
+// タスクの中の実行時エラーはスレッドを終了させず、エラーの起きた行を含むメッセージをタスクに
+// 記録して、join したところで報告し直す。
+
+#define PARALLEL_CHUNKS_PER_THREAD 8 // 要素ごとの重さのばらつきを均すため、スレッドあたりに切るチャンク数
+#define PARALLEL_MIN_CHUNK 16        // これより小さいチャンクには分けない (分配の手間の方が大きい)
+#define DEQUE_INITIAL_CAPACITY 64    // 両端キューの最初の大きさ (2の冪。溢れたら倍にする)
+
+typedef enum {
+    TASK_PENDING, // どのスレッドもまだ実行していない
+    TASK_RUNNING,
+    TASK_DONE,
+    TASK_FAILED   // 実行時エラーで終わった (error にメッセージがある)
+} TaskStatus;
+
+typedef struct ParallelJob ParallelJob;
+
+struct KTask {
+    unsigned int refcount;  // future の値とキューがそれぞれ参照を持つ
+    int status;             // TaskStatus (原子的に読み書きする)
+    bool spawned;           // spawn したタスク (false なら parallel_map のチャンクか自動並列化の呼び出し)
+    bool joined;            // 結果を join で受け取った (原子的に読み書きする)
+    int line;
+    Environment *globals;
+    OutputWriter *out;
+    long *load_budget;
+    TaskGroup *group;       // タスクを作った実行の組
+    ASTNode *func_def;      // spawn: 呼び出す関数
+    Value *args;            // spawn: 評価済みの引数 (実行すると関数に渡す)
+    int num_args;
+    Value result;
+    ParallelJob *job;       // parallel_map: チャンクを処理する仕事
+    size_t chunk;
+    char *error;            // 失敗したときの実行時エラーのメッセージ
+    struct Worker *runner;  // 実行している作業スレッド (作業スレッドでなければ NULL。原子的に公開する)
+    long floor;             // 実行を始めたときの runner のキューの底 (これより上はこのタスクが積んだもの)
+    bool deferred;          // 組の後回しの一覧にある (組のロックを取って読み書きする)
+    struct KTask *next;        // 投入キューか後回しの一覧の次のタスク
+    struct KTask *prev;        // 後回しの一覧の前のタスク
+    struct KTask *next_failed; // 失敗したタスクの一覧の次のタスク
+};
+
+struct ParallelJob {
+    ASTNode *func_def;
+    const KArray *input;
+    KArray *output;
+    int line;
+    size_t start;      // チャンクに分ける範囲の先頭 (それより前の要素は処理済み)
+    size_t chunk_size;
+};
+
+// 両端キューのバッファ。拡張しても古いバッファは盗む側がまだ読んでいるかもしれないので解放しない
+typedef struct DequeBuffer {
+    long capacity;
+    struct DequeBuffer *retired;
+    KTask *slots[];
+} DequeBuffer;
+
+typedef struct Worker {
+    long top;              // 盗む側が取る端 (CAS で進める)
+    long bottom;           // 持ち主が積んで取る端
+    DequeBuffer *buffer;
+    ExecState state;
+    unsigned int victim_seed; // 盗みに行く相手を選ぶ乱数
+    long floor;               // 実行中のタスクを始めたときの bottom (持ち主だけが読み書きする)
+    int helpers;              // このキューから手伝おうと眠って待っているスレッドの数
+} Worker;
+
+// 実行時エラーの戻り先 (タスクとジェネレータの本体を実行する間に設定する)
+struct TaskFailure {
+    jmp_buf env;
+    char *error; // 捕まえたエラーのメッセージ
+};
+
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static int requested_threads = 0; // 0 なら CPU のコア数
+static int pool_threads = 0;      // 呼び出し元を含めて並列に動くスレッドの数 (0 は未起動)
+static Worker *workers = NULL;
+static int num_workers = 0;
+
+static __thread Worker *current_worker = NULL;
+static __thread ExecState help_state;             // 作業スレッドでないスレッドが join したタスクを実行する値スタック
+static __thread TaskFailure *current_failure = NULL;
+static __thread bool capturing_syntax_errors = false; // 埋め込み API がコンパイル中
+static __thread char *captured_syntax_errors = NULL;
+
+// 投入キュー (作業スレッドでないスレッドが作ったタスク)
+static pthread_mutex_t inject_lock = PTHREAD_MUTEX_INITIALIZER;
+static KTask *inject_head = NULL;
+static KTask *inject_tail = NULL;
+static int inject_count = 0;
+
+// 仕事がなくて眠っている作業スレッド
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_wake = PTHREAD_COND_INITIALIZER;
+static int sleeping_workers = 0;
+
+// 他のスレッドが実行中のタスクの終わりを待っているスレッド
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_wake = PTHREAD_COND_INITIALIZER;
+static int blocked_waiters = 0;
+
+// 純粋性の解析は結果を関数定義に書き込むので、複数のスレッドで同時に行わない
+static pthread_mutex_t purity_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// 並列に動かすスレッドの数を指定する (0 なら CPU のコア数。最初のタスクより前に呼ぶ)
+void set_parallel_threads(int threads) {
+    requested_threads = threads;
+}
+
+// --- 実行時エラーと読み込み時のエラー ---
+
+// 組み立てたメッセージ (所有権を受け取る) で実行を打ち切る
+// タスクやジェネレータの本体の中ならそれを実行したところへ戻り、そうでなければ報告して終了する。
+void raise_error_message(char *message) {
+    if (current_failure != NULL) {
+        current_failure->error = message;
+        longjmp(current_failure->env, 1);
+    }
+    fprintf(stderr, "%s\n", message);
+    exit(EXIT_FAILURE);
+}
+
+// body(arg) を実行し、その中で起きた実行時エラーを捕まえる
+// エラーで打ち切られたらメッセージ (呼び出し側が所有する) を、そうでなければ NULL を返す。
+// (ジェネレータの本体は途中で別のスレッドに移って再開され得るので、戻り先は exchange_error_trap で
+//  読み書きし、スレッドローカル変数のアドレスを body の前後で使い回さない)
+char *run_trapping_errors(void (*body)(void *), void *arg) {
+    TaskFailure failure;
+    failure.error = NULL;
+    TaskFailure *outer = exchange_error_trap(&failure);
+    if (setjmp(failure.env) == 0) {
+        body(arg);
+    }
+    exchange_error_trap(outer);
+    return failure.error;
+}
+
+// このスレッドの実行時エラーの戻り先を差し替え、それまでの戻り先を返す
+// (ジェネレータは自分の本体のスタックに戻り先を持つので、本体に切り替えるたびに入れ替える)
+__attribute__((noinline)) TaskFailure *exchange_error_trap(TaskFailure *trap) {
+    TaskFailure *previous = current_failure;
+    current_failure = trap;
+    return previous;
+}
+
+// --- 呼び出しの深さ ---
+// 終わらない再帰で C スタックが溢れてプロセスが落ちないように、関数を呼び出すたびに今のスタックの
+// 残りを確かめ、足りなければ実行時エラーにする。値スタックのフレームの数ではなく C スタックの位置で
+// 測るので、join がその場で実行したタスクやジェネレータの本体 (自分のスタックを持つ) の中の呼び出しも数えられる。
+
+#define STACK_RESERVE (256 * 1024)        // 上限に達した後のエラーの報告と組み込み関数のために残す C スタック
+#define FALLBACK_STACK_SIZE (1024 * 1024) // スタックの範囲を調べられないスレッドで仮定する大きさ
+
+static __thread char *stack_floor = NULL; // 関数の呼び出しがこれより下に進んではいけない位置 (NULL は未計算)
+
+// このスレッドのスタックの下端に、上限に達した後のために残す分を足した位置を求める
+static char *thread_stack_floor(void) {
+    char *here = __builtin_frame_address(0);
+#ifdef __GLIBC__
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        void *address;
+        size_t size;
+        int status = pthread_attr_getstack(&attr, &address, &size);
+        pthread_attr_destroy(&attr);
+        char *low = address;
+        if (status == 0 && here > low && here <= low + size) {
+            // 小さなスタックのスレッド (埋め込む側が作ったもの) では残す量も減らす
+            return low + ((size / 4 < STACK_RESERVE) ? size / 4 : STACK_RESERVE);
+        }
+    }
+#endif
+    return here - (FALLBACK_STACK_SIZE - STACK_RESERVE);
+}
+
+// 関数の本体に入る前に呼ぶ (スタックが下へ伸びる環境を前提にする)
+// ジェネレータの本体は途中で別のスレッドに移って再開され得るので、スレッドローカル変数は呼ぶたびにここで読む。
+__attribute__((noinline)) void check_call_depth(int line) {
+    if (stack_floor == NULL) {
+        stack_floor = thread_stack_floor();
+    }
+    if ((char *)__builtin_frame_address(0) < stack_floor) {
+        runtime_error(line, "関数の呼び出しが深すぎます (終わらない再帰の可能性があります)。");
+    }
+}
+
+// このスレッドの呼び出しの深さの下限を差し替え、それまでの下限を返す
+// (ジェネレータの本体は自分のスタックで実行するので、本体に切り替えるたびに入れ替える)
+__attribute__((noinline)) char *exchange_stack_floor(char *floor) {
+    char *previous = stack_floor;
+    stack_floor = floor;
+    return previous;
+}
+
+// 「<prefix><行>): <詳細>」の形のメッセージを組み立てる (呼び出し側が所有する)
+static char *format_error(const char *prefix, int line, const char *format, va_list args) {
+    char detail[512];
+    vsnprintf(detail, sizeof(detail), format, args);
+    char *message = malloc(strlen(prefix) + 24 + strlen(detail) + 1);
+    if (message == NULL) {
+        perror("Failed to allocate error message");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(message, "%s%d): %s", prefix, line, detail);
+    return message;
+}
+
+void runtime_error(int line, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    char *message = format_error("実行時エラー (行 ", line, format, args);
+    va_end(args);
+    raise_error_message(message);
+}
+
+// 読み込み時 (名前解決・型検査・コンパイル時評価) のエラーで打ち切る
+// 実行時エラーと同じ戻り先に戻るので、埋め込み API はコンパイルを打ち切ってメッセージを返せる。
+void compile_error(int line, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    char *message = format_error("エラー (行 ", line, format, args);
+    va_end(args);
+    raise_error_message(message);
+}
+
+// 字句・構文のエラーを報告する (構文解析は打ち切らずに NULL を返して抜ける)
+// 捕まえている間はメッセージを溜め、そうでなければ標準エラーに書く。
+void syntax_error(int line, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    char *message = format_error("エラー (行 ", line, format, args);
+    va_end(args);
+    if (!capturing_syntax_errors) {
+        fprintf(stderr, "%s\n", message);
+        free(message);
+        return;
+    }
+    // 複数のメッセージは改行でつなぐ
+    size_t length = (captured_syntax_errors != NULL) ? strlen(captured_syntax_errors) : 0;
+    char *joined = realloc(captured_syntax_errors, length + strlen(message) + 2);
+    if (joined == NULL) {
+        perror("Failed to allocate error message");
+        exit(EXIT_FAILURE);
+    }
+    if (length > 0) {
+        joined[length++] = '\n';
+    }
+    strcpy(joined + length, message);
+    captured_syntax_errors = joined;
+    free(message);
+}
+
+// このスレッドの字句・構文のエラーを溜め始める
+void begin_syntax_error_capture(void) {
+    capturing_syntax_errors = true;
+    captured_syntax_errors = NULL;
+}
+
+// 溜めるのをやめ、溜めたメッセージ (呼び出し側が所有する。なければ NULL) を返す
+char *end_syntax_error_capture(void) {
+    char *messages = captured_syntax_errors;
+    capturing_syntax_errors = false;
+    captured_syntax_errors = NULL;
+    return messages;
+}
+
+static char *duplicate_message(const char *message) {
+    char *copy = strdup(message);
+    if (copy == NULL) {
+        perror("Failed to duplicate error message");
+        exit(EXIT_FAILURE);
+    }
+    return copy;
+}
+
+// --- 両端キュー (Chase–Lev) ---
+// 持ち主だけが bottom を動かし、top は持ち主と盗む側が CAS で取り合う。
+// 最後の1つを取るときだけ持ち主も CAS に参加する。
+
+static DequeBuffer *deque_buffer_new(long capacity, DequeBuffer *retired) {
+    DequeBuffer *buffer = malloc(sizeof(DequeBuffer) + sizeof(KTask *) * (size_t)capacity);
+    if (buffer == NULL) {
+        perror("Failed to allocate task deque");
+        exit(EXIT_FAILURE);
+    }
+    buffer->capacity = capacity;
+    buffer->retired = retired;
+    return buffer;
+}
+
+// 持ち主が底にタスクを積む
+static void deque_push(Worker *worker, KTask *task) {
+    long bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+    DequeBuffer *buffer = worker->buffer;
+    if (bottom - top >= buffer->capacity) {
+        DequeBuffer *grown = deque_buffer_new(buffer->capacity * 2, buffer);
+        for (long i = top; i < bottom; i++) {
+            grown->slots[i & (grown->capacity - 1)] = __atomic_load_n(&buffer->slots[i & (buffer->capacity - 1)], __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&worker->buffer, grown, __ATOMIC_RELEASE);
+        buffer = grown;
+    }
+    __atomic_store_n(&buffer->slots[bottom & (buffer->capacity - 1)], task, __ATOMIC_RELAXED);
+    // タスクの中身を盗む側に公開する (眠っているスレッドの数を読む前に見えるよう SEQ_CST にする)
+    __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_SEQ_CST);
+}
+
+// 持ち主が底からタスクを取る (空なら NULL)
+static KTask *deque_take(Worker *worker) {
+    long bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED) - 1;
+    DequeBuffer *buffer = worker->buffer;
+    __atomic_store_n(&worker->bottom, bottom, __ATOMIC_SEQ_CST);
+    long top = __atomic_load_n(&worker->top, __ATOMIC_SEQ_CST);
+    if (top > bottom) {
+        __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    KTask *task = __atomic_load_n(&buffer->slots[bottom & (buffer->capacity - 1)], __ATOMIC_RELAXED);
+    if (top == bottom) {
+        // 最後の1つは盗む側と取り合う
+        if (!__atomic_compare_exchange_n(&worker->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            task = NULL;
+        }
+        __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+// 他のスレッドのキューの天井からタスクを盗む (空か、取り合いに負けたら NULL)
+static KTask *deque_steal(Worker *victim) {
+    long top = __atomic_load_n(&victim->top, __ATOMIC_SEQ_CST);
+    long bottom = __atomic_load_n(&victim->bottom, __ATOMIC_SEQ_CST);
+    if (top >= bottom) {
+        return NULL;
+    }
+    DequeBuffer *buffer = __atomic_load_n(&victim->buffer, __ATOMIC_ACQUIRE);
+    KTask *task = __atomic_load_n(&buffer->slots[top & (buffer->capacity - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&victim->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return task;
+}
+
+static bool deque_nonempty(Worker *worker) {
+    return __atomic_load_n(&worker->top, __ATOMIC_SEQ_CST) < __atomic_load_n(&worker->bottom, __ATOMIC_SEQ_CST);
+}
+
+// 天井が floor 以上のときだけ盗む (floor より下のタスクが残っていれば、その上のものも取らない)
+static KTask *deque_steal_above(Worker *victim, long floor) {
+    if (__atomic_load_n(&victim->top, __ATOMIC_SEQ_CST) < floor) {
+        return NULL;
+    }
+    return deque_steal(victim);
+}
+
+static bool deque_nonempty_above(Worker *worker, long floor) {
+    long top = __atomic_load_n(&worker->top, __ATOMIC_SEQ_CST);
+    return top >= floor && top < __atomic_load_n(&worker->bottom, __ATOMIC_SEQ_CST);
+}
+
+// --- タスク ---
+
+static KTask *task_new(ExecState *state, int line) {
+    KTask *task = malloc(sizeof(KTask));
+    if (task == NULL) {
+        perror("Failed to allocate task");
+        exit(EXIT_FAILURE);
+    }
+    task->refcount = 2; // 作った側とキュー (後回しの一覧) の分
+    task->status = TASK_PENDING;
+    task->spawned = false;
+    task->joined = false;
+    task->line = line;
+    task->globals = state->globals;
+    task->out = state->out;
+    task->load_budget = state->load_budget;
+    task->group = state->tasks;
+    task->func_def = NULL;
+    task->args = NULL;
+    task->num_args = 0;
+    task->result = VOID_VAL;
+    task->job = NULL;
+    task->chunk = 0;
+    task->error = NULL;
+    task->runner = NULL;
+    task->floor = 0;
+    task->deferred = false;
+    task->next = NULL;
+    task->prev = NULL;
+    task->next_failed = NULL;
+    __atomic_add_fetch(&task->group->pending, 1, __ATOMIC_SEQ_CST);
+    return task;
+}
+
+void ktask_retain(KTask *task) {
+    __atomic_fetch_add(&task->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void ktask_release(KTask *task) {
+    // 最後の参照を落としたスレッドだけが解放する
+    if (__atomic_sub_fetch(&task->refcount, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    if (task->args != NULL) {
+        for (int i = 0; i < task->num_args; i++) {
+            free_value_data(task->args[i]);
+        }
+        free(task->args);
+    }
+    free_value_data(task->result);
+    free(task->error);
+    free(task);
+}
+
+// 実行するスレッドを決める (このスレッドが PENDING から RUNNING にできたら true)
+static bool claim_task(KTask *task) {
+    int expected = TASK_PENDING;
+    return __atomic_compare_exchange_n(&task->status, &expected, TASK_RUNNING, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+static bool task_finished(KTask *task) {
+    int status = __atomic_load_n(&task->status, __ATOMIC_SEQ_CST);
+    return status == TASK_DONE || status == TASK_FAILED;
+}
+
+// 眠っている作業スレッドを起こす (タスクを積んだ後に呼ぶ)
+static void wake_workers(bool all) {
+    if (__atomic_load_n(&sleeping_workers, __ATOMIC_SEQ_CST) == 0) {
+        return;
+    }
+    pthread_mutex_lock(&idle_lock);
+    if (all) {
+        pthread_cond_broadcast(&idle_wake);
+    } else {
+        pthread_cond_signal(&idle_wake);
+    }
+    pthread_mutex_unlock(&idle_lock);
+}
+
+static void inject_tasks(KTask **tasks, size_t count) {
+    pthread_mutex_lock(&inject_lock);
+    for (size_t i = 0; i < count; i++) {
+        tasks[i]->next = NULL;
+        if (inject_tail != NULL) {
+            inject_tail->next = tasks[i];
+        } else {
+            inject_head = tasks[i];
+        }
+        inject_tail = tasks[i];
+    }
+    __atomic_add_fetch(&inject_count, (int)count, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&inject_lock);
+}
+
+// 作業スレッドのないプールで、タスクを作った組の後回しの一覧の先頭に入れる
+static void defer_tasks(KTask **tasks, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        TaskGroup *group = tasks[i]->group;
+        pthread_mutex_lock(&group->lock);
+        tasks[i]->deferred = true;
+        tasks[i]->prev = NULL;
+        tasks[i]->next = group->deferred;
+        if (group->deferred != NULL) {
+            group->deferred->prev = tasks[i];
+        }
+        group->deferred = tasks[i];
+        pthread_mutex_unlock(&group->lock);
+    }
+}
+
+// 後回しの一覧から task を外す (組のロックを取って呼ぶ)
+static void unlink_deferred(TaskGroup *group, KTask *task) {
+    if (task->prev != NULL) {
+        task->prev->next = task->next;
+    } else {
+        group->deferred = task->next;
+    }
+    if (task->next != NULL) {
+        task->next->prev = task->prev;
+    }
+    task->deferred = false;
+    task->next = NULL;
+    task->prev = NULL;
+}
+
+// 後回しの一覧にあれば外す (外したら true。一覧の参照は呼び出し側が落とす)
+static bool undefer_task(KTask *task) {
+    TaskGroup *group = task->group;
+    pthread_mutex_lock(&group->lock);
+    bool deferred = task->deferred;
+    if (deferred) {
+        unlink_deferred(group, task);
+    }
+    pthread_mutex_unlock(&group->lock);
+    return deferred;
+}
+
+// 組の後回しの一覧から1つ外して返す (空なら NULL)
+static KTask *take_deferred(TaskGroup *group) {
+    pthread_mutex_lock(&group->lock);
+    KTask *task = group->deferred;
+    if (task != NULL) {
+        unlink_deferred(group, task);
+    }
+    pthread_mutex_unlock(&group->lock);
+    return task;
+}
+
+// タスクを実行待ちにする (作業スレッドなら自分のキューに、そうでなければ投入キューに積む)
+// 作業スレッドのないプールでは、どのスレッドもキューから取らないので組に後回しにする。
+static void submit_tasks(KTask **tasks, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    if (__atomic_load_n(&pool_threads, __ATOMIC_ACQUIRE) == 1) {
+        defer_tasks(tasks, count);
+        return;
+    }
+    if (current_worker != NULL) {
+        for (size_t i = 0; i < count; i++) {
+            deque_push(current_worker, tasks[i]);
+        }
+        // このスレッドが実行中のタスクの終わりを待ちながら、手伝える仕事を待っているスレッドを起こす
+        if (__atomic_load_n(&current_worker->helpers, __ATOMIC_SEQ_CST) > 0) {
+            pthread_mutex_lock(&done_lock);
+            pthread_cond_broadcast(&done_wake);
+            pthread_mutex_unlock(&done_lock);
+        }
+    } else {
+        inject_tasks(tasks, count);
+    }
+    wake_workers(count > 1);
+}
+
+static KTask *take_injected(void) {
+    if (__atomic_load_n(&inject_count, __ATOMIC_SEQ_CST) == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&inject_lock);
+    KTask *task = inject_head;
+    if (task != NULL) {
+        inject_head = task->next;
+        if (inject_head == NULL) {
+            inject_tail = NULL;
+        }
+        __atomic_sub_fetch(&inject_count, 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&inject_lock);
+    return task;
+}
+
+// 実行できそうなタスクを探す: 自分のキュー、投入キュー、他のスレッドのキューの順
+static KTask *find_task(Worker *self) {
+    KTask *task = (self != NULL) ? deque_take(self) : NULL;
+    if (task == NULL) {
+        task = take_injected();
+    }
+    if (task == NULL && num_workers > 0) {
+        unsigned int start = 0;
+        if (self != NULL) {
+            self->victim_seed = self->victim_seed * 1103515245u + 12345u;
+            start = (self->victim_seed >> 16) % (unsigned int)num_workers;
+        }
+        for (int i = 0; i < num_workers && task == NULL; i++) {
+            Worker *victim = &workers[(start + (unsigned int)i) % (unsigned int)num_workers];
+            if (victim != self) {
+                task = deque_steal(victim);
+            }
+        }
+    }
+    return task;
+}
+
+static bool work_available(void) {
+    if (__atomic_load_n(&inject_count, __ATOMIC_SEQ_CST) > 0) {
+        return true;
+    }
+    for (int i = 0; i < num_workers; i++) {
+        if (deque_nonempty(&workers[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// parallel_map のチャンクを処理する
+static void store_result(const ParallelJob *job, size_t index, Value result);
+static Value apply_to_element(const ParallelJob *job, size_t index, ExecState *state);
+
+typedef struct TaskRun {
+    KTask *task;
+    ExecState *state;
+    Value *args; // 関数に渡した引数の配列 (実行時エラーで打ち切られたら run_task が解放する)
+} TaskRun;
+
+static void execute_task(void *arg) {
+    TaskRun *run = arg;
+    KTask *task = run->task;
+    ExecState *state = run->state;
+    if (task->job != NULL) {
+        const ParallelJob *job = task->job;
+        size_t begin = job->start + task->chunk * job->chunk_size;
+        size_t end = begin + job->chunk_size;
+        if (end > job->input->length) {
+            end = job->input->length;
+        }
+        for (size_t i = begin; i < end; i++) {
+            store_result(job, i, apply_to_element(job, i, state));
+        }
+        return;
+    }
+    // 引数の値は呼び出しのフレームに移るので、配列だけを解放する
+    run->args = task->args;
+    task->args = NULL;
+    Value result = call_function(task->func_def, run->args, task->num_args, state, task->line);
+    free(run->args);
+    run->args = NULL;
+    task->result = result;
+}
+
+// 終わったタスクの状態を公開し、終わりを待っているスレッドを起こす
+// 組はタスクの終わりを待った実行が片付けるので、組の数を減らすのは状態を公開するより前にする。
+static void finish_task(KTask *task, TaskStatus status) {
+    TaskGroup *group = task->group;
+    if (status == TASK_FAILED && task->spawned) {
+        ktask_retain(task);
+        pthread_mutex_lock(&group->lock);
+        if (group->failed_tail != NULL) {
+            group->failed_tail->next_failed = task;
+        } else {
+            group->failed_head = task;
+        }
+        group->failed_tail = task;
+        pthread_mutex_unlock(&group->lock);
+    }
+    __atomic_sub_fetch(&group->pending, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&task->status, status, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&blocked_waiters, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&done_lock);
+        pthread_cond_broadcast(&done_wake);
+        pthread_mutex_unlock(&done_lock);
+    }
+}
+
+// このスレッドが実行権を取ったタスクを state の値スタックの上で実行する
+static void run_task(KTask *task, ExecState *state) {
+    Environment *globals = state->globals;
+    OutputWriter *out = state->out;
+    long *load_budget = state->load_budget;
+    TaskGroup *tasks = state->tasks;
+    int base = state->stack_top;
+    size_t saved_line = output_set_aside_line();
+    TaskRun run = { task, state, NULL };
+    // これから積むタスクはこのタスクの部分木のもの (待っている他のスレッドが手伝える)
+    Worker *worker = current_worker;
+    long floor = 0;
+    if (worker != NULL) {
+        floor = worker->floor;
+        worker->floor = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED);
+        task->floor = worker->floor;
+    }
+    __atomic_store_n(&task->runner, worker, __ATOMIC_RELEASE);
+
+    state->globals = task->globals;
+    state->out = task->out;
+    state->load_budget = task->load_budget;
+    state->tasks = task->group;
+    task->error = run_trapping_errors(execute_task, &run);
+    if (task->error != NULL) {
+        // 途中のフレームに残った値を解放して、タスクを始めたときの高さに戻す
+        for (int i = base; i < state->stack_top; i++) {
+            free_value_data(state->stack[i]);
+        }
+        state->stack_top = base;
+        free(run.args);
+    }
+    output_resume_line(saved_line);
+    if (worker != NULL) {
+        worker->floor = floor;
+    }
+    state->globals = globals;
+    state->out = out;
+    state->load_budget = load_budget;
+    state->tasks = tasks;
+    finish_task(task, (task->error != NULL) ? TASK_FAILED : TASK_DONE);
+}
+
+static ExecState *current_state(void) {
+    return (current_worker != NULL) ? &current_worker->state : &help_state;
+}
+
+// waited の終わりを待つ間に手伝えるタスクを探す (見つからなければ NULL)
+static KTask *find_helpable_task(Worker *self, KTask *waited) {
+    if (self != NULL && __atomic_load_n(&self->bottom, __ATOMIC_RELAXED) > self->floor) {
+        KTask *task = deque_take(self);
+        if (task != NULL) {
+            return task;
+        }
+    }
+    Worker *runner = __atomic_load_n(&waited->runner, __ATOMIC_ACQUIRE);
+    if (runner == NULL || runner == self) {
+        return NULL;
+    }
+    KTask *task = deque_steal_above(runner, waited->floor);
+    if (task != NULL && task_finished(waited)) {
+        // 待つタスクが終わって相手が下のタスクに戻った後に積んだものかもしれないので、
+        // ここでは実行せず、どのタスクの下でもなく実行される投入キューへ回す
+        inject_tasks(&task, 1);
+        wake_workers(false);
+        return NULL;
+    }
+    return task;
+}
+
+// 他のスレッドが実行中のタスクが終わるまで、その部分木のタスクを手伝いながら待つ
+static void help_until_finished(KTask *task) {
+    Worker *self = current_worker;
+    while (!task_finished(task)) {
+        KTask *work = find_helpable_task(self, task);
+        if (work != NULL) {
+            if (claim_task(work)) {
+                run_task(work, current_state());
+            }
+            ktask_release(work);
+            continue;
+        }
+        // 手伝えるものがない: タスクが終わるか、実行しているスレッドが新しく積むまで眠る
+        pthread_mutex_lock(&done_lock);
+        __atomic_add_fetch(&blocked_waiters, 1, __ATOMIC_SEQ_CST);
+        Worker *runner = __atomic_load_n(&task->runner, __ATOMIC_ACQUIRE);
+        if (runner == self) {
+            runner = NULL;
+        }
+        if (runner != NULL) {
+            __atomic_add_fetch(&runner->helpers, 1, __ATOMIC_SEQ_CST);
+        }
+        if (!task_finished(task) && (runner == NULL || !deque_nonempty_above(runner, task->floor))) {
+            pthread_cond_wait(&done_wake, &done_lock);
+        }
+        if (runner != NULL) {
+            __atomic_sub_fetch(&runner->helpers, 1, __ATOMIC_SEQ_CST);
+        }
+        __atomic_sub_fetch(&blocked_waiters, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&done_lock);
+    }
+}
+
+// --- 作業スレッド ---
+
+// 仕事が積まれるまで眠る (眠る前にもう一度探して、積んだ側の起こし忘れを防ぐ)
+static void sleep_until_work(void) {
+    pthread_mutex_lock(&idle_lock);
+    __atomic_add_fetch(&sleeping_workers, 1, __ATOMIC_SEQ_CST);
+    if (!work_available()) {
+        pthread_cond_wait(&idle_wake, &idle_lock);
+    }
+    __atomic_sub_fetch(&sleeping_workers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&idle_lock);
+}
+
+// 作業スレッド: 自分のキューのタスクを処理し、なくなったら他から盗む
+static void *worker_main(void *arg) {
+    Worker *self = arg;
+    current_worker = self;
+    for (;;) {
+        KTask *task = find_task(self);
+        if (task == NULL) {
+            sleep_until_work();
+            continue;
+        }
+        // 既に join したスレッドが実行したタスクは、キューの参照を落とすだけ
+        if (claim_task(task)) {
+            run_task(task, &self->state);
+        }
+        ktask_release(task);
+    }
+    return NULL;
+}
+
+// 初めて使うときに作業スレッドを起動し、呼び出し元を含めたスレッドの数を返す
+// 呼び出し元のスレッドも join や parallel_map でタスクを実行するので、作業スレッドは1つ少なく作る。
+static int start_pool(void) {
+    int threads = __atomic_load_n(&pool_threads, __ATOMIC_ACQUIRE);
+    if (threads > 0) {
+        return threads;
+    }
+    pthread_mutex_lock(&start_lock);
+    threads = pool_threads;
+    if (threads == 0) {
+        int requested = requested_threads;
+        if (requested <= 0) {
+            long cores = sysconf(_SC_NPROCESSORS_ONLN);
+            requested = (cores > 0) ? (int)cores : 1;
+        }
+        // 全ての作業スレッドの状態を用意してから起動する (起動したスレッドはすぐに他のキューを覗く)
+        num_workers = requested - 1;
+        if (num_workers > 0) {
+            workers = calloc((size_t)num_workers, sizeof(Worker));
+            if (workers == NULL) {
+                perror("Failed to allocate workers");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (int i = 0; i < num_workers; i++) {
+            workers[i].buffer = deque_buffer_new(DEQUE_INITIAL_CAPACITY, NULL);
+            workers[i].victim_seed = (unsigned int)i * 2654435761u + 1;
+        }
+        threads = 1;
+        for (int i = 0; i < num_workers; i++) {
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, worker_main, &workers[i]) != 0) {
+                continue; // 作れなかったスレッドのキューは空のまま、作れた分だけで動かす
+            }
+            pthread_detach(thread);
+            threads++;
+        }
+        __atomic_store_n(&pool_threads, threads, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&start_lock);
+    return threads;
+}
+
+// --- spawn / join ---
+
+// spawn f(...): 関数の呼び出しをタスクにして future を返す
+// (評価済みの引数の配列と値の所有権を受け取る。state は spawn したスレッドの実行状態)
+Value spawn_task(ASTNode *func_def, Value *args, int num_args, ExecState *state, int line) {
+    start_pool();
+    KTask *task = task_new(state, line);
+    task->spawned = true;
+    task->func_def = func_def;
+    task->args = args;
+    task->num_args = num_args;
+    submit_tasks(&task, 1);
+    return FUTURE_VAL(task);
+}
+
+// 自動並列化: 純粋な関数の呼び出しをタスクにして future を返す (引数の配列と値の所有権を受け取る)
+// 呼び出し元は式の中の呼び出しの位置で必ず join するか、実行時エラーで式ごと捨てるので、
+// spawn と違って join されない失敗の報告の対象にはしない。
+Value fork_task(ASTNode *func_def, Value *args, int num_args, ExecState *state, int line) {
+    KTask *task = task_new(state, line);
+    task->func_def = func_def;
+    task->args = args;
+    task->num_args = num_args;
+    submit_tasks(&task, 1);
+    return FUTURE_VAL(task);
+}
+
+// 呼び出し元を含めて並列に動くスレッドの数 (まだ起動していなければ起動する)
+int parallel_pool_size(void) {
+    return start_pool();
+}
+
+// join(future): タスクの結果を返す (まだ始まっていなければこのスレッドで実行し、
+// 他のスレッドが実行中ならその部分木のタスクを手伝いながら待つ)
+// タスクが実行時エラーで終わっていれば、そのメッセージ (タスクの中の行番号) で報告し直す。
+Value join_task(KTask *task) {
+    if (undefer_task(task)) {
+        ktask_release(task); // 一覧の参照 (future の参照が残るので解放されない)
+    }
+    if (claim_task(task)) {
+        run_task(task, current_state());
+    } else {
+        help_until_finished(task);
+    }
+    __atomic_store_n(&task->joined, true, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&task->status, __ATOMIC_ACQUIRE) == TASK_FAILED) {
+        raise_error_message(duplicate_message(task->error));
+    }
+    return copy_value(task->result);
+}
+
+void task_group_init(TaskGroup *group) {
+    group->pending = 0;
+    pthread_mutex_init(&group->lock, NULL);
+    group->failed_head = NULL;
+    group->failed_tail = NULL;
+    group->deferred = NULL;
+}
+
+// 組を片付ける (組のタスクが全て終わってから呼ぶ)
+void task_group_destroy(TaskGroup *group) {
+    KTask *failed = group->failed_head;
+    while (failed != NULL) {
+        KTask *next = failed->next_failed;
+        ktask_release(failed);
+        failed = next;
+    }
+    group->failed_head = NULL;
+    group->failed_tail = NULL;
+    pthread_mutex_destroy(&group->lock);
+}
+
+// 組のタスクが全て終わるまで、このスレッドも (他の組のものを含め) タスクを実行する
+static void drain_tasks(TaskGroup *group) {
+    while (__atomic_load_n(&group->pending, __ATOMIC_SEQ_CST) > 0) {
+        KTask *task = take_deferred(group);
+        if (task == NULL) {
+            task = find_task(current_worker);
+        }
+        if (task != NULL) {
+            if (claim_task(task)) {
+                run_task(task, current_state());
+            }
+            ktask_release(task);
+            continue;
+        }
+        // 残りは他のスレッドが実行中: どれかが終わるまで眠る
+        pthread_mutex_lock(&done_lock);
+        __atomic_add_fetch(&blocked_waiters, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&group->pending, __ATOMIC_SEQ_CST) > 0 && !work_available()) {
+            pthread_cond_wait(&done_wake, &done_lock);
+        }
+        __atomic_sub_fetch(&blocked_waiters, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&done_lock);
+    }
+    free(help_state.stack);
+    help_state.stack = NULL;
+    help_state.stack_top = 0;
+    help_state.stack_capacity = 0;
+}
+
+// main が終わった後に、組のまだ終わっていない spawn したタスクを全て実行する
+// join されないまま失敗したタスクがあれば、最初に失敗したものを報告する。
+void wait_for_tasks(TaskGroup *group) {
+    drain_tasks(group);
+
+    pthread_mutex_lock(&group->lock);
+    KTask *failed = group->failed_head;
+    group->failed_head = NULL;
+    group->failed_tail = NULL;
+    pthread_mutex_unlock(&group->lock);
+    char *message = NULL;
+    while (failed != NULL) {
+        KTask *next = failed->next_failed;
+        if (message == NULL && !__atomic_load_n(&failed->joined, __ATOMIC_RELAXED)) {
+            message = duplicate_message(failed->error);
+        }
+        ktask_release(failed);
+        failed = next;
+    }
+    if (message != NULL) {
+        raise_error_message(message);
+    }
+}
+
+// 実行時エラーで打ち切った実行の、残りのタスクを終わらせる (失敗は報告しない)
+// 組のタスクは AST と出力先を使うので、実行の後始末より前に呼ぶ。
+void discard_tasks(TaskGroup *group) {
+    drain_tasks(group);
+}
+
+// --- parallel_map ---
+
+static void report_bad_result(const ParallelJob *job) {
+    runtime_error(job->line, "parallel_map に渡す関数 '%s' は int か double の値を返さなければなりません。",
+            job->func_def->data.func_def.name);
+}
+
+// 関数の戻り値を結果の配列の index 番目に書き込む (値の参照を受け取る)
+static void store_result(const ParallelJob *job, size_t index, Value result) {
+    ValueType type = VAL_TYPE(result);
+    if (job->output->element_type == VALUE_TYPE_DOUBLE) {
+        if (type != VALUE_TYPE_DOUBLE && type != VALUE_TYPE_INT && type != VALUE_TYPE_BOOL) {
+            free_value_data(result);
+            report_bad_result(job);
+        }
+        job->output->data.doubles[index] = AS_DOUBLE(convert_value_to_double(result, job->line));
+    } else if (type == VALUE_TYPE_INT) {
+        job->output->data.ints[index] = AS_INT(result);
+    } else if (type == VALUE_TYPE_BOOL) {
+        job->output->data.ints[index] = AS_BOOL(result) ? 1 : 0;
+    } else if (type == VALUE_TYPE_DOUBLE) {
+        runtime_error(job->line, "parallel_map に渡す関数 '%s' が要素によって int と double の異なる型の値を返しました。",
+                job->func_def->data.func_def.name);
+    } else {
+        free_value_data(result);
+        report_bad_result(job);
+    }
+    free_value_data(result);
+}
+
+// index 番目の要素に関数を適用する
+static Value apply_to_element(const ParallelJob *job, size_t index, ExecState *state) {
+    Value arg = (job->input->element_type == VALUE_TYPE_DOUBLE)
+        ? DOUBLE_VAL(job->input->data.doubles[index])
+        : INT_VAL(job->input->data.ints[index]);
+    return call_function(job->func_def, &arg, 1, state, job->line);
+}
+
+// parallel_map(関数, 配列): 配列の各要素に関数を適用した結果の配列を返す
+// (引数は借りるだけで解放しない。state は呼び出し元の実行状態)
+// 結果は関数の戻り値が int (bool) なら int[]、double なら double[]。
+// 配列をチャンクに分けてタスクにし、呼び出したスレッドも他のスレッドがまだ取っていない
+// チャンクを後ろから処理する (作業スレッドは前から盗む)。
+Value parallel_map(Value function, Value array, ExecState *state, int line) {
+    ASTNode *func_def = AS_FUNC(function);
+    const char *func_name = func_def->data.func_def.name;
+    if (func_def->data.func_def.num_parameters != 1) {
+        runtime_error(line, "parallel_map に渡す関数 '%s' は1つの引数を取らなければなりません。", func_name);
+    }
+
+    pthread_mutex_lock(&purity_lock);
+    Purity purity = analyze_purity(func_def);
+    pthread_mutex_unlock(&purity_lock);
+    if (purity == PURITY_IMPURE) {
+        runtime_error(line, "parallel_map に渡す関数 '%s' は純粋でなければなりません (print を呼ぶ関数や再帰する関数は使えません)。",
+                func_name);
+    }
+    int threads = start_pool();
+
+    ParallelJob job;
+    job.func_def = func_def;
+    job.input = AS_ARRAY(array);
+    job.line = line;
+    size_t length = job.input->length;
+
+    // 結果の要素の型: 型検査で分からなければ最初の要素の結果で決める
+    ValueType result_type = func_def->data.func_def.result_type;
+    size_t first = 0;
+    Value first_result = UNKNOWN_VAL;
+    if (result_type != VALUE_TYPE_INT && result_type != VALUE_TYPE_BOOL && result_type != VALUE_TYPE_DOUBLE && length > 0) {
+        first_result = apply_to_element(&job, 0, state);
+        result_type = VAL_TYPE(first_result);
+        first = 1;
+    }
+    job.output = karray_new(result_type == VALUE_TYPE_DOUBLE ? VALUE_TYPE_DOUBLE : VALUE_TYPE_INT, length, line);
+    // 要素の呼び出しや結果の検査が実行時エラーで打ち切られても解放されるよう、結果の配列は値スタックに積んでおく
+    push_temporary(state, ARRAY_VAL(job.output));
+    if (first == 1) {
+        store_result(&job, 0, first_result);
+    }
+
+    size_t remaining = length - first;
+    size_t chunk_size = (remaining + (size_t)threads * PARALLEL_CHUNKS_PER_THREAD - 1) / ((size_t)threads * PARALLEL_CHUNKS_PER_THREAD);
+    if (chunk_size < PARALLEL_MIN_CHUNK) {
+        chunk_size = PARALLEL_MIN_CHUNK;
+    }
+    if (threads == 1 || remaining <= chunk_size) {
+        // 分けるほどの要素がなければ呼び出し元のスレッドだけで処理する
+        for (size_t i = first; i < length; i++) {
+            store_result(&job, i, apply_to_element(&job, i, state));
+        }
+        return pop_temporary(state);
+    }
+
+    job.start = first;
+    job.chunk_size = chunk_size;
+    size_t num_chunks = (remaining + chunk_size - 1) / chunk_size;
+    KTask **chunks = malloc(sizeof(KTask *) * num_chunks);
+    if (chunks == NULL) {
+        perror("Failed to allocate chunk tasks");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t c = 0; c < num_chunks; c++) {
+        chunks[c] = task_new(state, line);
+        chunks[c]->job = &job;
+        chunks[c]->chunk = c;
+    }
+    submit_tasks(chunks, num_chunks);
+    for (size_t c = num_chunks; c-- > 0;) {
+        if (claim_task(chunks[c])) {
+            run_task(chunks[c], state);
+        }
+    }
+
+    // 全てのチャンクが終わるのを待ってから、最初に失敗したチャンクのエラーを報告する
+    char *error = NULL;
+    for (size_t c = 0; c < num_chunks; c++) {
+        help_until_finished(chunks[c]);
+        if (error == NULL && chunks[c]->error != NULL) {
+            error = duplicate_message(chunks[c]->error);
+        }
+        ktask_release(chunks[c]);
+    }
+    free(chunks);
+    Value output = pop_temporary(state);
+    if (error != NULL) {
+        free_value_data(output);
+        raise_error_message(error);
+    }
+    return output;
+}
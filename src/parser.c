@@ -18,10 +18,24 @@ ASTNode *create_ast_node(ASTNodeType type, int line) {
             break;
         case NODE_FUNCTION_DEFINITION:
             node->data.func_def.name = NULL;
+            node->data.func_def.name_hash = 0;
             node->data.func_def.parameters = NULL;
             node->data.func_def.num_parameters = 0;
             node->data.func_def.capacity_parameters = 0;
             node->data.func_def.body = NULL;
+            node->data.func_def.frame_size = 0;
+            node->data.func_def.call_count = 0;
+            node->data.func_def.tier_state = TIER_COLD;
+            node->data.func_def.optimized_body = NULL;
+            node->data.func_def.optimized_frame_size = 0;
+            node->data.func_def.result_type = VALUE_TYPE_UNKNOWN;
+            node->data.func_def.check_state = 0;
+            node->data.func_def.purity = PURITY_UNKNOWN;
+            node->data.func_def.memoize_annotated = false;
+            node->data.func_def.memoized = false;
+            node->data.func_def.generator = false;
+            node->data.func_def.yield_type = VALUE_TYPE_UNKNOWN;
+            node->data.func_def.cost_estimate = -1;
             break;
         case NODE_BLOCK:
             node->data.block.statements = NULL;
@@ -31,6 +45,9 @@ ASTNode *create_ast_node(ASTNodeType type, int line) {
         case NODE_RETURN_STATEMENT:
             node->data.return_stmt.value = NULL;
             break;
+        case NODE_YIELD:
+            node->data.yield_stmt.value = NULL;
+            break;
         case NODE_PRINT_STATEMENT:
             node->data.print_stmt.arguments = NULL;
             node->data.print_stmt.num_arguments = 0;
@@ -38,6 +55,7 @@ ASTNode *create_ast_node(ASTNodeType type, int line) {
             break;
         case NODE_STRING_LITERAL:
             node->data.string_literal.value = NULL;
+            node->data.string_literal.cached = VOID_VAL;
             break;
         case NODE_NUMBER_LITERAL:
             node->data.number_literal.value = 0;
@@ -47,30 +65,97 @@ ASTNode *create_ast_node(ASTNodeType type, int line) {
             break;
         case NODE_FUNCTION_CALL:
             node->data.func_call.function_name = NULL;
+            node->data.func_call.name_hash = 0;
             node->data.func_call.arguments = NULL;
             node->data.func_call.num_arguments = 0;
             node->data.func_call.capacity_arguments = 0;
+            node->data.func_call.native = NULL;
+            node->data.func_call.cached_target = NULL;
+            node->data.func_call.cached_epoch = 0;
+            node->data.func_call.callee = NULL;
+            node->data.func_call.checked = false;
+            node->data.func_call.spawned = false;
+            node->data.func_call.fork_slot = -1;
             break;
         case NODE_VAR_DECLARATION:
             node->data.var_decl.type_name = NULL;
+            node->data.var_decl.decl_type = VALUE_TYPE_UNKNOWN;
             node->data.var_decl.name = NULL;
+            node->data.var_decl.name_hash = 0;
             node->data.var_decl.initializer = NULL;
+            node->data.var_decl.slot = -1;
+            node->data.var_decl.checked = false;
+            node->data.var_decl.is_const = false;
             break;
         case NODE_ASSIGNMENT:
             node->data.assignment.name = NULL;
+            node->data.assignment.name_hash = 0;
             node->data.assignment.value = NULL;
+            node->data.assignment.slot = -1;
+            node->data.assignment.checked = false;
             break;
         case NODE_IDENTIFIER_EXPR:
             node->data.identifier_expr.name = NULL;
+            node->data.identifier_expr.name_hash = 0;
+            node->data.identifier_expr.slot = -1;
             break;
         // 算術演算子ノード
         case NODE_ADD:
         case NODE_SUBTRACT:
         case NODE_MULTIPLY:
         case NODE_DIVIDE:
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_DIVIDE_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE:
+        case NODE_CONCAT:
             node->data.binary_expr.left = NULL;
             node->data.binary_expr.right = NULL;
             break;
+        case NODE_CONVERT:
+            node->data.convert.operand = NULL;
+            node->data.convert.from = VALUE_TYPE_UNKNOWN;
+            node->data.convert.to = VALUE_TYPE_UNKNOWN;
+            break;
+        case NODE_ARRAY_LITERAL:
+            node->data.array_literal.elements = NULL;
+            node->data.array_literal.num_elements = 0;
+            node->data.array_literal.capacity_elements = 0;
+            node->data.array_literal.element_type = VALUE_TYPE_UNKNOWN;
+            break;
+        case NODE_INDEX:
+            node->data.index_expr.target = NULL;
+            node->data.index_expr.index = NULL;
+            node->data.index_expr.column = NULL;
+            break;
+        case NODE_INDEX_ASSIGNMENT:
+            node->data.index_assignment.name = NULL;
+            node->data.index_assignment.name_hash = 0;
+            node->data.index_assignment.index = NULL;
+            node->data.index_assignment.column = NULL;
+            node->data.index_assignment.value = NULL;
+            node->data.index_assignment.slot = -1;
+            node->data.index_assignment.checked = false;
+            break;
+        case NODE_FOR:
+            node->data.for_stmt.name = NULL;
+            node->data.for_stmt.name_hash = 0;
+            node->data.for_stmt.start = NULL;
+            node->data.for_stmt.end = NULL;
+            node->data.for_stmt.iterable = NULL;
+            node->data.for_stmt.body = NULL;
+            node->data.for_stmt.slot = -1;
+            node->data.for_stmt.iterator_slot = -1;
+            node->data.for_stmt.checked = false;
+            node->data.for_stmt.function = NULL;
+            break;
+        case NODE_FORK:
+            node->data.fork_expr.body = NULL;
+            break;
         default:
             break;
     }
@@ -152,6 +237,146 @@ void add_argument_to_function_call(ASTNode *func_call_node, ASTNode *argument) {
     func_call_node->data.func_call.arguments[func_call_node->data.func_call.num_arguments++] = argument;
 }
 
+// 関数定義ノードに引数 (NODE_VAR_DECLARATION) を追加するヘルパー関数
+void add_parameter_to_function_definition(ASTNode *func_def_node, ASTNode *parameter) {
+    if (func_def_node->type != NODE_FUNCTION_DEFINITION) {
+        fprintf(stderr, "エラー: add_parameter_to_function_definitionはNODE_FUNCTION_DEFINITIONノードにのみ適用できます。\n");
+        return;
+    }
+    if (func_def_node->data.func_def.num_parameters >= func_def_node->data.func_def.capacity_parameters) {
+        int new_capacity = (func_def_node->data.func_def.capacity_parameters == 0) ? 4 : func_def_node->data.func_def.capacity_parameters * 2;
+        func_def_node->data.func_def.parameters = realloc(func_def_node->data.func_def.parameters, sizeof(ASTNode *) * new_capacity);
+        if (func_def_node->data.func_def.parameters == NULL) {
+            perror("Failed to reallocate parameters array for function definition");
+            exit(EXIT_FAILURE);
+        }
+        func_def_node->data.func_def.capacity_parameters = new_capacity;
+    }
+    func_def_node->data.func_def.parameters[func_def_node->data.func_def.num_parameters++] = parameter;
+}
+
+// 配列リテラルノードに要素を追加するヘルパー関数
+void add_element_to_array_literal(ASTNode *array_node, ASTNode *element) {
+    if (array_node->type != NODE_ARRAY_LITERAL) {
+        fprintf(stderr, "エラー: add_element_to_array_literalはNODE_ARRAY_LITERALノードにのみ適用できます。\n");
+        return;
+    }
+    if (array_node->data.array_literal.num_elements >= array_node->data.array_literal.capacity_elements) {
+        int new_capacity = (array_node->data.array_literal.capacity_elements == 0) ? 4 : array_node->data.array_literal.capacity_elements * 2;
+        array_node->data.array_literal.elements = realloc(array_node->data.array_literal.elements, sizeof(ASTNode *) * new_capacity);
+        if (array_node->data.array_literal.elements == NULL) {
+            perror("Failed to reallocate elements array for array literal");
+            exit(EXIT_FAILURE);
+        }
+        array_node->data.array_literal.capacity_elements = new_capacity;
+    }
+    array_node->data.array_literal.elements[array_node->data.array_literal.num_elements++] = element;
+}
+
+// 配列リテラルをパースする関数 ('[' は読み終えている)
+// [1, 2, 3]
+static ASTNode *parse_array_literal(Lexer *lexer, int line) {
+    ASTNode *array_node = create_ast_node(NODE_ARRAY_LITERAL, line);
+    int expect_comma = 0;
+    while (1) {
+        int original_pos = lexer->pos;
+        int original_line = lexer->line;
+        Token *peek_token = lexer_next_token(lexer);
+        lexer->pos = original_pos;
+        lexer->line = original_line;
+
+        if (peek_token->type == TOKEN_RBRACKET) {
+            token_destroy(peek_token);
+            break; // ']' ならループを抜ける
+        }
+        token_destroy(peek_token);
+
+        if (expect_comma) {
+            Token *token = lexer_next_token(lexer); // ',' を読む
+            if (token->type != TOKEN_COMMA) {
+                syntax_error(token->line, "配列の要素の間に ',' が期待されますが '%s' が見つかりました。", token->value);
+                token_destroy(token);
+                destroy_ast(array_node);
+                return NULL;
+            }
+            token_destroy(token);
+        }
+
+        ASTNode *element_expr = parse_expression(lexer);
+        if (element_expr == NULL) {
+            destroy_ast(array_node);
+            return NULL;
+        }
+        add_element_to_array_literal(array_node, element_expr);
+        expect_comma = 1;
+    }
+
+    Token *token = lexer_next_token(lexer); // 閉じ ']' を読む
+    token_destroy(token);
+    return array_node;
+}
+
+// 式の後に続く添字をパースする関数
+// factor ( '[' expression [ ',' expression ] ']' )*  (2つ目の添字は行列の列)
+static ASTNode *parse_index_suffix(Lexer *lexer, ASTNode *node) {
+    while (node != NULL) {
+        int original_pos = lexer->pos;
+        int original_line = lexer->line;
+        Token *token = lexer_next_token(lexer);
+        if (token->type != TOKEN_LBRACKET) {
+            lexer->pos = original_pos; // トークンを戻す
+            lexer->line = original_line;
+            token_destroy(token);
+            break;
+        }
+        ASTNode *index_node = create_ast_node(NODE_INDEX, token->line);
+        token_destroy(token);
+        index_node->data.index_expr.target = node;
+        node = index_node;
+
+        index_node->data.index_expr.index = parse_expression(lexer);
+        if (index_node->data.index_expr.index == NULL) {
+            destroy_ast(index_node);
+            return NULL;
+        }
+        token = lexer_next_token(lexer);
+        if (token->type == TOKEN_COMMA) {
+            token_destroy(token);
+            index_node->data.index_expr.column = parse_expression(lexer);
+            if (index_node->data.index_expr.column == NULL) {
+                destroy_ast(index_node);
+                return NULL;
+            }
+            token = lexer_next_token(lexer);
+        }
+        if (token->type != TOKEN_RBRACKET) {
+            syntax_error(token->line, "期待される ']' が見つかりません。見つかったのは '%s' です。", token->value);
+            token_destroy(token);
+            destroy_ast(index_node);
+            return NULL;
+        }
+        token_destroy(token);
+    }
+    return node;
+}
+
+
+// spawn 関数名(引数, ...): 呼び出しをタスクとして実行する式をパースする (spawn は読み終えている)
+static ASTNode *parse_spawn(Lexer *lexer, const Token *spawn_token) {
+    Token *name_token = lexer_next_token(lexer);
+    if (name_token->type != TOKEN_IDENTIFIER) {
+        syntax_error(spawn_token->line, "'spawn' の後に関数呼び出しが期待されますが '%s' が見つかりました。", name_token->value);
+        token_destroy(name_token);
+        return NULL;
+    }
+    ASTNode *node = parse_function_call(lexer, name_token->value);
+    token_destroy(name_token);
+    if (node != NULL) {
+        node->line = spawn_token->line;
+        node->data.func_call.spawned = true;
+    }
+    return node;
+}
 
 // 最も高い優先順位の式 (リテラル、識別子、括弧) をパースする関数
 ASTNode *parse_factor(Lexer *lexer) {
@@ -171,6 +396,7 @@ ASTNode *parse_factor(Lexer *lexer) {
             perror("Failed to duplicate string for AST node");
             exit(EXIT_FAILURE);
         }
+        node->data.string_literal.cached = make_string_value(token->value, strlen(token->value));
     } else if (token->type == TOKEN_TRUE) {
         node = create_ast_node(NODE_NUMBER_LITERAL, token->line); // bool値は数値として格納 (1)
         node->data.number_literal.value = 1;
@@ -198,23 +424,28 @@ ASTNode *parse_factor(Lexer *lexer) {
                 perror("Failed to duplicate identifier name for AST node");
                 exit(EXIT_FAILURE);
             }
+            node->data.identifier_expr.name_hash = hash_symbol_name(node->data.identifier_expr.name);
         }
     } else if (token->type == TOKEN_LPAREN) {
         node = parse_expression(lexer); // 括弧内の式を再帰的にパース
         Token *rparen_token = lexer_next_token(lexer);
         if (rparen_token->type != TOKEN_RPAREN) {
-            fprintf(stderr, "エラー (行 %d): 期待される ')' が見つかりません。見つかったのは '%s' です。\n", rparen_token->line, rparen_token->value);
+            syntax_error(rparen_token->line, "期待される ')' が見つかりません。見つかったのは '%s' です。", rparen_token->value);
             token_destroy(rparen_token);
             destroy_ast(node);
             return NULL;
         }
         token_destroy(rparen_token);
+    } else if (token->type == TOKEN_LBRACKET) {
+        node = parse_array_literal(lexer, token->line);
+    } else if (token->type == TOKEN_SPAWN) {
+        node = parse_spawn(lexer, token);
     } else {
-        fprintf(stderr, "エラー (行 %d): 予期しないトークン '%s' です。式が期待されます。\n", token->line, token->value);
+        syntax_error(token->line, "予期しないトークン '%s' です。式が期待されます。", token->value);
         node = NULL;
     }
     token_destroy(token);
-    return node;
+    return parse_index_suffix(lexer, node);
 }
 
 // 乗除算の式をパースする関数
@@ -297,7 +528,7 @@ ASTNode *parse_print_statement(Lexer *lexer) {
     
     Token *token = lexer_next_token(lexer); // '(' を読む
     if (token->type != TOKEN_LPAREN) {
-        fprintf(stderr, "エラー (行 %d): 'print' の後に '(' が期待されますが '%s' が見つかりました。\n", line, token->value);
+        syntax_error(line, "'print' の後に '(' が期待されますが '%s' が見つかりました。", token->value);
         token_destroy(token);
         destroy_ast(print_node);
         return NULL;
@@ -327,7 +558,7 @@ ASTNode *parse_print_statement(Lexer *lexer) {
         if (expect_comma) {
             token = lexer_next_token(lexer); // ',' を読む
             if (token->type != TOKEN_COMMA) {
-                fprintf(stderr, "エラー (行 %d): 引数の間に ',' が期待されますが '%s' が見つかりました。\n", token->line, token->value);
+                syntax_error(token->line, "引数の間に ',' が期待されますが '%s' が見つかりました。", token->value);
                 token_destroy(token);
                 destroy_ast(print_node);
                 return NULL;
@@ -368,6 +599,18 @@ ASTNode *parse_return_statement(Lexer *lexer) {
     return return_node;
 }
 
+// yield文をパースする関数 ('yield' は読み終えている)
+// yield 式
+ASTNode *parse_yield_statement(Lexer *lexer) {
+    ASTNode *yield_node = create_ast_node(NODE_YIELD, lexer->line);
+    yield_node->data.yield_stmt.value = parse_expression(lexer);
+    if (yield_node->data.yield_stmt.value == NULL) {
+        destroy_ast(yield_node);
+        return NULL;
+    }
+    return yield_node;
+}
+
 // 関数呼び出しをパースする関数
 // functionName(arg1, arg2)
 ASTNode *parse_function_call(Lexer *lexer, char *function_name) {
@@ -378,10 +621,11 @@ ASTNode *parse_function_call(Lexer *lexer, char *function_name) {
         perror("Failed to duplicate function name for function call");
         exit(EXIT_FAILURE);
     }
+    func_call_node->data.func_call.name_hash = hash_symbol_name(function_name);
 
     Token *token = lexer_next_token(lexer); // '(' を読む
     if (token->type != TOKEN_LPAREN) {
-        fprintf(stderr, "エラー (行 %d): 関数呼び出しの後に '(' が期待されますが '%s' が見つかりました。\n", line, token->value);
+        syntax_error(line, "関数呼び出しの後に '(' が期待されますが '%s' が見つかりました。", token->value);
         token_destroy(token);
         destroy_ast(func_call_node);
         return NULL;
@@ -406,7 +650,7 @@ ASTNode *parse_function_call(Lexer *lexer, char *function_name) {
         if (expect_comma) {
             token = lexer_next_token(lexer); // ',' を読む
             if (token->type != TOKEN_COMMA) {
-                fprintf(stderr, "エラー (行 %d): 関数引数の間に ',' が期待されますが '%s' が見つかりました。\n", token->line, token->value);
+                syntax_error(token->line, "関数引数の間に ',' が期待されますが '%s' が見つかりました。", token->value);
                 token_destroy(token);
                 destroy_ast(func_call_node);
                 return NULL;
@@ -429,6 +673,65 @@ ASTNode *parse_function_call(Lexer *lexer, char *function_name) {
     return func_call_node;
 }
 
+// 型名 (int, str, double, bool, int[], double[], mat, future, generator) を値の型に変換する
+static ValueType type_from_name(const char *type_name) {
+    if (strcmp(type_name, "int") == 0) {
+        return VALUE_TYPE_INT;
+    } else if (strcmp(type_name, "str") == 0) {
+        return VALUE_TYPE_STR;
+    } else if (strcmp(type_name, "double") == 0) {
+        return VALUE_TYPE_DOUBLE;
+    } else if (strcmp(type_name, "bool") == 0) {
+        return VALUE_TYPE_BOOL;
+    } else if (strcmp(type_name, "int[]") == 0) {
+        return VALUE_TYPE_INT_ARRAY;
+    } else if (strcmp(type_name, "double[]") == 0) {
+        return VALUE_TYPE_DOUBLE_ARRAY;
+    } else if (strcmp(type_name, "mat") == 0) {
+        return VALUE_TYPE_MAT;
+    } else if (strcmp(type_name, "future") == 0) {
+        return VALUE_TYPE_FUTURE;
+    } else if (strcmp(type_name, "generator") == 0) {
+        return VALUE_TYPE_GENERATOR;
+    }
+    return VALUE_TYPE_UNKNOWN;
+}
+
+// 型名のトークンに続く '[]' を読み、完全な型名を返す (呼び出し側が解放する。不正な '[' なら NULL)
+// int[] と double[] だけが配列の型になる。
+static char *parse_type_name(Lexer *lexer, const Token *type_token) {
+    int original_pos = lexer->pos;
+    int original_line = lexer->line;
+    Token *token = lexer_next_token(lexer);
+    if (token->type != TOKEN_LBRACKET) {
+        lexer->pos = original_pos; // トークンを戻す
+        lexer->line = original_line;
+        token_destroy(token);
+        char *type_name = strdup(type_token->value);
+        if (type_name == NULL) {
+            perror("Failed to duplicate type name");
+            exit(EXIT_FAILURE);
+        }
+        return type_name;
+    }
+    token_destroy(token);
+
+    token = lexer_next_token(lexer);
+    bool closed = (token->type == TOKEN_RBRACKET);
+    token_destroy(token);
+    if (!closed || (type_token->type != TOKEN_INT && type_token->type != TOKEN_DOUBLE)) {
+        syntax_error(type_token->line, "配列の型は 'int[]' または 'double[]' です。");
+        return NULL;
+    }
+    char *type_name = malloc(strlen(type_token->value) + 3);
+    if (type_name == NULL) {
+        perror("Failed to allocate type name");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(type_name, "%s[]", type_token->value);
+    return type_name;
+}
+
 // 変数宣言をパースする関数
 ASTNode *parse_var_declaration(Lexer *lexer, char *type_name) {
     int line = lexer->line;
@@ -438,10 +741,11 @@ ASTNode *parse_var_declaration(Lexer *lexer, char *type_name) {
         perror("Failed to duplicate type name for var declaration");
         exit(EXIT_FAILURE);
     }
+    var_decl_node->data.var_decl.decl_type = type_from_name(type_name);
 
     Token *token = lexer_next_token(lexer); // 変数名 (識別子) を読む
     if (token->type != TOKEN_IDENTIFIER) {
-        fprintf(stderr, "エラー (行 %d): 変数名が期待されますが '%s' が見つかりました。\n", line, token->value);
+        syntax_error(line, "変数名が期待されますが '%s' が見つかりました。", token->value);
         token_destroy(token);
         destroy_ast(var_decl_node);
         return NULL;
@@ -451,11 +755,12 @@ ASTNode *parse_var_declaration(Lexer *lexer, char *type_name) {
         perror("Failed to duplicate var name for var declaration");
         exit(EXIT_FAILURE);
     }
+    var_decl_node->data.var_decl.name_hash = hash_symbol_name(var_decl_node->data.var_decl.name);
     token_destroy(token);
 
     token = lexer_next_token(lexer); // '=' を読む
     if (token->type != TOKEN_ASSIGN) {
-        fprintf(stderr, "エラー (行 %d): 変数宣言で '=' が期待されますが '%s' が見つかりました。\n", line, token->value);
+        syntax_error(line, "変数宣言で '=' が期待されますが '%s' が見つかりました。", token->value);
         token_destroy(token);
         destroy_ast(var_decl_node);
         return NULL;
@@ -503,6 +808,7 @@ ASTNode *parse_assignment_or_call(Lexer *lexer, char *identifier_name) {
             perror("Failed to duplicate assignment target name");
             exit(EXIT_FAILURE);
         }
+        assignment_node->data.assignment.name_hash = hash_symbol_name(identifier_name);
 
         // 代入する値の式をパース
         ASTNode *value_expr = parse_expression(lexer);
@@ -513,9 +819,58 @@ ASTNode *parse_assignment_or_call(Lexer *lexer, char *identifier_name) {
             assignment_node->data.assignment.value = value_expr;
             statement_node = assignment_node;
         }
+    } else if (peek_token->type == TOKEN_LBRACKET) {
+        // 配列の要素への代入: name[index] = value (行列は name[row, column] = value)
+        Token *bracket_token = lexer_next_token(lexer); // 正式に '[' を取得
+        token_destroy(bracket_token);
+
+        ASTNode *assignment_node = create_ast_node(NODE_INDEX_ASSIGNMENT, current_line);
+        assignment_node->data.index_assignment.name = strdup(identifier_name);
+        if (assignment_node->data.index_assignment.name == NULL) {
+            perror("Failed to duplicate assignment target name");
+            exit(EXIT_FAILURE);
+        }
+        assignment_node->data.index_assignment.name_hash = hash_symbol_name(identifier_name);
+        statement_node = assignment_node;
+
+        assignment_node->data.index_assignment.index = parse_expression(lexer);
+        Token *token = NULL;
+        if (assignment_node->data.index_assignment.index != NULL) {
+            token = lexer_next_token(lexer);
+            if (token->type == TOKEN_COMMA) {
+                token_destroy(token);
+                assignment_node->data.index_assignment.column = parse_expression(lexer);
+                token = (assignment_node->data.index_assignment.column != NULL) ? lexer_next_token(lexer) : NULL;
+            }
+        }
+        if (token != NULL) {
+            if (token->type != TOKEN_RBRACKET) {
+                syntax_error(token->line, "期待される ']' が見つかりません。見つかったのは '%s' です。", token->value);
+                statement_node = NULL;
+            } else {
+                token_destroy(token);
+                token = lexer_next_token(lexer);
+                if (token->type != TOKEN_ASSIGN) {
+                    syntax_error(token->line, "配列の要素の後に '=' が期待されますが '%s' が見つかりました。", token->value);
+                    statement_node = NULL;
+                }
+            }
+            token_destroy(token);
+        } else {
+            statement_node = NULL;
+        }
+        if (statement_node != NULL) {
+            assignment_node->data.index_assignment.value = parse_expression(lexer);
+            if (assignment_node->data.index_assignment.value == NULL) {
+                statement_node = NULL;
+            }
+        }
+        if (statement_node == NULL) {
+            destroy_ast(assignment_node); // エラー時
+        }
     } else {
-        fprintf(stderr, "エラー (行 %d): 識別子 '%s' の後に予期しないトークン '%s' です。代入または関数呼び出しが期待されます。\n", 
-                peek_token->line, identifier_name, peek_token->value);
+        syntax_error(peek_token->line, "識別子 '%s' の後に予期しないトークン '%s' です。代入または関数呼び出しが期待されます。",
+                identifier_name, peek_token->value);
         statement_node = NULL; // エラー時
     }
     
@@ -526,6 +881,108 @@ ASTNode *parse_assignment_or_call(Lexer *lexer, char *identifier_name) {
     return statement_node;
 }
 
+static ASTNode *parse_loop_body(Lexer *lexer, ASTNode *for_node);
+
+// for 文をパースする関数 ('for' は読み終えている)
+// for i in range(a, b) { ... }  (range(b) は range(0, b) と同じ)
+// for x in 式 { ... }           (式の値のジェネレータが yield する値を順に x に入れる)
+// 関数本体は分岐を持たないので、ループの本体に return は書けない。
+ASTNode *parse_for_statement(Lexer *lexer) {
+    int line = lexer->line;
+    ASTNode *for_node = create_ast_node(NODE_FOR, line);
+
+    Token *token = lexer_next_token(lexer); // ループ変数の名前を読む
+    if (token->type != TOKEN_IDENTIFIER) {
+        syntax_error(line, "'for' の後にループ変数の名前が期待されますが '%s' が見つかりました。", token->value);
+        token_destroy(token);
+        destroy_ast(for_node);
+        return NULL;
+    }
+    for_node->data.for_stmt.name = strdup(token->value);
+    if (for_node->data.for_stmt.name == NULL) {
+        perror("Failed to duplicate loop variable name");
+        exit(EXIT_FAILURE);
+    }
+    for_node->data.for_stmt.name_hash = hash_symbol_name(for_node->data.for_stmt.name);
+    token_destroy(token);
+
+    token = lexer_next_token(lexer); // 'in' を読む
+    bool valid = (token->type == TOKEN_IN);
+    token_destroy(token);
+    if (!valid) {
+        syntax_error(line, "'for %s' の後に 'in' が期待されます。", for_node->data.for_stmt.name);
+        destroy_ast(for_node);
+        return NULL;
+    }
+
+    // 'range(' が続かなければジェネレータの式
+    int original_pos = lexer->pos;
+    int original_line = lexer->line;
+    token = lexer_next_token(lexer);
+    bool is_range = (token->type == TOKEN_IDENTIFIER && strcmp(token->value, "range") == 0);
+    token_destroy(token);
+    if (is_range) {
+        token = lexer_next_token(lexer);
+        is_range = (token->type == TOKEN_LPAREN);
+        token_destroy(token);
+    }
+    if (!is_range) {
+        lexer->pos = original_pos; // トークンを戻す
+        lexer->line = original_line;
+        for_node->data.for_stmt.iterable = parse_expression(lexer);
+        if (for_node->data.for_stmt.iterable == NULL) {
+            destroy_ast(for_node);
+            return NULL;
+        }
+        return parse_loop_body(lexer, for_node);
+    }
+
+    ASTNode *first = parse_expression(lexer);
+    if (first == NULL) {
+        destroy_ast(for_node);
+        return NULL;
+    }
+    token = lexer_next_token(lexer);
+    if (token->type == TOKEN_COMMA) {
+        token_destroy(token);
+        for_node->data.for_stmt.start = first;
+        for_node->data.for_stmt.end = parse_expression(lexer);
+        if (for_node->data.for_stmt.end == NULL) {
+            destroy_ast(for_node);
+            return NULL;
+        }
+        token = lexer_next_token(lexer);
+    } else {
+        for_node->data.for_stmt.start = create_ast_node(NODE_NUMBER_LITERAL, line); // 0
+        for_node->data.for_stmt.end = first;
+    }
+    if (token->type != TOKEN_RPAREN) {
+        syntax_error(token->line, "期待される ')' が見つかりません。見つかったのは '%s' です。", token->value);
+        token_destroy(token);
+        destroy_ast(for_node);
+        return NULL;
+    }
+    token_destroy(token);
+    return parse_loop_body(lexer, for_node);
+}
+
+// for 文の本体をパースして for_node に付ける (失敗したら for_node ごと解放して NULL)
+static ASTNode *parse_loop_body(Lexer *lexer, ASTNode *for_node) {
+    ASTNode *body = parse_block(lexer);
+    if (body == NULL) {
+        destroy_ast(for_node);
+        return NULL;
+    }
+    for_node->data.for_stmt.body = body;
+    for (int i = 0; i < body->data.block.num_statements; i++) {
+        if (body->data.block.statements[i]->type == NODE_RETURN_STATEMENT) {
+            syntax_error(body->data.block.statements[i]->line, "'for' の本体に 'return' を書くことはできません。");
+            destroy_ast(for_node);
+            return NULL;
+        }
+    }
+    return for_node;
+}
 
 // コードブロックをパースする関数
 // { ... }
@@ -535,7 +992,7 @@ ASTNode *parse_block(Lexer *lexer) {
 
     Token *token = lexer_next_token(lexer); // '{' を読む
     if (token->type != TOKEN_LBRACE) {
-        fprintf(stderr, "エラー (行 %d): '{' が期待されますが '%s' が見つかりました。\n", line, token->value);
+        syntax_error(line, "'{' が期待されますが '%s' が見つかりました。", token->value);
         token_destroy(token);
         destroy_ast(block_node);
         return NULL;
@@ -549,7 +1006,7 @@ ASTNode *parse_block(Lexer *lexer) {
             break; // ブロックの終わり
         }
         if (current_token->type == TOKEN_EOF) {
-            fprintf(stderr, "エラー (行 %d): ブロックの終わりに '}' が期待されますが、ファイルの終わりに達しました。\n", current_token->line);
+            syntax_error(current_token->line, "ブロックの終わりに '}' が期待されますが、ファイルの終わりに達しました。");
             token_destroy(current_token);
             destroy_ast(block_node);
             return NULL;
@@ -570,17 +1027,53 @@ ASTNode *parse_block(Lexer *lexer) {
         } else if (current_token->type == TOKEN_RETURN) {
             token_destroy(current_token);
             statement = parse_return_statement(lexer);
+        } else if (current_token->type == TOKEN_YIELD) {
+            token_destroy(current_token);
+            statement = parse_yield_statement(lexer);
+        } else if (current_token->type == TOKEN_FOR) {
+            token_destroy(current_token);
+            statement = parse_for_statement(lexer);
         } else if (current_token->type == TOKEN_INT || 
                    current_token->type == TOKEN_STR ||
                    current_token->type == TOKEN_DOUBLE ||
-                   current_token->type == TOKEN_BOOL) {
-            char *type_name = strdup(current_token->value);
+                   current_token->type == TOKEN_BOOL ||
+                   current_token->type == TOKEN_MAT ||
+                   current_token->type == TOKEN_FUTURE ||
+                   current_token->type == TOKEN_GENERATOR) {
+            char *type_name = parse_type_name(lexer, current_token);
+            token_destroy(current_token);
+            if (type_name != NULL) {
+                statement = parse_var_declaration(lexer, type_name);
+                free(type_name); // 名前は関数内でコピーされるのでここで解放
+            }
+        } else if (current_token->type == TOKEN_SPAWN) {
+            // 結果を受け取らない spawn も文として書ける (main が終わる前に完了を待つ)
+            statement = parse_spawn(lexer, current_token);
             token_destroy(current_token);
-            statement = parse_var_declaration(lexer, type_name);
-            free(type_name); // strdupした名前は関数内でコピーされるのでここで解放
+        } else if (current_token->type == TOKEN_CONST) {
+            // const 型名 名前 = 式
+            int const_line = current_token->line;
+            token_destroy(current_token);
+            Token *type_token = lexer_next_token(lexer);
+            if (type_token->type != TOKEN_INT && type_token->type != TOKEN_STR &&
+                type_token->type != TOKEN_DOUBLE && type_token->type != TOKEN_BOOL && type_token->type != TOKEN_MAT) {
+                syntax_error(const_line, "'const' の後に型名が期待されますが '%s' が見つかりました。", type_token->value);
+                token_destroy(type_token);
+                destroy_ast(block_node);
+                return NULL;
+            }
+            char *type_name = parse_type_name(lexer, type_token);
+            token_destroy(type_token);
+            if (type_name != NULL) {
+                statement = parse_var_declaration(lexer, type_name);
+                free(type_name);
+            }
+            if (statement != NULL) {
+                statement->data.var_decl.is_const = true;
+            }
         }
         else {
-            fprintf(stderr, "エラー (行 %d): ブロック内で不正な文です。'%s'\n", current_token->line, current_token->value);
+            syntax_error(current_token->line, "ブロック内で不正な文です。'%s'", current_token->value);
             token_destroy(current_token);
             destroy_ast(block_node);
             return NULL;
@@ -596,15 +1089,28 @@ ASTNode *parse_block(Lexer *lexer) {
 }
 
 
+// ブロック (入れ子のループの本体を含む) に yield 文があるか
+static bool contains_yield(const ASTNode *block) {
+    for (int i = 0; i < block->data.block.num_statements; i++) {
+        const ASTNode *statement = block->data.block.statements[i];
+        if (statement->type == NODE_YIELD ||
+            (statement->type == NODE_FOR && contains_yield(statement->data.for_stmt.body))) {
+            return true;
+        }
+    }
+    return false;
+}
+
 // 関数定義をパースする関数
 // def main() { ... }
+// def area(int r, double pi) { ... }
 ASTNode *parse_function_definition(Lexer *lexer) {
     int line = lexer->line;
     ASTNode *func_def_node = create_ast_node(NODE_FUNCTION_DEFINITION, line);
 
     Token *token = lexer_next_token(lexer); // 関数名 (識別子) を読む
     if (token->type != TOKEN_IDENTIFIER) {
-        fprintf(stderr, "エラー (行 %d): 関数名が期待されますが '%s' が見つかりました。\n", line, token->value);
+        syntax_error(line, "関数名が期待されますが '%s' が見つかりました。", token->value);
         token_destroy(token);
         destroy_ast(func_def_node);
         return NULL;
@@ -614,25 +1120,75 @@ ASTNode *parse_function_definition(Lexer *lexer) {
         perror("Failed to duplicate function name");
         exit(EXIT_FAILURE);
     }
+    func_def_node->data.func_def.name_hash = hash_symbol_name(func_def_node->data.func_def.name);
     token_destroy(token);
 
     token = lexer_next_token(lexer); // '(' を読む
     if (token->type != TOKEN_LPAREN) {
-        fprintf(stderr, "エラー (行 %d): 関数名の後に '(' が期待されますが '%s' が見つかりました。\n", line, token->value);
+        syntax_error(line, "関数名の後に '(' が期待されますが '%s' が見つかりました。", token->value);
         token_destroy(token);
         destroy_ast(func_def_node);
         return NULL;
     }
     token_destroy(token);
 
-    token = lexer_next_token(lexer); // ')' を読む (引数はまだサポートしないため)
-    if (token->type != TOKEN_RPAREN) {
-        fprintf(stderr, "エラー (行 %d): '(' の後に ')' が期待されますが '%s' が見つかりました。\n", line, token->value);
+    // 引数リストをパース: (int a, double b)
+    int expect_comma = 0;
+    while (1) {
+        token = lexer_next_token(lexer);
+        if (token->type == TOKEN_RPAREN) {
+            token_destroy(token);
+            break; // ')' ならループを抜ける
+        }
+
+        if (expect_comma) {
+            if (token->type != TOKEN_COMMA) {
+                syntax_error(token->line, "引数の間に ',' が期待されますが '%s' が見つかりました。", token->value);
+                token_destroy(token);
+                destroy_ast(func_def_node);
+                return NULL;
+            }
+            token_destroy(token);
+            token = lexer_next_token(lexer); // 型名を読む
+        }
+
+        if (token->type != TOKEN_INT && token->type != TOKEN_STR &&
+            token->type != TOKEN_DOUBLE && token->type != TOKEN_BOOL && token->type != TOKEN_MAT &&
+            token->type != TOKEN_FUTURE && token->type != TOKEN_GENERATOR) {
+            syntax_error(token->line, "引数の型名が期待されますが '%s' が見つかりました。", token->value);
+            token_destroy(token);
+            destroy_ast(func_def_node);
+            return NULL;
+        }
+        ASTNode *param_node = create_ast_node(NODE_VAR_DECLARATION, token->line);
+        param_node->data.var_decl.type_name = parse_type_name(lexer, token);
         token_destroy(token);
-        destroy_ast(func_def_node);
-        return NULL;
+        if (param_node->data.var_decl.type_name == NULL) {
+            destroy_ast(param_node);
+            destroy_ast(func_def_node);
+            return NULL;
+        }
+        param_node->data.var_decl.decl_type = type_from_name(param_node->data.var_decl.type_name);
+
+        token = lexer_next_token(lexer); // 引数名を読む
+        if (token->type != TOKEN_IDENTIFIER) {
+            syntax_error(token->line, "引数名が期待されますが '%s' が見つかりました。", token->value);
+            token_destroy(token);
+            destroy_ast(param_node);
+            destroy_ast(func_def_node);
+            return NULL;
+        }
+        param_node->data.var_decl.name = strdup(token->value);
+        if (param_node->data.var_decl.name == NULL) {
+            perror("Failed to duplicate parameter name");
+            exit(EXIT_FAILURE);
+        }
+        param_node->data.var_decl.name_hash = hash_symbol_name(param_node->data.var_decl.name);
+        token_destroy(token);
+
+        add_parameter_to_function_definition(func_def_node, param_node);
+        expect_comma = 1;
     }
-    token_destroy(token);
 
     // 関数本体のブロックをパース
     ASTNode *body_block = parse_block(lexer);
@@ -642,6 +1198,19 @@ ASTNode *parse_function_definition(Lexer *lexer) {
     }
     func_def_node->data.func_def.body = body_block;
 
+    // 本体に yield があればジェネレータ関数 (値は yield で返すので return は書けない)
+    func_def_node->data.func_def.generator = contains_yield(body_block);
+    if (func_def_node->data.func_def.generator) {
+        for (int i = 0; i < body_block->data.block.num_statements; i++) {
+            if (body_block->data.block.statements[i]->type == NODE_RETURN_STATEMENT) {
+                syntax_error(body_block->data.block.statements[i]->line, "ジェネレータ関数 '%s' に 'return' を書くことはできません。",
+                        func_def_node->data.func_def.name);
+                destroy_ast(func_def_node);
+                return NULL;
+            }
+        }
+    }
+
     return func_def_node;
 }
 
@@ -651,6 +1220,28 @@ ASTNode *parse(Lexer *lexer) {
 
     Token *token;
     while ((token = lexer_next_token(lexer))->type != TOKEN_EOF) {
+        // 関数定義の前の注釈 (@memoize)
+        bool memoize = false;
+        while (token->type == TOKEN_AT) {
+            int line = token->line;
+            token_destroy(token);
+            token = lexer_next_token(lexer);
+            if (token->type != TOKEN_IDENTIFIER || strcmp(token->value, "memoize") != 0) {
+                syntax_error(line, "不明な注釈 '@%s' です。", token->value ? token->value : "");
+                token_destroy(token);
+                destroy_ast(program_node);
+                return NULL;
+            }
+            memoize = true;
+            token_destroy(token);
+            token = lexer_next_token(lexer);
+            if (token->type != TOKEN_DEF) {
+                syntax_error(line, "注釈の後には関数定義が期待されます。");
+                token_destroy(token);
+                destroy_ast(program_node);
+                return NULL;
+            }
+        }
         if (token->type == TOKEN_DEF) { // 'def' キーワードを見つけたら関数定義をパース
             token_destroy(token); // def トークンを解放
             ASTNode *func_def_stmt = parse_function_definition(lexer);
@@ -658,9 +1249,10 @@ ASTNode *parse(Lexer *lexer) {
                 destroy_ast(program_node);
                 return NULL;
             }
+            func_def_stmt->data.func_def.memoize_annotated = memoize;
             add_statement_to_program(program_node, func_def_stmt);
         } else {
-            fprintf(stderr, "エラー (行 %d): 不正なトークン '%s' です。関数定義が期待されます。\n", token->line, token->value);
+            syntax_error(token->line, "不正なトークン '%s' です。関数定義が期待されます。", token->value);
             token_destroy(token);
             destroy_ast(program_node);
             return NULL;
@@ -690,7 +1282,14 @@ void destroy_ast(ASTNode *node) {
             if (node->data.func_def.name) {
                 free(node->data.func_def.name);
             }
+            for (int i = 0; i < node->data.func_def.num_parameters; i++) {
+                destroy_ast(node->data.func_def.parameters[i]);
+            }
+            if (node->data.func_def.parameters) {
+                free(node->data.func_def.parameters);
+            }
             destroy_ast(node->data.func_def.body);
+            destroy_ast(node->data.func_def.optimized_body);
             break;
         case NODE_BLOCK:
             for (int i = 0; i < node->data.block.num_statements; i++) {
@@ -705,6 +1304,9 @@ void destroy_ast(ASTNode *node) {
                 destroy_ast(node->data.return_stmt.value);
             }
             break;
+        case NODE_YIELD:
+            destroy_ast(node->data.yield_stmt.value);
+            break;
         case NODE_PRINT_STATEMENT:
             for (int i = 0; i < node->data.print_stmt.num_arguments; i++) {
                 destroy_ast(node->data.print_stmt.arguments[i]);
@@ -717,6 +1319,7 @@ void destroy_ast(ASTNode *node) {
             if (node->data.string_literal.value) {
                 free(node->data.string_literal.value);
             }
+            free_value_data(node->data.string_literal.cached);
             break;
         case NODE_NUMBER_LITERAL:
             break;
@@ -761,9 +1364,309 @@ void destroy_ast(ASTNode *node) {
         case NODE_SUBTRACT:
         case NODE_MULTIPLY:
         case NODE_DIVIDE:
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_DIVIDE_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE:
+        case NODE_CONCAT:
             destroy_ast(node->data.binary_expr.left);
             destroy_ast(node->data.binary_expr.right);
             break;
+        case NODE_CONVERT:
+            destroy_ast(node->data.convert.operand);
+            break;
+        case NODE_ARRAY_LITERAL:
+            for (int i = 0; i < node->data.array_literal.num_elements; i++) {
+                destroy_ast(node->data.array_literal.elements[i]);
+            }
+            if (node->data.array_literal.elements) {
+                free(node->data.array_literal.elements);
+            }
+            break;
+        case NODE_INDEX:
+            destroy_ast(node->data.index_expr.target);
+            destroy_ast(node->data.index_expr.index);
+            destroy_ast(node->data.index_expr.column);
+            break;
+        case NODE_INDEX_ASSIGNMENT:
+            if (node->data.index_assignment.name) {
+                free(node->data.index_assignment.name);
+            }
+            destroy_ast(node->data.index_assignment.index);
+            destroy_ast(node->data.index_assignment.column);
+            destroy_ast(node->data.index_assignment.value);
+            break;
+        case NODE_FOR:
+            if (node->data.for_stmt.name) {
+                free(node->data.for_stmt.name);
+            }
+            destroy_ast(node->data.for_stmt.start);
+            destroy_ast(node->data.for_stmt.end);
+            destroy_ast(node->data.for_stmt.iterable);
+            destroy_ast(node->data.for_stmt.body);
+            break;
+        case NODE_FORK:
+            destroy_ast(node->data.fork_expr.body);
+            break;
     }
     free(node);
-}
\ No newline at end of file
+}
+
+// 名前などの文字列を複製する (NULL はそのまま)
+static char *clone_string(const char *str) {
+    if (str == NULL) {
+        return NULL;
+    }
+    char *copy = strdup(str);
+    if (copy == NULL) {
+        perror("Failed to duplicate string for AST clone");
+        exit(EXIT_FAILURE);
+    }
+    return copy;
+}
+
+static ASTNode **clone_node_array(ASTNode **nodes, int count) {
+    if (count == 0) {
+        return NULL;
+    }
+    ASTNode **copy = malloc(sizeof(ASTNode *) * count);
+    if (copy == NULL) {
+        perror("Failed to allocate AST clone array");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++) {
+        copy[i] = clone_ast(nodes[i]);
+    }
+    return copy;
+}
+
+// ASTの部分木を深く複製する (最適化は元の木を変えずに複製の上で行う)
+// 実行時に書き換わるキャッシュ (呼び出し先など) は複製せず、未解決の状態から始める。
+ASTNode *clone_ast(const ASTNode *node) {
+    if (node == NULL) {
+        return NULL;
+    }
+    ASTNode *copy = create_ast_node(node->type, node->line);
+
+    switch (node->type) {
+        case NODE_PROGRAM:
+        case NODE_BLOCK:
+            copy->data.block.statements = clone_node_array(node->data.block.statements, node->data.block.num_statements);
+            copy->data.block.num_statements = node->data.block.num_statements;
+            copy->data.block.capacity_statements = node->data.block.num_statements;
+            break;
+        case NODE_FUNCTION_DEFINITION:
+            copy->data.func_def.name = clone_string(node->data.func_def.name);
+            copy->data.func_def.name_hash = node->data.func_def.name_hash;
+            copy->data.func_def.parameters = clone_node_array(node->data.func_def.parameters, node->data.func_def.num_parameters);
+            copy->data.func_def.num_parameters = node->data.func_def.num_parameters;
+            copy->data.func_def.capacity_parameters = node->data.func_def.num_parameters;
+            copy->data.func_def.body = clone_ast(node->data.func_def.body);
+            copy->data.func_def.frame_size = node->data.func_def.frame_size;
+            copy->data.func_def.result_type = node->data.func_def.result_type;
+            copy->data.func_def.check_state = node->data.func_def.check_state;
+            copy->data.func_def.purity = node->data.func_def.purity;
+            copy->data.func_def.generator = node->data.func_def.generator;
+            copy->data.func_def.yield_type = node->data.func_def.yield_type;
+            break;
+        case NODE_RETURN_STATEMENT:
+            copy->data.return_stmt.value = clone_ast(node->data.return_stmt.value);
+            break;
+        case NODE_YIELD:
+            copy->data.yield_stmt.value = clone_ast(node->data.yield_stmt.value);
+            break;
+        case NODE_PRINT_STATEMENT:
+            copy->data.print_stmt.arguments = clone_node_array(node->data.print_stmt.arguments, node->data.print_stmt.num_arguments);
+            copy->data.print_stmt.num_arguments = node->data.print_stmt.num_arguments;
+            copy->data.print_stmt.capacity_arguments = node->data.print_stmt.num_arguments;
+            break;
+        case NODE_STRING_LITERAL:
+            copy->data.string_literal.value = clone_string(node->data.string_literal.value);
+            copy->data.string_literal.cached = copy_value(node->data.string_literal.cached);
+            break;
+        case NODE_NUMBER_LITERAL:
+            copy->data.number_literal.value = node->data.number_literal.value;
+            break;
+        case NODE_FLOAT_LITERAL:
+            copy->data.float_literal.value = node->data.float_literal.value;
+            break;
+        case NODE_FUNCTION_CALL:
+            copy->data.func_call.function_name = clone_string(node->data.func_call.function_name);
+            copy->data.func_call.name_hash = node->data.func_call.name_hash;
+            copy->data.func_call.arguments = clone_node_array(node->data.func_call.arguments, node->data.func_call.num_arguments);
+            copy->data.func_call.num_arguments = node->data.func_call.num_arguments;
+            copy->data.func_call.capacity_arguments = node->data.func_call.num_arguments;
+            copy->data.func_call.native = node->data.func_call.native;
+            copy->data.func_call.checked = node->data.func_call.checked;
+            copy->data.func_call.callee = node->data.func_call.callee;
+            copy->data.func_call.spawned = node->data.func_call.spawned;
+            copy->data.func_call.fork_slot = node->data.func_call.fork_slot;
+            break;
+        case NODE_VAR_DECLARATION:
+            copy->data.var_decl.type_name = clone_string(node->data.var_decl.type_name);
+            copy->data.var_decl.decl_type = node->data.var_decl.decl_type;
+            copy->data.var_decl.name = clone_string(node->data.var_decl.name);
+            copy->data.var_decl.name_hash = node->data.var_decl.name_hash;
+            copy->data.var_decl.initializer = clone_ast(node->data.var_decl.initializer);
+            copy->data.var_decl.slot = node->data.var_decl.slot;
+            copy->data.var_decl.checked = node->data.var_decl.checked;
+            copy->data.var_decl.is_const = node->data.var_decl.is_const;
+            break;
+        case NODE_ASSIGNMENT:
+            copy->data.assignment.name = clone_string(node->data.assignment.name);
+            copy->data.assignment.name_hash = node->data.assignment.name_hash;
+            copy->data.assignment.value = clone_ast(node->data.assignment.value);
+            copy->data.assignment.slot = node->data.assignment.slot;
+            copy->data.assignment.checked = node->data.assignment.checked;
+            break;
+        case NODE_IDENTIFIER_EXPR:
+            copy->data.identifier_expr.name = clone_string(node->data.identifier_expr.name);
+            copy->data.identifier_expr.name_hash = node->data.identifier_expr.name_hash;
+            copy->data.identifier_expr.slot = node->data.identifier_expr.slot;
+            break;
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE:
+        case NODE_ADD_INT:
+        case NODE_SUBTRACT_INT:
+        case NODE_MULTIPLY_INT:
+        case NODE_DIVIDE_INT:
+        case NODE_ADD_DOUBLE:
+        case NODE_SUBTRACT_DOUBLE:
+        case NODE_MULTIPLY_DOUBLE:
+        case NODE_DIVIDE_DOUBLE:
+        case NODE_CONCAT:
+            copy->data.binary_expr.left = clone_ast(node->data.binary_expr.left);
+            copy->data.binary_expr.right = clone_ast(node->data.binary_expr.right);
+            break;
+        case NODE_CONVERT:
+            copy->data.convert.operand = clone_ast(node->data.convert.operand);
+            copy->data.convert.from = node->data.convert.from;
+            copy->data.convert.to = node->data.convert.to;
+            break;
+        case NODE_ARRAY_LITERAL:
+            copy->data.array_literal.elements = clone_node_array(node->data.array_literal.elements, node->data.array_literal.num_elements);
+            copy->data.array_literal.num_elements = node->data.array_literal.num_elements;
+            copy->data.array_literal.capacity_elements = node->data.array_literal.num_elements;
+            copy->data.array_literal.element_type = node->data.array_literal.element_type;
+            break;
+        case NODE_INDEX:
+            copy->data.index_expr.target = clone_ast(node->data.index_expr.target);
+            copy->data.index_expr.index = clone_ast(node->data.index_expr.index);
+            copy->data.index_expr.column = clone_ast(node->data.index_expr.column);
+            break;
+        case NODE_INDEX_ASSIGNMENT:
+            copy->data.index_assignment.name = clone_string(node->data.index_assignment.name);
+            copy->data.index_assignment.name_hash = node->data.index_assignment.name_hash;
+            copy->data.index_assignment.index = clone_ast(node->data.index_assignment.index);
+            copy->data.index_assignment.column = clone_ast(node->data.index_assignment.column);
+            copy->data.index_assignment.value = clone_ast(node->data.index_assignment.value);
+            copy->data.index_assignment.slot = node->data.index_assignment.slot;
+            copy->data.index_assignment.checked = node->data.index_assignment.checked;
+            break;
+        case NODE_FOR:
+            copy->data.for_stmt.name = clone_string(node->data.for_stmt.name);
+            copy->data.for_stmt.name_hash = node->data.for_stmt.name_hash;
+            copy->data.for_stmt.start = clone_ast(node->data.for_stmt.start);
+            copy->data.for_stmt.end = clone_ast(node->data.for_stmt.end);
+            copy->data.for_stmt.iterable = clone_ast(node->data.for_stmt.iterable);
+            copy->data.for_stmt.body = clone_ast(node->data.for_stmt.body);
+            copy->data.for_stmt.slot = node->data.for_stmt.slot;
+            copy->data.for_stmt.iterator_slot = node->data.for_stmt.iterator_slot;
+            copy->data.for_stmt.checked = node->data.for_stmt.checked;
+            copy->data.for_stmt.function = node->data.for_stmt.function;
+            break;
+        case NODE_FORK:
+            copy->data.fork_expr.body = clone_ast(node->data.fork_expr.body);
+            break;
+    }
+    return copy;
+}
+
+// 評価済みの値をリテラルノードにする (リテラルで表せない型なら NULL)
+// bool は対応するリテラルがないので、整数リテラルの bool への変換ノードで表す。
+// 値の参照はノードに移す。
+ASTNode *make_literal_node(Value value, int line) {
+    ASTNode *literal;
+    switch (VAL_TYPE(value)) {
+        case VALUE_TYPE_INT:
+            literal = create_ast_node(NODE_NUMBER_LITERAL, line);
+            literal->data.number_literal.value = AS_INT(value);
+            free_value_data(value);
+            return literal;
+        case VALUE_TYPE_DOUBLE:
+            literal = create_ast_node(NODE_FLOAT_LITERAL, line);
+            literal->data.float_literal.value = AS_DOUBLE(value);
+            return literal;
+        case VALUE_TYPE_BOOL: {
+            ASTNode *number = create_ast_node(NODE_NUMBER_LITERAL, line);
+            number->data.number_literal.value = AS_BOOL(value) ? 1 : 0;
+            literal = create_ast_node(NODE_CONVERT, line);
+            literal->data.convert.operand = number;
+            literal->data.convert.from = VALUE_TYPE_INT;
+            literal->data.convert.to = VALUE_TYPE_BOOL;
+            return literal;
+        }
+        case VALUE_TYPE_STR: {
+            StrView view;
+            string_view(value, &view);
+            literal = create_ast_node(NODE_STRING_LITERAL, line);
+            literal->data.string_literal.value = malloc(view.length + 1);
+            if (literal->data.string_literal.value == NULL) {
+                perror("Failed to allocate string literal");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(literal->data.string_literal.value, view.data, view.length);
+            literal->data.string_literal.value[view.length] = '\0';
+            literal->data.string_literal.cached = value;
+            return literal;
+        }
+        case VALUE_TYPE_INT_ARRAY:
+        case VALUE_TYPE_DOUBLE_ARRAY: {
+            // 短い配列だけ要素のリテラルを並べた配列リテラルにする
+            const KArray *array = AS_ARRAY(value);
+            if (array->length > ARRAY_LITERAL_MAX_ELEMENTS) {
+                free_value_data(value);
+                return NULL;
+            }
+            literal = create_ast_node(NODE_ARRAY_LITERAL, line);
+            literal->data.array_literal.element_type = array->element_type;
+            for (size_t i = 0; i < array->length; i++) {
+                Value element = (array->element_type == VALUE_TYPE_DOUBLE)
+                    ? DOUBLE_VAL(array->data.doubles[i]) : INT_VAL(array->data.ints[i]);
+                add_element_to_array_literal(literal, make_literal_node(element, line));
+            }
+            free_value_data(value);
+            return literal;
+        }
+        default:
+            free_value_data(value);
+            return NULL;
+    }
+}
+
+// make_literal_node が作る形のノードか
+bool is_literal_node(const ASTNode *node) {
+    switch (node->type) {
+        case NODE_NUMBER_LITERAL:
+        case NODE_FLOAT_LITERAL:
+        case NODE_STRING_LITERAL:
+            return true;
+        case NODE_CONVERT:
+            return node->data.convert.to == VALUE_TYPE_BOOL && node->data.convert.operand->type == NODE_NUMBER_LITERAL;
+        case NODE_ARRAY_LITERAL:
+            for (int i = 0; i < node->data.array_literal.num_elements; i++) {
+                if (!is_literal_node(node->data.array_literal.elements[i])) {
+                    return false;
+                }
+            }
+            return node->data.array_literal.element_type != VALUE_TYPE_UNKNOWN;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,147 @@
+#include "kappok.h"
+
+// 関数ごとの名前解決の状態
+// 引数とローカル変数にフレーム内のスロット番号を振り、実行時に名前で探索しなくて済むようにする。
+typedef struct ResolveScope {
+    Environment *names; // 名前 → スロット番号 (int値として保存)
+    int num_slots;
+    ASTNode *func_def;  // 解決中の関数
+} ResolveScope;
+
+// 名前に新しいスロットを割り当てる (同名の再宣言は同じスロットを使う)
+static int declare_slot(ResolveScope *scope, const char *name, unsigned int hash) {
+    SymbolEntry *entry = get_local_symbol_hashed(scope->names, name, hash);
+    if (entry != NULL) {
+        return (int)AS_INT(entry->value);
+    }
+    define_symbol_hashed(scope->names, name, hash, INT_VAL(scope->num_slots));
+    return scope->num_slots++;
+}
+
+// 宣言済みの名前のスロットを返す (見つからなければ -1 で、実行時にグローバルを探索する)
+static int lookup_slot(ResolveScope *scope, const char *name, unsigned int hash) {
+    SymbolEntry *entry = get_local_symbol_hashed(scope->names, name, hash);
+    if (entry == NULL) {
+        return -1;
+    }
+    return (int)AS_INT(entry->value);
+}
+
+static void resolve_node(ASTNode *node, ResolveScope *scope) {
+    if (node == NULL) {
+        return;
+    }
+
+    switch (node->type) {
+        case NODE_PROGRAM:
+        case NODE_BLOCK:
+            for (int i = 0; i < node->data.block.num_statements; i++) {
+                resolve_node(node->data.block.statements[i], scope);
+            }
+            break;
+        case NODE_RETURN_STATEMENT:
+            resolve_node(node->data.return_stmt.value, scope);
+            break;
+        case NODE_YIELD:
+            resolve_node(node->data.yield_stmt.value, scope);
+            break;
+        case NODE_PRINT_STATEMENT:
+            for (int i = 0; i < node->data.print_stmt.num_arguments; i++) {
+                resolve_node(node->data.print_stmt.arguments[i], scope);
+            }
+            break;
+        case NODE_FUNCTION_CALL:
+            // ネイティブ関数は同名のユーザー定義関数より優先する
+            node->data.func_call.native = find_native_function(node->data.func_call.function_name, node->data.func_call.name_hash);
+            for (int i = 0; i < node->data.func_call.num_arguments; i++) {
+                resolve_node(node->data.func_call.arguments[i], scope);
+            }
+            break;
+        case NODE_VAR_DECLARATION:
+            // 初期化式は宣言より前の名前で解決する (int x = x は外側の x を指す)
+            resolve_node(node->data.var_decl.initializer, scope);
+            node->data.var_decl.slot = declare_slot(scope, node->data.var_decl.name, node->data.var_decl.name_hash);
+            break;
+        case NODE_ASSIGNMENT:
+            resolve_node(node->data.assignment.value, scope);
+            node->data.assignment.slot = lookup_slot(scope, node->data.assignment.name, node->data.assignment.name_hash);
+            break;
+        case NODE_INDEX_ASSIGNMENT:
+            resolve_node(node->data.index_assignment.index, scope);
+            resolve_node(node->data.index_assignment.column, scope);
+            resolve_node(node->data.index_assignment.value, scope);
+            node->data.index_assignment.slot = lookup_slot(scope, node->data.index_assignment.name, node->data.index_assignment.name_hash);
+            break;
+        case NODE_ARRAY_LITERAL:
+            for (int i = 0; i < node->data.array_literal.num_elements; i++) {
+                resolve_node(node->data.array_literal.elements[i], scope);
+            }
+            break;
+        case NODE_INDEX:
+            resolve_node(node->data.index_expr.target, scope);
+            resolve_node(node->data.index_expr.index, scope);
+            resolve_node(node->data.index_expr.column, scope);
+            break;
+        case NODE_FOR:
+            // 範囲はループ変数の宣言より前の名前で解決する
+            resolve_node(node->data.for_stmt.start, scope);
+            resolve_node(node->data.for_stmt.end, scope);
+            resolve_node(node->data.for_stmt.iterable, scope);
+            if (node->data.for_stmt.iterable != NULL) {
+                // 回しているジェネレータは名前のないスロットに置く (ループごとに別のスロット)
+                node->data.for_stmt.iterator_slot = scope->num_slots++;
+            }
+            node->data.for_stmt.slot = declare_slot(scope, node->data.for_stmt.name, node->data.for_stmt.name_hash);
+            node->data.for_stmt.function = scope->func_def;
+            resolve_node(node->data.for_stmt.body, scope);
+            break;
+        case NODE_IDENTIFIER_EXPR:
+            node->data.identifier_expr.slot = lookup_slot(scope, node->data.identifier_expr.name, node->data.identifier_expr.name_hash);
+            break;
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE:
+            resolve_node(node->data.binary_expr.left, scope);
+            resolve_node(node->data.binary_expr.right, scope);
+            break;
+        default:
+            break;
+    }
+}
+
+// 関数定義の引数と本体を解決し、フレームサイズを決める
+static void resolve_function(ASTNode *func_def) {
+    ResolveScope scope;
+    scope.names = create_environment(NULL);
+    scope.num_slots = 0;
+    scope.func_def = func_def;
+
+    // 引数はスロット 0 から順に並ぶ (呼び出し側が実引数をそのまま書き込む)
+    for (int i = 0; i < func_def->data.func_def.num_parameters; i++) {
+        ASTNode *param = func_def->data.func_def.parameters[i];
+        if (lookup_slot(&scope, param->data.var_decl.name, param->data.var_decl.name_hash) >= 0) {
+            compile_error(param->line, "関数 '%s' の引数 '%s' が重複しています。",
+                    func_def->data.func_def.name, param->data.var_decl.name);
+        }
+        param->data.var_decl.slot = declare_slot(&scope, param->data.var_decl.name, param->data.var_decl.name_hash);
+    }
+
+    resolve_node(func_def->data.func_def.body, &scope);
+    func_def->data.func_def.frame_size = scope.num_slots;
+
+    destroy_environment(scope.names);
+}
+
+// プログラム内の全ての関数について、ローカル変数をスロットに解決する
+void resolve_program(ASTNode *program_node) {
+    if (program_node == NULL || program_node->type != NODE_PROGRAM) {
+        return;
+    }
+    for (int i = 0; i < program_node->data.program.num_statements; i++) {
+        ASTNode *statement = program_node->data.program.statements[i];
+        if (statement->type == NODE_FUNCTION_DEFINITION) {
+            resolve_function(statement);
+        }
+    }
+}
@@ -0,0 +1,529 @@
+#define _DEFAULT_SOURCE // realpath
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "kappok.h"
+#include "kappok_api.h"
+
+// 常駐サーバ (--serve) とそのクライアント (--client)
+// サーバは Unix ドメインソケットで待ち受け、ワーカーのスレッドがそれぞれ接続を受け付けて実行する。
+// コンパイルしたプログラムはパスごとに保持し、ファイルの更新時刻・大きさ・i ノードが変わらない限り
+// 読み込み直さずに埋め込み API の kappok_run で実行する。保持するのは最近使われた CACHE_MAX_PROGRAMS 個まで。
+//
+// 要求: クライアントは実行するファイルの絶対パス ('\0' 終端) を、自分の標準出力の記述子を
+//       SCM_RIGHTS で添えて送る。サーバはその記述子に直接 main の出力を書く。
+// 応答: 1 バイトの状態 (KappokStatus) に続けてエラーメッセージ (なければ空) を送り、接続を閉じる。
+//
+// 信頼の範囲: 接続できる者はサーバの権限で任意のファイルを実行させられるので、ソケットファイルは
+// サーバを起動した利用者だけが読み書きできる (0600) ように作る。要求そのものは検査しない。
+
+#define CACHE_BUCKETS 256
+#define CACHE_MAX_PROGRAMS 128 // 保持するプログラムの上限 (超えたら最も長く使われていないものを外す)
+
+typedef struct CachedProgram {
+    char *path;
+    unsigned int hash;
+    dev_t device;           // 以下はコンパイルしたときのファイルの状態
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+    KappokProgram *program;
+    int refs;               // 表から外れても、実行中のワーカーが使い終えるまで解放しない
+    struct CachedProgram *next;     // 同じバケツの次のプログラム
+    struct CachedProgram *lru_prev; // 使われた順の一覧 (先頭が最も最近使われたもの)
+    struct CachedProgram *lru_next;
+} CachedProgram;
+
+static KappokRuntime *server_runtime = NULL;
+static int listen_fd = -1;
+static CachedProgram *cache[CACHE_BUCKETS];
+static CachedProgram *lru_head = NULL;
+static CachedProgram *lru_tail = NULL;
+static int num_cached = 0;
+// 表と参照の数を守る (コンパイルと解放はロックの外で行う)
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool same_file_state(const CachedProgram *entry, const struct stat *info) {
+    return entry->device == info->st_dev && entry->inode == info->st_ino && entry->size == info->st_size &&
+           entry->mtime.tv_sec == info->st_mtim.tv_sec && entry->mtime.tv_nsec == info->st_mtim.tv_nsec;
+}
+
+static void free_cached_program(CachedProgram *entry) {
+    kappok_program_free(entry->program);
+    free(entry->path);
+    free(entry);
+}
+
+// 参照を一つ手放し、最後の参照ならプログラムを解放する
+static void release_cached_program(CachedProgram *entry) {
+    pthread_mutex_lock(&cache_lock);
+    bool last = --entry->refs == 0;
+    pthread_mutex_unlock(&cache_lock);
+    if (last) {
+        free_cached_program(entry);
+    }
+}
+
+// 以下の表の操作は cache_lock を取って呼ぶ
+
+static void lru_unlink(CachedProgram *entry) {
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        lru_tail = entry->lru_prev;
+    }
+}
+
+static void lru_push_front(CachedProgram *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head != NULL) {
+        lru_head->lru_prev = entry;
+    } else {
+        lru_tail = entry;
+    }
+    lru_head = entry;
+}
+
+// path のプログラムを探す (なければ NULL)
+static CachedProgram *lookup_locked(const char *path, unsigned int hash) {
+    CachedProgram *entry = cache[hash % CACHE_BUCKETS];
+    while (entry != NULL && (entry->hash != hash || strcmp(entry->path, path) != 0)) {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+// 表から外す (表の参照を落とすのは呼び出し側。最後の参照ならロックの外で解放する)
+static void remove_locked(CachedProgram *entry) {
+    CachedProgram **link = &cache[entry->hash % CACHE_BUCKETS];
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+    lru_unlink(entry);
+    num_cached--;
+}
+
+// 表から現在のファイルの状態でコンパイルしたものを探し、あれば参照を増やして返す
+static CachedProgram *find_cached_program(const char *path, unsigned int hash, const struct stat *info) {
+    pthread_mutex_lock(&cache_lock);
+    CachedProgram *entry = lookup_locked(path, hash);
+    if (entry != NULL && same_file_state(entry, info)) {
+        entry->refs++;
+        lru_unlink(entry);
+        lru_push_front(entry);
+    } else {
+        entry = NULL;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return entry;
+}
+
+// 新しくコンパイルしたもの (参照は呼び出し側の1つ) を表に入れ、参照を一つ持った状態で返す
+// 同じ状態のファイルを他のワーカーが先にコンパイルして入れていれば、新しいものは捨ててそちらを返す。
+// 同じパスの古いものと、上限を超えた分の最も長く使われていないものは表から外す。
+static CachedProgram *insert_cached_program(CachedProgram *entry) {
+    CachedProgram *dropped[2] = { NULL, NULL };
+    int num_dropped = 0;
+    pthread_mutex_lock(&cache_lock);
+    CachedProgram *existing = lookup_locked(entry->path, entry->hash);
+    if (existing != NULL && existing->device == entry->device && existing->inode == entry->inode &&
+        existing->size == entry->size && existing->mtime.tv_sec == entry->mtime.tv_sec &&
+        existing->mtime.tv_nsec == entry->mtime.tv_nsec) {
+        existing->refs++;
+        pthread_mutex_unlock(&cache_lock);
+        free_cached_program(entry); // まだ誰も使っていない
+        return existing;
+    }
+    if (existing != NULL) {
+        remove_locked(existing);
+        dropped[num_dropped++] = existing;
+    }
+    entry->refs++; // 表の分
+    entry->next = cache[entry->hash % CACHE_BUCKETS];
+    cache[entry->hash % CACHE_BUCKETS] = entry;
+    lru_push_front(entry);
+    num_cached++;
+    if (num_cached > CACHE_MAX_PROGRAMS) {
+        CachedProgram *oldest = lru_tail;
+        remove_locked(oldest);
+        dropped[num_dropped++] = oldest;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    for (int i = 0; i < num_dropped; i++) {
+        release_cached_program(dropped[i]);
+    }
+    return entry;
+}
+
+// path のプログラムを (必要ならコンパイルして) 参照を一つ持った状態で返す
+// 失敗したら NULL を返し、*status と *error に結果を入れる。
+// コンパイルはロックを取らずに行うので、遅いコンパイルが他のファイルの要求を待たせない
+// (同じファイルを複数のワーカーが同時にコンパイルしたら、表に入れるときに一つを残す)。
+static CachedProgram *acquire_program(const char *path, KappokStatus *status, char **error) {
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        // メッセージはクライアントが渡されたファイル名で書く
+        *status = KAPPOK_ERROR_IO;
+        *error = NULL;
+        return NULL;
+    }
+    unsigned int hash = hash_symbol_name(path);
+    CachedProgram *entry = find_cached_program(path, hash, &info);
+    if (entry != NULL) {
+        return entry;
+    }
+
+    KappokProgram *program;
+    *status = kappok_compile_file(server_runtime, path, &program, error);
+    if (*status != KAPPOK_OK) {
+        return NULL;
+    }
+    entry = malloc(sizeof(CachedProgram));
+    if (entry == NULL) {
+        perror("Failed to allocate cached program");
+        exit(EXIT_FAILURE);
+    }
+    entry->path = strdup(path);
+    if (entry->path == NULL) {
+        perror("Failed to duplicate program path");
+        exit(EXIT_FAILURE);
+    }
+    entry->hash = hash;
+    // コンパイル前に調べた状態で記録する (読んでいる間に書き換えられたら次の要求で読み直す)
+    entry->device = info.st_dev;
+    entry->inode = info.st_ino;
+    entry->size = info.st_size;
+    entry->mtime = info.st_mtim;
+    entry->program = program;
+    entry->refs = 1; // 呼び出し側
+    return insert_cached_program(entry);
+}
+
+// 全て送る (失敗したら false。クライアントが切断していても SIGPIPE は受けない)
+static bool send_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return true;
+}
+
+// 要求を受け取る (パスを path に入れ、添えられた出力先の記述子を返す。不正な要求なら -1)
+static int receive_request(int connection, char *path, size_t capacity) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { path, capacity };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do {
+        received = recvmsg(connection, &message, 0);
+    } while (received < 0 && errno == EINTR);
+    if (received <= 0) {
+        return -1;
+    }
+    int output_fd = -1;
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if (header != NULL && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS &&
+        header->cmsg_len == CMSG_LEN(sizeof(int))) {
+        memcpy(&output_fd, CMSG_DATA(header), sizeof(int));
+    }
+    if (output_fd < 0) {
+        return -1;
+    }
+
+    // パスが分かれて届いた場合は '\0' まで読む
+    size_t length = (size_t)received;
+    while (memchr(path, '\0', length) == NULL) {
+        if (length == capacity) {
+            close(output_fd);
+            return -1;
+        }
+        ssize_t more = recv(connection, path + length, capacity - length, 0);
+        if (more < 0 && errno == EINTR) {
+            continue;
+        }
+        if (more <= 0) {
+            close(output_fd);
+            return -1;
+        }
+        length += (size_t)more;
+    }
+    return output_fd;
+}
+
+// 一つの接続の要求を実行して応答する
+static void serve_connection(int connection) {
+    char path[PATH_MAX + 1];
+    int output_fd = receive_request(connection, path, sizeof(path));
+    if (output_fd < 0) {
+        return;
+    }
+
+    KappokStatus status;
+    char *error = NULL;
+    CachedProgram *entry = acquire_program(path, &status, &error);
+    if (entry != NULL) {
+        status = kappok_run(entry->program, output_fd, &error);
+        release_cached_program(entry);
+    }
+    close(output_fd); // 出力は応答より前に書き終えている
+
+    char code = (char)status;
+    if (send_all(connection, &code, 1) && error != NULL) {
+        send_all(connection, error, strlen(error));
+    }
+    free(error);
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        int connection = accept(listen_fd, NULL, NULL);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) {
+                continue;
+            }
+            perror("accept");
+            exit(EXIT_FAILURE);
+        }
+        serve_connection(connection);
+        close(connection);
+    }
+    return NULL;
+}
+
+static bool socket_address(const char *socket_path, struct sockaddr_un *address) {
+    if (strlen(socket_path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "エラー: ソケットのパス '%s' が長すぎます\n", socket_path);
+        return false;
+    }
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, socket_path);
+    return true;
+}
+
+// ソケットファイルを所有者だけが接続できる権限 (0600) で作る
+// (bind の後に chmod すると、その間に他の利用者が接続できてしまう)
+static int bind_private(int fd, const struct sockaddr_un *address) {
+    mode_t saved_mask = umask(0177);
+    int bound = bind(fd, (const struct sockaddr *)address, sizeof(*address));
+    int saved_errno = errno;
+    umask(saved_mask);
+    errno = saved_errno;
+    return bound;
+}
+
+// 待ち受けるソケットを作る (前回のサーバが残したソケットファイルは、応答がなければ消して作り直す)
+static int open_listen_socket(const char *socket_path) {
+    struct sockaddr_un address;
+    if (!socket_address(socket_path, &address)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    int bound = bind_private(fd, &address);
+    if (bound != 0 && errno == EADDRINUSE) {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool alive = probe >= 0 && connect(probe, (struct sockaddr *)&address, sizeof(address)) == 0;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (alive) {
+            fprintf(stderr, "エラー: '%s' では既にサーバが動いています\n", socket_path);
+            close(fd);
+            return -1;
+        }
+        unlink(socket_path);
+        bound = bind_private(fd, &address);
+    }
+    if (bound != 0) {
+        fprintf(stderr, "エラー: ソケット '%s' を作れません: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, SOMAXCONN) != 0) {
+        perror("listen");
+        close(fd);
+        unlink(socket_path);
+        return -1;
+    }
+    return fd;
+}
+
+// socket_path で待ち受け、workers 個 (0 なら CPU のコア数) のワーカーで要求を実行する
+// SIGINT か SIGTERM を受けるとソケットファイルを消して終了する。
+int run_server(const char *socket_path, int workers, const KappokOptions *options) {
+    server_runtime = kappok_runtime_new(options);
+    if (server_runtime == NULL) {
+        fprintf(stderr, "エラー: 実行時オブジェクトを作れません\n");
+        return 1;
+    }
+    listen_fd = open_listen_socket(socket_path);
+    if (listen_fd < 0) {
+        kappok_runtime_free(server_runtime);
+        return 1;
+    }
+    if (workers <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? (int)cores : 1;
+    }
+
+    // 終了の合図はこのスレッドだけが sigwait で受け取る (ワーカーは受け継いだマスクで塞ぐ)
+    signal(SIGPIPE, SIG_IGN); // 出力先のパイプの読み手が閉じても、書き込みの失敗として扱う
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
+    for (int i = 0; i < workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_main, NULL) != 0) {
+            perror("Failed to create server worker");
+            unlink(socket_path);
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread);
+    }
+
+    int received;
+    sigwait(&stop_signals, &received);
+    unlink(socket_path);
+    // 実行中の要求は待たない (クライアントは応答がないことを失敗として扱う)
+    return 0;
+}
+
+// --client: サーバに file の実行を頼み、コマンドラインと同じ出力と終了コードで終わる
+int run_client(const char *socket_path, const char *filename) {
+    char path[PATH_MAX];
+    if (realpath(filename, path) == NULL) {
+        printf("エラー: ファイル '%s' を開けません\n", filename);
+        return 1;
+    }
+    struct sockaddr_un address;
+    if (!socket_address(socket_path, &address)) {
+        return 1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "エラー: サーバ '%s' に接続できません\n", socket_path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    // パスに標準出力の記述子を添えて送る
+    int output_fd = STDOUT_FILENO;
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { path, strlen(path) + 1 };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &output_fd, sizeof(int));
+    ssize_t sent;
+    do {
+        sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0 || (size_t)sent < iov.iov_len) {
+        // 1 回で送れなかった残りはふつうに送る
+        if (sent < 0 || !send_all(fd, path + sent, iov.iov_len - (size_t)sent)) {
+            fprintf(stderr, "エラー: サーバ '%s' に要求を送れません\n", socket_path);
+            close(fd);
+            return 1;
+        }
+    }
+
+    // 応答 (状態とメッセージ) を終わりまで読む
+    size_t length = 0;
+    size_t capacity = 256;
+    char *response = malloc(capacity);
+    if (response == NULL) {
+        perror("Failed to allocate server response");
+        exit(EXIT_FAILURE);
+    }
+    for (;;) {
+        if (length == capacity) {
+            capacity *= 2;
+            char *grown = realloc(response, capacity);
+            if (grown == NULL) {
+                perror("Failed to allocate server response");
+                exit(EXIT_FAILURE);
+            }
+            response = grown;
+        }
+        ssize_t received = read(fd, response + length, capacity - length);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+        length += (size_t)received;
+    }
+    close(fd);
+    if (length == 0) {
+        fprintf(stderr, "エラー: サーバ '%s' から応答がありません\n", socket_path);
+        free(response);
+        return 1;
+    }
+
+    KappokStatus status = (KappokStatus)response[0];
+    const char *error = response + 1;
+    int error_length = (int)(length - 1);
+    int exit_code = 1;
+    switch (status) {
+        case KAPPOK_OK:
+            exit_code = 0;
+            break;
+        case KAPPOK_ERROR_SYNTAX:
+            // 構文エラーのコマンドラインは何も実行せずに改行だけを出力して成功する
+            fprintf(stderr, "%.*s\n", error_length, error);
+            printf("\n");
+            exit_code = 0;
+            break;
+        case KAPPOK_ERROR_IO:
+            printf("エラー: ファイル '%s' を開けません\n", filename);
+            break;
+        default:
+            fprintf(stderr, "%.*s\n", error_length, error);
+            break;
+    }
+    free(response);
+    return exit_code;
+}
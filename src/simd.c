@@ -0,0 +1,639 @@
+#include "kappok.h"
+#include <pthread.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define KAPPOK_SIMD_X86 1
+#endif
+
+// 配列演算のカーネル
+// 要素ごとの四則演算と、総和・内積・最小・最大の集約を、実行時に選んだ命令セットで行う。
+// x86-64 では SSE2 が常に使え、CPU が対応していれば AVX2 を使う。それ以外の環境はスカラーのループ。
+//
+// 集約は要素を SIMD_LANES 本のレーン (添字を SIMD_LANES で割った余り) に分けて集計し、
+// レーンを決まった順にまとめてから端数の要素を順に足す。どの命令セットでもレーンの分け方と
+// まとめる順が同じなので、double の総和や内積の丸めの結果はビット単位で一致する。
+// (積和演算 (FMA) は使わない。積を丸めてから足す点もスカラーのループと同じ)
+//
+// int の要素は64ビットで、加減算と乗算は2の補数で折り返す (スカラーの int 演算と同じ結果)。
+// 64ビット整数の乗算と double への変換は AVX2 にないので、命令セットによらずスカラーで行う。
+
+#define SIMD_LANES 16
+
+static SimdLevel max_level = SIMD_AVX2; // --simd で指定された上限
+static SimdLevel current_level = SIMD_SCALAR;
+static pthread_once_t detect_once = PTHREAD_ONCE_INIT;
+
+static void detect_simd_level(void) {
+    SimdLevel level = SIMD_SCALAR;
+#ifdef KAPPOK_SIMD_X86
+    level = SIMD_SSE2;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        level = SIMD_AVX2;
+    }
+#endif
+    current_level = (level < max_level) ? level : max_level;
+}
+
+// 使う命令セットの上限を決める (最初の配列演算より前に呼ぶ)
+void set_simd_level(SimdLevel level) {
+    max_level = level;
+}
+
+SimdLevel simd_level(void) {
+    pthread_once(&detect_once, detect_simd_level);
+    return current_level;
+}
+
+// --- スカラー ---
+
+static inline double double_op(ArrayOp op, double x, double y) {
+    switch (op) {
+        case ARRAY_OP_ADD: return x + y;
+        case ARRAY_OP_SUBTRACT: return x - y;
+        case ARRAY_OP_MULTIPLY: return x * y;
+        default: return x / y;
+    }
+}
+
+static inline long int_op(ArrayOp op, long x, long y) {
+    // 符号なしで計算して折り返しを定義された動作にする (除算は呼び出し側が扱う)
+    switch (op) {
+        case ARRAY_OP_ADD: return (long)((unsigned long)x + (unsigned long)y);
+        case ARRAY_OP_SUBTRACT: return (long)((unsigned long)x - (unsigned long)y);
+        default: return (long)((unsigned long)x * (unsigned long)y);
+    }
+}
+
+// 端数の要素と、ベクトル化しない命令セットの要素ごとの演算
+// a_step, b_step が 0 ならその側はスカラー (先頭の値を繰り返し使う)
+static void scalar_double_op(ArrayOp op, const double *a, size_t a_step, const double *b, size_t b_step,
+                             double *out, size_t start, size_t n) {
+    for (size_t i = start; i < n; i++) {
+        out[i] = double_op(op, a[i * a_step], b[i * b_step]);
+    }
+}
+
+static void scalar_int_op(ArrayOp op, const long *a, size_t a_step, const long *b, size_t b_step,
+                          long *out, size_t start, size_t n) {
+    for (size_t i = start; i < n; i++) {
+        out[i] = int_op(op, a[i * a_step], b[i * b_step]);
+    }
+}
+
+// レーンを隣同士から順にまとめる (どの命令セットでも同じ順)
+static double combine_double_lanes(double *lanes) {
+    for (int width = 1; width < SIMD_LANES; width *= 2) {
+        for (int i = 0; i < SIMD_LANES; i += 2 * width) {
+            lanes[i] += lanes[i + width];
+        }
+    }
+    return lanes[0];
+}
+
+// x が現在の値 m より小さい (maximum なら大きい) ときだけ置き換える
+// (SSE2/AVX2 の min/max 命令と同じ規則: どちらかが NaN なら m が残る)
+static inline double pick_extreme(double x, double m, bool maximum) {
+    return (maximum ? (x > m) : (x < m)) ? x : m;
+}
+
+static double combine_extreme_lanes(double *lanes, bool maximum) {
+    for (int width = 1; width < SIMD_LANES; width *= 2) {
+        for (int i = 0; i < SIMD_LANES; i += 2 * width) {
+            lanes[i] = pick_extreme(lanes[i + width], lanes[i], maximum);
+        }
+    }
+    return lanes[0];
+}
+
+static double scalar_double_sum(const double *a, size_t n) {
+    double lanes[SIMD_LANES] = { 0.0 };
+    size_t blocked = n - n % SIMD_LANES;
+    for (size_t i = 0; i < blocked; i += SIMD_LANES) {
+        for (int k = 0; k < SIMD_LANES; k++) {
+            lanes[k] += a[i + k];
+        }
+    }
+    double sum = combine_double_lanes(lanes);
+    for (size_t i = blocked; i < n; i++) {
+        sum += a[i];
+    }
+    return sum;
+}
+
+static double scalar_double_dot(const double *a, const double *b, size_t n) {
+    double lanes[SIMD_LANES] = { 0.0 };
+    size_t blocked = n - n % SIMD_LANES;
+    for (size_t i = 0; i < blocked; i += SIMD_LANES) {
+        for (int k = 0; k < SIMD_LANES; k++) {
+            lanes[k] += a[i + k] * b[i + k];
+        }
+    }
+    double sum = combine_double_lanes(lanes);
+    for (size_t i = blocked; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// 最小・最大: レーンは最初の SIMD_LANES 個の要素から始める (n >= SIMD_LANES の場合)
+static double scalar_double_extreme(const double *a, size_t n, bool maximum) {
+    bool has_nan = false;
+    double result;
+    size_t start;
+    if (n >= SIMD_LANES) {
+        double lanes[SIMD_LANES];
+        size_t blocked = n - n % SIMD_LANES;
+        for (int k = 0; k < SIMD_LANES; k++) {
+            lanes[k] = a[k];
+            has_nan = has_nan || (a[k] != a[k]);
+        }
+        for (size_t i = SIMD_LANES; i < blocked; i += SIMD_LANES) {
+            for (int k = 0; k < SIMD_LANES; k++) {
+                double x = a[i + k];
+                lanes[k] = pick_extreme(x, lanes[k], maximum);
+                has_nan = has_nan || (x != x);
+            }
+        }
+        result = combine_extreme_lanes(lanes, maximum);
+        start = blocked;
+    } else {
+        result = a[0];
+        has_nan = (a[0] != a[0]);
+        start = 1;
+    }
+    for (size_t i = start; i < n; i++) {
+        result = pick_extreme(a[i], result, maximum);
+        has_nan = has_nan || (a[i] != a[i]);
+    }
+    return has_nan ? NAN : result;
+}
+
+static long scalar_int_extreme(const long *a, size_t n, bool maximum) {
+    long result = a[0];
+    for (size_t i = 1; i < n; i++) {
+        if (maximum ? (a[i] > result) : (a[i] < result)) {
+            result = a[i];
+        }
+    }
+    return result;
+}
+
+#ifdef KAPPOK_SIMD_X86
+
+// --- SSE2 (2要素のベクトル) ---
+
+static inline __m128d sse2_double_op(ArrayOp op, __m128d x, __m128d y) {
+    switch (op) {
+        case ARRAY_OP_ADD: return _mm_add_pd(x, y);
+        case ARRAY_OP_SUBTRACT: return _mm_sub_pd(x, y);
+        case ARRAY_OP_MULTIPLY: return _mm_mul_pd(x, y);
+        default: return _mm_div_pd(x, y);
+    }
+}
+
+static void sse2_double_op_arrays(ArrayOp op, const double *a, size_t a_step, const double *b, size_t b_step,
+                                  double *out, size_t n) {
+    __m128d a_scalar = _mm_set1_pd(a[0]);
+    __m128d b_scalar = _mm_set1_pd(b[0]);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = a_step ? _mm_loadu_pd(a + i) : a_scalar;
+        __m128d y = b_step ? _mm_loadu_pd(b + i) : b_scalar;
+        _mm_storeu_pd(out + i, sse2_double_op(op, x, y));
+    }
+    scalar_double_op(op, a, a_step, b, b_step, out, i, n);
+}
+
+static void sse2_int_op_arrays(ArrayOp op, const long *a, size_t a_step, const long *b, size_t b_step,
+                               long *out, size_t n) {
+    if (op == ARRAY_OP_MULTIPLY) {
+        scalar_int_op(op, a, a_step, b, b_step, out, 0, n);
+        return;
+    }
+    __m128i a_scalar = _mm_set1_epi64x(a[0]);
+    __m128i b_scalar = _mm_set1_epi64x(b[0]);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i x = a_step ? _mm_loadu_si128((const __m128i *)(a + i)) : a_scalar;
+        __m128i y = b_step ? _mm_loadu_si128((const __m128i *)(b + i)) : b_scalar;
+        __m128i r = (op == ARRAY_OP_ADD) ? _mm_add_epi64(x, y) : _mm_sub_epi64(x, y);
+        _mm_storeu_si128((__m128i *)(out + i), r);
+    }
+    scalar_int_op(op, a, a_step, b, b_step, out, i, n);
+}
+
+// 16本のレーンを8本のレジスタ (各2要素) に持つ
+static double sse2_double_sum(const double *a, const double *b, size_t n) {
+    __m128d acc[SIMD_LANES / 2];
+    for (int r = 0; r < SIMD_LANES / 2; r++) {
+        acc[r] = _mm_setzero_pd();
+    }
+    size_t blocked = n - n % SIMD_LANES;
+    for (size_t i = 0; i < blocked; i += SIMD_LANES) {
+        for (int r = 0; r < SIMD_LANES / 2; r++) {
+            __m128d x = _mm_loadu_pd(a + i + 2 * r);
+            if (b != NULL) {
+                x = _mm_mul_pd(x, _mm_loadu_pd(b + i + 2 * r));
+            }
+            acc[r] = _mm_add_pd(acc[r], x);
+        }
+    }
+    double lanes[SIMD_LANES];
+    for (int r = 0; r < SIMD_LANES / 2; r++) {
+        _mm_storeu_pd(lanes + 2 * r, acc[r]);
+    }
+    double sum = combine_double_lanes(lanes);
+    for (size_t i = blocked; i < n; i++) {
+        sum += (b != NULL) ? a[i] * b[i] : a[i];
+    }
+    return sum;
+}
+
+static double sse2_double_extreme(const double *a, size_t n, bool maximum) {
+    if (n < SIMD_LANES) {
+        return scalar_double_extreme(a, n, maximum);
+    }
+    __m128d acc[SIMD_LANES / 2];
+    __m128d nan_mask = _mm_setzero_pd();
+    for (int r = 0; r < SIMD_LANES / 2; r++) {
+        acc[r] = _mm_loadu_pd(a + 2 * r);
+        nan_mask = _mm_or_pd(nan_mask, _mm_cmpunord_pd(acc[r], acc[r]));
+    }
+    size_t blocked = n - n % SIMD_LANES;
+    for (size_t i = SIMD_LANES; i < blocked; i += SIMD_LANES) {
+        for (int r = 0; r < SIMD_LANES / 2; r++) {
+            __m128d x = _mm_loadu_pd(a + i + 2 * r);
+            acc[r] = maximum ? _mm_max_pd(x, acc[r]) : _mm_min_pd(x, acc[r]);
+            nan_mask = _mm_or_pd(nan_mask, _mm_cmpunord_pd(x, x));
+        }
+    }
+    double lanes[SIMD_LANES];
+    for (int r = 0; r < SIMD_LANES / 2; r++) {
+        _mm_storeu_pd(lanes + 2 * r, acc[r]);
+    }
+    bool has_nan = _mm_movemask_pd(nan_mask) != 0;
+    double result = combine_extreme_lanes(lanes, maximum);
+    for (size_t i = blocked; i < n; i++) {
+        result = pick_extreme(a[i], result, maximum);
+        has_nan = has_nan || (a[i] != a[i]);
+    }
+    return has_nan ? NAN : result;
+}
+
+static bool sse2_double_has_zero(const double *a, size_t n) {
+    __m128d zero = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        if (_mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(a + i), zero)) != 0) {
+            return true;
+        }
+    }
+    return i < n && a[i] == 0.0;
+}
+
+static long sse2_int_sum(const long *a, size_t n) {
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_epi64(acc0, _mm_loadu_si128((const __m128i *)(a + i)));
+        acc1 = _mm_add_epi64(acc1, _mm_loadu_si128((const __m128i *)(a + i + 2)));
+    }
+    long lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+    unsigned long sum = (unsigned long)lanes[0] + (unsigned long)lanes[1];
+    for (; i < n; i++) {
+        sum += (unsigned long)a[i];
+    }
+    return (long)sum;
+}
+
+// --- AVX2 (4要素のベクトル) ---
+// 関数ごとに target 属性で AVX2 の命令を許可し、CPU が対応しているときだけ呼ぶ。
+
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+
+static AVX2_FUNCTION inline __m256d avx2_double_op(ArrayOp op, __m256d x, __m256d y) {
+    switch (op) {
+        case ARRAY_OP_ADD: return _mm256_add_pd(x, y);
+        case ARRAY_OP_SUBTRACT: return _mm256_sub_pd(x, y);
+        case ARRAY_OP_MULTIPLY: return _mm256_mul_pd(x, y);
+        default: return _mm256_div_pd(x, y);
+    }
+}
+
+static AVX2_FUNCTION void avx2_double_op_arrays(ArrayOp op, const double *a, size_t a_step, const double *b, size_t b_step,
+                                                double *out, size_t n) {
+    __m256d a_scalar = _mm256_set1_pd(a[0]);
+    __m256d b_scalar = _mm256_set1_pd(b[0]);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = a_step ? _mm256_loadu_pd(a + i) : a_scalar;
+        __m256d y = b_step ? _mm256_loadu_pd(b + i) : b_scalar;
+        _mm256_storeu_pd(out + i, avx2_double_op(op, x, y));
+    }
+    scalar_double_op(op, a, a_step, b, b_step, out, i, n);
+}
+
+static AVX2_FUNCTION void avx2_int_op_arrays(ArrayOp op, const long *a, size_t a_step, const long *b, size_t b_step,
+                                             long *out, size_t n) {
+    if (op == ARRAY_OP_MULTIPLY) {
+        scalar_int_op(op, a, a_step, b, b_step, out, 0, n);
+        return;
+    }
+    __m256i a_scalar = _mm256_set1_epi64x(a[0]);
+    __m256i b_scalar = _mm256_set1_epi64x(b[0]);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = a_step ? _mm256_loadu_si256((const __m256i *)(a + i)) : a_scalar;
+        __m256i y = b_step ? _mm256_loadu_si256((const __m256i *)(b + i)) : b_scalar;
+        __m256i r = (op == ARRAY_OP_ADD) ? _mm256_add_epi64(x, y) : _mm256_sub_epi64(x, y);
+        _mm256_storeu_si256((__m256i *)(out + i), r);
+    }
+    scalar_int_op(op, a, a_step, b, b_step, out, i, n);
+}
+
+// 16本のレーンを4本のレジスタ (各4要素) に持つ
+static AVX2_FUNCTION double avx2_double_sum(const double *a, const double *b, size_t n) {
+    __m256d acc[SIMD_LANES / 4];
+    for (int r = 0; r < SIMD_LANES / 4; r++) {
+        acc[r] = _mm256_setzero_pd();
+    }
+    size_t blocked = n - n % SIMD_LANES;
+    for (size_t i = 0; i < blocked; i += SIMD_LANES) {
+        for (int r = 0; r < SIMD_LANES / 4; r++) {
+            __m256d x = _mm256_loadu_pd(a + i + 4 * r);
+            if (b != NULL) {
+                x = _mm256_mul_pd(x, _mm256_loadu_pd(b + i + 4 * r));
+            }
+            acc[r] = _mm256_add_pd(acc[r], x);
+        }
+    }
+    double lanes[SIMD_LANES];
+    for (int r = 0; r < SIMD_LANES / 4; r++) {
+        _mm256_storeu_pd(lanes + 4 * r, acc[r]);
+    }
+    double sum = combine_double_lanes(lanes);
+    for (size_t i = blocked; i < n; i++) {
+        sum += (b != NULL) ? a[i] * b[i] : a[i];
+    }
+    return sum;
+}
+
+static AVX2_FUNCTION double avx2_double_extreme(const double *a, size_t n, bool maximum) {
+    if (n < SIMD_LANES) {
+        return scalar_double_extreme(a, n, maximum);
+    }
+    __m256d acc[SIMD_LANES / 4];
+    __m256d nan_mask = _mm256_setzero_pd();
+    for (int r = 0; r < SIMD_LANES / 4; r++) {
+        acc[r] = _mm256_loadu_pd(a + 4 * r);
+        nan_mask = _mm256_or_pd(nan_mask, _mm256_cmp_pd(acc[r], acc[r], _CMP_UNORD_Q));
+    }
+    size_t blocked = n - n % SIMD_LANES;
+    for (size_t i = SIMD_LANES; i < blocked; i += SIMD_LANES) {
+        for (int r = 0; r < SIMD_LANES / 4; r++) {
+            __m256d x = _mm256_loadu_pd(a + i + 4 * r);
+            acc[r] = maximum ? _mm256_max_pd(x, acc[r]) : _mm256_min_pd(x, acc[r]);
+            nan_mask = _mm256_or_pd(nan_mask, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+        }
+    }
+    double lanes[SIMD_LANES];
+    for (int r = 0; r < SIMD_LANES / 4; r++) {
+        _mm256_storeu_pd(lanes + 4 * r, acc[r]);
+    }
+    bool has_nan = _mm256_movemask_pd(nan_mask) != 0;
+    double result = combine_extreme_lanes(lanes, maximum);
+    for (size_t i = blocked; i < n; i++) {
+        result = pick_extreme(a[i], result, maximum);
+        has_nan = has_nan || (a[i] != a[i]);
+    }
+    return has_nan ? NAN : result;
+}
+
+static AVX2_FUNCTION bool avx2_double_has_zero(const double *a, size_t n) {
+    __m256d zero = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        if (_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(a + i), zero, _CMP_EQ_OQ)) != 0) {
+            return true;
+        }
+    }
+    for (; i < n; i++) {
+        if (a[i] == 0.0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static AVX2_FUNCTION long avx2_int_sum(const long *a, size_t n) {
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_epi64(acc0, _mm256_loadu_si256((const __m256i *)(a + i)));
+        acc1 = _mm256_add_epi64(acc1, _mm256_loadu_si256((const __m256i *)(a + i + 4)));
+    }
+    long lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+    unsigned long sum = (unsigned long)lanes[0] + (unsigned long)lanes[1] + (unsigned long)lanes[2] + (unsigned long)lanes[3];
+    for (; i < n; i++) {
+        sum += (unsigned long)a[i];
+    }
+    return (long)sum;
+}
+
+static AVX2_FUNCTION long avx2_int_extreme(const long *a, size_t n, bool maximum) {
+    if (n < 4) {
+        return scalar_int_extreme(a, n, maximum);
+    }
+    __m256i acc = _mm256_loadu_si256((const __m256i *)a);
+    size_t i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i take = maximum ? _mm256_cmpgt_epi64(x, acc) : _mm256_cmpgt_epi64(acc, x);
+        acc = _mm256_blendv_epi8(acc, x, take);
+    }
+    long lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    long result = scalar_int_extreme(lanes, 4, maximum);
+    for (; i < n; i++) {
+        if (maximum ? (a[i] > result) : (a[i] < result)) {
+            result = a[i];
+        }
+    }
+    return result;
+}
+
+#endif // KAPPOK_SIMD_X86
+
+// --- 命令セットの選択 ---
+
+static void double_op_dispatch(ArrayOp op, const double *a, size_t a_step, const double *b, size_t b_step,
+                               double *out, size_t n) {
+    switch (simd_level()) {
+#ifdef KAPPOK_SIMD_X86
+        case SIMD_AVX2:
+            avx2_double_op_arrays(op, a, a_step, b, b_step, out, n);
+            return;
+        case SIMD_SSE2:
+            sse2_double_op_arrays(op, a, a_step, b, b_step, out, n);
+            return;
+#endif
+        default:
+            scalar_double_op(op, a, a_step, b, b_step, out, 0, n);
+            return;
+    }
+}
+
+static void int_op_dispatch(ArrayOp op, const long *a, size_t a_step, const long *b, size_t b_step,
+                            long *out, size_t n) {
+    switch (simd_level()) {
+#ifdef KAPPOK_SIMD_X86
+        case SIMD_AVX2:
+            avx2_int_op_arrays(op, a, a_step, b, b_step, out, n);
+            return;
+        case SIMD_SSE2:
+            sse2_int_op_arrays(op, a, a_step, b, b_step, out, n);
+            return;
+#endif
+        default:
+            scalar_int_op(op, a, a_step, b, b_step, out, 0, n);
+            return;
+    }
+}
+
+// out[i] = a[i] op b[i] (out は a または b と同じ領域でもよい)
+void simd_double_op(ArrayOp op, const double *a, const double *b, double *out, size_t n) {
+    if (n > 0) {
+        double_op_dispatch(op, a, 1, b, 1, out, n);
+    }
+}
+
+// out[i] = a[i] op scalar (scalar_left なら scalar op a[i])
+void simd_double_op_scalar(ArrayOp op, const double *a, double scalar, double *out, size_t n, bool scalar_left) {
+    if (n == 0) {
+        return;
+    }
+    if (scalar_left) {
+        double_op_dispatch(op, &scalar, 0, a, 1, out, n);
+    } else {
+        double_op_dispatch(op, a, 1, &scalar, 0, out, n);
+    }
+}
+
+// int の加算・減算・乗算 (除算は 0 の検査が要るので呼び出し側で行う)
+void simd_int_op(ArrayOp op, const long *a, const long *b, long *out, size_t n) {
+    if (n > 0) {
+        int_op_dispatch(op, a, 1, b, 1, out, n);
+    }
+}
+
+void simd_int_op_scalar(ArrayOp op, const long *a, long scalar, long *out, size_t n, bool scalar_left) {
+    if (n == 0) {
+        return;
+    }
+    if (scalar_left) {
+        int_op_dispatch(op, &scalar, 0, a, 1, out, n);
+    } else {
+        int_op_dispatch(op, a, 1, &scalar, 0, out, n);
+    }
+}
+
+// 0 (-0.0 を含む) の要素があるか (除算の前の検査)
+bool simd_double_has_zero(const double *a, size_t n) {
+    switch (simd_level()) {
+#ifdef KAPPOK_SIMD_X86
+        case SIMD_AVX2:
+            return avx2_double_has_zero(a, n);
+        case SIMD_SSE2:
+            return sse2_double_has_zero(a, n);
+#endif
+        default:
+            for (size_t i = 0; i < n; i++) {
+                if (a[i] == 0.0) {
+                    return true;
+                }
+            }
+            return false;
+    }
+}
+
+double simd_double_sum(const double *a, size_t n) {
+    switch (simd_level()) {
+#ifdef KAPPOK_SIMD_X86
+        case SIMD_AVX2:
+            return avx2_double_sum(a, NULL, n);
+        case SIMD_SSE2:
+            return sse2_double_sum(a, NULL, n);
+#endif
+        default:
+            return scalar_double_sum(a, n);
+    }
+}
+
+double simd_double_dot(const double *a, const double *b, size_t n) {
+    switch (simd_level()) {
+#ifdef KAPPOK_SIMD_X86
+        case SIMD_AVX2:
+            return avx2_double_sum(a, b, n);
+        case SIMD_SSE2:
+            return sse2_double_sum(a, b, n);
+#endif
+        default:
+            return scalar_double_dot(a, b, n);
+    }
+}
+
+// 最小値 (maximum なら最大値)。NaN の要素があれば NaN を返す。n は 1 以上
+double simd_double_extreme(const double *a, size_t n, bool maximum) {
+    switch (simd_level()) {
+#ifdef KAPPOK_SIMD_X86
+        case SIMD_AVX2:
+            return avx2_double_extreme(a, n, maximum);
+        case SIMD_SSE2:
+            return sse2_double_extreme(a, n, maximum);
+#endif
+        default:
+            return scalar_double_extreme(a, n, maximum);
+    }
+}
+
+long simd_int_sum(const long *a, size_t n) {
+    switch (simd_level()) {
+#ifdef KAPPOK_SIMD_X86
+        case SIMD_AVX2:
+            return avx2_int_sum(a, n);
+        case SIMD_SSE2:
+            return sse2_int_sum(a, n);
+#endif
+        default: {
+            unsigned long sum = 0;
+            for (size_t i = 0; i < n; i++) {
+                sum += (unsigned long)a[i];
+            }
+            return (long)sum;
+        }
+    }
+}
+
+long simd_int_dot(const long *a, const long *b, size_t n) {
+    unsigned long sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += (unsigned long)a[i] * (unsigned long)b[i];
+    }
+    return (long)sum;
+}
+
+// n は 1 以上
+long simd_int_extreme(const long *a, size_t n, bool maximum) {
+#ifdef KAPPOK_SIMD_X86
+    if (simd_level() == SIMD_AVX2) {
+        return avx2_int_extreme(a, n, maximum);
+    }
+#endif
+    return scalar_int_extreme(a, n, maximum);
+}
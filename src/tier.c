@@ -0,0 +1,154 @@
+#include "kappok.h"
+#include <pthread.h>
+
+// 段階的実行
+// 関数は最初は元のASTのまま tree walker で実行する (コンパイルのコストはゼロ)。
+// 呼び出し回数が閾値に達した関数だけを最適化スレッドで最適化し、完成した本体をアトミックに公開する。
+// 実行中のスレッドは次の呼び出しから最適化済みの本体を使う。
+// for ループの周回も呼び出しと同じように数えるので、ループで時間を使う関数は呼び出しが少なくても最適化される。
+//
+// 最適化スレッドはプロセスに1つだけで、最初に関数が閾値に達したときに起動し、キューに入った関数を
+// 順に最適化する。プログラムを解放するときは、そのプログラムの関数の最適化だけを待つ (tier_wait_for_compiles)。
+
+static int tier_threshold = TIER_DEFAULT_THRESHOLD;
+
+// 最適化を待っている関数
+typedef struct TierJob {
+    ASTNode *func_def;
+    struct TierJob *next;
+} TierJob;
+
+static pthread_mutex_t tier_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tier_work = PTHREAD_COND_INITIALIZER; // キューに関数が入った
+static pthread_cond_t tier_done = PTHREAD_COND_INITIALIZER; // 関数の最適化が終わった
+static TierJob *queue_head = NULL;
+static TierJob *queue_tail = NULL;
+static ASTNode *compiling = NULL; // 最適化スレッドが最適化中の関数
+static bool compiler_started = false;
+
+// 0 以下なら段階的実行を無効にする (常に元のASTを実行する)
+void set_tier_threshold(int threshold) {
+    tier_threshold = threshold;
+}
+
+static void compile_function(ASTNode *func_def) {
+    int frame_size;
+    ASTNode *optimized = optimize_function_body(func_def, &frame_size);
+    func_def->data.func_def.optimized_frame_size = frame_size; // 本体の公開 (release) より前に書く
+    __atomic_store_n(&func_def->data.func_def.optimized_body, optimized, __ATOMIC_RELEASE);
+    __atomic_store_n(&func_def->data.func_def.tier_state, TIER_OPTIMIZED, __ATOMIC_RELEASE);
+}
+
+static void *compiler_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&tier_lock);
+    for (;;) {
+        while (queue_head == NULL) {
+            pthread_cond_wait(&tier_work, &tier_lock);
+        }
+        TierJob *job = queue_head;
+        queue_head = job->next;
+        if (queue_head == NULL) {
+            queue_tail = NULL;
+        }
+        ASTNode *func_def = job->func_def;
+        compiling = func_def;
+        pthread_mutex_unlock(&tier_lock);
+        free(job);
+
+        compile_function(func_def);
+
+        pthread_mutex_lock(&tier_lock);
+        compiling = NULL;
+        pthread_cond_broadcast(&tier_done);
+    }
+    return NULL;
+}
+
+// 関数を最適化スレッドのキューに入れる (スレッドを作れない環境ではその場で最適化する)
+static void enqueue_compile(ASTNode *func_def) {
+    pthread_mutex_lock(&tier_lock);
+    if (!compiler_started) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, compiler_main, NULL) != 0) {
+            pthread_mutex_unlock(&tier_lock);
+            compile_function(func_def);
+            return;
+        }
+        pthread_detach(thread);
+        compiler_started = true;
+    }
+    TierJob *job = malloc(sizeof(TierJob));
+    if (job == NULL) {
+        perror("Failed to allocate tier job");
+        exit(EXIT_FAILURE);
+    }
+    job->func_def = func_def;
+    job->next = NULL;
+    if (queue_tail != NULL) {
+        queue_tail->next = job;
+    } else {
+        queue_head = job;
+    }
+    queue_tail = job;
+    pthread_cond_signal(&tier_work);
+    pthread_mutex_unlock(&tier_lock);
+}
+
+// 呼び出し回数を数え、閾値に達したら最適化を始める
+void tier_count_call(ASTNode *func_def) {
+    tier_count_iterations(func_def, 1);
+}
+
+// ループの周回を iterations 回分数え、閾値に達したら最適化を始める
+void tier_count_iterations(ASTNode *func_def, unsigned int iterations) {
+    if (tier_threshold <= 0 || __atomic_load_n(&func_def->data.func_def.tier_state, __ATOMIC_RELAXED) != TIER_COLD) {
+        return;
+    }
+    unsigned int count = __atomic_add_fetch(&func_def->data.func_def.call_count, iterations, __ATOMIC_RELAXED);
+    if (count < (unsigned int)tier_threshold) {
+        return;
+    }
+    int expected = TIER_COLD;
+    if (!__atomic_compare_exchange_n(&func_def->data.func_def.tier_state, &expected, TIER_COMPILING,
+                                     false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return; // 他のスレッドが既に最適化を始めた
+    }
+    enqueue_compile(func_def);
+}
+
+// func_def が program_node のトップレベルの関数定義か
+static bool program_defines(const ASTNode *program_node, const ASTNode *func_def) {
+    for (int i = 0; i < program_node->data.program.num_statements; i++) {
+        if (program_node->data.program.statements[i] == func_def) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// program_node の関数がキューにあるか最適化中なら true (tier_lock を取って呼ぶ)
+static bool program_has_compiles(const ASTNode *program_node) {
+    if (compiling != NULL && program_defines(program_node, compiling)) {
+        return true;
+    }
+    for (TierJob *job = queue_head; job != NULL; job = job->next) {
+        if (program_defines(program_node, job->func_def)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// program_node の関数の最適化が全て終わるのを待つ (ASTを解放する前に呼ぶ)
+// 他のプログラムの関数の最適化は待たない。
+void tier_wait_for_compiles(const ASTNode *program_node) {
+    if (program_node == NULL || program_node->type != NODE_PROGRAM) {
+        return;
+    }
+    pthread_mutex_lock(&tier_lock);
+    while (program_has_compiles(program_node)) {
+        pthread_cond_wait(&tier_done, &tier_lock);
+    }
+    pthread_mutex_unlock(&tier_lock);
+}
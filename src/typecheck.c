@@ -0,0 +1,732 @@
+#include "kappok.h"
+
+// 型検査
+// main を実行する前に全ての関数本体の式の型を宣言から推論し、型エラーを報告する。
+// 型が確定した式は特殊化されたノード (int の加算、double の加算、int→double の変換など) に
+// 書き換えるので、型の正しいコードでは実行時に型による分岐をしない。
+//
+// 関数本体は分岐を含まない文の並びなので、スロットごとの型を文の順にたどれば
+// 各時点の変数の型は正確に分かる (同名の再宣言で型が変わってもよい)。
+// for 文の本体は一度だけ検査し、繰り返しても変数の型が変わらないことを確かめる。
+// 型が静的に分からない式 (再帰呼び出しの結果、戻り値の型のないホスト関数など) は
+// VALUE_TYPE_UNKNOWN として扱い、そこから先は従来どおり実行時に検査する。
+
+// 検査全体の状態
+// 検査中の作業領域は確保したものを覚えておき、compile_error で打ち切られたら
+// typecheck_program がまとめて解放する (埋め込み API はエラーの後も同じプロセスで続く)。
+typedef struct TypeChecker {
+    ASTNode *program_node;
+    Environment *globals;
+    void **buffers; // 確保して、まだ解放していない作業領域
+    int num_buffers;
+    int capacity_buffers;
+} TypeChecker;
+
+// 関数ごとの検査状態
+typedef struct CheckScope {
+    ASTNode *func_def;
+    TypeChecker *checker;
+    Environment *globals;
+    ValueType *slot_types;
+    bool *declared;
+    bool *constant; // const で宣言された変数 (代入できない)
+    bool yielded;         // 本体に検査済みの yield がある
+    ValueType yield_type; // それまでの yield の値の型 (型が食い違えば VALUE_TYPE_UNKNOWN)
+} CheckScope;
+
+static ValueType check_function(ASTNode *func_def, TypeChecker *checker);
+static ValueType check_expression(ASTNode **node_ref, CheckScope *scope);
+
+// 0 で埋めた作業領域を確保する (check_free で解放する)
+static void *check_alloc(TypeChecker *checker, size_t count, size_t size) {
+    if (checker->num_buffers == checker->capacity_buffers) {
+        int new_capacity = (checker->capacity_buffers == 0) ? 16 : checker->capacity_buffers * 2;
+        void **buffers = realloc(checker->buffers, sizeof(void *) * new_capacity);
+        if (buffers == NULL) {
+            perror("Failed to reallocate type check buffers");
+            exit(EXIT_FAILURE);
+        }
+        checker->buffers = buffers;
+        checker->capacity_buffers = new_capacity;
+    }
+    void *buffer = calloc(count > 0 ? count : 1, size);
+    if (buffer == NULL) {
+        perror("Failed to allocate type check buffer");
+        exit(EXIT_FAILURE);
+    }
+    checker->buffers[checker->num_buffers++] = buffer;
+    return buffer;
+}
+
+static void check_free(TypeChecker *checker, void *buffer) {
+    // 作業領域は確保と逆の順に解放することが多いので後ろから探す
+    for (int i = checker->num_buffers - 1; i >= 0; i--) {
+        if (checker->buffers[i] == buffer) {
+            checker->buffers[i] = checker->buffers[--checker->num_buffers];
+            break;
+        }
+    }
+    free(buffer);
+}
+
+const char *value_type_name(ValueType type) {
+    switch (type) {
+        case VALUE_TYPE_INT: return "int";
+        case VALUE_TYPE_STR: return "str";
+        case VALUE_TYPE_DOUBLE: return "double";
+        case VALUE_TYPE_BOOL: return "bool";
+        case VALUE_TYPE_VOID: return "void";
+        case VALUE_TYPE_FUNCTION: return "function";
+        case VALUE_TYPE_INT_ARRAY: return "int[]";
+        case VALUE_TYPE_DOUBLE_ARRAY: return "double[]";
+        case VALUE_TYPE_MAT: return "mat";
+        case VALUE_TYPE_FUTURE: return "future";
+        case VALUE_TYPE_GENERATOR: return "generator";
+        default: return "unknown";
+    }
+}
+
+// 宣言型 declared の変数 (引数) に type 型の値を入れられるか
+// 実行時の変換規則と同じ: int と bool は相互に、int と bool は double に変換できる
+bool is_assignable_type(ValueType declared, ValueType type) {
+    switch (declared) {
+        case VALUE_TYPE_INT:
+        case VALUE_TYPE_BOOL:
+            return type == VALUE_TYPE_INT || type == VALUE_TYPE_BOOL;
+        case VALUE_TYPE_DOUBLE:
+            return type == VALUE_TYPE_DOUBLE || type == VALUE_TYPE_INT || type == VALUE_TYPE_BOOL;
+        case VALUE_TYPE_STR:
+            return type == VALUE_TYPE_STR;
+        case VALUE_TYPE_INT_ARRAY:
+            return type == VALUE_TYPE_INT_ARRAY;
+        case VALUE_TYPE_DOUBLE_ARRAY:
+            return type == VALUE_TYPE_DOUBLE_ARRAY || type == VALUE_TYPE_INT_ARRAY;
+        case VALUE_TYPE_MAT:
+            return type == VALUE_TYPE_MAT;
+        case VALUE_TYPE_FUTURE:
+            return type == VALUE_TYPE_FUTURE;
+        case VALUE_TYPE_GENERATOR:
+            return type == VALUE_TYPE_GENERATOR;
+        default:
+            return false;
+    }
+}
+
+static bool is_array_type(ValueType type) {
+    return type == VALUE_TYPE_INT_ARRAY || type == VALUE_TYPE_DOUBLE_ARRAY;
+}
+
+// 配列の要素の型 (配列でなければその型のまま)
+static ValueType element_type_of(ValueType type) {
+    switch (type) {
+        case VALUE_TYPE_INT_ARRAY: return VALUE_TYPE_INT;
+        case VALUE_TYPE_DOUBLE_ARRAY: return VALUE_TYPE_DOUBLE;
+        default: return type;
+    }
+}
+
+// 式を宣言型に合わせる (型が違えば変換ノードで包む)
+static void convert_expression(ASTNode **node_ref, ValueType from, ValueType to) {
+    if (from == to) {
+        return;
+    }
+    ASTNode *node = *node_ref;
+    if (node->type == NODE_ARRAY_LITERAL && to == VALUE_TYPE_DOUBLE_ARRAY) {
+        // 配列リテラルは配列ごと変換せず、要素を double で作る
+        for (int i = 0; i < node->data.array_literal.num_elements; i++) {
+            convert_expression(&node->data.array_literal.elements[i], VALUE_TYPE_INT, VALUE_TYPE_DOUBLE);
+        }
+        node->data.array_literal.element_type = VALUE_TYPE_DOUBLE;
+        return;
+    }
+    ASTNode *convert = create_ast_node(NODE_CONVERT, (*node_ref)->line);
+    convert->data.convert.operand = *node_ref;
+    convert->data.convert.from = from;
+    convert->data.convert.to = to;
+    *node_ref = convert;
+}
+
+// 四則演算の型を決め、型が確定していれば特殊化したノードに書き換える
+static ValueType check_binary(ASTNode *node, CheckScope *scope) {
+    ValueType left = check_expression(&node->data.binary_expr.left, scope);
+    ValueType right = check_expression(&node->data.binary_expr.right, scope);
+    if (left == VALUE_TYPE_UNKNOWN || right == VALUE_TYPE_UNKNOWN) {
+        return VALUE_TYPE_UNKNOWN; // 実行時に検査する
+    }
+
+    if (node->type == NODE_ADD && left == VALUE_TYPE_STR && right == VALUE_TYPE_STR) {
+        node->type = NODE_CONCAT;
+        return VALUE_TYPE_STR;
+    }
+
+    if (is_array_type(left) || is_array_type(right)) {
+        // 配列の演算は要素ごとにスカラーと同じ規則を当てはめる (ノードは実行時に配列を扱う汎用のまま)
+        ValueType left_element = element_type_of(left);
+        ValueType right_element = element_type_of(right);
+        bool left_element_numeric = (left_element == VALUE_TYPE_INT || left_element == VALUE_TYPE_BOOL || left_element == VALUE_TYPE_DOUBLE);
+        bool right_element_numeric = (right_element == VALUE_TYPE_INT || right_element == VALUE_TYPE_BOOL || right_element == VALUE_TYPE_DOUBLE);
+        if ((left_element == VALUE_TYPE_DOUBLE || right_element == VALUE_TYPE_DOUBLE) && left_element_numeric && right_element_numeric) {
+            return VALUE_TYPE_DOUBLE_ARRAY;
+        }
+        if (left_element == VALUE_TYPE_INT && right_element == VALUE_TYPE_INT) {
+            return VALUE_TYPE_INT_ARRAY;
+        }
+        compile_error(node->line, "算術演算子に互換性のない型です。");
+    }
+
+    bool left_numeric = (left == VALUE_TYPE_INT || left == VALUE_TYPE_BOOL || left == VALUE_TYPE_DOUBLE);
+    bool right_numeric = (right == VALUE_TYPE_INT || right == VALUE_TYPE_BOOL || right == VALUE_TYPE_DOUBLE);
+    if ((left == VALUE_TYPE_DOUBLE || right == VALUE_TYPE_DOUBLE) && left_numeric && right_numeric) {
+        // どちらかが double なら、もう一方 (int, bool) を double に広げる
+        convert_expression(&node->data.binary_expr.left, left, VALUE_TYPE_DOUBLE);
+        convert_expression(&node->data.binary_expr.right, right, VALUE_TYPE_DOUBLE);
+        switch (node->type) {
+            case NODE_ADD: node->type = NODE_ADD_DOUBLE; break;
+            case NODE_SUBTRACT: node->type = NODE_SUBTRACT_DOUBLE; break;
+            case NODE_MULTIPLY: node->type = NODE_MULTIPLY_DOUBLE; break;
+            default: node->type = NODE_DIVIDE_DOUBLE; break;
+        }
+        return VALUE_TYPE_DOUBLE;
+    }
+    if (left == VALUE_TYPE_INT && right == VALUE_TYPE_INT) {
+        switch (node->type) {
+            case NODE_ADD: node->type = NODE_ADD_INT; break;
+            case NODE_SUBTRACT: node->type = NODE_SUBTRACT_INT; break;
+            case NODE_MULTIPLY: node->type = NODE_MULTIPLY_INT; break;
+            default: node->type = NODE_DIVIDE_INT; break;
+        }
+        return VALUE_TYPE_INT;
+    }
+
+    compile_error(node->line, "算術演算子に互換性のない型です。");
+}
+
+// parallel_map(関数, 配列) の結果の型を関数の戻り値の型から求める
+// 関数が静的に分かれば、引数の個数と型、戻り値の型、純粋であることをここで確かめる。
+static ValueType check_parallel_map(ASTNode *node, CheckScope *scope, const ValueType *arg_types) {
+    ASTNode *function = node->data.func_call.arguments[0];
+    if (function->type != NODE_IDENTIFIER_EXPR || function->data.identifier_expr.slot >= 0) {
+        return VALUE_TYPE_UNKNOWN;
+    }
+    SymbolEntry *entry = get_symbol_hashed(scope->globals, function->data.identifier_expr.name, function->data.identifier_expr.name_hash);
+    if (entry == NULL || VAL_TYPE(entry->value) != VALUE_TYPE_FUNCTION) {
+        return VALUE_TYPE_UNKNOWN;
+    }
+    ASTNode *func_def = AS_FUNC(entry->value);
+    const char *func_name = func_def->data.func_def.name;
+    if (func_def->data.func_def.num_parameters != 1) {
+        compile_error(node->line, "parallel_map に渡す関数 '%s' は1つの引数を取らなければなりません。", func_name);
+    }
+    ASTNode *param = func_def->data.func_def.parameters[0];
+    ValueType element = (arg_types[1] == VALUE_TYPE_DOUBLE_ARRAY) ? VALUE_TYPE_DOUBLE
+        : (arg_types[1] == VALUE_TYPE_INT_ARRAY) ? VALUE_TYPE_INT : VALUE_TYPE_UNKNOWN;
+    if (element != VALUE_TYPE_UNKNOWN && !is_assignable_type(param->data.var_decl.decl_type, element)) {
+        compile_error(node->line, "parallel_map に渡す関数 '%s' の '%s' 型の引数 '%s' に '%s' の要素を渡せません。",
+                func_name, param->data.var_decl.type_name, param->data.var_decl.name, value_type_name(arg_types[1]));
+    }
+
+    ValueType result = check_function(func_def, scope->checker);
+    // 検査中 (再帰) の関数の純粋性はまだ分からないので、呼び出し時に確かめる
+    if (func_def->data.func_def.check_state == 2 && analyze_purity(func_def) == PURITY_IMPURE) {
+        compile_error(node->line, "parallel_map に渡す関数 '%s' は純粋でなければなりません (print を呼ぶ関数や再帰する関数は使えません)。",
+                func_name);
+    }
+    switch (result) {
+        case VALUE_TYPE_INT:
+        case VALUE_TYPE_BOOL:
+            return VALUE_TYPE_INT_ARRAY;
+        case VALUE_TYPE_DOUBLE:
+            return VALUE_TYPE_DOUBLE_ARRAY;
+        case VALUE_TYPE_UNKNOWN:
+            return VALUE_TYPE_UNKNOWN;
+        default:
+            compile_error(node->line, "parallel_map に渡す関数 '%s' は int か double の値を返さなければなりません。", func_name);
+    }
+}
+
+static ValueType check_call(ASTNode *node, CheckScope *scope) {
+    int num_args = node->data.func_call.num_arguments;
+    ValueType arg_types[NATIVE_MAX_PARAMS] = { VALUE_TYPE_UNKNOWN };
+    const NativeFunctionEntry *native = node->data.func_call.native;
+
+    if (native != NULL && node->data.func_call.spawned) {
+        compile_error(node->line, "spawn できるのはユーザー定義関数の呼び出しだけです ('%s' は組み込み関数です)。",
+                node->data.func_call.function_name);
+    }
+    if (native != NULL) {
+        bool all_known = true;
+        for (int i = 0; i < num_args; i++) {
+            ValueType type = check_expression(&node->data.func_call.arguments[i], scope);
+            if (i < NATIVE_MAX_PARAMS) {
+                arg_types[i] = type;
+            }
+            all_known = all_known && (type != VALUE_TYPE_UNKNOWN);
+        }
+        check_native_call(native, node->line, num_args, arg_types);
+        node->data.func_call.checked = all_known;
+        if (native->maps_function) {
+            return check_parallel_map(node, scope, arg_types);
+        }
+        if (native->element_result) {
+            // 配列の引数の要素の型 (どれかが double[] なら double)
+            if (!all_known) {
+                return VALUE_TYPE_UNKNOWN;
+            }
+            for (int i = 0; i < num_args; i++) {
+                if (arg_types[i] == VALUE_TYPE_DOUBLE_ARRAY) {
+                    return VALUE_TYPE_DOUBLE;
+                }
+            }
+            return VALUE_TYPE_INT;
+        }
+        return native->return_type;
+    }
+
+    const char *func_name = node->data.func_call.function_name;
+    SymbolEntry *entry = get_symbol_hashed(scope->globals, func_name, node->data.func_call.name_hash);
+    if (entry == NULL || VAL_TYPE(entry->value) != VALUE_TYPE_FUNCTION) {
+        compile_error(node->line, "未定義の関数 '%s' を呼び出そうとしました。", func_name);
+    }
+    ASTNode *func_def = AS_FUNC(entry->value);
+    node->data.func_call.callee = func_def;
+    if (node->data.func_call.spawned && func_def->data.func_def.generator) {
+        compile_error(node->line, "ジェネレータ関数 '%s' は spawn できません。", func_name);
+    }
+    int num_parameters = func_def->data.func_def.num_parameters;
+    if (num_args != num_parameters) {
+        compile_error(node->line, "関数 '%s' は %d 個の引数を取りますが、%d 個が渡されました。",
+                func_name, num_parameters, num_args);
+    }
+
+    bool all_known = true;
+    for (int i = 0; i < num_args; i++) {
+        ASTNode *param = func_def->data.func_def.parameters[i];
+        ValueType declared = param->data.var_decl.decl_type;
+        ValueType type = check_expression(&node->data.func_call.arguments[i], scope);
+        if (type == VALUE_TYPE_UNKNOWN) {
+            all_known = false;
+            continue;
+        }
+        if (!is_assignable_type(declared, type)) {
+            compile_error(node->line, "関数 '%s' の '%s' 型の引数 '%s' に互換性のない型の値を渡そうとしました。",
+                    func_name, param->data.var_decl.type_name, param->data.var_decl.name);
+        }
+        convert_expression(&node->data.func_call.arguments[i], type, declared);
+    }
+    node->data.func_call.checked = all_known;
+
+    // 呼び出し先を先に検査して結果の型を得る (再帰中なら不明)
+    ValueType result = check_function(func_def, scope->checker);
+    // spawn した呼び出しの値は future で、結果は join で受け取る
+    // ジェネレータ関数の呼び出しは本体を実行せず、再帰中でもジェネレータを返す
+    if (node->data.func_call.spawned) {
+        return VALUE_TYPE_FUTURE;
+    }
+    return func_def->data.func_def.generator ? VALUE_TYPE_GENERATOR : result;
+}
+
+// 配列リテラルの要素の型を決め、要素を揃える (どれかが double なら double[]、そうでなければ int[])
+static ValueType check_array_literal(ASTNode *node, CheckScope *scope) {
+    int num_elements = node->data.array_literal.num_elements;
+    bool all_known = true;
+    bool any_double = false;
+    ValueType *types = check_alloc(scope->checker, (size_t)num_elements, sizeof(ValueType));
+    for (int i = 0; i < num_elements; i++) {
+        ValueType type = check_expression(&node->data.array_literal.elements[i], scope);
+        if (type != VALUE_TYPE_UNKNOWN && type != VALUE_TYPE_INT && type != VALUE_TYPE_BOOL && type != VALUE_TYPE_DOUBLE) {
+            compile_error(node->line, "配列の要素に '%s' 型の値は使えません。", value_type_name(type));
+        }
+        types[i] = type;
+        all_known = all_known && (type != VALUE_TYPE_UNKNOWN);
+        any_double = any_double || (type == VALUE_TYPE_DOUBLE);
+    }
+    if (!all_known) {
+        check_free(scope->checker, types);
+        return VALUE_TYPE_UNKNOWN; // 要素の型は実行時に決める
+    }
+    ValueType element_type = any_double ? VALUE_TYPE_DOUBLE : VALUE_TYPE_INT;
+    for (int i = 0; i < num_elements; i++) {
+        convert_expression(&node->data.array_literal.elements[i], types[i], element_type);
+    }
+    check_free(scope->checker, types);
+    node->data.array_literal.element_type = element_type;
+    return any_double ? VALUE_TYPE_DOUBLE_ARRAY : VALUE_TYPE_INT_ARRAY;
+}
+
+// 添字の式を検査する (int に揃える)
+static void check_index(ASTNode **index_ref, CheckScope *scope) {
+    ValueType type = check_expression(index_ref, scope);
+    if (type == VALUE_TYPE_UNKNOWN) {
+        return;
+    }
+    if (type != VALUE_TYPE_INT && type != VALUE_TYPE_BOOL) {
+        compile_error((*index_ref)->line, "配列の添字は整数でなければなりません。");
+    }
+    convert_expression(index_ref, type, VALUE_TYPE_INT);
+}
+
+// range の範囲の式を検査する (int に揃える。型が静的に分からなければ false)
+static bool check_range_bound(ASTNode **bound_ref, CheckScope *scope) {
+    ValueType type = check_expression(bound_ref, scope);
+    if (type == VALUE_TYPE_UNKNOWN) {
+        return false;
+    }
+    if (type != VALUE_TYPE_INT && type != VALUE_TYPE_BOOL) {
+        compile_error((*bound_ref)->line, "range の範囲は整数でなければなりません。");
+    }
+    convert_expression(bound_ref, type, VALUE_TYPE_INT);
+    return true;
+}
+
+// ブロック (入れ子のループの本体を含む) でスロットを最後に宣言する文を探す
+static const ASTNode *find_declaration(const ASTNode *block, int slot) {
+    const ASTNode *found = NULL;
+    for (int i = 0; i < block->data.block.num_statements; i++) {
+        const ASTNode *statement = block->data.block.statements[i];
+        if (statement->type == NODE_VAR_DECLARATION && statement->data.var_decl.slot == slot) {
+            found = statement;
+        } else if (statement->type == NODE_FOR) {
+            const ASTNode *nested = find_declaration(statement->data.for_stmt.body, slot);
+            if (nested != NULL) {
+                found = nested;
+            }
+        }
+    }
+    return found;
+}
+
+// 行列の添字 m[行, 列] は行列にだけ、行列には2つの添字で付ける
+static void check_matrix_index(ValueType target, bool matrix_index, int line) {
+    if (target != VALUE_TYPE_MAT) {
+        compile_error(line, "'%s' 型の値に [行, 列] の添字を付けることはできません。", value_type_name(target));
+    }
+    if (!matrix_index) {
+        compile_error(line, "行列の要素は [行, 列] の2つの添字で指定します。");
+    }
+}
+
+static ValueType check_expression(ASTNode **node_ref, CheckScope *scope) {
+    ASTNode *node = *node_ref;
+    switch (node->type) {
+        case NODE_NUMBER_LITERAL:
+            return VALUE_TYPE_INT; // True/False も整数リテラル
+        case NODE_FLOAT_LITERAL:
+            return VALUE_TYPE_DOUBLE;
+        case NODE_STRING_LITERAL:
+            return VALUE_TYPE_STR;
+        case NODE_IDENTIFIER_EXPR: {
+            int slot = node->data.identifier_expr.slot;
+            if (slot >= 0 && scope->declared[slot]) {
+                return scope->slot_types[slot];
+            }
+            if (slot < 0) {
+                SymbolEntry *entry = get_symbol_hashed(scope->globals, node->data.identifier_expr.name, node->data.identifier_expr.name_hash);
+                if (entry != NULL) {
+                    return VAL_TYPE(entry->value);
+                }
+            }
+            compile_error(node->line, "未定義の識別子 '%s' です。", node->data.identifier_expr.name);
+        }
+        case NODE_FUNCTION_CALL:
+            return check_call(node, scope);
+        case NODE_ADD:
+        case NODE_SUBTRACT:
+        case NODE_MULTIPLY:
+        case NODE_DIVIDE:
+            return check_binary(node, scope);
+        case NODE_ARRAY_LITERAL:
+            return check_array_literal(node, scope);
+        case NODE_INDEX: {
+            ValueType target = check_expression(&node->data.index_expr.target, scope);
+            check_index(&node->data.index_expr.index, scope);
+            bool matrix_index = (node->data.index_expr.column != NULL);
+            if (matrix_index) {
+                check_index(&node->data.index_expr.column, scope);
+            }
+            if (target == VALUE_TYPE_UNKNOWN) {
+                return VALUE_TYPE_UNKNOWN;
+            }
+            if (target == VALUE_TYPE_MAT || matrix_index) {
+                check_matrix_index(target, matrix_index, node->line);
+                return VALUE_TYPE_DOUBLE;
+            }
+            if (!is_array_type(target)) {
+                compile_error(node->line, "'%s' 型の値に添字を付けることはできません。", value_type_name(target));
+            }
+            return element_type_of(target);
+        }
+        default:
+            return VALUE_TYPE_UNKNOWN;
+    }
+}
+
+static ValueType check_statement(ASTNode **node_ref, CheckScope *scope);
+static void check_loop_body(ASTNode *node, CheckScope *scope);
+
+// ジェネレータを回す for の式を検査し、ループ変数の型を返す
+// ジェネレータ関数を直接呼び出していれば、その関数が yield する値の型が分かる。
+static ValueType check_iterable(ASTNode *node, CheckScope *scope) {
+    ValueType type = check_expression(&node->data.for_stmt.iterable, scope);
+    if (type != VALUE_TYPE_GENERATOR && type != VALUE_TYPE_UNKNOWN) {
+        compile_error(node->line, "'for' で回せるのは range(...) かジェネレータだけですが、'%s' 型の値が渡されました。",
+                value_type_name(type));
+    }
+    int slot = node->data.for_stmt.slot;
+    if (scope->declared[slot]) {
+        compile_error(node->line, "ジェネレータを回す 'for' のループ変数 '%s' は既に宣言されています。",
+                node->data.for_stmt.name);
+    }
+    const ASTNode *iterable = node->data.for_stmt.iterable;
+    const ASTNode *callee = (iterable->type == NODE_FUNCTION_CALL) ? iterable->data.func_call.callee : NULL;
+    if (callee != NULL && callee->data.func_def.generator && callee->data.func_def.check_state == 2) {
+        return callee->data.func_def.yield_type;
+    }
+    return VALUE_TYPE_UNKNOWN;
+}
+
+// for 文を検査する
+// 本体は2回目以降も1回目と同じ型の状態から実行されるよう、ループの前に宣言された変数の
+// 型を本体で変えることは認めない。ループ変数と本体で宣言した変数はループの外では使えない
+// (範囲が空なら本体は一度も実行されないので、ループの後に値があるとは限らない)。
+// ジェネレータを回すループ変数は、ループの前に宣言されていない新しい名前でなければならない。
+static void check_for(ASTNode *node, CheckScope *scope) {
+    int slot = node->data.for_stmt.slot;
+    bool declared_before = scope->declared[slot];
+    if (node->data.for_stmt.iterable != NULL) {
+        scope->slot_types[slot] = check_iterable(node, scope);
+        scope->declared[slot] = true;
+        check_loop_body(node, scope);
+        scope->declared[slot] = false;
+        return;
+    }
+
+    bool start_known = check_range_bound(&node->data.for_stmt.start, scope);
+    bool end_known = check_range_bound(&node->data.for_stmt.end, scope);
+    node->data.for_stmt.checked = start_known && end_known;
+
+    if (scope->declared[slot]) {
+        if (scope->constant[slot]) {
+            compile_error(node->line, "定数 '%s' をループ変数にすることはできません。", node->data.for_stmt.name);
+        }
+        if (scope->slot_types[slot] != VALUE_TYPE_INT) {
+            compile_error(node->line, "ループ変数 '%s' は int 型でなければなりませんが、'%s' 型で宣言されています。",
+                    node->data.for_stmt.name, value_type_name(scope->slot_types[slot]));
+        }
+    }
+    scope->slot_types[slot] = VALUE_TYPE_INT;
+    scope->declared[slot] = true;
+    check_loop_body(node, scope);
+    scope->declared[slot] = declared_before;
+}
+
+// ループの本体を検査する (ループ変数は宣言済みにしておくこと)
+static void check_loop_body(ASTNode *node, CheckScope *scope) {
+    int frame_size = scope->func_def->data.func_def.frame_size;
+    ValueType *entry_types = check_alloc(scope->checker, (size_t)frame_size, sizeof(ValueType));
+    bool *entry_declared = check_alloc(scope->checker, (size_t)frame_size, sizeof(bool));
+    bool *entry_constant = check_alloc(scope->checker, (size_t)frame_size, sizeof(bool));
+    memcpy(entry_types, scope->slot_types, sizeof(ValueType) * frame_size);
+    memcpy(entry_declared, scope->declared, sizeof(bool) * frame_size);
+    memcpy(entry_constant, scope->constant, sizeof(bool) * frame_size);
+
+    ASTNode *body = node->data.for_stmt.body;
+    for (int i = 0; i < body->data.block.num_statements; i++) {
+        check_statement(&body->data.block.statements[i], scope);
+    }
+
+    for (int i = 0; i < frame_size; i++) {
+        if (entry_declared[i] && (scope->slot_types[i] != entry_types[i] || scope->constant[i] != entry_constant[i])) {
+            const ASTNode *declaration = find_declaration(body, i);
+            compile_error(declaration->line, "ループの前に宣言された変数 '%s' を 'for' の本体で別の型で宣言し直すことはできません。",
+                    declaration->data.var_decl.name);
+        }
+        // 本体で初めて宣言した変数はループの後では未定義に戻す
+        scope->declared[i] = entry_declared[i];
+    }
+    check_free(scope->checker, entry_types);
+    check_free(scope->checker, entry_declared);
+    check_free(scope->checker, entry_constant);
+}
+
+// 文を検査し、その文の値の型を返す (ブロックの値は最後に実行した文の値)
+static ValueType check_statement(ASTNode **node_ref, CheckScope *scope) {
+    ASTNode *node = *node_ref;
+    switch (node->type) {
+        case NODE_PRINT_STATEMENT:
+            for (int i = 0; i < node->data.print_stmt.num_arguments; i++) {
+                check_expression(&node->data.print_stmt.arguments[i], scope);
+            }
+            return VALUE_TYPE_VOID;
+        case NODE_RETURN_STATEMENT:
+            if (node->data.return_stmt.value == NULL) {
+                return VALUE_TYPE_VOID;
+            }
+            return check_expression(&node->data.return_stmt.value, scope);
+        case NODE_YIELD: {
+            ValueType type = check_expression(&node->data.yield_stmt.value, scope);
+            if (!scope->yielded) {
+                scope->yield_type = type;
+                scope->yielded = true;
+            } else if (scope->yield_type != type) {
+                scope->yield_type = VALUE_TYPE_UNKNOWN; // yield ごとに型が違えば、値を受け取る側で検査する
+            }
+            return VALUE_TYPE_VOID;
+        }
+        case NODE_VAR_DECLARATION: {
+            ValueType declared = node->data.var_decl.decl_type;
+            ValueType type = check_expression(&node->data.var_decl.initializer, scope);
+            if (type != VALUE_TYPE_UNKNOWN) {
+                if (!is_assignable_type(declared, type)) {
+                    compile_error(node->line, "'%s' 型の変数 '%s' に互換性のない型の値を初期化しようとしました。",
+                            node->data.var_decl.type_name, node->data.var_decl.name);
+                }
+                convert_expression(&node->data.var_decl.initializer, type, declared);
+                node->data.var_decl.checked = true;
+            }
+            // 以降この変数は宣言型の値を持つ (実行時の変換が失敗すればそこでエラーになる)
+            int slot = node->data.var_decl.slot;
+            if (slot >= 0) {
+                scope->slot_types[slot] = declared;
+                scope->declared[slot] = true;
+                scope->constant[slot] = node->data.var_decl.is_const;
+            }
+            return VALUE_TYPE_VOID;
+        }
+        case NODE_ASSIGNMENT: {
+            const char *var_name = node->data.assignment.name;
+            int slot = node->data.assignment.slot;
+            ValueType target;
+            if (slot >= 0 && scope->declared[slot]) {
+                if (scope->constant[slot]) {
+                    compile_error(node->line, "定数 '%s' に代入しようとしました。", var_name);
+                }
+                target = scope->slot_types[slot];
+            } else {
+                SymbolEntry *entry = (slot < 0) ? get_symbol_hashed(scope->globals, var_name, node->data.assignment.name_hash) : NULL;
+                if (entry == NULL) {
+                    compile_error(node->line, "未定義の変数 '%s' に代入しようとしました。", var_name);
+                }
+                compile_error(node->line, "'%s' 変数への代入がサポートされていない型です。", var_name);
+            }
+            ValueType type = check_expression(&node->data.assignment.value, scope);
+            // 型の分からない変数 (ジェネレータの値を受け取るループ変数) への代入は実行時に検査する
+            if (type != VALUE_TYPE_UNKNOWN && target != VALUE_TYPE_UNKNOWN) {
+                if (!is_assignable_type(target, type)) {
+                    compile_error(node->line, "'%s' 変数に互換性のない型の値を代入しようとしました。", var_name);
+                }
+                convert_expression(&node->data.assignment.value, type, target);
+                node->data.assignment.checked = true;
+            }
+            return VALUE_TYPE_VOID;
+        }
+        case NODE_INDEX_ASSIGNMENT: {
+            const char *var_name = node->data.index_assignment.name;
+            int slot = node->data.index_assignment.slot;
+            if (slot < 0 || !scope->declared[slot]) {
+                compile_error(node->line, "未定義の変数 '%s' に代入しようとしました。", var_name);
+            }
+            if (scope->constant[slot]) {
+                compile_error(node->line, "定数 '%s' の要素に代入しようとしました。", var_name);
+            }
+            ValueType target = scope->slot_types[slot];
+            bool matrix_index = (node->data.index_assignment.column != NULL);
+            if (target == VALUE_TYPE_MAT || matrix_index) {
+                check_matrix_index(target, matrix_index, node->line);
+            } else if (!is_array_type(target)) {
+                compile_error(node->line, "'%s' 型の変数 '%s' に添字を付けて代入することはできません。",
+                        value_type_name(target), var_name);
+            }
+            check_index(&node->data.index_assignment.index, scope);
+            if (matrix_index) {
+                check_index(&node->data.index_assignment.column, scope);
+            }
+            ValueType element = (target == VALUE_TYPE_MAT) ? VALUE_TYPE_DOUBLE : element_type_of(target);
+            ValueType type = check_expression(&node->data.index_assignment.value, scope);
+            if (type != VALUE_TYPE_UNKNOWN) {
+                if (!is_assignable_type(element, type)) {
+                    compile_error(node->line, "'%s' の要素に互換性のない型の値を代入しようとしました。", var_name);
+                }
+                convert_expression(&node->data.index_assignment.value, type, element);
+                node->data.index_assignment.checked = true;
+            }
+            return VALUE_TYPE_VOID;
+        }
+        case NODE_FOR:
+            check_for(node, scope);
+            return VALUE_TYPE_VOID;
+        default:
+            return check_expression(node_ref, scope);
+    }
+}
+
+// 関数本体を検査して呼び出し結果の型を返す (検査は関数ごとに一度だけ)
+static ValueType check_function(ASTNode *func_def, TypeChecker *checker) {
+    if (func_def->data.func_def.check_state == 2) {
+        return func_def->data.func_def.result_type;
+    }
+    if (func_def->data.func_def.check_state == 1) {
+        return VALUE_TYPE_UNKNOWN; // 再帰: 結果の型は実行時に決まる
+    }
+    func_def->data.func_def.check_state = 1;
+
+    CheckScope scope;
+    scope.func_def = func_def;
+    scope.checker = checker;
+    scope.globals = checker->globals;
+    size_t frame_size = (size_t)func_def->data.func_def.frame_size;
+    scope.slot_types = check_alloc(checker, frame_size, sizeof(ValueType));
+    scope.declared = check_alloc(checker, frame_size, sizeof(bool));
+    scope.constant = check_alloc(checker, frame_size, sizeof(bool));
+    scope.yielded = false;
+    scope.yield_type = VALUE_TYPE_UNKNOWN;
+    for (int i = 0; i < func_def->data.func_def.num_parameters; i++) {
+        ASTNode *param = func_def->data.func_def.parameters[i];
+        scope.slot_types[param->data.var_decl.slot] = param->data.var_decl.decl_type;
+        scope.declared[param->data.var_decl.slot] = true;
+    }
+
+    ValueType result = VALUE_TYPE_VOID;
+    ASTNode *body = func_def->data.func_def.body;
+    for (int i = 0; i < body->data.block.num_statements; i++) {
+        result = check_statement(&body->data.block.statements[i], &scope);
+    }
+
+    check_free(checker, scope.slot_types);
+    check_free(checker, scope.declared);
+    check_free(checker, scope.constant);
+    if (func_def->data.func_def.generator) {
+        result = VALUE_TYPE_GENERATOR;
+        func_def->data.func_def.yield_type = scope.yield_type;
+    }
+    func_def->data.func_def.result_type = result;
+    func_def->data.func_def.check_state = 2;
+    return result;
+}
+
+static void check_all_functions(void *arg) {
+    TypeChecker *checker = arg;
+    ASTNode *program_node = checker->program_node;
+    for (int i = 0; i < program_node->data.program.num_statements; i++) {
+        ASTNode *statement = program_node->data.program.statements[i];
+        if (statement->type == NODE_FUNCTION_DEFINITION) {
+            check_function(statement, checker);
+        }
+    }
+}
+
+// プログラム内の全ての関数を検査する (globals には関数が登録済み)
+// 型エラーは作業領域を解放してから呼び出し側の戻り先へ報告し直す。
+void typecheck_program(ASTNode *program_node, Environment *globals) {
+    if (program_node == NULL || program_node->type != NODE_PROGRAM) {
+        return;
+    }
+    TypeChecker checker = { program_node, globals, NULL, 0, 0 };
+    char *message = run_trapping_errors(check_all_functions, &checker);
+    for (int i = 0; i < checker.num_buffers; i++) {
+        free(checker.buffers[i]);
+    }
+    free(checker.buffers);
+    if (message != NULL) {
+        raise_error_message(message);
+    }
+}
@@ -0,0 +1,470 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kappok_api.h"
+#include "test_util.h"
+
+// 埋め込み API のテスト (make test)
+// 各テストはプログラムをコンパイルして実行し、状態コード・出力・エラーメッセージを確かめる。
+
+// source をコンパイルする (失敗したらメッセージを出して NULL を返す)
+static KappokProgram *compile(KappokRuntime *runtime, const char *source) {
+    KappokProgram *program;
+    char *error;
+    if (kappok_compile(runtime, source, &program, &error) != KAPPOK_OK) {
+        fprintf(stderr, "コンパイルに失敗しました: %s\n", error);
+        free(error);
+        failures++;
+        return NULL;
+    }
+    return program;
+}
+
+// 動的な型の被演算子の型の誤りは、プロセスを終了させずに実行時エラーとして返る
+static void test_type_mismatch_is_runtime_error(KappokRuntime *runtime) {
+    KappokProgram *program = compile(runtime,
+        "def values() {\n"
+        "    yield 2.5\n"
+        "    yield \"a\"\n"
+        "}\n"
+        "\n"
+        "def main() {\n"
+        "    for x in values() {\n"
+        "        print(x + 1.5)\n"
+        "    }\n"
+        "}\n");
+    if (program == NULL) {
+        return;
+    }
+    for (int run = 0; run < 2; run++) {
+        char *output;
+        size_t length;
+        char *error;
+        KappokStatus status = kappok_run_capture(program, &output, &length, &error);
+        CHECK(status == KAPPOK_ERROR_RUNTIME);
+        CHECK(strcmp(output, "4\n") == 0);
+        CHECK(error != NULL && strstr(error, "実行時エラー (行 8)") != NULL);
+        free(output);
+        free(error);
+    }
+    kappok_program_free(program);
+}
+
+// int の除算の LONG_MIN / -1 はプロセスを落とさず、加減算や乗算と同じく折り返す
+// (動的な型の被演算子、型の確定した被演算子、int[] の要素ごとの除算)
+static void test_int_division_overflow_wraps(KappokRuntime *runtime) {
+    KappokProgram *program = compile(runtime,
+        "def values() {\n"
+        "    yield 0 - 9223372036854775807 - 1\n"
+        "}\n"
+        "def divide(int a, int b) {\n"
+        "    return a / b\n"
+        "}\n"
+        "def main() {\n"
+        "    for x in values() {\n"
+        "        print(x / (0 - 1))\n"
+        "    }\n"
+        "    int m = 0 - 9223372036854775807 - 1\n"
+        "    int[] a = [m, 6]\n"
+        "    print(divide(m, 0 - 1), a / [0 - 1, 0 - 1], m / [0 - 1, 2])\n"
+        "}\n");
+    if (program == NULL) {
+        return;
+    }
+    char *output;
+    char *error;
+    KappokStatus status = kappok_run_capture(program, &output, NULL, &error);
+    CHECK(status == KAPPOK_OK);
+    CHECK(strcmp(output, "-9223372036854775808\n"
+                         "-9223372036854775808 [-9223372036854775808, -6] [-9223372036854775808, -4611686018427387904]\n"
+                         "\n") == 0);
+    free(output);
+    free(error);
+    kappok_program_free(program);
+}
+
+// 終わらない再帰は C スタックを溢れさせずに実行時エラーとして返り、同じプログラムを実行し直せる
+// (ジェネレータの本体の中と、join がその場で実行するタスクの中の再帰も同じ)
+static void test_deep_recursion_is_runtime_error(KappokRuntime *runtime) {
+    static const char *const sources[] = {
+        "def r(int n) {\n"
+        "    return r(n + 1) + 1\n"
+        "}\n"
+        "def main() {\n"
+        "    print(r(0))\n"
+        "}\n",
+
+        "def r(int n) {\n"
+        "    return r(n + 1) + 1\n"
+        "}\n"
+        "def numbers() {\n"
+        "    yield r(0)\n"
+        "}\n"
+        "def main() {\n"
+        "    for x in numbers() {\n"
+        "        print(x)\n"
+        "    }\n"
+        "}\n",
+
+        "def r(int n) {\n"
+        "    return join(spawn r(n + 1)) + 1\n"
+        "}\n"
+        "def main() {\n"
+        "    print(r(0))\n"
+        "}\n",
+    };
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        KappokProgram *program = compile(runtime, sources[i]);
+        if (program == NULL) {
+            continue;
+        }
+        for (int run = 0; run < 2; run++) {
+            char *output;
+            char *error;
+            KappokStatus status = kappok_run_capture(program, &output, NULL, &error);
+            CHECK(status == KAPPOK_ERROR_RUNTIME);
+            CHECK(error != NULL && strstr(error, "実行時エラー (行 2): 関数の呼び出しが深すぎます") != NULL);
+            free(output);
+            free(error);
+        }
+        kappok_program_free(program);
+    }
+}
+
+#define SMALL_STACK_SIZE (512 * 1024)
+
+typedef struct {
+    KappokProgram *program;
+    KappokStatus status;
+} HostRun;
+
+static void *run_on_host_thread(void *arg) {
+    HostRun *run = arg;
+    char *output;
+    char *error;
+    run->status = kappok_run_capture(run->program, &output, NULL, &error);
+    free(output);
+    free(error);
+    return NULL;
+}
+
+// 埋め込む側が作った小さなスタックのスレッドでも、深すぎる再帰はそのスタックの大きさで打ち切られる
+static void test_deep_recursion_on_small_host_stack(KappokRuntime *runtime) {
+    KappokProgram *program = compile(runtime,
+        "def r(int n) {\n"
+        "    return r(n + 1) + 1\n"
+        "}\n"
+        "def main() {\n"
+        "    print(r(0))\n"
+        "}\n");
+    if (program == NULL) {
+        return;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, SMALL_STACK_SIZE);
+    HostRun run = { program, KAPPOK_OK };
+    pthread_t thread;
+    CHECK(pthread_create(&thread, &attr, run_on_host_thread, &run) == 0);
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+    CHECK(run.status == KAPPOK_ERROR_RUNTIME);
+    kappok_program_free(program);
+}
+
+#define TEST_THREADS 4 // コア数によらず、タスクを他のスレッドが盗んで実行中の join を起こす
+
+// 深い再帰で spawn と join を繰り返す (タスクの数はスレッドの数よりずっと多い)
+// 盗まれた子タスクを join したスレッドは、その部分木のタスクを手伝いながら待つ。
+static void test_recursive_fan_out(KappokRuntime *runtime) {
+    KappokProgram *program = compile(runtime,
+        "def tree(int depth) {\n"
+        "    int total = 1\n"
+        "    for once in range((depth + depth) / (depth + 1)) {\n" // depth > 0 のときだけ1回
+        "        future left = spawn tree(depth - 1)\n"
+        "        future right = spawn tree(depth - 1)\n"
+        "        total = total + join(left) + join(right)\n"
+        "    }\n"
+        "    return total\n"
+        "}\n"
+        "def main() {\n"
+        "    print(tree(13))\n"
+        "}\n");
+    if (program == NULL) {
+        return;
+    }
+    for (int run = 0; run < 10; run++) {
+        char *output;
+        char *error;
+        KappokStatus status = kappok_run_capture(program, &output, NULL, &error);
+        CHECK(status == KAPPOK_OK);
+        CHECK(strcmp(output, "16383\n\n") == 0); // print の行と、実行の最後の改行
+        free(output);
+        free(error);
+    }
+    kappok_program_free(program);
+}
+
+// future を後から spawn したタスクに渡して join させても、待っている間の手伝いで止まらない
+static void test_futures_passed_to_tasks(KappokRuntime *runtime) {
+    KappokProgram *program = compile(runtime,
+        "def leaf(int n) {\n"
+        "    int t = 0\n"
+        "    for i in range(500) {\n"
+        "        t = t + i\n"
+        "    }\n"
+        "    return n + t - t\n"
+        "}\n"
+        "def waiter(future f) {\n"
+        "    return join(f) + 1\n"
+        "}\n"
+        "def chain(int n) {\n"
+        "    future a = spawn leaf(n)\n"
+        "    future b = spawn waiter(a)\n"
+        "    future c = spawn waiter(b)\n"
+        "    return join(c) + join(b) - join(a)\n"
+        "}\n"
+        "def main() {\n"
+        "    int total = 0\n"
+        "    for i in range(200) {\n"
+        "        future x = spawn chain(i)\n"
+        "        future y = spawn waiter(x)\n"
+        "        total = total + join(y) - join(x)\n"
+        "    }\n"
+        "    print(total)\n"
+        "}\n");
+    if (program == NULL) {
+        return;
+    }
+    char *output;
+    char *error;
+    KappokStatus status = kappok_run_capture(program, &output, NULL, &error);
+    CHECK(status == KAPPOK_OK);
+    CHECK(strcmp(output, "200\n\n") == 0);
+    free(output);
+    free(error);
+    kappok_program_free(program);
+}
+
+#define LEAK_RUNS 50
+#define LEAK_ARRAY_LENGTH 131072 // 1 MB の int[] (実行ごとに漏れれば 50 MB になる)
+
+// 実行時エラーで打ち切られた実行は、評価の途中の値 (大きな配列) を残さない
+// 左辺の配列を持ったままの右辺、添字を付けた配列、メモ化のキー、parallel_map の結果の配列がそれぞれ失敗する。
+static void test_failed_runs_do_not_leak(KappokRuntime *runtime) {
+    static const char *const sources[] = {
+        "def values() {\n"
+        "    yield 1\n"
+        "    yield \"s\"\n"
+        "}\n"
+        "def main() {\n"
+        "    int[] a = int_array(131072, 1)\n"
+        "    for x in values() {\n"
+        "        print(len((a * 2) + (x + 1.5)), a[x])\n"
+        "    }\n"
+        "}\n",
+
+        "@memoize\n"
+        "def ratio(int[] values, int n) {\n"
+        "    return len(values) / n\n"
+        "}\n"
+        "def main() {\n"
+        "    int[] a = int_array(131072, 1)\n"
+        "    print(ratio(a * 2, 0))\n"
+        "}\n",
+
+        "def inverse(int v) {\n"
+        "    return 10 / (v - 1)\n"
+        "}\n"
+        "def main() {\n"
+        "    int[] a = int_array(131072, 2)\n"
+        "    a[100000] = 1\n"
+        "    print(parallel_map(inverse, a))\n"
+        "}\n",
+    };
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        KappokProgram *program = compile(runtime, sources[i]);
+        if (program == NULL) {
+            continue;
+        }
+        size_t before = 0;
+        for (int run = 0; run <= LEAK_RUNS; run++) {
+            if (run == 1) {
+                before = heap_in_use(); // 最初の実行で作られるスレッドごとのバッファなどは数えない
+            }
+            char *output;
+            char *error;
+            KappokStatus status = kappok_run_capture(program, &output, NULL, &error);
+            CHECK(status == KAPPOK_ERROR_RUNTIME);
+            free(output);
+            free(error);
+        }
+        size_t after = heap_in_use();
+        CHECK(after < before + LEAK_ARRAY_LENGTH * sizeof(long));
+        kappok_program_free(program);
+    }
+}
+
+// 型エラーで打ち切られたコンパイルは、型検査の作業領域を残さない
+// (スロットの多い関数のループの中で失敗させ、作業領域を大きくする)
+static void test_failed_compiles_do_not_leak(KappokRuntime *runtime) {
+    size_t capacity = 64 * 1024;
+    char *source = malloc(capacity);
+    if (source == NULL) {
+        failures++;
+        return;
+    }
+    size_t length = (size_t)sprintf(source, "def f() {\n    for i in range(2) {\n");
+    for (int i = 0; i < 2000; i++) {
+        length += (size_t)sprintf(source + length, "        int v%d = %d\n", i, i);
+    }
+    sprintf(source + length, "        int[] q = [1, \"s\"]\n    }\n}\ndef main() {\n    f()\n}\n");
+
+    size_t before = 0;
+    for (int run = 0; run <= LEAK_RUNS; run++) {
+        if (run == 1) {
+            before = heap_in_use();
+        }
+        KappokProgram *program;
+        char *error;
+        KappokStatus status = kappok_compile(runtime, source, &program, &error);
+        CHECK(status == KAPPOK_ERROR_COMPILE);
+        CHECK(program == NULL);
+        free(error);
+    }
+    size_t after = heap_in_use();
+    CHECK(after < before + 64 * 1024);
+    free(source);
+}
+
+// プロセス全体の設定が食い違う実行時オブジェクトは作れない (他の実行時オブジェクトの設定を変えない)
+static void test_conflicting_options_are_rejected(void) {
+    KappokOptions options;
+    kappok_options_init(&options);
+    options.threads = TEST_THREADS + 1;
+    CHECK(kappok_runtime_new(&options) == NULL);
+
+    kappok_options_init(&options);
+    options.threads = TEST_THREADS;
+    options.tier_threshold = 1;
+    CHECK(kappok_runtime_new(&options) == NULL);
+
+    // 読み込みの設定は実行時オブジェクトごとに違ってよい
+    options.tier_threshold = -1;
+    options.memoize = true;
+    KappokRuntime *runtime = kappok_runtime_new(&options);
+    CHECK(runtime != NULL);
+    kappok_runtime_free(runtime);
+}
+
+static Value native_triple(Value *args, int num_args, int line) {
+    (void)num_args;
+    (void)line;
+    return INT_VAL(AS_INT(args[0]) * 3);
+}
+
+// ネイティブ関数は公開ヘッダだけで登録でき、登録した後にコンパイルしたプログラムから呼べる
+static void test_register_native(KappokRuntime *runtime) {
+    static const NativeParam triple_params[] = {
+        { "n", VALUE_TYPE_MASK(VALUE_TYPE_INT) },
+    };
+    CHECK(kappok_register_native("triple", native_triple, triple_params, 1));
+    CHECK(!kappok_register_native("triple", native_triple, triple_params, 1));
+    KappokProgram *program = compile(runtime,
+        "def main() {\n"
+        "    print(triple(14))\n"
+        "}\n");
+    if (program == NULL) {
+        return;
+    }
+    char *output;
+    CHECK(kappok_run_capture(program, &output, NULL, NULL) == KAPPOK_OK);
+    CHECK(strcmp(output, "42\n\n") == 0);
+    free(output);
+    kappok_program_free(program);
+}
+
+#define CHURN_THREADS 4
+#define CHURN_ROUNDS 50
+
+// 最初の呼び出しで最適化を始める関数を持つプログラムを、スレッドごとにコンパイル・実行・解放し続ける
+// (他のスレッドのプログラムの最適化中に解放しても、自分のプログラムの最適化は待ってから解放する)
+static void *churn_programs(void *arg) {
+    KappokRuntime *runtime = arg;
+    for (int round = 0; round < CHURN_ROUNDS; round++) {
+        KappokProgram *program = compile(runtime,
+            "def step(int v) {\n"
+            "    return v * 3 + 1\n"
+            "}\n"
+            "def twice(int v) {\n"
+            "    return step(v) + step(v + 1)\n"
+            "}\n"
+            "def main() {\n"
+            "    int total = 0\n"
+            "    for i in range(300) {\n"
+            "        total = total + twice(i)\n"
+            "    }\n"
+            "    print(total)\n"
+            "}\n");
+        if (program == NULL) {
+            return NULL;
+        }
+        char *output;
+        CHECK(kappok_run_capture(program, &output, NULL, NULL) == KAPPOK_OK);
+        CHECK(strcmp(output, "270600\n\n") == 0);
+        free(output);
+        kappok_program_free(program);
+    }
+    return NULL;
+}
+
+static void test_concurrent_compile_and_free(void) {
+    KappokOptions options;
+    kappok_options_init(&options);
+    options.threads = TEST_THREADS;
+    options.tier_threshold = 1;
+    KappokRuntime *runtime = kappok_runtime_new(&options);
+    CHECK(runtime != NULL);
+    if (runtime == NULL) {
+        return;
+    }
+    pthread_t threads[CHURN_THREADS];
+    for (int i = 0; i < CHURN_THREADS; i++) {
+        CHECK(pthread_create(&threads[i], NULL, churn_programs, runtime) == 0);
+    }
+    for (int i = 0; i < CHURN_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    kappok_runtime_free(runtime);
+}
+
+int main(void) {
+    KappokOptions options;
+    kappok_options_init(&options);
+    options.threads = TEST_THREADS;
+    KappokRuntime *runtime = kappok_runtime_new(&options);
+    if (runtime == NULL) {
+        fprintf(stderr, "実行時オブジェクトを作れません\n");
+        return 1;
+    }
+    test_type_mismatch_is_runtime_error(runtime);
+    test_int_division_overflow_wraps(runtime);
+    test_deep_recursion_is_runtime_error(runtime);
+    test_deep_recursion_on_small_host_stack(runtime);
+    test_recursive_fan_out(runtime);
+    test_futures_passed_to_tasks(runtime);
+    test_failed_runs_do_not_leak(runtime);
+    test_failed_compiles_do_not_leak(runtime);
+    test_conflicting_options_are_rejected();
+    test_register_native(runtime);
+    kappok_runtime_free(runtime);
+    // 生きている実行時オブジェクトがなくなれば、段階的実行の閾値を変えられる
+    test_concurrent_compile_and_free();
+    if (failures > 0) {
+        fprintf(stderr, "api_test: %d 件失敗\n", failures);
+        return 1;
+    }
+    printf("api_test: 成功\n");
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kappok.h"
+#include "test_util.h"
+
+// コンパイル時評価のテスト (make test)
+// const の初期化式と失敗しない純粋な式がロード時にリテラルへ置き換わり、実行時と同じ値になること、
+// 評価できない const の初期化式は行番号付きのコンパイルエラーになること、
+// 評価がステップ数の上限を超えた呼び出しは実行時に評価されることを確かめる。
+
+// 行番号 line にある main の文 (なければ NULL)
+static ASTNode *main_statement_at(ASTNode *program_node, int line) {
+    ASTNode *body = find_function(program_node, "main")->data.func_def.body;
+    for (int i = 0; i < body->data.block.num_statements; i++) {
+        if (body->data.block.statements[i]->line == line) {
+            return body->data.block.statements[i];
+        }
+    }
+    return NULL;
+}
+
+// source を読み込んで check で AST を調べてから実行し、出力を expected と比べる
+static void check_loaded(const char *source, void (*check)(ASTNode *program_node), const char *expected) {
+    char *buffer = strdup(source);
+    ASTNode *program_node = parse_source(buffer);
+    CHECK(program_node != NULL);
+    if (program_node == NULL) {
+        free(buffer);
+        return;
+    }
+    LoadOptions options = { false, false };
+    LoadedProgram program;
+    load_program(&program, program_node, &options);
+    check(program_node);
+    char *output = run_captured(&program);
+    if (strcmp(output, expected) != 0) {
+        fprintf(stderr, "出力: 期待 \"%s\"、実際 \"%s\"\n", expected, output);
+        failures++;
+    }
+    free(output);
+    unload_program(&program);
+    destroy_ast(program_node);
+    free(buffer);
+}
+
+static const char folded_source[] =
+    "def square(int v) {\n"
+    "    return v * v\n"
+    "}\n"
+    "def main() {\n"
+    "    const int SIZE = square(12) + 1\n"
+    "    const str LABEL = \"size=\" + round(SIZE / 7.0, 2)\n"
+    "    const int WRAPPED = (0 - 9223372036854775807 - 1) / (0 - 1)\n"
+    "    const double HALF = SIZE / 2.0\n"
+    "    print(LABEL, WRAPPED, HALF, square(SIZE))\n"
+    "}\n";
+
+static void check_folded(ASTNode *program_node) {
+    // 定数を読む箇所は値に置き換わり、失敗しない純粋な呼び出しは const でなくても評価する
+    ASTNode *print = main_statement_at(program_node, 9);
+    CHECK(print != NULL && print->type == NODE_PRINT_STATEMENT);
+    for (int i = 0; print != NULL && i < print->data.print_stmt.num_arguments; i++) {
+        CHECK(is_literal_node(print->data.print_stmt.arguments[i]));
+    }
+}
+
+// const の初期化式は読み込みでリテラルになり、int の折り返しも実行時と同じ
+static void test_folded_constants(void) {
+    check_loaded(folded_source, check_folded, "size=20.71 -9223372036854775808 72.5 21025\n");
+}
+
+static const char budget_source[] =
+    "def sum_to(int n) {\n"
+    "    int s = 0\n"
+    "    for i in range(n) {\n"
+    "        s = s + i\n"
+    "    }\n"
+    "    return s\n"
+    "}\n"
+    "def main() {\n"
+    "    print(sum_to(10))\n"
+    "    print(sum_to(3000000))\n"
+    "}\n";
+
+static void check_budget(ASTNode *program_node) {
+    ASTNode *small = main_statement_at(program_node, 9);
+    ASTNode *large = main_statement_at(program_node, 10);
+    CHECK(small != NULL && is_literal_node(small->data.print_stmt.arguments[0]));
+    CHECK(large != NULL && large->data.print_stmt.arguments[0]->type == NODE_FUNCTION_CALL);
+}
+
+// 評価がステップ数の上限を超えた呼び出しは置き換えずに残し、実行時に同じ値を返す
+static void test_budget_left_to_runtime(void) {
+    check_loaded(budget_source, check_budget, "45\n4499998500000\n");
+}
+
+typedef struct {
+    const char *source;
+    const char *message; // エラーメッセージに含まれるはずの部分 (行番号を含む)
+} RejectedProgram;
+
+static const RejectedProgram rejected_programs[] = {
+    // print する関数は純粋でない
+    { "def show(int v) {\n"
+      "    print(v)\n"
+      "    return v\n"
+      "}\n"
+      "def main() {\n"
+      "    const int SHOWN = show(1)\n"
+      "}\n",
+      "エラー (行 6): 定数 'SHOWN' の初期化式はコンパイル時に評価できません。" },
+    // const でない変数の値はロード時には分からない
+    { "def main() {\n"
+      "    int m = 3\n"
+      "    const int N = m + 1\n"
+      "}\n",
+      "エラー (行 3): 定数 'N' の初期化式はコンパイル時に評価できません。" },
+    // ロード時の実行時エラーは失敗した式の行で報告し、main は実行しない
+    { "def ratio(int a, int b) {\n"
+      "    return a / b\n"
+      "}\n"
+      "def main() {\n"
+      "    print(\"before\")\n"
+      "    const int Q = ratio(1, 0)\n"
+      "}\n",
+      "実行時エラー (行 2): 0による除算です。" },
+    { "def sum_to(int n) {\n"
+      "    int s = 0\n"
+      "    for i in range(n) {\n"
+      "        s = s + i\n"
+      "    }\n"
+      "    return s\n"
+      "}\n"
+      "def main() {\n"
+      "    const int BIG = sum_to(100000000)\n"
+      "}\n",
+      "エラー (行 9): 定数の初期化式の評価がロード時のステップ数の上限を超えました。" },
+};
+
+// 評価できない const の初期化式はコンパイルエラーになる
+static void test_rejections(KappokRuntime *runtime) {
+    for (size_t i = 0; i < sizeof(rejected_programs) / sizeof(rejected_programs[0]); i++) {
+        KappokProgram *program;
+        char *error;
+        KappokStatus status = kappok_compile(runtime, rejected_programs[i].source, &program, &error);
+        CHECK(status == KAPPOK_ERROR_COMPILE);
+        CHECK(program == NULL);
+        if (error == NULL || strstr(error, rejected_programs[i].message) == NULL) {
+            fprintf(stderr, "%zu 番目のプログラム: 期待 \"%s\"、実際 \"%s\"\n", i, rejected_programs[i].message,
+                    (error != NULL) ? error : "(なし)");
+            failures++;
+        }
+        free(error);
+        kappok_program_free(program);
+    }
+}
+
+int main(void) {
+    test_folded_constants();
+    test_budget_left_to_runtime();
+    KappokRuntime *runtime = kappok_runtime_new(NULL);
+    if (runtime == NULL) {
+        fprintf(stderr, "実行時オブジェクトを作れません\n");
+        return 1;
+    }
+    test_rejections(runtime);
+    kappok_runtime_free(runtime);
+    if (failures > 0) {
+        fprintf(stderr, "consteval_test: %d 件失敗\n", failures);
+        return 1;
+    }
+    printf("consteval_test: 成功\n");
+    return 0;
+}
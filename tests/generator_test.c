@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "kappok_api.h"
+#include "test_util.h"
+
+// ジェネレータのテスト (make test)
+// 本体のスタックへの切り替えをまたいで値が保たれること、止まったまま捨てられたジェネレータが
+// 片付けられることを、埋め込み API でプログラムを実行して確かめる。
+
+// 生成器をつないだ流れの値は、ループの変数や浮動小数点数の途中の値も含めて切り替えをまたいで保たれる
+static void test_pipeline(KappokRuntime *runtime) {
+    char *output;
+    char *error;
+    KappokStatus status = run_source(runtime,
+        "def numbers(int n) {\n"
+        "    for i in range(n) {\n"
+        "        yield i\n"
+        "    }\n"
+        "}\n"
+        "def squares(generator g) {\n"
+        "    for x in g {\n"
+        "        yield x * x\n"
+        "    }\n"
+        "}\n"
+        "def halves(int n) {\n"
+        "    double h = 0.25\n"
+        "    for i in range(n) {\n"
+        "        yield h + i * 0.5\n"
+        "    }\n"
+        "}\n"
+        "def main() {\n"
+        "    int total = 0\n"
+        "    for s in squares(numbers(1000)) {\n"
+        "        total = total + s\n"
+        "    }\n"
+        "    double sum = 0.0\n"
+        "    for h in halves(8) {\n"
+        "        sum = sum + h\n"
+        "    }\n"
+        "    print(total, sum)\n"
+        "}\n", &output, &error);
+    CHECK(status == KAPPOK_OK);
+    CHECK(output != NULL && strcmp(output, "332833500 16\n\n") == 0);
+    free(output);
+    free(error);
+}
+
+#define ABANDON_ROUNDS 2000 // スタックを取っておく数 (16) よりずっと多い
+#define ABANDON_GROWTH_LIMIT (64L * 1024 * 1024)
+
+// 確保した仮想メモリの大きさ (本体のスタックの mmap を含む。Linux 以外では測らずに 0 を返す)
+static long virtual_size(void) {
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) {
+        return 0;
+    }
+    if (fscanf(statm, "%ld", &pages) != 1) {
+        pages = 0;
+    }
+    fclose(statm);
+    return pages * sysconf(_SC_PAGESIZE);
+}
+
+// 始まる前に捨てられたジェネレータも、本体が yield で止まったまま実行時エラーで捨てられたものも片付けられ、
+// スタックが使い回される (片付けられなければ実行ごとに 1 MiB のスタックが残る)
+static void test_abandoned_generators(KappokRuntime *runtime) {
+    char source[1024];
+    snprintf(source, sizeof(source),
+        "def from(int start) {\n"
+        "    str label = \"a long label that does not fit inline\"\n"
+        "    for i in range(start, start + 100) {\n"
+        "        yield i\n"
+        "    }\n"
+        "}\n"
+        "def pipe(generator g) {\n"
+        "    for x in g {\n"
+        "        yield x\n"
+        "    }\n"
+        "}\n"
+        "def main() {\n"
+        "    for i in range(%d) {\n"
+        "        generator unused = from(i)\n"
+        "    }\n"
+        "    for y in pipe(from(5)) {\n"
+        "        print(y / (y - 6))\n"
+        "    }\n"
+        "}\n", ABANDON_ROUNDS);
+    KappokProgram *program;
+    char *error;
+    KappokStatus status = kappok_compile(runtime, source, &program, &error);
+    CHECK(status == KAPPOK_OK);
+    if (status != KAPPOK_OK) {
+        free(error);
+        return;
+    }
+    long before = 0;
+    for (int run = 0; run <= ABANDON_ROUNDS; run++) {
+        if (run == 1) {
+            before = virtual_size(); // 最初の実行で作られるスレッドとスタックは数えない
+        }
+        char *output;
+        status = kappok_run_capture(program, &output, NULL, &error);
+        CHECK(status == KAPPOK_ERROR_RUNTIME);
+        CHECK(strcmp(output, "-5\n") == 0);
+        free(output);
+        free(error);
+    }
+    CHECK(virtual_size() < before + ABANDON_GROWTH_LIMIT);
+    kappok_program_free(program);
+}
+
+// for の本体の実行時エラーで止まったまま捨てられたジェネレータの後も、同じプログラムを実行し直せる
+// 本体の中の実行時エラーは、本体の中の行で報告される
+static void test_errors_around_suspended_generators(KappokRuntime *runtime) {
+    KappokProgram *program;
+    char *error;
+    KappokStatus status = kappok_compile(runtime,
+        "def numbers(int n) {\n"
+        "    for i in range(n) {\n"
+        "        yield 10 / (3 - i)\n"
+        "    }\n"
+        "}\n"
+        "def main() {\n"
+        "    for x in numbers(2) {\n"
+        "        print(x)\n"
+        "    }\n"
+        "    for y in numbers(5) {\n"
+        "        print(y / (y - 5))\n"
+        "    }\n"
+        "}\n", &program, &error);
+    CHECK(status == KAPPOK_OK);
+    if (status != KAPPOK_OK) {
+        free(error);
+        return;
+    }
+    for (int run = 0; run < 3; run++) {
+        char *output;
+        status = kappok_run_capture(program, &output, NULL, &error);
+        CHECK(status == KAPPOK_ERROR_RUNTIME);
+        CHECK(strcmp(output, "3\n5\n-1\n") == 0);
+        CHECK(error != NULL && strstr(error, "実行時エラー (行 11)") != NULL);
+        free(output);
+        free(error);
+    }
+    kappok_program_free(program);
+
+    char *output;
+    status = run_source(runtime,
+        "def numbers(int n) {\n"
+        "    for i in range(n) {\n"
+        "        yield 10 / (3 - i)\n"
+        "    }\n"
+        "}\n"
+        "def main() {\n"
+        "    for x in numbers(5) {\n"
+        "        print(x)\n"
+        "    }\n"
+        "}\n", &output, &error);
+    CHECK(status == KAPPOK_ERROR_RUNTIME);
+    CHECK(output != NULL && strcmp(output, "3\n5\n10\n") == 0);
+    CHECK(error != NULL && strstr(error, "実行時エラー (行 3)") != NULL);
+    free(output);
+    free(error);
+}
+
+// yield で止まっているジェネレータを spawn したタスクに渡し、(盗まれれば別のスレッドで) 続きから回す
+static void test_resume_on_task(KappokRuntime *runtime) {
+    char *output;
+    char *error;
+    KappokStatus status = run_source(runtime,
+        "def numbers(int n) {\n"
+        "    for i in range(n) {\n"
+        "        yield i\n"
+        "    }\n"
+        "}\n"
+        "def rest(generator g) {\n"
+        "    int total = 0\n"
+        "    for x in g {\n"
+        "        total = total + x\n"
+        "    }\n"
+        "    return total\n"
+        "}\n"
+        "def main() {\n"
+        "    generator g = numbers(100)\n"
+        "    int seen = 0\n"
+        "    int rest_total = 0\n"
+        "    for x in g {\n"
+        "        seen = seen + 1\n"
+        "        rest_total = rest_total + join(spawn rest(g))\n"
+        "    }\n"
+        "    print(seen, rest_total)\n"
+        "}\n", &output, &error);
+    CHECK(status == KAPPOK_OK);
+    CHECK(output != NULL && strcmp(output, "1 4950\n\n") == 0);
+    free(output);
+    free(error);
+}
+
+int main(void) {
+    KappokOptions options;
+    kappok_options_init(&options);
+    options.threads = 4;
+    KappokRuntime *runtime = kappok_runtime_new(&options);
+    if (runtime == NULL) {
+        fprintf(stderr, "実行時オブジェクトを作れません\n");
+        return 1;
+    }
+    test_pipeline(runtime);
+    test_abandoned_generators(runtime);
+    test_errors_around_suspended_generators(runtime);
+    test_resume_on_task(runtime);
+    kappok_runtime_free(runtime);
+    if (failures > 0) {
+        fprintf(stderr, "generator_test: %d 件失敗\n", failures);
+        return 1;
+    }
+    printf("generator_test: 成功\n");
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kappok.h"
+#include "test_util.h"
+
+// メモ化の表のテスト (make test)
+// 内部のヘッダを使って二つのプログラムを読み込んで実行し、片方を解放したときに残る記録を確かめる。
+
+// source を読み込む (失敗したら NULL を返す。解放は unload_program と destroy_ast)
+static ASTNode *load(char *source, LoadedProgram *program) {
+    ASTNode *program_node = parse_source(source);
+    if (program_node == NULL) {
+        failures++;
+        return NULL;
+    }
+    LoadOptions options = { false, false };
+    load_program(program, program_node, &options);
+    return program_node;
+}
+
+// program の main を出力を捨てて実行する
+static void run(const LoadedProgram *program) {
+    free(run_captured(program));
+}
+
+static bool is_recorded(ASTNode *func_def, long argument) {
+    Value args[1] = { INT_VAL(argument) };
+    Value result;
+    if (!memo_lookup(func_def, args, 1, &result)) {
+        return false;
+    }
+    free_value_data(result);
+    return true;
+}
+
+// プログラムを解放すると、そのプログラムの関数の記録だけが消える
+// (二つのプログラムの記録は合わせて表の上限 4096 に収まる)
+static void test_unload_keeps_other_programs(void) {
+    char first_source[] =
+        "@memoize\n"
+        "def square(int n) {\n"
+        "    return n * n\n"
+        "}\n"
+        "def main() {\n"
+        "    for i in range(1500) {\n"
+        "        print(square(i))\n"
+        "    }\n"
+        "}\n";
+    char second_source[] =
+        "@memoize\n"
+        "def cube(int n) {\n"
+        "    return n * n * n\n"
+        "}\n"
+        "def main() {\n"
+        "    for i in range(1500) {\n"
+        "        print(cube(i))\n"
+        "    }\n"
+        "}\n";
+    LoadedProgram first;
+    LoadedProgram second;
+    ASTNode *first_node = load(first_source, &first);
+    ASTNode *second_node = load(second_source, &second);
+    if (first_node == NULL || second_node == NULL) {
+        return;
+    }
+    ASTNode *square = find_function(first_node, "square");
+    ASTNode *cube = find_function(second_node, "cube");
+    CHECK(square != NULL && cube != NULL);
+    if (square == NULL || cube == NULL) {
+        return;
+    }
+
+    run(&first);
+    run(&second);
+    CHECK(is_recorded(square, 3));
+    CHECK(is_recorded(cube, 3));
+
+    // 先に記録した square のエントリを取り除き、後ろの cube のエントリを詰めて移す
+    unload_program(&first);
+    int forgotten = 0;
+    int kept = 0;
+    for (long i = 0; i < 1500; i++) {
+        forgotten += !is_recorded(square, i);
+        kept += is_recorded(cube, i);
+    }
+    CHECK(forgotten == 1500);
+    CHECK(kept == 1500);
+    destroy_ast(first_node);
+
+    // 残った記録はそのまま使え、解放すれば表が空になる
+    run(&second);
+    CHECK(is_recorded(cube, 1));
+    unload_program(&second);
+    CHECK(!is_recorded(cube, 1));
+    destroy_ast(second_node);
+}
+
+int main(void) {
+    test_unload_keeps_other_programs();
+    if (failures > 0) {
+        fprintf(stderr, "memo_test: %d 件失敗\n", failures);
+        return 1;
+    }
+    printf("memo_test: 成功\n");
+    return 0;
+}
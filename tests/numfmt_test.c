@@ -0,0 +1,149 @@
+#include <float.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kappok.h"
+
+// 数値フォーマットのテスト (make test)
+// format_int / format_double_general / format_double_fixed の出力を、同じ値の snprintf ("%ld", "%g",
+// "%.*f") と比べる。丸めの境界や非正規化数などの値と、ビット列を乱数で作った値を試す。
+
+static int failures = 0;
+
+#define MAX_REPORTED_MISMATCHES 10
+#define RANDOM_VALUES 200000
+#define FIXED_MAX_PRECISION 20
+
+static int mismatches = 0;
+
+static void report_mismatch(const char *format, double value, int precision, const char *expected, const char *actual) {
+    failures++;
+    if (++mismatches <= MAX_REPORTED_MISMATCHES) {
+        fprintf(stderr, "%s (%a, 精度 %d): 期待 \"%s\"、実際 \"%s\"\n", format, value, precision, expected, actual);
+    }
+}
+
+static void check_general(double value) {
+    char expected[64];
+    char actual[FORMAT_DOUBLE_MAX_LENGTH];
+    snprintf(expected, sizeof(expected), "%g", value);
+    int length = format_double_general(value, actual);
+    actual[length] = '\0';
+    if (strcmp(expected, actual) != 0) {
+        report_mismatch("%g", value, 6, expected, actual);
+    }
+}
+
+static void check_fixed(double value, int precision) {
+    static char expected[FORMAT_FIXED_MAX_LENGTH(FIXED_MAX_PRECISION)];
+    static char actual[FORMAT_FIXED_MAX_LENGTH(FIXED_MAX_PRECISION)];
+    snprintf(expected, sizeof(expected), "%.*f", precision, value);
+    int length = format_double_fixed(value, precision, actual);
+    actual[length] = '\0';
+    if (strcmp(expected, actual) != 0) {
+        report_mismatch("%.*f", value, precision, expected, actual);
+    }
+}
+
+static void check_int(long value) {
+    char expected[FORMAT_INT_MAX_LENGTH];
+    char actual[FORMAT_INT_MAX_LENGTH];
+    snprintf(expected, sizeof(expected), "%ld", value);
+    int length = format_int(value, actual);
+    actual[length] = '\0';
+    if (strcmp(expected, actual) != 0) {
+        failures++;
+        fprintf(stderr, "%%ld: 期待 \"%s\"、実際 \"%s\"\n", expected, actual);
+    }
+}
+
+static void check_double(double value) {
+    check_general(value);
+    for (int precision = 0; precision <= FIXED_MAX_PRECISION; precision++) {
+        check_fixed(value, precision);
+    }
+}
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t next_random(void) {
+    // xorshift64*
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 0x2545F4914F6CDD1Dull;
+}
+
+static double double_from_bits(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// 丸めの境界・桁の繰り上がり・指数表記への切り替わり・非正規化数と無限大
+static void test_edge_values(void) {
+    static const double values[] = {
+        0.0, -0.0, 1.0, -1.0, 0.5, 1.5, 2.5, -2.5, 0.125, 0.1, 0.2, 0.3, 1.0 / 3.0, 2.0 / 3.0,
+        9.5, 99.5, 999999.5, 9999995.0, 0.0001, 0.00001, 0.000099999995, 123456.0, 1234567.0,
+        999999.0, 9999999.0, 1e15, 1e16, 1e21, 1e22, 1e23, 1.7976931348623157e308, 2.2250738585072014e-308,
+        4.9406564584124654e-324, 1.0e-320, 0.30000000000000004, 5e-7, 4.35, 1.005, 2.675, 1e300 * 10.0,
+        -1e300 * 10.0, 3.14159265358979, 6.02214076e23, 1.602176634e-19,
+    };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        check_double(values[i]);
+        check_double(-values[i]);
+    }
+    // ちょうど半分の値 (2進で正確に表せるものは偶数へ丸める) と、2進で表せない小数
+    for (int k = 0; k < 1000; k++) {
+        check_double(k + 0.5);
+        check_double(k / 8.0);
+        check_double(k * 0.005);
+    }
+    // 10の冪とその前後の double
+    for (int e = -30; e <= 30; e++) {
+        double power = exact_pow10(e);
+        check_double(power);
+        check_double(nextafter(power, 0.0));
+        check_double(nextafter(power, HUGE_VAL));
+    }
+}
+
+// ビット列を乱数で作った値 (全ての指数) と、表示で使われやすい大きさの値
+static void test_random_values(void) {
+    for (int i = 0; i < RANDOM_VALUES; i++) {
+        double value = double_from_bits(next_random());
+        if (isnan(value)) {
+            continue; // NaN の符号の表記は libc によって違う
+        }
+        check_general(value);
+        if (fabs(value) < 1e30) {
+            check_fixed(value, (int)(next_random() % (FIXED_MAX_PRECISION + 1)));
+        }
+        double scaled = (double)(int64_t)(next_random() >> 11) / exact_pow10((int)(next_random() % 20));
+        check_general(scaled);
+        check_fixed(scaled, (int)(next_random() % (FIXED_MAX_PRECISION + 1)));
+    }
+}
+
+static void test_integers(void) {
+    static const long values[] = { 0, 1, -1, 9, 10, 99, 100, 12345, -12345, 1000000000, 9999999999L, LONG_MAX, LONG_MIN };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        check_int(values[i]);
+    }
+    for (int i = 0; i < RANDOM_VALUES; i++) {
+        check_int((long)next_random() >> (next_random() % 64));
+    }
+}
+
+int main(void) {
+    test_edge_values();
+    test_random_values();
+    test_integers();
+    if (failures > 0) {
+        fprintf(stderr, "numfmt_test: %d 件失敗\n", failures);
+        return 1;
+    }
+    printf("numfmt_test: 成功\n");
+    return 0;
+}
@@ -0,0 +1,194 @@
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kappok.h"
+#include "test_util.h"
+
+// 最適化のテスト (make test)
+// 共通部分式の除去と代数的な簡約をした関数が、最適化しない場合とビット単位で同じ値を返すことを確かめる。
+// 同じプログラムを段階的実行なしで実行した結果と、全ての関数を最適化した後に実行した結果を比べる。
+
+// 丸めや符号が変わりやすい入力 (-0.0、NaN、無限大、非正規化数、2の冪の境界)
+static const double edge_values[] = {
+    0.0, -0.0, 1.0, -1.0, 3.0, 0.1, 1.0 / 3.0, -2.5, 1e308, -1e308, DBL_MAX, DBL_MIN, DBL_MIN / 3.0,
+    4.9406564584124654e-324, 1e-310, 0x1p-1022, 0x1.fffffffffffffp+1023, INFINITY, -INFINITY, NAN,
+};
+#define NUM_EDGE_VALUES ((int)(sizeof(edge_values) / sizeof(edge_values[0])))
+
+#define MAX_RECORDS 8192
+#define ROUNDS 200 // 入力の組の数 (edge() の値は周期的に繰り返す)
+
+// 実行ごとに record() に渡された値のビット列
+typedef struct {
+    unsigned long long bits[MAX_RECORDS];
+    int count;
+} Records;
+
+static Records *current_records = NULL;
+
+// edge(k): k 番目の入力
+static Value native_edge(Value *args, int num_args, int line) {
+    (void)num_args;
+    (void)line;
+    long k = AS_INT(args[0]);
+    return DOUBLE_VAL(edge_values[(k % NUM_EDGE_VALUES + NUM_EDGE_VALUES) % NUM_EDGE_VALUES]);
+}
+
+// record(v): 値のビット列を記録して 0 を返す (print の丸めで違いが隠れないように)
+static Value native_record(Value *args, int num_args, int line) {
+    (void)num_args;
+    (void)line;
+    unsigned long long bits;
+    if (VAL_TYPE(args[0]) == VALUE_TYPE_DOUBLE) {
+        double value = AS_DOUBLE(args[0]);
+        memcpy(&bits, &value, sizeof(bits));
+    } else {
+        bits = (unsigned long long)AS_INT(args[0]) ^ 0x8000000000000000ull;
+    }
+    if (current_records != NULL && current_records->count < MAX_RECORDS) {
+        current_records->bits[current_records->count++] = bits;
+    }
+    return INT_VAL(0);
+}
+
+static const char optimized_source[] =
+    // 同じ部分式の繰り返し (int と double の混在を含む)
+    "def area(int r, double pi) {\n"
+    "    double a = r * r * pi\n"
+    "    double b = r * r * pi + 1.0\n"
+    "    return a + b * (r * r * pi) - r * r * pi / 4.0\n"
+    "}\n"
+    // 変数に書き込んだ後は、その変数を読む式を使い回さない
+    "def rewrite(int x, int y) {\n"
+    "    int a = x * y + 7\n"
+    "    x = x + 1\n"
+    "    int b = x * y + 7\n"
+    "    y = y * 3\n"
+    "    return a * 1000 + b * 10 + (x * y + 7)\n"
+    "}\n"
+    // 結果の変わらない簡約 (x * 1.0、x - 0.0、x + (-0.0)、x / 1.0) と、簡約してはいけない x + 0.0
+    "def identities(double x) {\n"
+    "    return x * 1.0 - 0.0\n"
+    "}\n"
+    "def plus_negative_zero(double x) {\n"
+    "    return x + 0.0 * (0.0 - 1.0)\n"
+    "}\n"
+    "def plus_zero(double x) {\n"
+    "    return 1.0 * x + 0.0\n"
+    "}\n"
+    "def divide_by_one(double x) {\n"
+    "    return x / 1.0\n"
+    "}\n"
+    // 逆数が正確な2の冪の除算だけを乗算にする (3.0 や 1000.0 の逆数は丸められる)
+    "def divisions(double x) {\n"
+    "    return x / 4.0 + x / 0.5 + x / 3.0\n"
+    "}\n"
+    "def small_divisor(double x) {\n"
+    "    return x / 0.0078125\n"
+    "}\n"
+    "def other_divisor(double x) {\n"
+    "    return x / 1000.0\n"
+    "}\n"
+    // int の簡約は折り返しを含めて同じ値になり、int / int は切り捨てのまま
+    "def ints(int x) {\n"
+    "    return (x + 0) * 1 - 0 + x / 1 + (0 + x) * (1 * x)\n"
+    "}\n"
+    "def mixed(int n, double d) {\n"
+    "    return n / 2 + n / 2.0 + d * n + n * d + (n / 2) * 1.0\n"
+    "}\n"
+    // ループの本体の中の共通部分式
+    "def loop(int n, double s) {\n"
+    "    double t = 0.0\n"
+    "    for i in range(n) {\n"
+    "        t = t + s * i / 2.0\n"
+    "        t = t + s * i / 2.0\n"
+    "    }\n"
+    "    return t\n"
+    "}\n"
+    "def main() {\n"
+    "    for k in range(%d) {\n"
+    "        double x = edge(k)\n"
+    "        double y = edge(k + 7)\n"
+    "        double z = k * 0.37 + 0.1\n"
+    "        int n = k * 1234567891 - 987654321\n"
+    "        print(record(area(k, x)), record(area(n, y)), record(rewrite(n, k)), record(rewrite(k, n)))\n"
+    "        print(record(identities(x)), record(plus_negative_zero(x)), record(plus_zero(x)), record(divide_by_one(x)))\n"
+    "        print(record(divisions(x)), record(small_divisor(x)), record(other_divisor(x)))\n"
+    "        print(record(divisions(z)), record(other_divisor(z)), record(area(k, z)), record(mixed(n, z)))\n"
+    "        print(record(ints(n)), record(ints(k * 4611686018427387903)), record(mixed(n, x)), record(mixed(k, y)))\n"
+    "        print(record(loop(k, x)), record(loop(k, y)))\n"
+    "    }\n"
+    "}\n";
+
+// source を tier_threshold で実行して値を records に記録し、出力を返す
+// (threshold が 0 でなければ、一度実行して全ての関数を最適化させてから実行し直す)
+static char *run_with_threshold(char *source, int threshold, Records *records) {
+    ASTNode *program_node = parse_source(source);
+    CHECK(program_node != NULL);
+    if (program_node == NULL) {
+        return NULL;
+    }
+    set_tier_threshold(threshold);
+    LoadOptions options = { false, false };
+    LoadedProgram program;
+    load_program(&program, program_node, &options);
+    if (threshold != 0) {
+        free(run_captured(&program));
+        tier_wait_for_compiles(program_node);
+        for (int i = 0; i < program_node->data.program.num_statements; i++) {
+            ASTNode *statement = program_node->data.program.statements[i];
+            if (statement->type == NODE_FUNCTION_DEFINITION && statement->data.func_def.tier_state != TIER_OPTIMIZED) {
+                fprintf(stderr, "関数 '%s' が最適化されていません\n", statement->data.func_def.name);
+                failures++;
+            }
+        }
+    }
+    records->count = 0;
+    current_records = records;
+    char *output = run_captured(&program);
+    current_records = NULL;
+    tier_wait_for_compiles(program_node);
+    unload_program(&program);
+    destroy_ast(program_node);
+    return output;
+}
+
+static void test_optimized_results_match(void) {
+    static Records interpreted;
+    static Records optimized;
+    char source[sizeof(optimized_source) + 16];
+    snprintf(source, sizeof(source), optimized_source, ROUNDS);
+    char *expected = run_with_threshold(source, 0, &interpreted);
+    char *actual = run_with_threshold(source, 1, &optimized);
+    CHECK(expected != NULL && actual != NULL && strcmp(expected, actual) == 0);
+    if (expected != NULL && strstr(expected, "エラー") != NULL) {
+        fprintf(stderr, "%s", expected);
+        failures++;
+    }
+    CHECK(interpreted.count > 0 && interpreted.count == optimized.count);
+    for (int i = 0; i < interpreted.count && i < optimized.count; i++) {
+        if (interpreted.bits[i] != optimized.bits[i]) {
+            fprintf(stderr, "%d 番目の値: 期待 %016llx、実際 %016llx\n", i, interpreted.bits[i], optimized.bits[i]);
+            failures++;
+        }
+    }
+    free(expected);
+    free(actual);
+}
+
+int main(void) {
+    static const NativeParam edge_params[] = { { "k", VALUE_TYPE_MASK(VALUE_TYPE_INT) } };
+    static const NativeParam record_params[] = { { "v", NATIVE_ANY_TYPE } };
+    CHECK(kappok_register_native("edge", native_edge, edge_params, 1));
+    CHECK(kappok_register_native("record", native_record, record_params, 1));
+    test_optimized_results_match();
+    set_tier_threshold(TIER_DEFAULT_THRESHOLD);
+    if (failures > 0) {
+        fprintf(stderr, "optimizer_test: %d 件失敗\n", failures);
+        return 1;
+    }
+    printf("optimizer_test: 成功\n");
+    return 0;
+}
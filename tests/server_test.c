@@ -0,0 +1,205 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "test_util.h"
+
+// サーバモードのテスト (make test)
+// ./kappok --serve を子プロセスで起動し、./kappok --client で要求を送る (make test はリポジトリの直下で実行する)。
+// 実行時エラーになる要求の後もサーバが動き続けて次の要求を実行でき、
+// SIGTERM で止めるとソケットのファイルが消えることを確かめる。
+
+#define KAPPOK "./kappok"
+#define WAIT_STEP_MS 10
+#define WAIT_LIMIT_MS 5000
+
+static char directory[] = "/tmp/kappok_server_test.XXXXXX";
+static char socket_path[64];
+
+static void sleep_ms(long ms) {
+    struct timespec delay = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&delay, NULL);
+}
+
+// directory の下のパスを path に作る
+static void make_path(char *path, size_t size, const char *name) {
+    snprintf(path, size, "%s/%s", directory, name);
+}
+
+static void write_file(const char *path, const char *contents) {
+    FILE *file = fopen(path, "w");
+    CHECK(file != NULL);
+    if (file != NULL) {
+        fputs(contents, file);
+        fclose(file);
+    }
+}
+
+// ファイルの内容を読む (呼び出し側が free() する)
+static char *read_file(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return strdup("");
+    }
+    char *contents = malloc(65536);
+    size_t length = fread(contents, 1, 65535, file);
+    contents[length] = '\0';
+    fclose(file);
+    return contents;
+}
+
+static bool is_socket(const char *path) {
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISSOCK(info.st_mode);
+}
+
+static pid_t start_server(void) {
+    fflush(NULL);
+    pid_t server = fork();
+    if (server == 0) {
+        execl(KAPPOK, KAPPOK, "--serve", socket_path, "--workers", "2", (char *)NULL);
+        _exit(127);
+    }
+    for (int waited = 0; server > 0 && waited < WAIT_LIMIT_MS && !is_socket(socket_path); waited += WAIT_STEP_MS) {
+        sleep_ms(WAIT_STEP_MS);
+    }
+    return server;
+}
+
+// サーバがまだ動いているか
+static bool server_running(pid_t server) {
+    int status;
+    return waitpid(server, &status, WNOHANG) == 0;
+}
+
+// ./kappok --client で source を実行し、終了コードを返す (*output と *error は呼び出し側が free() する)
+static int run_client(const char *name, const char *source, char **output, char **error) {
+    char program_path[128];
+    char output_path[128];
+    char error_path[128];
+    make_path(program_path, sizeof(program_path), name);
+    make_path(output_path, sizeof(output_path), "stdout.txt");
+    make_path(error_path, sizeof(error_path), "stderr.txt");
+    write_file(program_path, source);
+    fflush(NULL);
+    pid_t client = fork();
+    if (client == 0) {
+        int out = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        int err = open(error_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (out < 0 || err < 0 || dup2(out, STDOUT_FILENO) < 0 || dup2(err, STDERR_FILENO) < 0) {
+            _exit(127);
+        }
+        execl(KAPPOK, KAPPOK, "--client", socket_path, program_path, (char *)NULL);
+        _exit(127);
+    }
+    int status = 0;
+    if (client < 0 || waitpid(client, &status, 0) != client || !WIFEXITED(status)) {
+        status = -1;
+    } else {
+        status = WEXITSTATUS(status);
+    }
+    *output = read_file(output_path);
+    *error = read_file(error_path);
+    unlink(output_path);
+    unlink(error_path);
+    unlink(program_path);
+    return status;
+}
+
+static const char recursion_source[] =
+    "def r(int n) {\n"
+    "    return r(n + 1) + 1\n"
+    "}\n"
+    "def main() {\n"
+    "    print(\"before\")\n"
+    "    print(r(0))\n"
+    "}\n";
+
+static const char division_source[] =
+    "def main() {\n"
+    "    print((0 - 9223372036854775807 - 1) / (0 - 1))\n"
+    "}\n";
+
+static const char zero_division_source[] =
+    "def ratio(int a, int b) {\n"
+    "    return a / b\n"
+    "}\n"
+    "def main() {\n"
+    "    future f = spawn ratio(1, 0)\n"
+    "    print(join(f))\n"
+    "}\n";
+
+static const char hello_source[] =
+    "def main() {\n"
+    "    print(\"hello\", 6 * 7)\n"
+    "}\n";
+
+// 失敗する要求の後もサーバは動き続け、次の要求を実行する
+static void test_failing_requests_keep_server(pid_t server) {
+    char *output;
+    char *error;
+    for (int round = 0; round < 2; round++) {
+        CHECK(run_client("recursion.kpp", recursion_source, &output, &error) == 1);
+        CHECK(strcmp(output, "before\n") == 0);
+        CHECK(strstr(error, "実行時エラー (行 2): 関数の呼び出しが深すぎます") != NULL);
+        free(output);
+        free(error);
+        CHECK(server_running(server));
+
+        CHECK(run_client("division.kpp", division_source, &output, &error) == 0);
+        CHECK(strcmp(output, "-9223372036854775808\n\n") == 0);
+        free(output);
+        free(error);
+
+        CHECK(run_client("zero.kpp", zero_division_source, &output, &error) == 1);
+        CHECK(strstr(error, "実行時エラー (行 2): 0による除算です。") != NULL);
+        free(output);
+        free(error);
+        CHECK(server_running(server));
+
+        CHECK(run_client("hello.kpp", hello_source, &output, &error) == 0);
+        CHECK(strcmp(output, "hello 42\n\n") == 0);
+        CHECK(strcmp(error, "") == 0);
+        free(output);
+        free(error);
+    }
+}
+
+// SIGTERM で止めるとソケットのファイルを消す
+static void test_stop_removes_socket(pid_t server) {
+    CHECK(kill(server, SIGTERM) == 0);
+    int status = 0;
+    CHECK(waitpid(server, &status, 0) == server);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(!is_socket(socket_path));
+}
+
+int main(void) {
+    if (access(KAPPOK, X_OK) != 0 || mkdtemp(directory) == NULL) {
+        fprintf(stderr, "server_test: %s か一時ディレクトリがありません\n", KAPPOK);
+        return 1;
+    }
+    make_path(socket_path, sizeof(socket_path), "kappok.sock");
+    pid_t server = start_server();
+    CHECK(server > 0 && is_socket(socket_path));
+    if (server > 0 && is_socket(socket_path)) {
+        test_failing_requests_keep_server(server);
+        test_stop_removes_socket(server);
+    } else if (server > 0) {
+        kill(server, SIGKILL);
+        waitpid(server, NULL, 0);
+    }
+    unlink(socket_path);
+    rmdir(directory);
+    if (failures > 0) {
+        fprintf(stderr, "server_test: %d 件失敗\n", failures);
+        return 1;
+    }
+    printf("server_test: 成功\n");
+    return 0;
+}
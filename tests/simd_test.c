@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "kappok.h"
+
+// 配列演算のカーネルのテスト (make test)
+// 命令セット (--simd scalar|sse2|avx2) はプロセスに1つなので、命令セットごとに子プロセスを作って
+// 同じ入力で全てのカーネルを実行し、結果のビット列がスカラーの子プロセスのものと一致することを確かめる。
+// 入力の長さと先頭のずれを変えて、レーンの端数や揃っていない領域も試す。
+
+static int failures = 0;
+
+#define MAX_LENGTH 4099
+#define MAX_OFFSET 3
+#define LEVEL_UNSUPPORTED 2 // 子プロセスの終了コード (CPU がその命令セットに対応していない)
+
+static uint64_t random_state = 0x2545F4914F6CDD1Dull;
+
+static uint64_t next_random(void) {
+    // xorshift64*
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 0x2545F4914F6CDD1Dull;
+}
+
+// 大きさの違う値を混ぜ、足す順で丸めの結果が変わるようにする
+static double random_double(void) {
+    double mantissa = (double)(int64_t)(next_random() >> 11) / 4503599627370496.0; // [-1, 1) の範囲
+    return mantissa * exact_pow10((int)(next_random() % 31) - 15);
+}
+
+// --- 子プロセス: 結果を pipe に書き出す ---
+
+static unsigned char *results = NULL;
+static size_t results_length = 0;
+static size_t results_capacity = 0;
+
+static void append_bytes(const void *bytes, size_t length) {
+    if (results_length + length > results_capacity) {
+        results_capacity = (results_capacity + length) * 2;
+        results = realloc(results, results_capacity);
+        if (results == NULL) {
+            _exit(1);
+        }
+    }
+    memcpy(results + results_length, bytes, length);
+    results_length += length;
+}
+
+static void append_double(double value) {
+    append_bytes(&value, sizeof(value));
+}
+
+static void append_long(long value) {
+    append_bytes(&value, sizeof(value));
+}
+
+static double doubles_a[MAX_LENGTH + MAX_OFFSET];
+static double doubles_b[MAX_LENGTH + MAX_OFFSET];
+static double doubles_out[MAX_LENGTH + MAX_OFFSET];
+static long longs_a[MAX_LENGTH + MAX_OFFSET];
+static long longs_b[MAX_LENGTH + MAX_OFFSET];
+static long longs_out[MAX_LENGTH + MAX_OFFSET];
+
+static void fill_inputs(void) {
+    for (size_t i = 0; i < MAX_LENGTH + MAX_OFFSET; i++) {
+        doubles_a[i] = random_double();
+        doubles_b[i] = random_double();
+        longs_a[i] = (long)next_random();
+        longs_b[i] = (long)(next_random() >> (next_random() % 64));
+    }
+}
+
+// 長さ n、先頭のずれ offset で全てのカーネルを実行する
+static void run_kernels(size_t n, size_t offset) {
+    const double *a = doubles_a + offset;
+    const double *b = doubles_b + offset;
+    const long *la = longs_a + offset;
+    const long *lb = longs_b + offset;
+
+    append_double(simd_double_sum(a, n));
+    append_double(simd_double_dot(a, b, n));
+    append_long(simd_int_sum(la, n));
+    append_long(simd_int_dot(la, lb, n));
+    append_long(simd_double_has_zero(a, n));
+    if (n > 0) {
+        append_double(simd_double_extreme(a, n, false));
+        append_double(simd_double_extreme(a, n, true));
+        append_long(simd_int_extreme(la, n, false));
+        append_long(simd_int_extreme(la, n, true));
+    }
+    for (ArrayOp op = ARRAY_OP_ADD; op <= ARRAY_OP_DIVIDE; op++) {
+        simd_double_op(op, a, b, doubles_out, n);
+        append_bytes(doubles_out, n * sizeof(double));
+        simd_double_op_scalar(op, a, b[0], doubles_out, n, false);
+        append_bytes(doubles_out, n * sizeof(double));
+        simd_double_op_scalar(op, a, b[0], doubles_out, n, true);
+        append_bytes(doubles_out, n * sizeof(double));
+        if (op != ARRAY_OP_DIVIDE) {
+            simd_int_op(op, la, lb, longs_out, n);
+            append_bytes(longs_out, n * sizeof(long));
+            simd_int_op_scalar(op, la, lb[0], longs_out, n, false);
+            append_bytes(longs_out, n * sizeof(long));
+            simd_int_op_scalar(op, la, lb[0], longs_out, n, true);
+            append_bytes(longs_out, n * sizeof(long));
+        }
+    }
+}
+
+// 0 と -0.0、NaN、無限大を含む入力での集約 (最小・最大と 0 の検査は値の並びによって結果が変わりやすい)
+static void run_special_values(void) {
+    static const double specials[] = { 0.0, -0.0, NAN, INFINITY, -INFINITY, 1.0, -1.0 };
+    size_t num_specials = sizeof(specials) / sizeof(specials[0]);
+    for (size_t n = 1; n <= 40; n++) {
+        for (size_t position = 0; position < n; position++) {
+            for (size_t s = 0; s < num_specials; s++) {
+                for (size_t i = 0; i < n; i++) {
+                    doubles_out[i] = (double)((i * 7) % 5) + 2.0;
+                }
+                doubles_out[position] = specials[s];
+                doubles_out[(position * 3) % n] = specials[(s + 1) % num_specials];
+                append_double(simd_double_sum(doubles_out, n));
+                append_double(simd_double_extreme(doubles_out, n, false));
+                append_double(simd_double_extreme(doubles_out, n, true));
+                append_long(simd_double_has_zero(doubles_out, n));
+            }
+        }
+    }
+}
+
+// level の命令セットで全てのカーネルを実行し、結果を fd に書く (子プロセスで呼ぶ)
+static int run_level(SimdLevel level, int fd) {
+    set_simd_level(level);
+    if (simd_level() != level) {
+        return LEVEL_UNSUPPORTED;
+    }
+    fill_inputs();
+    for (size_t n = 0; n <= 67; n++) {
+        for (size_t offset = 0; offset <= MAX_OFFSET; offset++) {
+            run_kernels(n, offset);
+        }
+    }
+    run_kernels(1000, 1);
+    run_kernels(MAX_LENGTH, 0);
+    run_special_values();
+    for (size_t written = 0; written < results_length;) {
+        ssize_t count = write(fd, results + written, results_length - written);
+        if (count <= 0) {
+            return 1;
+        }
+        written += (size_t)count;
+    }
+    return 0;
+}
+
+// --- 親プロセス ---
+
+// level の子プロセスの結果を読み、*length に長さを入れて返す (対応していない命令セットなら NULL)
+static unsigned char *collect_level(SimdLevel level, size_t *length) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        failures++;
+        return NULL;
+    }
+    fflush(NULL);
+    pid_t child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        _exit(run_level(level, fds[1]));
+    }
+    close(fds[1]);
+    unsigned char *buffer = NULL;
+    size_t capacity = 0;
+    *length = 0;
+    for (;;) {
+        if (*length == capacity) {
+            capacity = (capacity == 0) ? 65536 : capacity * 2;
+            buffer = realloc(buffer, capacity);
+        }
+        ssize_t count = read(fds[0], buffer + *length, capacity - *length);
+        if (count <= 0) {
+            break;
+        }
+        *length += (size_t)count;
+    }
+    close(fds[0]);
+    int status = 0;
+    if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status)) {
+        failures++;
+    } else if (WEXITSTATUS(status) == LEVEL_UNSUPPORTED) {
+        free(buffer);
+        return NULL;
+    } else if (WEXITSTATUS(status) != 0) {
+        failures++;
+    }
+    return buffer;
+}
+
+int main(void) {
+    static const SimdLevel levels[] = { SIMD_SSE2, SIMD_AVX2 };
+    static const char *level_names[] = { "sse2", "avx2" };
+    size_t scalar_length;
+    unsigned char *scalar = collect_level(SIMD_SCALAR, &scalar_length);
+    if (scalar == NULL) {
+        fprintf(stderr, "simd_test: スカラーの結果を得られません\n");
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        size_t length;
+        unsigned char *result = collect_level(levels[i], &length);
+        if (result == NULL) {
+            printf("simd_test: %s に対応していないので省きます\n", level_names[i]);
+            continue;
+        }
+        if (length != scalar_length || memcmp(result, scalar, length) != 0) {
+            size_t first = 0;
+            while (first < length && first < scalar_length && result[first] == scalar[first]) {
+                first++;
+            }
+            fprintf(stderr, "%s: 結果がスカラーと一致しません (%zu バイト目、長さ %zu と %zu)\n", level_names[i], first,
+                    length, scalar_length);
+            failures++;
+        }
+        free(result);
+    }
+    free(scalar);
+    if (failures > 0) {
+        fprintf(stderr, "simd_test: %d 件失敗\n", failures);
+        return 1;
+    }
+    printf("simd_test: 成功\n");
+    return 0;
+}
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "kappok_api.h"
+#include "test_util.h"
+
+// spawn / join のテスト (make test)
+// スレッドプールの大きさはプロセスに1つなので、スレッドの数ごとに子プロセスを作って同じテストを実行する。
+// --threads 1 では作業スレッドがなく、タスクは join したときか main の終わりに実行される。
+
+static int test_threads = 0; // 子プロセスのスレッドの数 (失敗の表示用)
+
+// 再帰で spawn と join を繰り返しても、スレッドの数によらず同じ結果になる
+static void test_fan_out(KappokRuntime *runtime) {
+    char *output;
+    char *error;
+    KappokStatus status = run_source(runtime,
+        "def tree(int depth) {\n"
+        "    int total = 1\n"
+        "    for once in range((depth + depth) / (depth + 1)) {\n" // depth > 0 のときだけ1回
+        "        future left = spawn tree(depth - 1)\n"
+        "        future right = spawn tree(depth - 1)\n"
+        "        total = total + join(right) + join(left)\n"
+        "    }\n"
+        "    return total\n"
+        "}\n"
+        "def main() {\n"
+        "    print(tree(12))\n"
+        "}\n", &output, &error);
+    CHECK(status == KAPPOK_OK);
+    CHECK(output != NULL && strcmp(output, "8191\n\n") == 0);
+    free(output);
+    free(error);
+}
+
+// join しなかったタスクは main の終わりまでに実行され、出力は main の戻り値より前に並ぶ
+static void test_unjoined_tasks_run_before_main_returns(KappokRuntime *runtime) {
+    char *output;
+    char *error;
+    KappokStatus status = run_source(runtime,
+        "def say(str text) {\n"
+        "    print(text)\n"
+        "    return 0\n"
+        "}\n"
+        "def main() {\n"
+        "    future a = spawn say(\"a\")\n"
+        "    return 7\n"
+        "}\n", &output, &error);
+    CHECK(status == KAPPOK_OK);
+    CHECK(output != NULL && strcmp(output, "a\n7\n") == 0);
+    free(output);
+    free(error);
+}
+
+// join されずに失敗したタスクは、main の後に実行時エラーとして報告される
+static void test_unjoined_failure_is_reported(KappokRuntime *runtime) {
+    char *output;
+    char *error;
+    KappokStatus status = run_source(runtime,
+        "def divide(int n) {\n"
+        "    return 10 / n\n"
+        "}\n"
+        "def main() {\n"
+        "    future a = spawn divide(0)\n"
+        "}\n", &output, &error);
+    CHECK(status == KAPPOK_ERROR_RUNTIME);
+    CHECK(error != NULL && strstr(error, "実行時エラー (行 2)") != NULL);
+    free(output);
+    free(error);
+}
+
+#define JOIN_LOOP_ITERATIONS 200000
+#define JOIN_LOOP_HEAP_LIMIT (4 * 1024 * 1024) // 1回ごとにタスクが残れば数十 MB になる
+
+static size_t heap_marks[2];
+static int num_heap_marks = 0;
+
+// mark_heap(): スクリプトの途中でヒープの大きさを記録する
+static Value native_mark_heap(Value *args, int num_args, int line) {
+    (void)args;
+    (void)num_args;
+    (void)line;
+    if (num_heap_marks < 2) {
+        heap_marks[num_heap_marks++] = heap_in_use();
+    }
+    return INT_VAL(0);
+}
+
+// join したタスクは、実行の途中でも解放される (main の終わりまで溜まらない)
+static void test_joined_tasks_are_freed(KappokRuntime *runtime) {
+    char source[512];
+    snprintf(source, sizeof(source),
+        "def f(int i) {\n"
+        "    return i * 2\n"
+        "}\n"
+        "def main() {\n"
+        "    int t = mark_heap()\n"
+        "    for i in range(%d) {\n"
+        "        t = t + join(spawn f(i))\n"
+        "    }\n"
+        "    print(t + mark_heap())\n"
+        "}\n", JOIN_LOOP_ITERATIONS);
+    num_heap_marks = 0;
+    char *output;
+    char *error;
+    KappokStatus status = run_source(runtime, source, &output, &error);
+    CHECK(status == KAPPOK_OK);
+    CHECK(output != NULL && strcmp(output, "39999800000\n\n") == 0);
+    CHECK(num_heap_marks == 2);
+    CHECK(num_heap_marks < 2 || heap_marks[1] < heap_marks[0] + JOIN_LOOP_HEAP_LIMIT);
+    free(output);
+    free(error);
+}
+
+// threads 個のスレッドで全てのテストを実行し、失敗の数を返す (子プロセスで呼ぶ)
+static int run_tests(int threads) {
+    test_threads = threads;
+    KappokOptions options;
+    kappok_options_init(&options);
+    options.threads = threads;
+    KappokRuntime *runtime = kappok_runtime_new(&options);
+    if (runtime == NULL) {
+        fprintf(stderr, "実行時オブジェクトを作れません\n");
+        return 1;
+    }
+    CHECK(kappok_register_native("mark_heap", native_mark_heap, NULL, 0));
+    test_fan_out(runtime);
+    test_unjoined_tasks_run_before_main_returns(runtime);
+    test_unjoined_failure_is_reported(runtime);
+    test_joined_tasks_are_freed(runtime);
+    kappok_runtime_free(runtime);
+    if (failures > 0) {
+        fprintf(stderr, "task_test (--threads %d): %d 件失敗\n", test_threads, failures);
+    }
+    return failures;
+}
+
+int main(void) {
+    static const int thread_counts[] = { 1, 4 };
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+        fflush(NULL);
+        pid_t child = fork();
+        if (child == 0) {
+            _exit(run_tests(thread_counts[i]) > 0 ? 1 : 0);
+        }
+        int status = 0;
+        if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed++;
+        }
+    }
+    if (failed > 0) {
+        fprintf(stderr, "task_test: %d 件失敗\n", failed);
+        return 1;
+    }
+    printf("task_test: 成功\n");
+    return 0;
+}
@@ -0,0 +1,88 @@
+#ifndef KAPPOK_TEST_UTIL_H
+#define KAPPOK_TEST_UTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kappok_api.h"
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// テストで共有する補助 (tests/*_test.c はそれぞれ1つの翻訳単位なので、関数は static inline で持つ)
+// 内部のヘッダ (kappok.h) を先に読み込んだテストでは、読み込んだプログラムを直接扱う補助も使える。
+
+static int failures = 0;
+
+#define CHECK(condition)                                                        \
+    do {                                                                        \
+        if (!(condition)) {                                                     \
+            fprintf(stderr, "%s:%d: 失敗: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+// source をコンパイルして実行し、状態コードを返す (*output と *error は呼び出し側が free() する)
+static inline KappokStatus run_source(KappokRuntime *runtime, const char *source, char **output, char **error) {
+    KappokProgram *program;
+    KappokStatus status = kappok_compile(runtime, source, &program, error);
+    if (status != KAPPOK_OK) {
+        fprintf(stderr, "コンパイルに失敗しました: %s\n", *error);
+        *output = NULL;
+        return status;
+    }
+    status = kappok_run_capture(program, output, NULL, error);
+    kappok_program_free(program);
+    return status;
+}
+
+// 確保されたままのヒープの大きさ (mmap で確保した大きな領域を含む)
+// glibc 以外では測らずに 0 を返す (ASan などのリーク検出の下で実行する)
+static inline size_t heap_in_use(void) {
+#ifdef __GLIBC__
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+#ifdef KAPPOK_H
+static inline ASTNode *parse_source(char *source) {
+    Lexer *lexer = lexer_create(source);
+    ASTNode *program_node = parse(lexer);
+    lexer_destroy(lexer);
+    return program_node;
+}
+
+// program の main を実行し、出力 (呼び出し側が free() する) を返す
+static inline char *run_captured(const LoadedProgram *program) {
+    TaskGroup tasks;
+    task_group_init(&tasks);
+    OutputWriter out;
+    output_open(&out, -1, OUTPUT_BUFFER_MEMORY);
+    ExecState state;
+    init_exec_state(&state, program->globals, &out, &tasks);
+    run_main(program, &state);
+    free(state.stack);
+    task_group_destroy(&tasks);
+    output_char(&out, '\0');
+    char *output = out.buffer;
+    out.buffer = NULL;
+    output_close(&out);
+    return output;
+}
+
+// 名前で関数定義を探す (なければ NULL)
+static inline ASTNode *find_function(ASTNode *program_node, const char *name) {
+    for (int i = 0; i < program_node->data.program.num_statements; i++) {
+        ASTNode *statement = program_node->data.program.statements[i];
+        if (statement->type == NODE_FUNCTION_DEFINITION && strcmp(statement->data.func_def.name, name) == 0) {
+            return statement;
+        }
+    }
+    return NULL;
+}
+#endif
+
+#endif
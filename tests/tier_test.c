@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kappok.h"
+#include "test_util.h"
+
+// 段階的実行のテスト (make test)
+// 内部のヘッダを使ってプログラムを読み込んで実行し、関数の段階 (TierState) を確かめる。
+
+// 一度しか呼ばれない関数も、ループの周回が閾値に達すれば最適化される
+// (周回の少ないループしかない関数は最適化されない)
+static void test_hot_loop_tiers_up(void) {
+    char source[] =
+        "def scale(int v) {\n"
+        "    return v * 3 + 1\n"
+        "}\n"
+        "def short() {\n"
+        "    int total = 0\n"
+        "    for i in range(10) {\n"
+        "        total = total + i\n"
+        "    }\n"
+        "    return total\n"
+        "}\n"
+        "def main() {\n"
+        "    int total = 0\n"
+        "    for i in range(5000) {\n"
+        "        total = total + scale(i)\n"
+        "    }\n"
+        "    for x in range(3) {\n"
+        "        total = total + x\n"
+        "    }\n"
+        "    print(total, short())\n"
+        "}\n";
+    ASTNode *program_node = parse_source(source);
+    CHECK(program_node != NULL);
+    if (program_node == NULL) {
+        return;
+    }
+    set_tier_threshold(1000);
+    LoadOptions options = { false, false };
+    LoadedProgram program;
+    load_program(&program, program_node, &options);
+    ASTNode *main_def = find_function(program_node, "main");
+    ASTNode *short_def = find_function(program_node, "short");
+    CHECK(main_def != NULL && short_def != NULL);
+    if (main_def == NULL || short_def == NULL) {
+        unload_program(&program);
+        destroy_ast(program_node);
+        return;
+    }
+
+    char *first = run_captured(&program);
+    tier_wait_for_compiles(program_node);
+    CHECK(main_def->data.func_def.tier_state == TIER_OPTIMIZED);
+    CHECK(short_def->data.func_def.tier_state == TIER_COLD);
+
+    // 二度目の実行は最適化済みの main を使い、同じ結果になる
+    char *second = run_captured(&program);
+    CHECK(strcmp(first, second) == 0);
+    free(first);
+    free(second);
+
+    tier_wait_for_compiles(program_node);
+    unload_program(&program);
+    destroy_ast(program_node);
+}
+
+// プログラムごとに自分の関数の最適化だけを待ち、待ち終えたら自分の関数は全て最適化済み
+// (二つのプログラムの最適化が同じキューに入っていても、それぞれ解放できる)
+static void test_wait_is_per_program(void) {
+    char first_source[] =
+        "def twice(int v) {\n"
+        "    return v * 2\n"
+        "}\n"
+        "def main() {\n"
+        "    print(twice(1) + twice(2))\n"
+        "}\n";
+    char second_source[] =
+        "def inc(int v) {\n"
+        "    return v + 1\n"
+        "}\n"
+        "def main() {\n"
+        "    print(inc(inc(1)))\n"
+        "}\n";
+    ASTNode *first_node = parse_source(first_source);
+    ASTNode *second_node = parse_source(second_source);
+    CHECK(first_node != NULL && second_node != NULL);
+    if (first_node == NULL || second_node == NULL) {
+        return;
+    }
+    set_tier_threshold(1);
+    LoadOptions options = { false, false };
+    LoadedProgram first;
+    LoadedProgram second;
+    load_program(&first, first_node, &options);
+    load_program(&second, second_node, &options);
+
+    char *first_output = run_captured(&first);
+    char *second_output = run_captured(&second);
+    CHECK(strcmp(first_output, "6\n") == 0);
+    CHECK(strcmp(second_output, "3\n") == 0);
+    free(first_output);
+    free(second_output);
+
+    tier_wait_for_compiles(first_node);
+    CHECK(find_function(first_node, "main")->data.func_def.tier_state == TIER_OPTIMIZED);
+    unload_program(&first);
+    destroy_ast(first_node);
+
+    // 先に解放したプログラムの後も、残ったプログラムは最適化済みの本体で実行できる
+    second_output = run_captured(&second);
+    CHECK(strcmp(second_output, "3\n") == 0);
+    free(second_output);
+    unload_program(&second);
+    destroy_ast(second_node);
+    set_tier_threshold(TIER_DEFAULT_THRESHOLD);
+}
+
+int main(void) {
+    test_hot_loop_tiers_up();
+    test_wait_is_per_program();
+    if (failures > 0) {
+        fprintf(stderr, "tier_test: %d 件失敗\n", failures);
+        return 1;
+    }
+    printf("tier_test: 成功\n");
+    return 0;
+}
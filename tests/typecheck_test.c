@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kappok_api.h"
+#include "test_util.h"
+
+// 型検査のテスト (make test)
+// 静的に型の合わないプログラムは main を実行する前にコンパイルエラー (行番号付き) になり、
+// 型の確定した式を特殊化したプログラムは特殊化しない場合と同じ結果を出すことを確かめる。
+
+typedef struct {
+    const char *source;
+    const char *message; // エラーメッセージに含まれるはずの部分 (行番号を含む)
+} RejectedProgram;
+
+static const RejectedProgram rejected_programs[] = {
+    { "def main() {\n"
+      "    int x = 1\n"
+      "    print(x + \"a\")\n"
+      "}\n",
+      "エラー (行 3): 算術演算子に互換性のない型です。" },
+    { "def main() {\n"
+      "    int x = \"text\"\n"
+      "}\n",
+      "エラー (行 2): 'int' 型の変数 'x' に互換性のない型の値を初期化しようとしました。" },
+    { "def main() {\n"
+      "    str s = \"a\"\n"
+      "    s = 2\n"
+      "}\n",
+      "エラー (行 3): 's' 変数に互換性のない型の値を代入しようとしました。" },
+    { "def twice(int v) {\n"
+      "    return v * 2\n"
+      "}\n"
+      "def main() {\n"
+      "    print(twice(1, 2))\n"
+      "}\n",
+      "エラー (行 5): 関数 'twice' は 1 個の引数を取りますが、2 個が渡されました。" },
+    { "def twice(int v) {\n"
+      "    return v * 2\n"
+      "}\n"
+      "def main() {\n"
+      "    print(twice(\"a\"))\n"
+      "}\n",
+      "エラー (行 5): 関数 'twice' の 'int' 型の引数 'v' に互換性のない型の値を渡そうとしました。" },
+    { "def main() {\n"
+      "    print(missing(1))\n"
+      "}\n",
+      "エラー (行 2): 未定義の関数 'missing' を呼び出そうとしました。" },
+    { "def main() {\n"
+      "    int[] a = [1, 2]\n"
+      "    print(a[\"x\"])\n"
+      "}\n",
+      "エラー (行 3): 配列の添字は整数でなければなりません。" },
+    { "def main() {\n"
+      "    for i in range(\"a\") {\n"
+      "        print(i)\n"
+      "    }\n"
+      "}\n",
+      "エラー (行 2): range の範囲は整数でなければなりません。" },
+    { "def main() {\n"
+      "    int x = 3\n"
+      "    for v in x {\n"
+      "        print(v)\n"
+      "    }\n"
+      "}\n",
+      "エラー (行 3): 'for' で回せるのは range(...) かジェネレータだけですが、'int' 型の値が渡されました。" },
+    { "def main() {\n"
+      "    const int LIMIT = 3\n"
+      "    LIMIT = 4\n"
+      "}\n",
+      "エラー (行 3): 定数 'LIMIT' に代入しようとしました。" },
+    { "def show(int v) {\n"
+      "    print(v)\n"
+      "    return v\n"
+      "}\n"
+      "def main() {\n"
+      "    int[] a = [1, 2]\n"
+      "    print(parallel_map(show, a))\n"
+      "}\n",
+      "エラー (行 7): parallel_map に渡す関数 'show' は純粋でなければなりません" },
+    // main が他の関数より先に書かれていても、実行の前に呼び出し先まで検査する
+    { "def main() {\n"
+      "    print(\"before\")\n"
+      "    print(label(2))\n"
+      "}\n"
+      "def label(int v) {\n"
+      "    double d = v * 1.5\n"
+      "    str s = d\n"
+      "    return s\n"
+      "}\n",
+      "エラー (行 7): 'str' 型の変数 's' に互換性のない型の値を初期化しようとしました。" },
+};
+
+// 型の合わないプログラムはコンパイルエラーになり、main は実行されない
+static void test_rejections(KappokRuntime *runtime) {
+    for (size_t i = 0; i < sizeof(rejected_programs) / sizeof(rejected_programs[0]); i++) {
+        KappokProgram *program;
+        char *error;
+        KappokStatus status = kappok_compile(runtime, rejected_programs[i].source, &program, &error);
+        CHECK(status == KAPPOK_ERROR_COMPILE);
+        CHECK(program == NULL);
+        if (error == NULL || strstr(error, rejected_programs[i].message) == NULL) {
+            fprintf(stderr, "%zu 番目のプログラム: 期待 \"%s\"、実際 \"%s\"\n", i, rejected_programs[i].message,
+                    (error != NULL) ? error : "(なし)");
+            failures++;
+        }
+        free(error);
+        kappok_program_free(program);
+    }
+}
+
+// 型の確定した演算 (int と double の混在、暗黙の変換、文字列の連結) は特殊化しても同じ値になる
+static void test_specialized_arithmetic(KappokRuntime *runtime) {
+    KappokProgram *program;
+    char *error;
+    KappokStatus status = kappok_compile(runtime,
+        "def area(int r, double pi) {\n"
+        "    return r * r * pi\n"
+        "}\n"
+        "def ratio(int a, int b) {\n"
+        "    return a / b\n"
+        "}\n"
+        "def main() {\n"
+        "    double d = 7\n"
+        "    int n = 7\n"
+        "    str s = \"n=\" + \"7\"\n"
+        "    print(area(2, 3.5), ratio(7, 2), d / 2, n / 2, s, n + 0.5)\n"
+        "}\n", &program, &error);
+    CHECK(status == KAPPOK_OK);
+    if (status != KAPPOK_OK) {
+        fprintf(stderr, "%s\n", error);
+        free(error);
+        return;
+    }
+    char *output;
+    status = kappok_run_capture(program, &output, NULL, &error);
+    CHECK(status == KAPPOK_OK);
+    CHECK(strcmp(output, "14 3 3.5 3 n=7 7.5\n\n") == 0);
+    free(output);
+    free(error);
+    kappok_program_free(program);
+}
+
+int main(void) {
+    KappokRuntime *runtime = kappok_runtime_new(NULL);
+    if (runtime == NULL) {
+        fprintf(stderr, "実行時オブジェクトを作れません\n");
+        return 1;
+    }
+    test_rejections(runtime);
+    test_specialized_arithmetic(runtime);
+    kappok_runtime_free(runtime);
+    if (failures > 0) {
+        fprintf(stderr, "typecheck_test: %d 件失敗\n", failures);
+        return 1;
+    }
+    printf("typecheck_test: 成功\n");
+    return 0;
+}